@@ -236,10 +236,13 @@ HEADERS += \
     src/key.h \
     src/extkey.h \
     src/eckey.h \
+    src/secp256k1.h \
+    src/sha256.h \
     src/db.h \
     src/txdb.h \
     src/walletdb.h \
     src/script.h \
+    src/prevector.h \
     src/stealth.h \
     src/ringsig.h  \
     src/core.h  \
@@ -304,6 +307,8 @@ SOURCES += \
     src/key.cpp \
     src/extkey.cpp \
     src/eckey.cpp \
+    src/secp256k1.cpp \
+    src/sha256.cpp \
     src/script.cpp \
     src/main.cpp \
     src/miner.cpp \
@@ -99,4 +99,69 @@ public:
     void UpdateEmptyFull();
 };
 
+/**
+ * A local bloom filter over hash160 values (key ids, script ids).
+ * The values are already uniformly distributed so their bits are used as the probe positions directly,
+ * no hashing is done.  Never serialised or sent to peers.
+ */
+class CHash160Filter
+{
+private:
+    std::vector<uint64_t> vData;
+    uint64_t nMask; // bits - 1, a power of 2
+    unsigned int nHashFuncs;
+    unsigned int nElements;
+
+    uint64_t Probe(const uint160& id, unsigned int n) const
+    {
+        // -- double hashing from the first 128 bits of id
+        const unsigned char *p = id.begin();
+        uint64_t h1, h2;
+        memcpy(&h1, p, 8);
+        memcpy(&h2, p + 8, 8);
+        return (h1 + n * (h2 | 1)) & nMask;
+    };
+
+public:
+    CHash160Filter() : nMask(0), nHashFuncs(0), nElements(0) {};
+
+    // ~16 bits per element and 6 probes, a false positive rate under 0.1%
+    void Init(unsigned int nMaxElements)
+    {
+        uint64_t nBits = 64;
+        while (nBits < (uint64_t)nMaxElements * 16)
+            nBits <<= 1;
+        vData.assign(nBits / 64, 0);
+        nMask = nBits - 1;
+        nHashFuncs = 6;
+        nElements = 0;
+    };
+
+    void insert(const uint160& id)
+    {
+        for (unsigned int i = 0; i < nHashFuncs; ++i)
+        {
+            uint64_t nBit = Probe(id, i);
+            vData[nBit >> 6] |= (uint64_t)1 << (nBit & 63);
+        };
+        nElements++;
+    };
+
+    bool contains(const uint160& id) const
+    {
+        if (vData.empty())
+            return true; // not built, can't rule anything out
+        for (unsigned int i = 0; i < nHashFuncs; ++i)
+        {
+            uint64_t nBit = Probe(id, i);
+            if (!(vData[nBit >> 6] & ((uint64_t)1 << (nBit & 63))))
+                return false;
+        };
+        return true;
+    };
+
+    unsigned int GetElements() const { return nElements; };
+    size_t GetSize() const { return vData.size() * 8; };
+};
+
 #endif /* BITCOIN_BLOOM_H */
@@ -6,9 +6,11 @@
 
 #include "script.h"
 #include "scrypt.h"
+#include "pbkdf2.h"
 
 #include <string>
 #include <vector>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
@@ -16,7 +18,16 @@
 #include <windows.h>
 #endif
 
-bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod)
+static bool DeriveLanesRange(const SecureString* pstrKeyData, const CKeyingMaterial* pvchLaneSalt, unsigned int nRounds,
+    std::vector<uint256>* pvLaneHash, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+        (*pvLaneHash)[i] = scrypt_salted_multiround_hash((const void*)pstrKeyData->c_str(), pstrKeyData->size(), &(*pvchLaneSalt)[i * 32], 32, nRounds);
+    return true;
+}
+
+bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod,
+    const std::vector<unsigned char>& vchOtherDerivationParameters)
 {
     if (nRounds < 1 || chSalt.size() != WALLET_CRYPTO_SALT_SIZE)
         return false;
@@ -38,6 +49,31 @@ bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::v
         OPENSSL_cleanse(&scryptHash, sizeof scryptHash);
     }
 
+    if (nDerivationMethod == 2)
+    {
+        if (vchOtherDerivationParameters.size() != 4)
+            return false;
+        unsigned int nLanes = 0;
+        for (int k = 0; k < 4; k++)
+            nLanes |= (unsigned int)vchOtherDerivationParameters[k] << (8 * k);
+        if (nLanes < 1 || nLanes > WALLET_SCRYPT_MAX_LANES)
+            return false;
+
+        // -- a salt per lane, the lanes are independent so they are split over the cores
+        CKeyingMaterial vchLaneSalt(nLanes * 32);
+        PBKDF2_SHA256((const uint8_t*)strKeyData.c_str(), strKeyData.size(), &chSalt[0], chSalt.size(), 1, &vchLaneSalt[0], vchLaneSalt.size());
+
+        std::vector<uint256> vLaneHash(nLanes);
+        SplitOverThreads(nLanes, 1, boost::bind(&DeriveLanesRange, &strKeyData, &vchLaneSalt, nRounds, &vLaneHash, _1, _2));
+
+        CKeyingMaterial vchDerived(sizeof(chKey) + sizeof(chIV));
+        PBKDF2_SHA256((const uint8_t*)strKeyData.c_str(), strKeyData.size(), (const uint8_t*)&vLaneHash[0], nLanes * 32, 1, &vchDerived[0], vchDerived.size());
+        memcpy(chKey, &vchDerived[0], sizeof(chKey));
+        memcpy(chIV, &vchDerived[sizeof(chKey)], sizeof(chIV));
+        OPENSSL_cleanse(&vLaneHash[0], nLanes * 32);
+        i = WALLET_CRYPTO_KEY_SIZE;
+    }
+
 
     if (i != (int)WALLET_CRYPTO_KEY_SIZE)
     {
@@ -47,6 +83,7 @@ bool CCrypter::SetKeyFromPassphrase(const SecureString& strKeyData, const std::v
     }
 
     fKeySet = true;
+    nCtxMode = CTX_NONE;
     return true;
 }
 
@@ -59,6 +96,25 @@ bool CCrypter::SetKey(const CKeyingMaterial& chNewKey, const std::vector<unsigne
     memcpy(&chIV[0], &chNewIV[0], sizeof chIV);
 
     fKeySet = true;
+    nCtxMode = CTX_NONE;
+    return true;
+}
+
+bool CCrypter::InitCtx(int nMode, const unsigned char* pIV)
+{
+    if (!ctx && !(ctx = EVP_CIPHER_CTX_new()))
+        return false;
+
+    // -- same key and direction, keep the key schedule and reset the IV only
+    if (nMode == nCtxMode)
+        return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, pIV, nMode == CTX_ENCRYPT);
+
+    nCtxMode = CTX_NONE;
+    const EVP_CIPHER* cipher = nMode == CTX_DECRYPT_ECB ? EVP_aes_256_ecb() : EVP_aes_256_cbc();
+    if (!EVP_CipherInit_ex(ctx, cipher, NULL, chKey, pIV, nMode == CTX_ENCRYPT))
+        return false;
+    EVP_CIPHER_CTX_set_padding(ctx, nMode == CTX_DECRYPT_ECB ? 0 : 1);
+    nCtxMode = nMode;
     return true;
 }
 
@@ -73,15 +129,9 @@ bool CCrypter::Encrypt(const CKeyingMaterial& vchPlaintext, std::vector<unsigned
     int nCLen = nLen + AES_BLOCK_SIZE, nFLen = 0;
     vchCiphertext = std::vector<unsigned char> (nCLen);
 
-    EVP_CIPHER_CTX ctx;
-
-    bool fOk = true;
-
-    EVP_CIPHER_CTX_init(&ctx);
-    if (fOk) fOk = EVP_EncryptInit_ex(&ctx, EVP_aes_256_cbc(), NULL, chKey, chIV);
-    if (fOk) fOk = EVP_EncryptUpdate(&ctx, &vchCiphertext[0], &nCLen, &vchPlaintext[0], nLen);
-    if (fOk) fOk = EVP_EncryptFinal_ex(&ctx, (&vchCiphertext[0])+nCLen, &nFLen);
-    EVP_CIPHER_CTX_cleanup(&ctx);
+    bool fOk = InitCtx(CTX_ENCRYPT, chIV);
+    if (fOk) fOk = EVP_EncryptUpdate(ctx, &vchCiphertext[0], &nCLen, &vchPlaintext[0], nLen);
+    if (fOk) fOk = EVP_EncryptFinal_ex(ctx, (&vchCiphertext[0])+nCLen, &nFLen);
 
     if (!fOk) return false;
 
@@ -100,15 +150,9 @@ bool CCrypter::Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingM
 
     vchPlaintext = CKeyingMaterial(nPLen);
 
-    EVP_CIPHER_CTX ctx;
-
-    bool fOk = true;
-
-    EVP_CIPHER_CTX_init(&ctx);
-    if (fOk) fOk = EVP_DecryptInit_ex(&ctx, EVP_aes_256_cbc(), NULL, chKey, chIV);
-    if (fOk) fOk = EVP_DecryptUpdate(&ctx, &vchPlaintext[0], &nPLen, &vchCiphertext[0], nLen);
-    if (fOk) fOk = EVP_DecryptFinal_ex(&ctx, (&vchPlaintext[0])+nPLen, &nFLen);
-    EVP_CIPHER_CTX_cleanup(&ctx);
+    bool fOk = InitCtx(CTX_DECRYPT, chIV);
+    if (fOk) fOk = EVP_DecryptUpdate(ctx, &vchPlaintext[0], &nPLen, &vchCiphertext[0], nLen);
+    if (fOk) fOk = EVP_DecryptFinal_ex(ctx, (&vchPlaintext[0])+nPLen, &nFLen);
 
     if (!fOk) return false;
 
@@ -116,6 +160,76 @@ bool CCrypter::Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingM
     return true;
 }
 
+bool CCrypter::DecryptBatch(const std::vector<const std::vector<unsigned char>*>& vCiphertext, const std::vector<uint256>& vIV, std::vector<CKeyingMaterial>& vPlaintext)
+{
+    assert(vCiphertext.size() == vIV.size());
+    vPlaintext.clear();
+    vPlaintext.resize(vCiphertext.size());
+    if (!fKeySet)
+        return false;
+
+    // -- gather the blocks of every well formed ciphertext
+    bool fAllOk = true;
+    std::vector<unsigned char> vchIn;
+    for (unsigned int i = 0; i < vCiphertext.size(); i++)
+    {
+        const std::vector<unsigned char>& vchCiphertext = *vCiphertext[i];
+        if (vchCiphertext.empty() || vchCiphertext.size() % AES_BLOCK_SIZE != 0)
+        {
+            fAllOk = false;
+            continue;
+        };
+        vchIn.insert(vchIn.end(), vchCiphertext.begin(), vchCiphertext.end());
+    };
+    if (vchIn.empty())
+        return fAllOk;
+
+    CKeyingMaterial vchOut(vchIn.size());
+    int nOut = 0;
+    if (!InitCtx(CTX_DECRYPT_ECB, NULL)
+        || !EVP_DecryptUpdate(ctx, &vchOut[0], &nOut, &vchIn[0], vchIn.size())
+        || nOut != (int)vchIn.size())
+    {
+        OPENSSL_cleanse(&vchOut[0], vchOut.size());
+        return false;
+    };
+
+    // -- CBC: each block is xored with the ciphertext block before it, or the IV for the first
+    unsigned int nPos = 0;
+    for (unsigned int i = 0; i < vCiphertext.size(); i++)
+    {
+        const std::vector<unsigned char>& vchCiphertext = *vCiphertext[i];
+        if (vchCiphertext.empty() || vchCiphertext.size() % AES_BLOCK_SIZE != 0)
+            continue;
+
+        unsigned char* p = &vchOut[nPos];
+        unsigned int nLen = vchCiphertext.size();
+        for (unsigned int k = 0; k < AES_BLOCK_SIZE; k++)
+            p[k] ^= vIV[i].begin()[k];
+        for (unsigned int k = AES_BLOCK_SIZE; k < nLen; k++)
+            p[k] ^= vchCiphertext[k - AES_BLOCK_SIZE];
+
+        // -- PKCS#7 padding, checked without branching on the plaintext
+        const unsigned char* pLast = p + nLen - AES_BLOCK_SIZE;
+        unsigned int nPad = pLast[AES_BLOCK_SIZE - 1];
+        unsigned int nBad = ((nPad - 1) | (AES_BLOCK_SIZE - nPad)) >> 8;
+        for (unsigned int k = 0; k < AES_BLOCK_SIZE; k++)
+        {
+            unsigned int fIsPad = ((AES_BLOCK_SIZE - 1 - k) - nPad) >> 31; // last nPad bytes
+            nBad |= fIsPad * (pLast[k] ^ nPad);
+        };
+
+        if (nBad == 0)
+            vPlaintext[i].assign(p, p + nLen - nPad);
+        else
+            fAllOk = false;
+        nPos += nLen;
+    };
+
+    OPENSSL_cleanse(&vchOut[0], vchOut.size());
+    return fAllOk;
+}
+
 
 bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext)
 {
@@ -137,6 +251,15 @@ bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned
     return cKeyCrypter.Decrypt(vchCiphertext, *((CKeyingMaterial*)&vchPlaintext));
 }
 
+bool DecryptSecrets(const CKeyingMaterial& vMasterKey, const std::vector<const std::vector<unsigned char>*>& vCiphertext, const std::vector<uint256>& vIV, std::vector<CKeyingMaterial>& vPlaintext)
+{
+    CCrypter cKeyCrypter;
+    std::vector<unsigned char> chIV(WALLET_CRYPTO_KEY_SIZE, 0); // each secret has its own
+    if (!cKeyCrypter.SetKey(vMasterKey, chIV))
+        return false;
+    return cKeyCrypter.DecryptBatch(vCiphertext, vIV, vPlaintext);
+}
+
 bool CCryptoKeyStore::SetCrypted()
 {
     LOCK(cs_KeyStore);
@@ -237,7 +360,12 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
     {
         LOCK(cs_KeyStore);
         if (!IsCrypted())
-            return CBasicKeyStore::AddKeyPubKey(key, pubkey);
+        {
+            if (!CBasicKeyStore::AddKeyPubKey(key, pubkey))
+                return false;
+            nOwnedIdsAdded++;
+            return true;
+        };
         if (IsLocked())
             return false;
         std::vector<unsigned char> vchCryptedSecret;
@@ -252,6 +380,14 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
     return true;
 }
 
+bool CCryptoKeyStore::AddCScript(const CScript& redeemScript)
+{
+    if (!CBasicKeyStore::AddCScript(redeemScript))
+        return false;
+    nOwnedIdsAdded++;
+    return true;
+}
+
 
 bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
@@ -261,6 +397,7 @@ bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<
             return false;
 
         mapCryptedKeys[vchPubKey.GetID()] = make_pair(vchPubKey, vchCryptedSecret);
+        nOwnedIdsAdded++;
     }
     return true;
 }
@@ -10,8 +10,13 @@
 #include "keystore.h"
 #include "util.h"
 
+#include <openssl/evp.h>
+#include <boost/atomic.hpp>
+
 const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
+const unsigned int WALLET_SCRYPT_MAX_LANES = 64;    // most lanes derivation method 2 may be stored with
+const unsigned int WALLET_SCRYPT_MIN_ROUNDS = 16;   // fewest chained scrypt hashes for method 1, and per lane for method 2
 
 /*
 Private key encryption is done based on a CMasterKey,
@@ -23,6 +28,12 @@ derived using derivation method nDerivationMethod
 vchOtherDerivationParameters is provided for alternative algorithms
 which may require more parameters (such as scrypt).
 
+Method 2 runs a number of scrypt lanes, kept little endian in the 4 bytes of
+vchOtherDerivationParameters, each chaining nDeriveIterations scrypt hashes.
+The lanes are salted apart by a PBKDF2 of the passphrase and run on all cores,
+the key and IV are a PBKDF2 of every lane's result. EncryptWallet sets one
+lane per core, so the same unlock time buys as many times more work.
+
 Wallet Private Keys are then encrypted using AES-256-CBC
 with the double-sha256 of the public key as the IV, and the
 master key's key as the encryption key (see keystore.[ch]).
@@ -36,6 +47,7 @@ public:
     std::vector<unsigned char> vchSalt;
     // 0 = EVP_sha512()
     // 1 = scrypt()
+    // 2 = scrypt lanes on all cores
     unsigned int nDerivationMethod;
     unsigned int nDeriveIterations;
     // Use this for more parameters to key derivation,
@@ -75,37 +87,94 @@ public:
                 nDerivationMethod = 1;
                 vchOtherDerivationParameters = std::vector<unsigned char>(0);
             break;
+
+            case 2: // scrypt lanes
+                nDeriveIterations = WALLET_SCRYPT_MIN_ROUNDS;
+                nDerivationMethod = 2;
+                SetLanes(boost::thread::hardware_concurrency());
+            break;
         }
     }
 
+    void SetLanes(unsigned int nLanes)
+    {
+        nLanes = std::min(std::max(nLanes, 1u), WALLET_SCRYPT_MAX_LANES);
+        vchOtherDerivationParameters.resize(4);
+        for (int i = 0; i < 4; i++)
+            vchOtherDerivationParameters[i] = (nLanes >> (8 * i)) & 0xff;
+    }
+
+    // fewest iterations a passphrase is derived with, EncryptWallet times this many first
+    // an iteration of the scrypt methods is a scrypt hash, far slower than the sha512 rounds of method 0
+    unsigned int GetMinIterations() const
+    {
+        return nDerivationMethod == 0 ? 25000 : WALLET_SCRYPT_MIN_ROUNDS;
+    }
+
 };
 
 typedef std::vector<unsigned char, secure_allocator<unsigned char> > CKeyingMaterial;
 
-/** Encryption/decryption context with key information */
+/** Encryption/decryption context with key information.
+ *  The cipher context is kept between calls, while the key and direction stay the same only the IV
+ *  is reset, so the AES key schedule isn't expanded again for every secret.
+ *  OpenSSL's AES uses AES-NI, or vpaes without it, neither has key or data dependent table lookups.
+ */
 class CCrypter
 {
 private:
+    enum
+    {
+        CTX_NONE = 0,
+        CTX_ENCRYPT,
+        CTX_DECRYPT,
+        CTX_DECRYPT_ECB,
+    };
+
     unsigned char chKey[WALLET_CRYPTO_KEY_SIZE];
     unsigned char chIV[WALLET_CRYPTO_KEY_SIZE];
     bool fKeySet;
+    EVP_CIPHER_CTX* ctx;
+    int nCtxMode;
+
+    bool InitCtx(int nMode, const unsigned char* pIV);
+
+    // the context holds the key schedule, it is not copied
+    CCrypter(const CCrypter&);
+    CCrypter& operator=(const CCrypter&);
 
 public:
-    bool SetKeyFromPassphrase(const SecureString &strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod);
+    bool SetKeyFromPassphrase(const SecureString &strKeyData, const std::vector<unsigned char>& chSalt, const unsigned int nRounds, const unsigned int nDerivationMethod,
+        const std::vector<unsigned char>& vchOtherDerivationParameters = std::vector<unsigned char>());
     bool Encrypt(const CKeyingMaterial& vchPlaintext, std::vector<unsigned char> &vchCiphertext);
     bool Decrypt(const std::vector<unsigned char>& vchCiphertext, CKeyingMaterial& vchPlaintext);
     bool SetKey(const CKeyingMaterial& chNewKey, const std::vector<unsigned char>& chNewIV);
 
+    /** Decrypts many secrets under the one key, vIV[i] is the IV of vCiphertext[i]. The blocks of all of them
+     *  go through a single ECB call, so AES-NI keeps several blocks in flight instead of one CBC chain at a
+     *  time, then each is chained to its IV and has its padding checked in constant time.
+     *  vPlaintext[i] is left empty if vCiphertext[i] doesn't decrypt, and false returned.
+     */
+    bool DecryptBatch(const std::vector<const std::vector<unsigned char>*>& vCiphertext, const std::vector<uint256>& vIV, std::vector<CKeyingMaterial>& vPlaintext);
+
     void CleanKey()
     {
         OPENSSL_cleanse(chKey, sizeof(chKey));
         OPENSSL_cleanse(chIV, sizeof(chIV));
         fKeySet = false;
+
+        // -- freeing the context cleanses its key schedule
+        if (ctx)
+            EVP_CIPHER_CTX_free(ctx);
+        ctx = NULL;
+        nCtxMode = CTX_NONE;
     }
 
     CCrypter()
     {
         fKeySet = false;
+        ctx = NULL;
+        nCtxMode = CTX_NONE;
 
         // Try to keep the key data out of swap (and be a bit over-careful to keep the IV that we don't even use out of swap)
         // Note that this does nothing about suspend-to-disk (which will put all our key data on disk)
@@ -125,6 +194,7 @@ public:
 
 bool EncryptSecret(const CKeyingMaterial& vMasterKey, const CKeyingMaterial &vchPlaintext, const uint256& nIV, std::vector<unsigned char> &vchCiphertext);
 bool DecryptSecret(const CKeyingMaterial& vMasterKey, const std::vector<unsigned char>& vchCiphertext, const uint256& nIV, CKeyingMaterial& vchPlaintext);
+bool DecryptSecrets(const CKeyingMaterial& vMasterKey, const std::vector<const std::vector<unsigned char>*>& vCiphertext, const std::vector<uint256>& vIV, std::vector<CKeyingMaterial>& vPlaintext);
 
 /** Keystore which keeps the private keys encrypted.
  * It derives from the basic key store, which is used if no encryption is active.
@@ -147,7 +217,10 @@ protected:
     bool Unlock(const CKeyingMaterial& vMasterKeyIn);
 
 public:
-    CCryptoKeyStore() : fUseCrypto(false)
+    // -- bumped after a key or script id is added to this store or one of the wallet's ext key accounts, CWallet::MayOwn rebuilds its filter when it changes
+    boost::atomic<unsigned int> nOwnedIdsAdded;
+
+    CCryptoKeyStore() : fUseCrypto(false), nOwnedIdsAdded(0)
     {
     }
 
@@ -174,6 +247,7 @@ public:
     
     bool AddKey(const CKey& key);
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    bool AddCScript(const CScript& redeemScript);
     bool HaveKey(const CKeyID &address) const
     {
         {
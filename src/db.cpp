@@ -11,11 +11,15 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+
 #ifndef WIN32
 #include "sys/stat.h"
 #endif
 
 using namespace std;
+namespace fs = boost::filesystem;
 
 
 unsigned int nWalletDBUpdated;
@@ -49,6 +53,7 @@ CDBEnv::CDBEnv() : dbenv(DB_CXX_NO_EXCEPTIONS)
 
 CDBEnv::~CDBEnv()
 {
+    CloseLevelDB();
     EnvShutdown();
 }
 
@@ -219,6 +224,66 @@ bool CDBEnv::Salvage(std::string strFile, bool fAggressive,
 }
 
 
+fs::path CDBEnv::GetLevelDBPath(const std::string& strFile)
+{
+    // -- wallet.dat is stored in wallet.ldb/
+    fs::path pathFile(strFile);
+    pathFile.replace_extension(".ldb");
+    return GetDataDir() / pathFile;
+}
+
+bool CDBEnv::IsLevelDB(const std::string& strFile)
+{
+    {
+        LOCK(cs_db);
+        if (mapLdb.count(strFile))
+            return true;
+    }
+
+    if (fs::exists(GetLevelDBPath(strFile)))
+        return true;
+
+    return !fMockDb
+        && GetArg("-walletbackend", "bdb") == "leveldb"
+        && !fs::exists(GetDataDir() / strFile);
+}
+
+leveldb::DB* CDBEnv::OpenLevelDB(const std::string& strFile, bool fCreate)
+{
+    AssertLockHeld(cs_db);
+
+    std::map<std::string, leveldb::DB*>::iterator mi = mapLdb.find(strFile);
+    if (mi != mapLdb.end())
+        return mi->second;
+
+    fs::path pathLdb = GetLevelDBPath(strFile);
+    if (!fCreate && !fs::is_directory(pathLdb))
+        return NULL;
+
+    leveldb::Options options;
+    options.create_if_missing = fCreate;
+
+    leveldb::DB* pldb = NULL;
+    leveldb::Status s = leveldb::DB::Open(options, pathLdb.string(), &pldb);
+    if (!s.ok())
+    {
+        LogPrintf("CDBEnv::OpenLevelDB() - Error opening %s: %s\n", pathLdb.string().c_str(), s.ToString().c_str());
+        return NULL;
+    };
+
+    LogPrintf("Opened LevelDB wallet store %s\n", pathLdb.string().c_str());
+    mapLdb[strFile] = pldb;
+    return pldb;
+}
+
+void CDBEnv::CloseLevelDB()
+{
+    LOCK(cs_db);
+    for (std::map<std::string, leveldb::DB*>::iterator mi = mapLdb.begin(); mi != mapLdb.end(); ++mi)
+        delete mi->second;
+    mapLdb.clear();
+}
+
 void CDBEnv::CheckpointLSN(const std::string& strFile)
 {
     dbenv.txn_checkpoint(0, 0, 0);
@@ -229,7 +294,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 
 
 CDB::CDB(const std::string& strFilename, const char* pszMode) :
-    pdb(NULL), activeTxn(NULL)
+    pdb(NULL), activeTxn(NULL), pldb(NULL), activeBatch(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -237,6 +302,24 @@ CDB::CDB(const std::string& strFilename, const char* pszMode) :
         return;
 
     bool fCreate = strchr(pszMode, 'c');
+
+    if (bitdb.IsLevelDB(strFilename))
+    {
+        LOCK(bitdb.cs_db);
+        strFile = strFilename;
+        if (!(pldb = bitdb.OpenLevelDB(strFile, fCreate)))
+            throw runtime_error(strprintf("CDB : can't open LevelDB store for %s", strFile.c_str()));
+
+        if (fCreate && !Exists(string("version")))
+        {
+            bool fTmp = fReadOnly;
+            fReadOnly = false;
+            WriteVersion(CLIENT_VERSION);
+            fReadOnly = fTmp;
+        };
+        return;
+    };
+
     unsigned int nFlags = DB_READ_UNCOMMITTED | DB_THREAD; // get must be called with DB_READ_UNCOMMITTED also for it to apply
     if (fCreate)
         nFlags |= DB_CREATE;
@@ -301,6 +384,14 @@ static bool IsChainFile(std::string strFile)
 
 void CDB::Close()
 {
+    if (pldb)
+    {
+        // -- handle stays open in bitdb.mapLdb, uncommitted batches are dropped like aborted txns
+        TxnAbort();
+        pldb = NULL;
+        return;
+    };
+
     if (!pdb)
         return;
     if (activeTxn)
@@ -325,6 +416,273 @@ void CDB::Close()
     }
 }
 
+bool CDB::ReadLdb(const CDataStream& ssKey, std::string& strValue)
+{
+    std::string strKey(ssKey.begin(), ssKey.end());
+
+    if (activeBatch)
+    {
+        // -- reads inside a txn must see its writes
+        std::map<std::string, std::string>::iterator mi = mapBatchWrites.find(strKey);
+        if (mi != mapBatchWrites.end())
+        {
+            strValue = mi->second;
+            return true;
+        };
+        if (setBatchErased.count(strKey))
+            return false;
+    };
+
+    leveldb::Status s = pldb->Get(leveldb::ReadOptions(), strKey, &strValue);
+    if (!s.ok())
+    {
+        if (!s.IsNotFound())
+            LogPrintf("CDB LevelDB read failure: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    return true;
+}
+
+bool CDB::WriteLdb(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite)
+{
+    if (!fOverwrite && ExistsLdb(ssKey))
+        return false;
+
+    std::string strKey(ssKey.begin(), ssKey.end());
+    leveldb::Slice slValue(&ssValue[0], ssValue.size());
+
+    if (activeBatch)
+    {
+        activeBatch->Put(strKey, slValue);
+        mapBatchWrites[strKey] = slValue.ToString();
+        setBatchErased.erase(strKey);
+        return true;
+    };
+
+    // -- synced as BDB's would be by the flush thread, which leaves LevelDB wallets alone
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pldb->Put(writeOptions, strKey, slValue);
+    if (!s.ok())
+        return error("CDB LevelDB write failure: %s", s.ToString().c_str());
+
+    return true;
+}
+
+bool CDB::EraseLdb(const CDataStream& ssKey)
+{
+    std::string strKey(ssKey.begin(), ssKey.end());
+
+    if (activeBatch)
+    {
+        activeBatch->Delete(strKey);
+        mapBatchWrites.erase(strKey);
+        setBatchErased.insert(strKey);
+        return true;
+    };
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pldb->Delete(writeOptions, strKey);
+    if (!s.ok())
+        return error("CDB LevelDB erase failure: %s", s.ToString().c_str());
+
+    return true;
+}
+
+bool CDB::ExistsLdb(const CDataStream& ssKey)
+{
+    std::string strValue;
+    return ReadLdb(ssKey, strValue);
+}
+
+CDBCursor* CDB::GetCursor()
+{
+    // -- LevelDB cursors iterate a snapshot, writes made through them or in an open txn are not seen
+    if (pldb)
+        return new CDBCursor(pldb->NewIterator(leveldb::ReadOptions()), this);
+
+    if (!pdb)
+        return NULL;
+    Dbc* pdbc = NULL;
+    int ret = pdb->cursor(NULL, &pdbc, 0);
+    if (ret != 0)
+        return NULL;
+    return new CDBCursor(pdbc);
+}
+
+int CDB::ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags)
+{
+    if (pcursor->pit)
+    {
+        // -- LevelDB keys sort bytewise as in the Berkeley DB btree, only DB_SET_RANGE and DB_NEXT are needed
+        leveldb::Iterator* pit = pcursor->pit;
+        if (fFlags == DB_SET_RANGE)
+            pit->Seek(leveldb::Slice(&ssKey[0], ssKey.size()));
+        else
+        if (fFlags != DB_NEXT)
+            return EINVAL;
+        else
+        if (!pcursor->fPositioned)
+            pit->SeekToFirst();
+        else
+            pit->Next();
+        pcursor->fPositioned = true;
+
+        if (!pit->Valid())
+            return pit->status().ok() ? DB_NOTFOUND : 99999;
+
+        leveldb::Slice slKey = pit->key();
+        leveldb::Slice slValue = pit->value();
+        ssKey.SetType(SER_DISK);
+        ssKey.clear();
+        ssKey.write(slKey.data(), slKey.size());
+        ssValue.SetType(SER_DISK);
+        ssValue.clear();
+        ssValue.write(slValue.data(), slValue.size());
+        return 0;
+    };
+
+    // Read at cursor
+    Dbt datKey;
+    if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
+    {
+        datKey.set_data(&ssKey[0]);
+        datKey.set_size(ssKey.size());
+    }
+    Dbt datValue;
+    if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
+    {
+        datValue.set_data(&ssValue[0]);
+        datValue.set_size(ssValue.size());
+    }
+    datKey.set_flags(DB_DBT_MALLOC);
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pcursor->pdbc->get(&datKey, &datValue, fFlags);
+    if (ret != 0)
+        return ret;
+    else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
+        return 99999;
+
+    // Convert to streams
+    ssKey.SetType(SER_DISK);
+    ssKey.clear();
+    ssKey.write((char*)datKey.get_data(), datKey.get_size());
+    ssValue.SetType(SER_DISK);
+    ssValue.clear();
+    ssValue.write((char*)datValue.get_data(), datValue.get_size());
+
+    // Clear and free memory
+    memset(datKey.get_data(), 0, datKey.get_size());
+    memset(datValue.get_data(), 0, datValue.get_size());
+    free(datKey.get_data());
+    free(datValue.get_data());
+    return 0;
+}
+
+bool CDB::TxnBegin()
+{
+    if (pldb)
+    {
+        // -- a txn is a WriteBatch, committed atomically with one synced write
+        if (activeBatch)
+            return false;
+        activeBatch = new leveldb::WriteBatch();
+        return true;
+    };
+
+    if (!pdb || activeTxn)
+        return false;
+    DbTxn* ptxn = bitdb.TxnBegin();
+    if (!ptxn)
+        return false;
+    activeTxn = ptxn;
+    return true;
+}
+
+bool CDB::TxnCommit()
+{
+    if (pldb)
+    {
+        if (!activeBatch)
+            return false;
+        leveldb::WriteOptions writeOptions;
+        writeOptions.sync = true;
+        leveldb::Status s = pldb->Write(writeOptions, activeBatch);
+        TxnAbort();
+        if (!s.ok())
+            return error("CDB LevelDB batch commit failure: %s", s.ToString().c_str());
+        return true;
+    };
+
+    if (!pdb || !activeTxn)
+        return false;
+    int ret = activeTxn->commit(0);
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+bool CDB::TxnAbort()
+{
+    if (pldb)
+    {
+        if (!activeBatch)
+            return false;
+        delete activeBatch;
+        activeBatch = NULL;
+        mapBatchWrites.clear();
+        setBatchErased.clear();
+        return true;
+    };
+
+    if (!pdb || !activeTxn)
+        return false;
+    int ret = activeTxn->abort();
+    activeTxn = NULL;
+    return (ret == 0);
+}
+
+int CDBCursor::close()
+{
+    int ret = 0;
+    if (pdbc)
+        ret = pdbc->close();
+    if (pit)
+        delete pit;
+    delete this;
+    return ret;
+}
+
+int CDBCursor::del(uint32_t nFlags)
+{
+    if (pdbc)
+        return pdbc->del(nFlags);
+
+    if (!pit || !pit->Valid())
+        return EINVAL;
+
+    leveldb::Slice slKey = pit->key();
+    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+    return pOwner->EraseLdb(ssKey) ? 0 : EIO;
+}
+
+int CDBCursor::put(CDataStream& ssValue)
+{
+    if (pdbc)
+    {
+        Dbt datValue(&ssValue[0], ssValue.size());
+        return pdbc->put(NULL, &datValue, DB_CURRENT);
+    };
+
+    if (!pit || !pit->Valid())
+        return EINVAL;
+
+    leveldb::Slice slKey = pit->key();
+    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+    return pOwner->WriteLdb(ssKey, ssValue, true) ? 0 : EIO;
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -351,6 +709,36 @@ bool CDBEnv::RemoveDb(const string& strFile)
 
 bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 {
+    if (bitdb.IsLevelDB(strFile))
+    {
+        // -- no slack space to rewrite, compacting drops superseded values from the log and tables
+        LogPrintf("Compacting %s...\n", strFile.c_str());
+        CDB db(strFile.c_str(), "r+");
+        if (!db.pldb)
+            return false;
+
+        db.TxnBegin();
+        CDBCursor* pcursor = db.GetCursor();
+        while (pcursor)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            if (db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT) != 0)
+                break;
+            if (pszSkip &&
+                strncmp(&ssKey[0], pszSkip, std::min(ssKey.size(), strlen(pszSkip))) == 0)
+                pcursor->del(0);
+        };
+        if (pcursor)
+            pcursor->close();
+        db.WriteVersion(CLIENT_VERSION);
+        if (!db.TxnCommit())
+            return false;
+
+        db.pldb->CompactRange(NULL, NULL);
+        return true;
+    };
+
     for (;;)
     {
         boost::this_thread::interruption_point();
@@ -382,7 +770,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                         fSuccess = false;
                     }
 
-                    Dbc* pcursor = db.GetCursor();
+                    CDBCursor* pcursor = db.GetCursor();
                     if (pcursor)
                         while (fSuccess)
                         {
@@ -444,8 +832,103 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 }
 
 
+bool CDB::MigrateToLevelDB(const std::string& strFile)
+{
+    // -- copy every record of a Berkeley DB wallet file into a new LevelDB store,
+    //    the store is built in a temporary directory and only renamed into place once complete.
+    //    strFile is left untouched, it's no longer read once the store exists.
+    fs::path pathLdb = bitdb.GetLevelDBPath(strFile);
+    if (fs::exists(pathLdb))
+        return error("MigrateToLevelDB() : %s already exists.", pathLdb.string().c_str());
+
+    fs::path pathTmp(pathLdb.string() + ".tmp");
+    fs::remove_all(pathTmp);
+
+    LogPrintf("Migrating %s to %s...\n", strFile.c_str(), pathLdb.string().c_str());
+    int64_t nStart = GetTimeMillis();
+
+    leveldb::Options options;
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    leveldb::DB* pldbNew = NULL;
+    leveldb::Status s = leveldb::DB::Open(options, pathTmp.string(), &pldbNew);
+    if (!s.ok())
+        return error("MigrateToLevelDB() : Error opening %s: %s", pathTmp.string().c_str(), s.ToString().c_str());
+
+    const size_t nMaxBatchBytes = 4 * 1024 * 1024;
+    bool fSuccess = true;
+    uint32_t nRecords = 0;
+    {
+        CDB db(strFile.c_str(), "r");
+        CDBCursor* pcursor = db.pdb ? db.GetCursor() : NULL;
+        if (!pcursor)
+            fSuccess = error("MigrateToLevelDB() : Can't read %s.", strFile.c_str());
+
+        leveldb::WriteBatch batch;
+        size_t nBatchBytes = 0;
+        while (fSuccess)
+        {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
+            if (ret == DB_NOTFOUND)
+                break;
+            if (ret != 0)
+            {
+                fSuccess = error("MigrateToLevelDB() : Error %d reading %s.", ret, strFile.c_str());
+                break;
+            };
+
+            batch.Put(leveldb::Slice(&ssKey[0], ssKey.size()), leveldb::Slice(&ssValue[0], ssValue.size()));
+            nBatchBytes += ssKey.size() + ssValue.size();
+            nRecords++;
+
+            if (nBatchBytes < nMaxBatchBytes)
+                continue;
+
+            s = pldbNew->Write(leveldb::WriteOptions(), &batch);
+            if (!s.ok())
+                fSuccess = error("MigrateToLevelDB() : Write failed: %s", s.ToString().c_str());
+            batch.Clear();
+            nBatchBytes = 0;
+        };
+
+        if (pcursor)
+            pcursor->close();
+
+        if (fSuccess)
+        {
+            leveldb::WriteOptions writeOptions;
+            writeOptions.sync = true;
+            s = pldbNew->Write(writeOptions, &batch);
+            if (!s.ok())
+                fSuccess = error("MigrateToLevelDB() : Write failed: %s", s.ToString().c_str());
+        };
+    }
+    delete pldbNew;
+
+    try {
+        if (fSuccess)
+            fs::rename(pathTmp, pathLdb);
+        else
+            fs::remove_all(pathTmp);
+    } catch (const fs::filesystem_error& e)
+    {
+        fSuccess = error("MigrateToLevelDB() : %s", e.what());
+    };
+
+    if (fSuccess)
+        LogPrintf("Migrated %u records from %s in %dms.\n", nRecords, strFile.c_str(), GetTimeMillis() - nStart);
+
+    return fSuccess;
+}
+
+
 void CDBEnv::Flush(bool fShutdown)
 {
+    if (fShutdown)
+        CloseLevelDB();
+
     int64_t nStart = GetTimeMillis();
     // Flush log data to the actual data file
     //  on all files that are not in use
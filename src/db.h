@@ -8,11 +8,19 @@
 #include "main.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
 #include <db_cxx.h>
 
+namespace leveldb
+{
+    class DB;
+    class Iterator;
+    class WriteBatch;
+}
+
 class CAddress;
 class CAddrMan;
 class CBlockLocator;
@@ -23,6 +31,7 @@ class COutPoint;
 class CTxIndex;
 class CWallet;
 class CWalletTx;
+class CDB;
 
 extern unsigned int nWalletDBUpdated;
 
@@ -46,6 +55,7 @@ public:
     DbEnv dbenv;
     std::map<std::string, int> mapFileUseCount;
     std::map<std::string, Db*> mapDb;
+    std::map<std::string, leveldb::DB*> mapLdb; // wallet files stored in LevelDB, open until shutdown
 
     CDBEnv();
     ~CDBEnv();
@@ -81,6 +91,16 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
+    /*
+     * Wallet files can be kept in a LevelDB directory next to the Berkeley DB file,
+     * see GetLevelDBPath. The LevelDB store is used when its directory exists, or
+     * for new files when -walletbackend=leveldb.
+     */
+    boost::filesystem::path GetLevelDBPath(const std::string& strFile);
+    bool IsLevelDB(const std::string& strFile);
+    leveldb::DB* OpenLevelDB(const std::string& strFile, bool fCreate);
+    void CloseLevelDB();
+
     DbTxn *TxnBegin(int flags=DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
@@ -94,36 +114,96 @@ public:
 extern CDBEnv bitdb;
 
 
-/** RAII class that provides access to a Berkeley database */
+/** Cursor over a CDB, wraps a Berkeley DB cursor or a LevelDB iterator.
+    Read through CDB::ReadAtCursor, return codes follow Berkeley DB. */
+class CDBCursor
+{
+public:
+    CDBCursor(Dbc* pdbc_) : pdbc(pdbc_), pit(NULL), pOwner(NULL), fPositioned(false) {};
+    CDBCursor(leveldb::Iterator* pit_, CDB* pOwner_) : pdbc(NULL), pit(pit_), pOwner(pOwner_), fPositioned(false) {};
+
+    Dbc* pdbc;
+    leveldb::Iterator* pit;
+    CDB* pOwner;
+    bool fPositioned;
+
+    // -- like Dbc::close(), frees the cursor
+    int close();
+
+    // -- delete or overwrite the record at the cursor
+    int del(uint32_t nFlags=0);
+    int put(CDataStream& ssValue);
+
+private:
+    ~CDBCursor() {};
+};
+
+
+/** RAII class that provides access to a Berkeley database or a LevelDB wallet store */
 class CDB
 {
+friend class CDBCursor;
 protected:
     Db* pdb;
     std::string strFile;
     DbTxn *activeTxn;
     bool fReadOnly;
 
+    leveldb::DB* pldb; // set instead of pdb when strFile is kept in LevelDB
+    leveldb::WriteBatch* activeBatch;
+    std::map<std::string, std::string> mapBatchWrites; // records in activeBatch, reads check these first
+    std::set<std::string> setBatchErased;
+
     explicit CDB(const std::string& strFilename, const char* pszMode="r+");
     ~CDB() { Close(); }
 
 public:
     void Close();
 
+    bool IsLevelDB() const { return pldb != NULL; };
+
 private:
     CDB(const CDB&);
     void operator=(const CDB&);
 
 protected:
+    // -- LevelDB paths of Read, Write, Erase and Exists, see db.cpp
+    bool ReadLdb(const CDataStream& ssKey, std::string& strValue);
+    bool WriteLdb(const CDataStream& ssKey, const CDataStream& ssValue, bool fOverwrite);
+    bool EraseLdb(const CDataStream& ssKey);
+    bool ExistsLdb(const CDataStream& ssKey);
+
     template<typename K, typename T>
     bool Read(const K& key, T& value, uint32_t nFlags=0)
     {
-        if (!pdb)
+        if (!pdb && !pldb)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (pldb)
+        {
+            std::string strValue;
+            bool fFound = ReadLdb(ssKey, strValue);
+            memset(&ssKey[0], 0, ssKey.size());
+            if (!fFound)
+                return false;
+
+            bool fRet = true;
+            try {
+                CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> value;
+            } catch (std::exception &e) {
+                fRet = false;
+            }
+
+            memset(&strValue[0], 0, strValue.size());
+            return fRet;
+        };
+
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Read
@@ -152,7 +232,7 @@ protected:
     template<typename K, typename T>
     bool Write(const K& key, const T& value, bool fOverwrite=true)
     {
-        if (!pdb)
+        if (!pdb && !pldb)
             return false;
         
         if (fReadOnly)
@@ -162,12 +242,21 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
-        Dbt datKey(&ssKey[0], ssKey.size());
         
         // Value
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
+
+        if (pldb)
+        {
+            bool fRet = WriteLdb(ssKey, ssValue, fOverwrite);
+            memset(&ssKey[0], 0, ssKey.size());
+            memset(&ssValue[0], 0, ssValue.size());
+            return fRet;
+        };
+
+        Dbt datKey(&ssKey[0], ssKey.size());
         Dbt datValue(&ssValue[0], ssValue.size());
         
         // Write
@@ -183,7 +272,7 @@ protected:
     template<typename K>
     bool Erase(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !pldb)
             return false;
         if (fReadOnly)
             assert(!"Erase called on database in read-only mode");
@@ -192,6 +281,10 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (pldb)
+            return EraseLdb(ssKey);
+
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
@@ -205,13 +298,17 @@ protected:
     template<typename K>
     bool Exists(const K& key)
     {
-        if (!pdb)
+        if (!pdb && !pldb)
             return false;
 
         // Key
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+
+        if (pldb)
+            return ExistsLdb(ssKey);
+
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
@@ -222,87 +319,16 @@ protected:
         return (ret == 0);
     }
 
-    Dbc* GetCursor()
-    {
-        if (!pdb)
-            return NULL;
-        Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
-        if (ret != 0)
-            return NULL;
-        return pcursor;
-    }
+    CDBCursor* GetCursor();
 
 
 public:
 
-    int ReadAtCursor(Dbc* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT)
-    {
-        // Read at cursor
-        Dbt datKey;
-        if (fFlags == DB_SET || fFlags == DB_SET_RANGE || fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
-        {
-            datKey.set_data(&ssKey[0]);
-            datKey.set_size(ssKey.size());
-        }
-        Dbt datValue;
-        if (fFlags == DB_GET_BOTH || fFlags == DB_GET_BOTH_RANGE)
-        {
-            datValue.set_data(&ssValue[0]);
-            datValue.set_size(ssValue.size());
-        }
-        datKey.set_flags(DB_DBT_MALLOC);
-        datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pcursor->get(&datKey, &datValue, fFlags);
-        if (ret != 0)
-            return ret;
-        else if (datKey.get_data() == NULL || datValue.get_data() == NULL)
-            return 99999;
-
-        // Convert to streams
-        ssKey.SetType(SER_DISK);
-        ssKey.clear();
-        ssKey.write((char*)datKey.get_data(), datKey.get_size());
-        ssValue.SetType(SER_DISK);
-        ssValue.clear();
-        ssValue.write((char*)datValue.get_data(), datValue.get_size());
-
-        // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
-        free(datKey.get_data());
-        free(datValue.get_data());
-        return 0;
-    }
-
-    bool TxnBegin()
-    {
-        if (!pdb || activeTxn)
-            return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
-        if (!ptxn)
-            return false;
-        activeTxn = ptxn;
-        return true;
-    }
+    int ReadAtCursor(CDBCursor* pcursor, CDataStream& ssKey, CDataStream& ssValue, unsigned int fFlags=DB_NEXT);
 
-    bool TxnCommit()
-    {
-        if (!pdb || !activeTxn)
-            return false;
-        int ret = activeTxn->commit(0);
-        activeTxn = NULL;
-        return (ret == 0);
-    }
-
-    bool TxnAbort()
-    {
-        if (!pdb || !activeTxn)
-            return false;
-        int ret = activeTxn->abort();
-        activeTxn = NULL;
-        return (ret == 0);
-    }
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
 
     bool ReadVersion(int& nVersion)
     {
@@ -316,6 +342,7 @@ public:
     }
 
     bool static Rewrite(const std::string& strFile, const char* pszSkip = NULL);
+    bool static MigrateToLevelDB(const std::string& strFile);
 };
 
 
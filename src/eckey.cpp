@@ -288,6 +288,79 @@ bool CECKey::TweakPublic(const unsigned char vchTweak[32])
     return ret;
 }
 
+bool CECKey::TweakPublicMany(const unsigned char *pTweaks, size_t nTweaks, std::vector<CPubKey> &vOut, std::vector<char> &vfOk)
+{
+    vOut.assign(nTweaks, CPubKey());
+    vfOk.assign(nTweaks, false);
+    if (nTweaks == 0)
+        return true;
+
+    const EC_GROUP *group = EC_KEY_get0_group(pkey);
+    const EC_POINT *parent = EC_KEY_get0_public_key(pkey);
+    if (!parent)
+        return false;
+
+    bool ret = true;
+    BN_CTX *ctx = BN_CTX_new();
+    BN_CTX_start(ctx);
+    BIGNUM *bnTweak = BN_CTX_get(ctx);
+    BIGNUM *bnOrder = BN_CTX_get(ctx);
+    EC_GROUP_get_order(group, bnOrder, ctx);
+
+    std::vector<EC_POINT*> vPoints(nTweaks, (EC_POINT*)NULL);
+    for (size_t i = 0; i < nTweaks; ++i)
+    {
+        BN_bin2bn(pTweaks + i * 32, 32, bnTweak);
+        if (BN_cmp(bnTweak, bnOrder) >= 0)
+            continue; // extremely unlikely
+
+        EC_POINT *point = EC_POINT_new(group);
+        if (!point)
+        {
+            ret = false;
+            break;
+        };
+
+        // -- tweak*G, then add the parent point
+        if (!EC_POINT_mul(group, point, bnTweak, NULL, NULL, ctx)
+            || !EC_POINT_add(group, point, point, parent, ctx)
+            || EC_POINT_is_at_infinity(group, point))
+        {
+            EC_POINT_free(point);
+            continue; // ridiculously unlikely
+        };
+        vPoints[i] = point;
+    };
+
+    // -- one shared field inversion instead of one per point
+    std::vector<EC_POINT*> vValid;
+    for (size_t i = 0; i < nTweaks; ++i)
+        if (vPoints[i])
+            vValid.push_back(vPoints[i]);
+    if (ret && vValid.size() > 0
+        && !EC_POINTs_make_affine(group, vValid.size(), &vValid[0], ctx))
+        ret = false;
+
+    for (size_t i = 0; i < nTweaks; ++i)
+    {
+        if (!vPoints[i])
+            continue;
+
+        unsigned char c[33];
+        if (ret
+            && EC_POINT_point2oct(group, vPoints[i], POINT_CONVERSION_COMPRESSED, c, sizeof(c), ctx) == sizeof(c))
+        {
+            vOut[i].Set(&c[0], &c[33]);
+            vfOk[i] = true;
+        };
+        EC_POINT_free(vPoints[i]);
+    };
+
+    BN_CTX_end(ctx);
+    BN_CTX_free(ctx);
+    return ret;
+}
+
 bool TweakSecret(unsigned char vchSecretOut[32], const unsigned char vchSecretIn[32], const unsigned char vchTweak[32])
 {
     bool ret = true;
@@ -56,6 +56,11 @@ public:
     bool Recover(const uint256 &hash, const unsigned char *p64, int rec);
     
     bool TweakPublic(const unsigned char vchTweak[32]);
+
+    // Add tweak*G to the public key for each of the nTweaks 32 byte tweaks at pTweaks, the key itself is not changed.
+    // The group order and context are set up once and the results are converted to affine together.
+    // vfOk[i] is false where the tweak or the resulting point is invalid.
+    bool TweakPublicMany(const unsigned char *pTweaks, size_t nTweaks, std::vector<CPubKey> &vOut, std::vector<char> &vfOk);
 };
 
 bool TweakSecret(unsigned char vchSecretOut[32], const unsigned char vchSecretIn[32], const unsigned char vchTweak[32]);
@@ -19,6 +19,9 @@
 
 #include <stdint.h>
 
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
 
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
@@ -521,6 +524,7 @@ bool CExtKeyAccount::SaveKey(const CKeyID &id, CEKAKey &keyIn)
     {
         CBitcoinAddress addr(id);
         LogPrintf("Warning: SaveKey %s key not found in look ahead %s.\n", GetIDString58().c_str(), addr.ToString().c_str());
+        OwnedIdsAdded(); // a key out of the look ahead is owned already
     };
     
     mapKeys[id] = keyIn;
@@ -581,6 +585,7 @@ bool CExtKeyAccount::SaveKey(const CKeyID &id, CEKASCKey &keyIn)
         return error("SaveKey(): CEKASCKey Stealth key not in this account!");
     
     mapStealthChildKeys[id] = keyIn;
+    OwnedIdsAdded();
     
     if (fDebug)
     {
@@ -601,6 +606,52 @@ bool CExtKeyAccount::IsLocked(const CEKAStealthKey &aks)
     return true;
 };
 
+static bool DeriveKeysRange(const CExtKeyPair *pkp, uint32_t nChildIn, std::vector<CPubKey> *pvKeys, std::vector<char> *pvfOk,
+    size_t nBegin, size_t nEnd)
+{
+    // -- each part writes its own slots of the shared vectors
+    std::vector<CPubKey> vKeys;
+    std::vector<char> vfOk;
+    if (!pkp->DeriveMany(vKeys, vfOk, nChildIn + nBegin, nEnd - nBegin)
+        || vKeys.size() != nEnd - nBegin
+        || vfOk.size() != nEnd - nBegin)
+        return false;
+    std::copy(vKeys.begin(), vKeys.end(), pvKeys->begin() + nBegin);
+    std::copy(vfOk.begin(), vfOk.end(), pvfOk->begin() + nBegin);
+    return true;
+};
+
+int CStoredExtKey::DeriveKeys(std::vector<CPubKey> &vKeysOut, std::vector<uint32_t> &vChildOut, uint32_t nChildIn, uint32_t nCount)
+{
+    // -- derive the non-hardened children nChildIn to nChildIn+nCount-1, invalid children are left out
+    //    large ranges are split over threads, each thread decodes the parent point once
+    vKeysOut.clear();
+    vChildOut.clear();
+    
+    if (nCount == 0)
+        return 0;
+    if (((nChildIn + nCount - 1) >> 31) != 0
+        || nChildIn + nCount < nChildIn)
+        return errorN(1, "No more keys can be derived from master.");
+    
+    std::vector<CPubKey> vKeys(nCount);
+    std::vector<char> vfOk(nCount, 0);
+    if (!SplitOverThreads(nCount, EXTKEY_DERIVE_CHUNK, boost::bind(&DeriveKeysRange, &kp, nChildIn, &vKeys, &vfOk, _1, _2)))
+        return errorN(1, "DeriveMany failed.");
+    
+    vKeysOut.reserve(nCount);
+    vChildOut.reserve(nCount);
+    for (uint32_t k = 0; k < nCount; ++k)
+    {
+        if (!vfOk[k])
+            continue;
+        vKeysOut.push_back(vKeys[k]);
+        vChildOut.push_back(nChildIn + k);
+    };
+    
+    return 0;
+};
+
 int CExtKeyAccount::AddLookAhead(uint32_t nChain, uint32_t nKeys)
 {
     // -- start from key 0
@@ -611,27 +662,30 @@ int CExtKeyAccount::AddLookAhead(uint32_t nChain, uint32_t nKeys)
     if (fDebug)
         LogPrintf("%s: chain %s, keys %d.\n", __func__, pc->GetIDString58(), nKeys);
     
-    AccKeyMap::const_iterator mi;
     uint32_t nChild = pc->nGenerated;
-    uint32_t nChildOut = nChild;
+    uint32_t nAdded = 0;
+    uint32_t nDerived = 0;
     
+    // -- derive in batches, a batch can come up short where keys are invalid or already in mapKeys
+    std::vector<CPubKey> vKeys;
+    std::vector<uint32_t> vChildren;
     CKeyID keyId;
-    CPubKey pk;
-    for (uint32_t k = 0; k < nKeys; ++k)
+    while (nAdded < nKeys
+        && nDerived < nKeys * MAX_DERIVE_TRIES) // MAX_DERIVE_TRIES > lookahead pool
     {
-        bool fGotKey = false;
-        for (uint32_t i = 0; i < MAX_DERIVE_TRIES; ++i) // MAX_DERIVE_TRIES > lookahead pool
+        uint32_t nBatch = nKeys - nAdded;
+        if (pc->DeriveKeys(vKeys, vChildren, nChild, nBatch) != 0)
         {
-            if (pc->DeriveKey(pk, nChild, nChildOut, false) != 0)
-            {
-                LogPrintf("%s: DeriveKey failed, chain %d, child %d.\n", __func__, nChain, nChild);
-                nChild = nChildOut+1;
-                continue;
-            };
-            nChild = nChildOut+1;
-            
-            keyId = pk.GetID();
-            if ((mi = mapKeys.find(keyId)) != mapKeys.end())
+            LogPrintf("%s: DeriveKeys failed, chain %d, child %d.\n", __func__, nChain, nChild);
+            break;
+        };
+        nChild += nBatch;
+        nDerived += nBatch;
+        
+        for (size_t k = 0; k < vKeys.size(); ++k)
+        {
+            keyId = vKeys[k].GetID();
+            if (mapKeys.find(keyId) != mapKeys.end())
             {
                 if (fDebug)
                 {
@@ -640,25 +694,24 @@ int CExtKeyAccount::AddLookAhead(uint32_t nChain, uint32_t nKeys)
                 };
                 continue;
             };
-            fGotKey = true;
-            break;
-        };
-        
-        if (!fGotKey)
-        {
-            LogPrintf("%s: DeriveKey loop failed, chain %d, child %d.\n", __func__, nChain, nChild);
-            continue;
-        };
-        
-        mapLookAhead[keyId] = CEKAKey(nChain, nChildOut);
-        
-        if (fDebug)
-        {
-            CBitcoinAddress addr(keyId);
-            LogPrintf("%s: added %s\n", __func__, addr.ToString().c_str());
+            
+            mapLookAhead[keyId] = CEKAKey(nChain, vChildren[k]);
+            nAdded++;
+            
+            if (fDebug)
+            {
+                CBitcoinAddress addr(keyId);
+                LogPrintf("%s: added %s\n", __func__, addr.ToString().c_str());
+            };
         };
     };
     
+    if (nAdded > 0)
+        OwnedIdsAdded();
+    
+    if (nAdded < nKeys)
+        LogPrintf("%s: DeriveKey loop failed, chain %d, child %d, added %u of %u.\n", __func__, nChain, nChild, nAdded, nKeys);
+    
     return 0;
 };
 
@@ -756,7 +809,7 @@ int LoopExtKeysInDB(bool fInactive, bool fInAccount, LoopExtKeyCallback &callbac
     
     CWalletDB wdb(pwalletMain->strWalletFile);
     
-    Dbc *pcursor;
+    CDBCursor *pcursor;
     if (!(pcursor = wdb.GetAtCursor()))
         throw std::runtime_error(strprintf("%s : cannot create DB cursor", __func__).c_str());
     
@@ -799,7 +852,7 @@ int LoopExtAccountsInDB(bool fInactive, LoopExtKeyCallback &callback)
     CWalletDB wdb(pwalletMain->strWalletFile);
     // - list accounts
     
-    Dbc *pcursor;
+    CDBCursor *pcursor;
     if (!(pcursor = wdb.GetAtCursor()))
         throw std::runtime_error(strprintf("%s : cannot create DB cursor", __func__).c_str());
     
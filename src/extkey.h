@@ -13,6 +13,7 @@
 #include "state.h"
 
 static const uint32_t MAX_DERIVE_TRIES = 16;
+static const uint32_t EXTKEY_DERIVE_CHUNK = 64; // min keys per thread in CStoredExtKey::DeriveKeys
 static const uint32_t BIP32_KEY_LEN = 82; // raw, 74 + 4 bytes id + 4 checksum
 static const uint32_t BIP32_KEY_N_BYTES = 74; // raw without id and checksum
 
@@ -143,6 +144,8 @@ public:
         return 0;
     };
     
+    int DeriveKeys(std::vector<CPubKey> &vKeysOut, std::vector<uint32_t> &vChildOut, uint32_t nChildIn, uint32_t nCount);
+    
     int SetCounter(uint32_t nC, bool fHardened)
     {
         if (fHardened)
@@ -355,6 +358,7 @@ public:
         nFlags = 0;
         nPack = 0;
         nPackStealth = 0;
+        pnOwnedIdsAdded = NULL;
     };
     
     int FreeChains()
@@ -423,6 +427,12 @@ public:
     
     int AddLookAhead(uint32_t nChain, uint32_t nKeys);
     
+    void OwnedIdsAdded()
+    {
+        if (pnOwnedIdsAdded)
+            (*pnOwnedIdsAdded)++;
+    };
+    
     int AddLookAheadInternal(uint32_t nKeys)
     {
         return AddLookAhead(nActiveExternal, nKeys);
@@ -492,6 +502,8 @@ public:
     uint32_t nPackStealth;
     uint32_t nPackStealthKeys;
     mapEKValue_t mapValue;
+    
+    boost::atomic<unsigned int> *pnOwnedIdsAdded; // the wallet's, set by CWallet::ExtKeyAddAccountToMaps
 };
 
 
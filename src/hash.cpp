@@ -131,3 +131,14 @@ bool VerifyChecksum(const std::vector<uint8_t>& data)
     
     return BitcoinChecksum((uint8_t*)&data[0], data.size()-4) == checksum;
 };
+
+void MerkleHashLevel(const uint256* pLevel, size_t nSize, uint256* pNext)
+{
+    // -- a node pair is 64 contiguous bytes
+    SHA256D64((unsigned char*)pNext, (const unsigned char*)pLevel, nSize / 2);
+    if (nSize & 1)
+    {
+        const uint256& last = pLevel[nSize - 1];
+        pNext[nSize / 2] = Hash(last.begin(), last.end(), last.begin(), last.end());
+    };
+}
@@ -238,6 +238,8 @@ std::string HelpMessage()
     strUsage += "  -detachdb              " + _("Detach block and address databases. Increases shutdown time (default: 0)") + "\n";
     strUsage += "  -paytxfee=<amt>        " + _("Fee per KB to add to transactions you send") + "\n";
     strUsage += "  -mininput=<amt>        " + _("When creating transactions, ignore inputs with value less than this (default: 0.01)") + "\n";
+    strUsage += "  -coinselect=<mode>     " + _("Coin selection: bnb searches for a selection without change before falling back to knapsack (default: bnb)") + "\n";
+    strUsage += "  -consolidateinputs=<n> " + _("Add up to <n> of the smallest coins to transactions that need change (default: 0)") + "\n";
     if (!fHaveGUI)
     {
         strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
@@ -272,11 +274,17 @@ std::string HelpMessage()
     strUsage += "  -walletnotify=<cmd>    " + _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)") + "\n";
     strUsage += "  -confchange            " + _("Require a confirmations for change (default: 0)") + "\n";
     strUsage += "  -enforcecanonical      " + _("Enforce transaction scripts to use canonical PUSH operators (default: 1)") + "\n";
+    strUsage += "  -ecdsacrosscheck       " + _("Check every secp256k1 signature, verification and public key against OpenSSL (default: 0)") + "\n";
     strUsage += "  -alertnotify=<cmd>     " + _("Execute command when a relevant alert is received (%s in cmd is replaced by message)") + "\n";
     strUsage += "  -upgradewallet         " + _("Upgrade wallet to latest format") + "\n";
     strUsage += "  -keypool=<n>           " + _("Set key pool size to <n> (default: 100)") + "\n";
+    strUsage += "  -walletkdf=<n>         " + _("Passphrase derivation for newly encrypted wallets, 0 = sha512, 1 = scrypt, 2 = scrypt on all cores (default: 0)") + "\n";
     strUsage += "  -rescan                " + _("Rescan the block chain for missing wallet transactions") + "\n";
     strUsage += "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n";
+    strUsage += "  -walletbackend=<name>  " + _("Store new wallets in Berkeley DB (bdb) or LevelDB (leveldb) (default: bdb)") + "\n";
+    strUsage += "  -lazywallet            " + _("Keep only the compact part of deeply confirmed wallet transactions in memory (default: 0)") + "\n";
+    strUsage += "  -storesupportingtxns   " + _("Store supporting transactions with wallet transactions, 0 looks them up when relaying (default: 1)") + "\n";
+    strUsage += "  -migratewallet         " + _("Copy a Berkeley DB wallet.dat into a LevelDB store and use the store from then on") + "\n";
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
@@ -307,6 +315,9 @@ std::string HelpMessage()
     strUsage += "  -nosmsg                                  " + _("Disable secure messaging.") + "\n";
     strUsage += "  -debugsmsg                               " + _("Log extra debug messages.") + "\n";
     strUsage += "  -smsgscanchain                           " + _("Scan the block chain for public key addresses on startup.") + "\n";
+    strUsage += "  -smsgscanthreads=<n>                     " + _("Number of threads used to match secure messages against owned addresses (default: number of cores)") + "\n";
+    strUsage += "  -smsgmaxpeerrate=<n>                     " + _("Maximum secure message relay sent to each peer in kB/s, 0 for no limit (default: 64)") + "\n";
+    strUsage += "  -smsgmaxrate=<n>                         " + _("Maximum secure message relay sent to all peers in kB/s, 0 for no limit (default: 256)") + "\n";
     
     return strUsage;
 }
@@ -415,7 +426,7 @@ bool AppInit2(boost::thread_group& threadGroup)
         LogPrintf("nMinerSleep %u\n", nMinerSleep);
 
 
-    nDerivationMethodIndex = 0;
+    nDerivationMethodIndex = std::min(std::max((int)GetArg("-walletkdf", 0), 0), 2);
 
     fTestNet = GetBoolArg("-testnet", false);
 
@@ -538,7 +549,9 @@ bool AppInit2(boost::thread_group& threadGroup)
     };
 
     fConfChange = GetBoolArg("-confchange", false);
+    fStoreSupportingTxns = GetBoolArg("-storesupportingtxns", true);
     fEnforceCanonical = GetBoolArg("-enforcecanonical", true);
+    fSecp256k1CrossCheck = GetBoolArg("-ecdsacrosscheck", false);
 
     if (mapArgs.count("-mininput"))
     {
@@ -548,6 +561,9 @@ bool AppInit2(boost::thread_group& threadGroup)
 
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
+    // Pick the SHA-256 implementations before any thread hashes
+    std::string strSHA256 = SHA256AutoDetect();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Sumcoin is shutting down."));
@@ -577,6 +593,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("Sumcoin version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     LogPrintf("Operating in %s mode.\n", GetNodeModeName(nNodeMode));
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using SHA256 implementation %s\n", strSHA256.c_str());
 
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()).c_str());
@@ -675,14 +692,16 @@ bool AppInit2(boost::thread_group& threadGroup)
         return InitError(msg);
     };
 
-    if (GetBoolArg("-salvagewallet"))
+    bool fWalletLevelDB = bitdb.IsLevelDB(strWalletFileName);
+
+    if (GetBoolArg("-salvagewallet") && !fWalletLevelDB)
     {
         // Recover readable keypairs:
         if (!CWalletDB::Recover(bitdb, strWalletFileName, true))
             return false;
     };
 
-    if (fs::exists(GetDataDir() / strWalletFileName))
+    if (!fWalletLevelDB && fs::exists(GetDataDir() / strWalletFileName))
     {
         CDBEnv::VerifyResult r = bitdb.Verify(strWalletFileName, CWalletDB::Recover);
         if (r == CDBEnv::RECOVER_OK)
@@ -698,6 +717,14 @@ bool AppInit2(boost::thread_group& threadGroup)
             return InitError(_("wallet.dat corrupt, salvage failed"));
     };
 
+    if (GetBoolArg("-migratewallet") && !fWalletLevelDB
+        && fs::exists(GetDataDir() / strWalletFileName))
+    {
+        uiInterface.InitMessage(_("Migrating wallet to LevelDB..."));
+        if (!CDB::MigrateToLevelDB(strWalletFileName))
+            return InitError(_("Error migrating wallet to LevelDB, see debug.log"));
+    };
+
     // ********************************************************* Step 6: network initialization
 
     nMaxThinPeers = GetArg("-maxthinpeers", 8);
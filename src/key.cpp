@@ -4,6 +4,10 @@
 
 #include "key.h"
 #include "eckey.h"
+#include "secp256k1.h"
+#include "util.h"
+
+bool fSecp256k1CrossCheck = false;
 
 int CompareBigEndian(const unsigned char *c1, size_t c1len, const unsigned char *c2, size_t c2len)
 {
@@ -118,21 +122,29 @@ CPrivKey CKey::GetPrivKey() const
 
 CPubKey CKey::GetPubKey() const
 {
-    assert(fValid);
-    CECKey key;
-    key.SetSecretBytes(vch);
-    CPubKey pubkey;
-    key.GetPubKey(pubkey, fCompressed);
-    return pubkey;
+    return GetPubKey(fCompressed);
 }
 
 CPubKey CKey::GetPubKey(bool fForceCompressed) const
 {
     assert(fValid);
-    CECKey key;
-    key.SetSecretBytes(vch);
-    CPubKey pubkey;
-    key.GetPubKey(pubkey, fForceCompressed);
+    unsigned char vchPubKey[65];
+    unsigned int nLen = Secp256k1::GetPubKey(vch, fForceCompressed, vchPubKey);
+    assert(nLen);
+    CPubKey pubkey(&vchPubKey[0], &vchPubKey[nLen]);
+
+    if (fSecp256k1CrossCheck)
+    {
+        CECKey key;
+        key.SetSecretBytes(vch);
+        CPubKey pubkeyCheck;
+        key.GetPubKey(pubkeyCheck, fForceCompressed);
+        if (pubkeyCheck != pubkey)
+        {
+            LogPrintf("CKey::GetPubKey() : secp256k1 and OpenSSL public keys differ, using OpenSSL's.\n");
+            return pubkeyCheck;
+        };
+    };
     return pubkey;
 }
 
@@ -140,9 +152,24 @@ bool CKey::Sign(const uint256 &hash, std::vector<unsigned char>& vchSig) const
 {
     if (!fValid)
         return false;
-    CECKey key;
-    key.SetSecretBytes(vch);
-    return key.Sign(hash, vchSig);
+    if (!Secp256k1::Sign(vch, hash.begin(), vchSig))
+        return false;
+
+    if (fSecp256k1CrossCheck)
+    {
+        // -- OpenSSL signs with a random nonce and ours is RFC6979, so check the signature verifies under OpenSSL rather than comparing bytes
+        CECKey key;
+        key.SetSecretBytes(vch);
+        CPubKey pubkey;
+        key.GetPubKey(pubkey, true);
+        CECKey keyPub;
+        if (!keyPub.SetPubKey(pubkey) || !keyPub.Verify(hash, vchSig))
+        {
+            LogPrintf("CKey::Sign() : OpenSSL rejects the secp256k1 signature of %s, signing with OpenSSL.\n", hash.ToString().c_str());
+            return key.Sign(hash, vchSig);
+        };
+    };
+    return true;
 }
 
 bool CKey::SignCompact(const uint256 &hash, std::vector<unsigned char>& vchSig) const
@@ -183,12 +210,21 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
 {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(*this))
-        return false;
-    if (!key.Verify(hash, vchSig))
-        return false;
-    return true;
+    bool fOk = vchSig.size() > 0
+        && Secp256k1::Verify(vch, size(), hash.begin(), &vchSig[0], vchSig.size());
+
+    if (fSecp256k1CrossCheck)
+    {
+        CECKey key;
+        bool fValidCheck = vchSig.size() > 0 && key.SetPubKey(*this) && key.Verify(hash, vchSig);
+        if (fValidCheck != fOk)
+        {
+            LogPrintf("CPubKey::Verify() : secp256k1 %s and OpenSSL %s signature of %s, using OpenSSL's result.\n",
+                fOk ? "accepts" : "rejects", fValidCheck ? "accepts" : "rejects", hash.ToString().c_str());
+            return fValidCheck;
+        };
+    };
+    return fOk;
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig)
@@ -309,6 +345,31 @@ bool CPubKey::Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned i
     return ret;
 }
 
+bool CPubKey::DeriveMany(std::vector<CPubKey>& vChildren, std::vector<char>& vfOk, unsigned int nChild, unsigned int nCount, const unsigned char cc[32]) const
+{
+    vChildren.clear();
+    vfOk.clear();
+    if (nCount == 0)
+        return true;
+
+    assert(IsValid());
+    assert(((nChild + nCount - 1) >> 31) == 0 && nChild + nCount >= nChild);
+    assert(begin() + 33 == end());
+
+    std::vector<unsigned char> vTweaks(nCount * 32);
+    unsigned char out[64];
+    for (unsigned int i = 0; i < nCount; ++i)
+    {
+        BIP32Hash(cc, nChild + i, *begin(), begin()+1, out);
+        memcpy(&vTweaks[i * 32], out, 32);
+    };
+
+    CECKey key;
+    if (!key.SetPubKey(*this))
+        return false;
+    return key.TweakPublicMany(&vTweaks[0], nCount, vChildren, vfOk);
+}
+
 bool CExtKey::Derive(CExtKey &out, unsigned int nChild) const
 {
     out.nDepth = nDepth + 1;
@@ -515,6 +576,15 @@ bool CExtKeyPair::Derive(CPubKey &out, unsigned int nChild) const
     return true;
 };
 
+bool CExtKeyPair::DeriveMany(std::vector<CPubKey>& vOut, std::vector<char>& vfOk, unsigned int nChild, unsigned int nCount) const
+{
+    // -- non-hardened children only
+    if (nCount > 0
+        && (((nChild + nCount - 1) >> 31) != 0 || nChild + nCount < nChild))
+        return false;
+    return pubkey.DeriveMany(vOut, vfOk, nChild, nCount, vchChainCode);
+};
+
 CExtPubKey CExtKeyPair::GetExtPubKey() const
 {
     CExtPubKey ret;
@@ -576,5 +646,5 @@ bool ECC_InitSanityCheck()
     EC_KEY_free(pkey);
 
     // TODO Is there more EC functionality that could be missing?
-    return true;
+    return Secp256k1::SelfTest();
 }
@@ -173,6 +173,10 @@ public:
 
     // Derive BIP32 child pubkey.
     bool Derive(CPubKey& pubkeyChild, unsigned char ccChild[32], unsigned int nChild, const unsigned char cc[32]) const;
+
+    // Derive the nCount consecutive non-hardened BIP32 child pubkeys from nChild, the parent point is decoded once.
+    // vfOk[i] is false for children that are invalid and must be skipped.
+    bool DeriveMany(std::vector<CPubKey>& vChildren, std::vector<char>& vfOk, unsigned int nChild, unsigned int nCount, const unsigned char cc[32]) const;
     
 };
 
@@ -497,6 +501,7 @@ public:
     bool Derive(CExtPubKey &out, unsigned int nChild) const;
     bool Derive(CKey &out, unsigned int nChild) const;
     bool Derive(CPubKey &out, unsigned int nChild) const;
+    bool DeriveMany(std::vector<CPubKey>& vOut, std::vector<char>& vfOk, unsigned int nChild, unsigned int nCount) const;
     
     CExtPubKey GetExtPubKey() const;
     CExtKeyPair Neutered() const;
@@ -541,6 +546,9 @@ public:
     }
 };
 
+/** Check every secp256k1 result against OpenSSL, logging and using OpenSSL's on a mismatch */
+extern bool fSecp256k1CrossCheck;
+
 /** Check that required EC support is available at runtime */
 bool ECC_InitSanityCheck(void);
 
@@ -264,7 +264,7 @@ typedef struct {
 typedef enum { notLimited = 0, limited = 1 } limitedOutput_directive;
 typedef enum { byPtr, byU32, byU16 } tableType_t;
 
-typedef enum { noPrefix = 0, withPrefix = 1 } prefix64k_directive;
+typedef enum { noPrefix = 0, withPrefix = 1, withDict = 2 } prefix64k_directive;
 
 typedef enum { endOnOutputSize = 0, endOnInputSize = 1 } endCondition_directive;
 typedef enum { full = 0, partial = 1 } earlyEnd_directive;
@@ -726,7 +726,8 @@ FORCE_INLINE int LZ4_decompress_generic(
                  int endOnInput,         /* endOnOutputSize, endOnInputSize */
                  int prefix64k,          /* noPrefix, withPrefix */
                  int partialDecoding,    /* full, partial */
-                 int targetOutputSize    /* only used if partialDecoding==partial */
+                 int targetOutputSize,   /* only used if partialDecoding==partial */
+                 int dictSize            /* only used if prefix64k==withDict */
                  )
 {
     /* Local Variables */
@@ -793,6 +794,7 @@ FORCE_INLINE int LZ4_decompress_generic(
         /* get offset */
         LZ4_READ_LITTLEENDIAN_16(ref,cpy,ip); ip+=2;
         if ((prefix64k==noPrefix) && (unlikely(ref < (BYTE* const)dest))) goto _output_error;   /* Error : offset outside destination buffer */
+        if ((prefix64k==withDict) && (unlikely(ref < (BYTE* const)dest - dictSize))) goto _output_error;   /* Error : offset outside dictionary */
 
         /* get matchlength */
         if ((length=(token&ML_MASK)) == ML_MASK)
@@ -849,30 +851,35 @@ _output_error:
 
 int LZ4_decompress_safe(const char* source, char* dest, int inputSize, int maxOutputSize)
 {
-    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, noPrefix, full, 0);
+    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, noPrefix, full, 0, 0);
 }
 
 int LZ4_decompress_safe_withPrefix64k(const char* source, char* dest, int inputSize, int maxOutputSize)
 {
-    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, withPrefix, full, 0);
+    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, withPrefix, full, 0, 0);
+}
+
+int LZ4_decompress_safe_withDict(const char* source, char* dest, int inputSize, int maxOutputSize, int dictSize)
+{
+    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, withDict, full, 0, dictSize);
 }
 
 int LZ4_decompress_safe_partial(const char* source, char* dest, int inputSize, int targetOutputSize, int maxOutputSize)
 {
-    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, noPrefix, partial, targetOutputSize);
+    return LZ4_decompress_generic(source, dest, inputSize, maxOutputSize, endOnInputSize, noPrefix, partial, targetOutputSize, 0);
 }
 
 int LZ4_decompress_fast_withPrefix64k(const char* source, char* dest, int outputSize)
 {
-    return LZ4_decompress_generic(source, dest, 0, outputSize, endOnOutputSize, withPrefix, full, 0);
+    return LZ4_decompress_generic(source, dest, 0, outputSize, endOnOutputSize, withPrefix, full, 0, 0);
 }
 
 int LZ4_decompress_fast(const char* source, char* dest, int outputSize)
 {
 #ifdef _MSC_VER   /* This version is faster with Visual */
-    return LZ4_decompress_generic(source, dest, 0, outputSize, endOnOutputSize, noPrefix, full, 0);
+    return LZ4_decompress_generic(source, dest, 0, outputSize, endOnOutputSize, noPrefix, full, 0, 0);
 #else
-    return LZ4_decompress_generic(source, dest, 0, outputSize, endOnOutputSize, withPrefix, full, 0);
+    return LZ4_decompress_generic(source, dest, 0, outputSize, endOnOutputSize, withPrefix, full, 0, 0);
 #endif
 }
 
@@ -231,6 +231,15 @@ int LZ4_decompress_fast_withPrefix64k (const char* source, char* dest, int outpu
     These functions are necessary to decode inter-dependant blocks.
 */
 
+int LZ4_decompress_safe_withDict (const char* source, char* dest, int inputSize, int maxOutputSize, int dictSize);
+
+/*
+LZ4_decompress_safe_withDict() :
+    Same as LZ4_decompress_safe_withPrefix64k(), but only the 'dictSize' bytes in front of 'char* dest'
+    may be referenced, offsets reaching further back are an error.
+    Use it when less than 64KB of prefix is allocated, e.g. a preset dictionary.
+*/
+
 
 /**************************************
    Obsolete Functions
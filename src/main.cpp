@@ -762,9 +762,11 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     // Update the tx's hashBlock
     hashBlock = pblock->GetHash();
 
-    // Locate the transaction
+    // Locate the transaction, by its txid in the block's merkle tree
+    const std::vector<uint256>& vMerkleTree = pblock->GetMerkleTree();
+    uint256 hash = GetHash();
     for (nIndex = 0; nIndex < (int)pblock->vtx.size(); nIndex++)
-        if (pblock->vtx[nIndex] == *(CTransaction*)this)
+        if (vMerkleTree[nIndex] == hash)
             break;
 
     if (nIndex == (int)pblock->vtx.size())
@@ -1069,9 +1071,21 @@ bool AcceptToMemoryPool(CTxMemPool &pool, CTransaction &tx, CTxDB &txdb, bool *p
 
 bool CWalletTx::AcceptWalletTransaction(CTxDB& txdb)
 {
+    if (fStripped && pwallet)
+    {
+        // -- vtxPrev is needed, read it back from the wallet db
+        CWalletTx wtxFull;
+        if (pwallet->GetFullWalletTx(GetHash(), wtxFull))
+            return wtxFull.AcceptWalletTransaction(txdb);
+    };
+
     {
+        std::vector<CMerkleTx> vtxFetched;
+        if (vtxPrev.empty())
+            GetUnconfirmedAncestors(txdb, vtxFetched);
+
         // Add previous supporting transactions first
-        BOOST_FOREACH(CMerkleTx& tx, vtxPrev)
+        BOOST_FOREACH(CMerkleTx& tx, vtxPrev.empty() ? vtxFetched : vtxPrev)
         {
             if (!(tx.IsCoinBase() || tx.IsCoinStake()))
             {
@@ -2471,6 +2485,8 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+        // -- the signature hashes of all inputs share the prefix hash states kept in hasher
+        CSignatureHasher hasher(*this);
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             if (nVersion == ANON_TXN_VERSION
@@ -2493,7 +2509,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
                 // Verify signature
-                if (!VerifySignature(txPrev, *this, i, flags, 0))
+                if (!VerifySignature(txPrev, *this, i, flags, 0, &hasher))
                 {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
                         // Check whether the failure was caused by a
@@ -2502,7 +2518,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                         // if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
+                        if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0, &hasher))
                             return error("ConnectInputs() : %s non-mandatory VerifySignature failed", GetHash().ToString());
                     }
                     // Failures of other flags indicate a transaction that is
@@ -3121,24 +3137,107 @@ bool CMerkleTx::AcceptToMemoryPool()
     return AcceptToMemoryPool(txdb);
 }
 
+static void BuildMerkleTreeThread(const std::vector<CTransaction>* pvtx, std::vector<uint256>* pvTree,
+    const std::vector<unsigned int>* pvLevel, unsigned int nBegin, unsigned int nEnd, int nLevels)
+{
+    // -- txids [nBegin, nEnd) and the nodes above them for nLevels levels, nBegin is a multiple of
+    //    1 << nLevels so no pair straddles two threads
+    std::vector<uint256>& vTree = *pvTree;
+    for (unsigned int i = nBegin; i < nEnd; i++)
+        vTree[i] = (*pvtx)[i].GetHash();
+    for (int h = 0; h < nLevels; h++)
+    {
+        unsigned int nLevelBegin = nBegin >> h, nLevelEnd = (nEnd + (1 << h) - 1) >> h;
+        MerkleHashLevel(&vTree[(*pvLevel)[h] + nLevelBegin], nLevelEnd - nLevelBegin, &vTree[(*pvLevel)[h + 1] + nLevelBegin / 2]);
+    };
+}
+
+uint256 CBlock::BuildMerkleTree(unsigned int nThreads) const
+{
+    // -- vLevel[h] is where level h starts in vMerkleTree
+    unsigned int nTxns = vtx.size();
+    std::vector<unsigned int> vLevel(1, 0);
+    for (unsigned int nSize = nTxns; nSize > 1; nSize = (nSize + 1) / 2)
+        vLevel.push_back(vLevel.back() + nSize);
+    vMerkleTree.resize(GetMerkleTreeSize(nTxns));
+    if (nTxns == 0)
+        return 0;
+    int nHeight = vLevel.size() - 1;
+
+    if (nThreads == 0)
+        nThreads = boost::thread::hardware_concurrency();
+    nThreads = std::min(std::max(nThreads, 1u), nTxns / MERKLE_TXNS_PER_THREAD);
+
+    int nLevelsDone = 0;
+    if (nThreads <= 1)
+    {
+        BuildMerkleTreeThread(&vtx, &vMerkleTree, &vLevel, 0, nTxns, 0);
+    } else
+    {
+        // -- each thread takes whole subtrees of 1 << nLevelsDone txids, hashing them and the levels
+        //    below the subtree roots, the rest of the tree is left to this thread
+        unsigned int nPer = (nTxns + nThreads - 1) / nThreads;
+        while ((2u << nLevelsDone) <= nPer && nLevelsDone < nHeight)
+            nLevelsDone++;
+        nPer = (nPer + (1 << nLevelsDone) - 1) >> nLevelsDone << nLevelsDone;
+
+        boost::thread_group threadGroup;
+        for (unsigned int nBegin = 0; nBegin < nTxns; nBegin += nPer)
+            threadGroup.create_thread(boost::bind(&BuildMerkleTreeThread, &vtx, &vMerkleTree, &vLevel,
+                nBegin, std::min(nBegin + nPer, nTxns), nLevelsDone));
+        threadGroup.join_all();
+    };
+
+    for (int h = nLevelsDone; h < nHeight; h++)
+        MerkleHashLevel(&vMerkleTree[vLevel[h]], vLevel[h + 1] - vLevel[h], &vMerkleTree[vLevel[h + 1]]);
+    return vMerkleTree.back();
+}
+
+uint256 CBlock::UpdateMerkleTree(unsigned int nIndex) const
+{
+    if (vMerkleTree.size() != GetMerkleTreeSize(vtx.size()) || nIndex >= vtx.size())
+        return BuildMerkleTree();
+
+    vMerkleTree[nIndex] = vtx[nIndex].GetHash();
+    unsigned int j = 0;
+    for (unsigned int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        unsigned int i = nIndex & ~1u, i2 = std::min(i + 1, nSize - 1);
+        vMerkleTree[j + nSize + nIndex / 2] = Hash(BEGIN(vMerkleTree[j + i]), END(vMerkleTree[j + i]),
+                                                  BEGIN(vMerkleTree[j + i2]), END(vMerkleTree[j + i2]));
+        nIndex /= 2;
+        j += nSize;
+    };
+    return vMerkleTree.back();
+}
+
 uint256 CPartialMerkleTree::CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid)
 {
+    // hash at height 0 is the txids themself
     if (height == 0)
-    {
-        // hash at height 0 is the txids themself
         return vTxid[pos];
-    } else
+
+    // a block's whole tree, the node is already there
+    if (vTxid.size() > nTransactions)
     {
-        // calculate left hash
-        uint256 left = CalcHash(height-1, pos*2, vTxid), right;
-        // calculate right hash if not beyong the end of the array - copy left hash otherwise1
-        if (pos*2+1 < CalcTreeWidth(height-1))
-            right = CalcHash(height-1, pos*2+1, vTxid);
-        else
-            right = left;
-        // combine subhashes
-        return Hash(BEGIN(left), END(left), BEGIN(right), END(right));
+        unsigned int nOffset = 0;
+        for (int h = 0; h < height; h++)
+            nOffset += CalcTreeWidth(h);
+        return vTxid[nOffset + pos];
+    };
+
+    // hash the txids under this node up a level at a time, several node pairs at once, a node
+    // without a right sibling (beyond the end of the level) is paired with itself
+    unsigned int nBegin = pos << height;
+    unsigned int nEnd = std::min((pos + 1) << height, nTransactions);
+    std::vector<uint256> vLevel(vTxid.begin() + nBegin, vTxid.begin() + nEnd), vNext;
+    for (int h = 0; h < height; h++)
+    {
+        vNext.resize((vLevel.size() + 1) / 2);
+        MerkleHashLevel(&vLevel[0], vLevel.size(), &vNext[0]);
+        vLevel.swap(vNext);
     };
+    return vLevel[0];
 }
 
 void CPartialMerkleTree::TraverseAndBuild(int height, unsigned int pos, const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch)
@@ -3215,6 +3314,17 @@ CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vTxid, const
     TraverseAndBuild(nHeight, 0, vTxid, vMatch);
 }
 
+CPartialMerkleTree::CPartialMerkleTree(const std::vector<uint256> &vMerkleTree, unsigned int nTxns, const std::vector<bool> &vMatch) : nTransactions(nTxns), fBad(false)
+{
+    assert(vMerkleTree.size() == CBlock::GetMerkleTreeSize(nTxns));
+
+    int nHeight = 0;
+    while (CalcTreeWidth(nHeight) > 1)
+        nHeight++;
+
+    TraverseAndBuild(nHeight, 0, vMerkleTree, vMatch);
+}
+
 CPartialMerkleTree::CPartialMerkleTree() : nTransactions(0), fBad(true) {}
 
 uint256 CPartialMerkleTree::ExtractMatches(std::vector<uint256> &vMatch)
@@ -3257,29 +3367,24 @@ CMerkleBlock::CMerkleBlock(const CBlock& block, CBlockIndex *pBlockIndex, CBloom
 {
     header = pBlockIndex->GetBlockThinOnly();
 
+    // -- the txids and the hashes of the unmatched subtrees come from the block's merkle tree
+    const vector<uint256>& vMerkleTree = block.GetMerkleTree();
     vector<bool> vMatch;
-    vector<uint256> vHashes;
-
     vMatch.reserve(block.vtx.size());
-    vHashes.reserve(block.vtx.size());
 
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        const uint256& hash = block.vtx[i].GetHash();
-
         if (filter.IsRelevantAndUpdate(block.vtx[i]))
         {
             vMatch.push_back(true);
-            vMatchedTxn.push_back(make_pair(i, hash));
+            vMatchedTxn.push_back(make_pair(i, vMerkleTree[i]));
         } else
         {
             vMatch.push_back(false);
         };
-
-        vHashes.push_back(hash);
     };
 
-    txn = CPartialMerkleTree(vHashes, vMatch);
+    txn = CPartialMerkleTree(vMerkleTree, block.vtx.size(), vMatch);
 }
 
 // ppcoin: total coin age spent in transaction, in the unit of coin-days.
@@ -3490,11 +3595,9 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
 
     // Check for duplicate txids. This is caught by ConnectInputs(),
     // but catching it earlier avoids a potential DoS attack:
-    set<uint256> uniqueTx;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
-    {
-        uniqueTx.insert(tx.GetHash());
-    }
+    // -- the merkle tree starts with the txids, so it's built once for this and the root check
+    uint256 hashMerkleTree = BuildMerkleTree();
+    set<uint256> uniqueTx(vMerkleTree.begin(), vMerkleTree.begin() + vtx.size());
     if (uniqueTx.size() != vtx.size())
         return DoS(100, error("CheckBlock() : duplicate transaction"));
 
@@ -3508,7 +3611,7 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig) c
         return DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
 
     // Check merkle root
-    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
+    if (fCheckMerkleRoot && hashMerkleRoot != hashMerkleTree)
         return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
 
 
@@ -4179,6 +4282,56 @@ void PrintBlockTree()
     }
 }
 
+static void PrehashHeadersThread(const std::vector<unsigned char>* pvData, std::vector<uint256>* pvHashes,
+    unsigned int nBegin, unsigned int nEnd)
+{
+    scrypt_blockhash_many(&(*pvData)[nBegin * 80], &(*pvHashes)[nBegin], nEnd - nBegin);
+}
+
+void PrehashHeaders(const std::vector<const CBlockHeader*>& vpHeaders)
+{
+    // -- hash the legacy (scrypt) headers of vpHeaders together, several lanes per core and split over
+    //    the cores when there are enough of them. The hashes are left in each header's cache for GetHash.
+    std::vector<const CBlockHeader*> vpLegacy;
+    std::vector<unsigned char> vData;
+    BOOST_FOREACH(const CBlockHeader* pheader, vpHeaders)
+    {
+        if (pheader->nVersion > 6
+            || (pheader->fHashCached
+                && memcmp(pheader->vchHashedFields, BEGIN(pheader->nVersion), sizeof(pheader->vchHashedFields)) == 0))
+            continue;
+        vpLegacy.push_back(pheader);
+        vData.insert(vData.end(), BEGIN(pheader->nVersion), END(pheader->nNonce));
+    };
+
+    unsigned int nHeaders = vpLegacy.size();
+    if (nHeaders < 2)
+        return;
+
+    std::vector<uint256> vHashes(nHeaders);
+    unsigned int nLanes = scrypt_blockhash_lanes();
+    unsigned int nThreads = boost::thread::hardware_concurrency();
+    nThreads = std::min(std::max(nThreads, 1u), nHeaders / nLanes);
+    if (nThreads <= 1)
+    {
+        PrehashHeadersThread(&vData, &vHashes, 0, nHeaders);
+    } else
+    {
+        // -- whole batches of nLanes per thread, the last takes the rest
+        unsigned int nPer = (nHeaders / nThreads) / nLanes * nLanes;
+        boost::thread_group threadGroup;
+        for (unsigned int t = 0; t < nThreads; t++)
+        {
+            unsigned int nEnd = (t == nThreads - 1) ? nHeaders : (t + 1) * nPer;
+            threadGroup.create_thread(boost::bind(&PrehashHeadersThread, &vData, &vHashes, t * nPer, nEnd));
+        };
+        threadGroup.join_all();
+    };
+
+    for (unsigned int i = 0; i < nHeaders; i++)
+        vpLegacy[i]->SetCachedHash(vHashes[i]);
+}
+
 bool LoadExternalBlockFile(int nFile, FILE* fileIn)
 {
     if (nNodeMode != NT_FULL)
@@ -4195,46 +4348,81 @@ bool LoadExternalBlockFile(int nFile, FILE* fileIn)
         try {
             CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
             unsigned int nPos = 0;
+
+            // -- blocks are read ahead in batches so their legacy headers can be hashed together
+            unsigned int nBatch = std::max(boost::thread::hardware_concurrency(), 1u) * scrypt_blockhash_lanes();
+            nBatch = std::min(nBatch, 64u);
+            std::vector<CBlock> vBlocks;
+            std::vector<unsigned int> vBlockPos;
+            vBlocks.reserve(nBatch); // never reallocated, a copied txn drops its cached hash
+
             while (nPos != (unsigned int)-1 && blkdat.good())
             {
-                boost::this_thread::interruption_point();
-                unsigned char pchData[65536];
-                for (;;)
+                vBlocks.clear();
+                vBlockPos.clear();
+                while (vBlocks.size() < nBatch && nPos != (unsigned int)-1 && blkdat.good())
                 {
                     boost::this_thread::interruption_point();
-                    fseek(blkdat, nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-                    if (nRead <= 8)
+                    unsigned char pchData[65536];
+                    for (;;)
                     {
-                        nPos = (unsigned int)-1;
-                        break;
+                        boost::this_thread::interruption_point();
+                        fseek(blkdat, nPos, SEEK_SET);
+                        int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
+                        if (nRead <= 8)
+                        {
+                            nPos = (unsigned int)-1;
+                            break;
+                        };
+
+                        void* nFind = memchr(pchData, Params().MessageStart()[0], nRead+1-MESSAGE_START_SIZE);
+                        if (nFind)
+                        {
+                            if (memcmp(nFind, Params().MessageStart(), MESSAGE_START_SIZE)==0)
+                            {
+                                nPos += ((unsigned char*)nFind - pchData) + MESSAGE_START_SIZE;
+                                break;
+                            };
+                            nPos += ((unsigned char*)nFind - pchData) + 1;
+                        } else
+                        {
+                            nPos += sizeof(pchData) - MESSAGE_START_SIZE + 1;
+                        };
                     };
 
-                    void* nFind = memchr(pchData, Params().MessageStart()[0], nRead+1-MESSAGE_START_SIZE);
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, Params().MessageStart(), MESSAGE_START_SIZE)==0)
+                    if (nPos == (unsigned int)-1)
+                        break;
+
+                    try {
+                        fseek(blkdat, nPos, SEEK_SET);
+                        unsigned int nSize;
+                        blkdat >> nSize;
+                        if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
                         {
-                            nPos += ((unsigned char*)nFind - pchData) + MESSAGE_START_SIZE;
-                            break;
+                            vBlocks.resize(vBlocks.size() + 1);
+                            blkdat >> vBlocks.back();
+                            vBlockPos.push_back(nPos + sizeof(nSize)); // blockPos is after nSize
+                            nPos += 4 + nSize;
                         };
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    } else
+                    } catch (std::exception &e)
                     {
-                        nPos += sizeof(pchData) - MESSAGE_START_SIZE + 1;
+                        // -- process the blocks read so far, then stop as before
+                        LogPrintf("%s() : Deserialize or I/O error caught during load\n",
+                               __PRETTY_FUNCTION__);
+                        if (vBlocks.size() > vBlockPos.size())
+                            vBlocks.pop_back();
+                        nPos = (unsigned int)-1;
                     };
                 };
 
-                if (nPos == (unsigned int)-1)
-                    break;
+                std::vector<const CBlockHeader*> vpHeaders;
+                BOOST_FOREACH(const CBlock& block, vBlocks)
+                    vpHeaders.push_back(&block);
+                PrehashHeaders(vpHeaders);
 
-                fseek(blkdat, nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
+                for (unsigned int i = 0; i < vBlocks.size(); i++)
                 {
-                    CBlock block;
-                    blkdat >> block;
+                    CBlock& block = vBlocks[i];
                     uint256 hashblock = block.GetHash();
                     LOCK(cs_main);
                     if (ProcessBlock(NULL, &block, hashblock))
@@ -4242,10 +4430,9 @@ bool LoadExternalBlockFile(int nFile, FILE* fileIn)
                         uint256 hashProof;
                         if (fReindexing
                             && (!block.GetHashProof(hashProof)
-                              ||!block.AddToBlockIndex(nFile, nPos+sizeof(nSize), hashProof))) // blockPos is after nSize
+                              ||!block.AddToBlockIndex(nFile, vBlockPos[i], hashProof)))
                             LogPrintf("LoadExternalBlockFile() : AddToBlockIndex failed %s\n", hashblock.ToString().c_str());
                         nLoaded++;
-                        nPos += 4 + nSize;
 
                         if (nLoaded % 20000 == 0)
                             LogPrintf("Loaded %d blocks and counting.\n", nLoaded);
@@ -5716,6 +5903,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return false;
         };
 
+        std::vector<const CBlockHeader*> vpHeaders;
+        for (std::vector<CBlockThin>::iterator it = vHeaders.begin(); it < vHeaders.end(); ++it)
+            vpHeaders.push_back(&(*it));
+        PrehashHeaders(vpHeaders);
+
         for (std::vector<CBlockThin>::iterator it = vHeaders.begin(); it < vHeaders.end(); ++it)
         {
             if (!fThinFullIndex && pindexRear
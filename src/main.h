@@ -45,6 +45,8 @@ static const unsigned int MAX_MULTI_BLOCK_SIZE = 5120000;    // 5MiB, most likel
 static const unsigned int MAX_MULTI_BLOCK_ELEMENTS = 64;     // processing larger blocks is cpu intensive
 static const unsigned int MAX_MULTI_BLOCK_THIN_ELEMENTS = 128;
 
+static const unsigned int MERKLE_TXNS_PER_THREAD = 256;       // fewer txns than this per core are hashed on one thread
+
 /** No amount larger than this (in satoshi) is valid */
 static const int64_t MAX_MONEY = std::numeric_limits<int64_t>::max();
 inline bool MoneyRange(int64_t nValue) { return (nValue >= 0 && nValue <= MAX_MONEY); }
@@ -132,6 +134,7 @@ CBlockThinIndex* FindBlockThinByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, std::vector<CNode*> &vNodesCopy, bool fSendTrickle);
 
+void PrehashHeaders(const std::vector<const CBlockHeader*>& vpHeaders);
 bool LoadExternalBlockFile(int nFile, FILE* fileIn);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
 
@@ -223,6 +226,24 @@ public:
 
 typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
 
+/** Memoized hash of a transaction that was read from a stream, see CTransaction::GetHash.
+ *  Only a transaction read in place caches its hash, copies start out without one so that
+ *  building or signing a copy can't leave a stale hash behind.
+ */
+class CTxHashCache
+{
+public:
+    mutable uint256 hash;
+    mutable bool fEnabled;
+    mutable bool fSet;
+
+    CTxHashCache() : fEnabled(false), fSet(false) {}
+    CTxHashCache(const CTxHashCache&) : fEnabled(false), fSet(false) {}
+    CTxHashCache& operator=(const CTxHashCache&) { fEnabled = false; fSet = false; return *this; }
+
+    void Reset(bool fEnable) const { fEnabled = fEnable; fSet = false; }
+};
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
  */
@@ -240,6 +261,9 @@ public:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
 
+    // memory only
+    CTxHashCache hashCache;
+
     CTransaction()
     {
         SetNull();
@@ -253,6 +277,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            hashCache.Reset(true);
     )
 
     void SetNull()
@@ -263,6 +289,7 @@ public:
         vout.clear();
         nLockTime = 0;
         nDoS = 0;  // Denial-of-service prevention
+        hashCache.Reset(false);
     }
 
     bool IsNull() const
@@ -272,7 +299,22 @@ public:
 
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        // -- a txn read from a stream is hashed once, changing one in place must go through SetNull or
+        //    UpdateHash. Txns built in memory are hashed on every call.
+        if (hashCache.fSet)
+            return hashCache.hash;
+        uint256 hash = SerializeHash(*this);
+        if (hashCache.fEnabled)
+        {
+            hashCache.hash = hash;
+            hashCache.fSet = true;
+        };
+        return hash;
+    }
+
+    void UpdateHash() const
+    {
+        hashCache.fSet = false;
     }
 
     bool IsFinal(int nBlockHeight=0, int64_t nBlockTime=0) const
@@ -664,6 +706,11 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    // memory only: the header fields hashCached was computed from, see GetHash
+    mutable uint256 hashCached;
+    mutable unsigned char vchHashedFields[80];
+    mutable bool fHashCached;
+
     CBlockHeader()
     {
         SetHdrNull();
@@ -677,6 +724,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        fHashCached = false;
     }
 
     IMPLEMENT_SERIALIZE
@@ -697,10 +745,28 @@ public:
 
     uint256 GetHash() const
     {
+        // -- memoized, scrypt of a legacy header costs far more than comparing the 80 header bytes.
+        //    The fields are public and set directly (nNonce when mining, getwork), so the cache is
+        //    checked against them instead of being invalidated.
+        if (fHashCached
+            && memcmp(vchHashedFields, BEGIN(nVersion), sizeof(vchHashedFields)) == 0)
+            return hashCached;
+
         if (nVersion > 6)
-            return Hash(BEGIN(nVersion), END(nNonce));
+            hashCached = Hash(BEGIN(nVersion), END(nNonce));
         else
-            return scrypt_blockhash(CVOIDBEGIN(nVersion));
+            hashCached = scrypt_blockhash(CVOIDBEGIN(nVersion));
+        memcpy(vchHashedFields, BEGIN(nVersion), sizeof(vchHashedFields));
+        fHashCached = true;
+        return hashCached;
+    }
+
+    void SetCachedHash(const uint256& hash) const
+    {
+        // -- for hashes computed in bulk, see PrehashHeaders
+        hashCached = hash;
+        memcpy(vchHashedFields, BEGIN(nVersion), sizeof(vchHashedFields));
+        fHashCached = true;
     }
 
     int64_t GetBlockTime() const
@@ -762,6 +828,8 @@ public:
             const_cast<CBlock*>(this)->vtx.clear();
             const_cast<CBlock*>(this)->vchBlockSig.clear();
         }
+        if (fRead)
+            const_cast<CBlock*>(this)->vMerkleTree.clear();
     )
 
     void SetNull()
@@ -810,29 +878,34 @@ public:
         return maxTransactionTime;
     }
 
-    uint256 BuildMerkleTree() const
+    // Builds vMerkleTree, the txids and then each level above them, and returns the root. The txids and
+    // the lower levels are split over nThreads threads, 0 for as many as there are cores.
+    uint256 BuildMerkleTree(unsigned int nThreads = 0) const;
+
+    // Rehashes vtx[nIndex] and the nodes above it only, after a change to that txn (the coinbase, when
+    // mining). Builds the whole tree if there isn't one.
+    uint256 UpdateMerkleTree(unsigned int nIndex) const;
+
+    // vMerkleTree as last built, or built now if there isn't one for this many txns. Whoever changes
+    // vtx afterwards builds it again or updates it, as the miner does.
+    const std::vector<uint256>& GetMerkleTree() const
     {
-        vMerkleTree.clear();
-        BOOST_FOREACH(const CTransaction& tx, vtx)
-            vMerkleTree.push_back(tx.GetHash());
-        int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
-        {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
-            j += nSize;
-        }
-        return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
+        if (vMerkleTree.size() != GetMerkleTreeSize(vtx.size()))
+            BuildMerkleTree();
+        return vMerkleTree;
+    }
+
+    static unsigned int GetMerkleTreeSize(unsigned int nTxns)
+    {
+        unsigned int n = nTxns;
+        for (unsigned int nSize = nTxns; nSize > 1; nSize = (nSize + 1) / 2)
+            n += (nSize + 1) / 2;
+        return n;
     }
 
     std::vector<uint256> GetMerkleBranch(int nIndex) const
     {
-        if (vMerkleTree.empty())
-            BuildMerkleTree();
+        GetMerkleTree();
         std::vector<uint256> vMerkleBranch;
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
@@ -2035,6 +2108,7 @@ public:
     }
 
     // calculate the hash of a node in the merkle tree (at leaf level: the txid's themself)
+    // vTxid may be a whole tree laid out as CBlock::vMerkleTree, then the node is looked up
     uint256 CalcHash(int height, unsigned int pos, const std::vector<uint256> &vTxid);
 
     // recursive function that traverses tree nodes, storing the data as bits and hashes
@@ -2069,6 +2143,9 @@ public:
     // Construct a partial merkle tree from a list of transaction id's, and a mask that selects a subset of them
     CPartialMerkleTree(const std::vector<uint256> &vTxid, const std::vector<bool> &vMatch);
 
+    // The same from a block's whole merkle tree (CBlock::GetMerkleTree), without hashing any of it again
+    CPartialMerkleTree(const std::vector<uint256> &vMerkleTree, unsigned int nTxns, const std::vector<bool> &vMatch);
+
     CPartialMerkleTree();
 
     // extract the matching txid's represented by this partial merkle tree.
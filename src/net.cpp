@@ -367,6 +367,9 @@ uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
 
+uint64_t SecMsgNode::nQueuedTotal = 0;
+CCriticalSection SecMsgNode::cs_queuedTotal;
+
 CNode* FindNode(const CNetAddr& ip)
 {
     {
@@ -637,6 +640,14 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(smsgData.cs_smsg_net);
+        stats.nSmsgQueued = smsgData.vSendQueue.size();
+        stats.nSmsgQueuedBytes = smsgData.nQueuedBytes;
+        stats.nSmsgBytesSent = smsgData.nBytesSent;
+        stats.nSmsgBytesRecv = smsgData.nBytesRecv;
+    }
 }
 #undef X
 
@@ -1850,3 +1861,52 @@ uint64_t CNode::GetTotalBytesSent()
     LOCK(cs_totalBytesSent);
     return nTotalBytesSent;
 }
+
+
+bool SecMsgNode::QueueMessage(const char* pszCommand, const std::vector<uint8_t>& vchData, uint64_t nMaxQueue, uint64_t nMaxQueueTotal)
+{
+    // -- false if the message would take this peer's queue over nMaxQueue, or all queues over nMaxQueueTotal
+    if (nQueuedBytes + vchData.size() > nMaxQueue)
+        return false;
+
+    {
+        LOCK(cs_queuedTotal);
+        if (nQueuedTotal + vchData.size() > nMaxQueueTotal)
+            return false;
+        nQueuedTotal += vchData.size();
+    }
+
+    vSendQueue.push_back(std::make_pair(std::string(pszCommand), vchData));
+    nQueuedBytes += vchData.size();
+    return true;
+}
+
+void SecMsgNode::PopMessage()
+{
+    if (vSendQueue.empty())
+        return;
+
+    uint64_t nBytes = vSendQueue.front().second.size();
+    {
+        LOCK(cs_queuedTotal);
+        nQueuedTotal -= nBytes;
+    }
+    nQueuedBytes -= nBytes;
+    vSendQueue.pop_front();
+}
+
+void SecMsgNode::ClearQueue()
+{
+    {
+        LOCK(cs_queuedTotal);
+        nQueuedTotal -= nQueuedBytes;
+    }
+    vSendQueue.clear();
+    nQueuedBytes = 0;
+}
+
+uint64_t SecMsgNode::GetQueuedTotal()
+{
+    LOCK(cs_queuedTotal);
+    return nQueuedTotal;
+}
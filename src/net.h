@@ -202,6 +202,10 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    uint32_t nSmsgQueued;
+    uint64_t nSmsgQueuedBytes;
+    uint64_t nSmsgBytesSent;
+    uint64_t nSmsgBytesRecv;
 };
 
 
@@ -248,6 +252,42 @@ public:
 
 
 
+class SecMsgTokenBucket
+{
+// -- byte rate limiter for smsg relay
+public:
+    SecMsgTokenBucket()
+    {
+        nTokens         = 0;
+        nLastRefill     = 0;
+    };
+    
+    // -- add nRate bytes per second since the last refill, holding at most nBurst
+    void Refill(int64_t nTimeMicros, int64_t nRate, int64_t nBurst)
+    {
+        if (nLastRefill == 0
+            || nTimeMicros < nLastRefill)
+        {
+            if (nLastRefill == 0)
+                nTokens = nBurst;
+            nLastRefill = nTimeMicros;
+            return;
+        };
+        
+        nTokens += (nTimeMicros - nLastRefill) * nRate / 1000000;
+        if (nTokens > nBurst)
+            nTokens = nBurst;
+        nLastRefill = nTimeMicros;
+    };
+    
+    // -- a message may overdraw the bucket, the debt is repaid before the next is sent
+    bool Ready() const { return nTokens > 0; };
+    void Take(int64_t nBytes) { nTokens -= nBytes; };
+    
+    int64_t                     nTokens;
+    int64_t                     nLastRefill;    // microseconds
+};
+
 class SecMsgNode
 {
 public:
@@ -258,9 +298,18 @@ public:
         ignoreUntil     = 0;
         nWakeCounter    = 0;
         fEnabled        = false;
+        nQueuedBytes    = 0;
+        nBytesSent      = 0;
+        nBytesRecv      = 0;
     };
     
-    ~SecMsgNode() {};
+    ~SecMsgNode() { ClearQueue(); };
+    
+    // -- the queue functions are called with cs_smsg_net held, the destructor excepted
+    bool QueueMessage(const char* pszCommand, const std::vector<uint8_t>& vchData, uint64_t nMaxQueue, uint64_t nMaxQueueTotal);
+    void PopMessage();
+    void ClearQueue();
+    static uint64_t GetQueuedTotal();
     
     CCriticalSection            cs_smsg_net;
     int64_t                     lastSeen;
@@ -269,6 +318,16 @@ public:
     uint32_t                    nWakeCounter;
     bool                        fEnabled;
     
+    SecMsgTokenBucket           sendBucket;
+    std::deque<std::pair<std::string, std::vector<uint8_t> > > vSendQueue; // smsg messages waiting for bandwidth
+    uint64_t                    nQueuedBytes;
+    uint64_t                    nBytesSent;
+    uint64_t                    nBytesRecv;
+
+private:
+    // -- bytes waiting in the smsg queues of all peers
+    static CCriticalSection cs_queuedTotal;
+    static uint64_t nQueuedTotal;
 };
 
 /** Information about a peer */
@@ -0,0 +1,308 @@
+// Copyright (c) 2015 The Sumcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PREVECTOR_H
+#define PREVECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+
+/** A vector of trivially copyable elements that keeps up to N of them inline, allocating only when
+ *  it grows past that. Scripts and the values pushed by them are almost always short, so holding
+ *  them this way saves a heap allocation per CTxIn/CTxOut script.
+ *
+ *  The storage is a union of the inline elements and a pointer/capacity pair. _size counts the
+ *  elements while they are inline (<= N), and is size + N + 1 once they are on the heap.
+ *
+ *  Iterators are plain pointers, and are invalidated as a std::vector's are. Elements are moved with
+ *  memcpy/memmove and never constructed or destroyed, so T must be a POD type.
+ *
+ *  Packed, so a prevector<28, unsigned char> takes 32 bytes, as much as a std::vector on its own.
+ */
+#pragma pack(push, 1)
+template<unsigned int N, typename T>
+class prevector
+{
+public:
+    typedef uint32_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T value_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+private:
+    size_type _size;
+    union
+    {
+        char direct[sizeof(T) * N];
+        struct
+        {
+            size_type capacity;
+            char* indirect;
+        } heap;
+    } _union;
+
+    T* direct_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.direct) + pos; }
+    const T* direct_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.direct) + pos; }
+    T* indirect_ptr(difference_type pos) { return reinterpret_cast<T*>(_union.heap.indirect) + pos; }
+    const T* indirect_ptr(difference_type pos) const { return reinterpret_cast<const T*>(_union.heap.indirect) + pos; }
+    bool is_direct() const { return _size <= N; }
+
+    T* item_ptr(difference_type pos) { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
+    const T* item_ptr(difference_type pos) const { return is_direct() ? direct_ptr(pos) : indirect_ptr(pos); }
+
+    void change_capacity(size_type new_capacity)
+    {
+        if (new_capacity <= N)
+        {
+            if (!is_direct())
+            {
+                char* indirect = _union.heap.indirect;
+                _size -= N + 1;
+                memcpy(direct_ptr(0), indirect, _size * sizeof(T));
+                ::operator delete(indirect);
+            };
+            return;
+        };
+
+        char* indirect = static_cast<char*>(::operator new(((size_t)sizeof(T)) * new_capacity));
+        if (!is_direct())
+        {
+            memcpy(indirect, _union.heap.indirect, size() * sizeof(T));
+            ::operator delete(_union.heap.indirect);
+        } else
+        {
+            memcpy(indirect, direct_ptr(0), _size * sizeof(T));
+            _size += N + 1;
+        };
+        _union.heap.indirect = indirect;
+        _union.heap.capacity = new_capacity;
+    }
+
+    // size without reallocating, the caller has reserved room
+    void set_size(size_type new_size)
+    {
+        _size = is_direct() ? new_size : new_size + N + 1;
+    }
+
+    // room for n more elements, growing by half again so appending one at a time stays amortized O(1)
+    void grow_for(size_type n)
+    {
+        size_type new_size = size() + n;
+        if (new_size > capacity())
+            change_capacity(new_size + (new_size >> 1));
+    }
+
+public:
+    prevector() : _size(0) { }
+
+    explicit prevector(size_type n) : _size(0)
+    {
+        resize(n);
+    }
+
+    prevector(size_type n, const T& val) : _size(0)
+    {
+        change_capacity(n);
+        set_size(n);
+        T* p = item_ptr(0);
+        for (size_type i = 0; i < n; i++)
+            p[i] = val;
+    }
+
+    template<typename InputIterator>
+    prevector(InputIterator first, InputIterator last) : _size(0)
+    {
+        assign(first, last);
+    }
+
+    prevector(const prevector& other) : _size(0)
+    {
+        assign(other.begin(), other.end());
+    }
+
+    ~prevector()
+    {
+        if (!is_direct())
+            ::operator delete(_union.heap.indirect);
+    }
+
+    prevector& operator=(const prevector& other)
+    {
+        if (&other != this)
+            assign(other.begin(), other.end());
+        return *this;
+    }
+
+    size_type size() const { return is_direct() ? _size : _size - N - 1; }
+    bool empty() const { return size() == 0; }
+    size_type capacity() const { return is_direct() ? N : _union.heap.capacity; }
+
+    iterator begin() { return item_ptr(0); }
+    const_iterator begin() const { return item_ptr(0); }
+    iterator end() { return item_ptr(size()); }
+    const_iterator end() const { return item_ptr(size()); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+    T& operator[](size_type pos) { return *item_ptr(pos); }
+    const T& operator[](size_type pos) const { return *item_ptr(pos); }
+    T& front() { return *item_ptr(0); }
+    const T& front() const { return *item_ptr(0); }
+    T& back() { return *item_ptr(size() - 1); }
+    const T& back() const { return *item_ptr(size() - 1); }
+    T* data() { return item_ptr(0); }
+    const T* data() const { return item_ptr(0); }
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last)
+    {
+        size_type n = std::distance(first, last);
+        if (capacity() < n)
+            change_capacity(n);
+        set_size(n);
+        T* p = item_ptr(0);
+        for (; first != last; ++first)
+            *p++ = *first;
+    }
+
+    void reserve(size_type new_capacity)
+    {
+        if (new_capacity > capacity())
+            change_capacity(new_capacity);
+    }
+
+    void shrink_to_fit()
+    {
+        change_capacity(size());
+    }
+
+    void resize(size_type new_size)
+    {
+        size_type old_size = size();
+        if (new_size > capacity())
+            change_capacity(new_size);
+        set_size(new_size);
+        if (new_size > old_size)
+            memset(item_ptr(old_size), 0, (new_size - old_size) * sizeof(T));
+    }
+
+    void clear()
+    {
+        resize(0);
+    }
+
+    void push_back(const T& value)
+    {
+        T v = value; // value may live in this prevector
+        grow_for(1);
+        size_type n = size();
+        set_size(n + 1);
+        *item_ptr(n) = v;
+    }
+
+    void pop_back()
+    {
+        set_size(size() - 1);
+    }
+
+    iterator insert(iterator pos, const T& value)
+    {
+        T v = value;
+        difference_type p = pos - begin();
+        size_type n = size();
+        grow_for(1);
+        T* ptr = item_ptr(p);
+        memmove(ptr + 1, ptr, (n - p) * sizeof(T));
+        set_size(n + 1);
+        *ptr = v;
+        return ptr;
+    }
+
+    void insert(iterator pos, size_type count, const T& value)
+    {
+        T v = value;
+        difference_type p = pos - begin();
+        size_type n = size();
+        grow_for(count);
+        T* ptr = item_ptr(p);
+        memmove(ptr + count, ptr, (n - p) * sizeof(T));
+        set_size(n + count);
+        for (size_type i = 0; i < count; i++)
+            ptr[i] = v;
+    }
+
+    template<typename InputIterator>
+    void insert(iterator pos, InputIterator first, InputIterator last)
+    {
+        // the range may not point into this prevector
+        difference_type p = pos - begin();
+        size_type count = std::distance(first, last);
+        size_type n = size();
+        grow_for(count);
+        T* ptr = item_ptr(p);
+        memmove(ptr + count, ptr, (n - p) * sizeof(T));
+        set_size(n + count);
+        for (; first != last; ++first)
+            *ptr++ = *first;
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        memmove(first, last, (end() - last) * sizeof(T));
+        set_size(size() - (last - first));
+        return first;
+    }
+
+    void swap(prevector& other)
+    {
+        char tmp[sizeof(_union)];
+        memcpy(tmp, &_union, sizeof(_union));
+        memcpy(&_union, &other._union, sizeof(_union));
+        memcpy(&other._union, tmp, sizeof(_union));
+        std::swap(_size, other._size);
+    }
+
+    bool operator==(const prevector& other) const
+    {
+        return size() == other.size() && memcmp(item_ptr(0), other.item_ptr(0), size() * sizeof(T)) == 0;
+    }
+
+    bool operator!=(const prevector& other) const
+    {
+        return !(*this == other);
+    }
+
+    bool operator<(const prevector& other) const
+    {
+        // lexicographic, as std::vector
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+
+    size_t allocated_memory() const
+    {
+        return is_direct() ? 0 : ((size_t)sizeof(T)) * _union.heap.capacity;
+    }
+};
+#pragma pack(pop)
+
+#endif // PREVECTOR_H
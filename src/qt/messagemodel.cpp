@@ -22,6 +22,9 @@
 
 Q_DECLARE_METATYPE(std::vector<unsigned char>);
 
+/* Messages loaded from each folder at a time, more are fetched as the view scrolls */
+static const uint32_t MESSAGE_PAGE_SIZE = 200;
+
 QList<QString> ambiguous; /**< Specifies Ambiguous addresses */
 
 const QString MessageModel::Sent = "S";
@@ -41,133 +44,171 @@ public:
     QList<MessageTableEntry> cachedMessageTable;
     MessageModel *parent;
 
+    // -- number of index entries read from each folder and if there could be more
+    uint32_t nInboxLoaded;
+    uint32_t nOutboxLoaded;
+    bool fInboxMore;
+    bool fOutboxMore;
+
     MessageTablePriv(MessageModel *parent):
-        parent(parent) {}
+        parent(parent), nInboxLoaded(0), nOutboxLoaded(0), fInboxMore(false), fOutboxMore(false) {}
 
     void refreshMessageTable()
     {
         cachedMessageTable.clear();
+        nInboxLoaded = nOutboxLoaded = 0;
+        fInboxMore = fOutboxMore = false;
 
         if (parent->getWalletModel()->getEncryptionStatus() == WalletModel::Locked)
             // -- messages are stored encrypted, can't load them without the private keys
             return;
 
+        loadMessages(true);
+
+        qSort(cachedMessageTable.begin(), cachedMessageTable.end(), MessageTableEntryLessThan());
+    }
+
+    void loadMessages(bool append)
+    {
+        // -- load the next page of each folder, newest first
+        LOCK2(pwalletMain->cs_wallet, cs_smsgDB);
+
+        SecMsgDB dbSmsg;
+
+        if (!dbSmsg.Open("cr+"))
+            //throw runtime_error("Could not open DB.");
+            return;
+
+        loadPage(dbSmsg, "im", nInboxLoaded, fInboxMore, append);
+        loadPage(dbSmsg, "sm", nOutboxLoaded, fOutboxMore, append);
+    }
+
+    void loadPage(SecMsgDB& dbSmsg, const std::string& sPrefix, uint32_t& nLoaded, bool& fMore, bool append)
+    {
+        // -- only the rows of the page are read and decrypted
+        std::vector<std::vector<unsigned char> > vKeys;
+        if (!dbSmsg.ListSmesg(sPrefix, "", false, 0, nLoaded, MESSAGE_PAGE_SIZE, true, vKeys))
         {
-            LOCK2(pwalletMain->cs_wallet, cs_smsgDB);
+            fMore = false;
+            return;
+        };
 
-            SecMsgDB dbSmsg;
+        nLoaded += vKeys.size();
+        fMore = vKeys.size() == MESSAGE_PAGE_SIZE;
 
-            if (!dbSmsg.Open("cr+"))
-                //throw runtime_error("Could not open DB.");
-                return;
+        unsigned char chKey[18];
+        SecMsgStored smsgStored;
 
-            unsigned char chKey[18];
-            std::vector<unsigned char> vchKey;
-            vchKey.resize(18);
+        for (size_t i = 0; i < vKeys.size(); ++i)
+        {
+            memcpy(chKey, &vKeys[i][0], 18);
+            if (!dbSmsg.ReadSmesg(chKey, smsgStored))
+                continue;
+
+            if (sPrefix == "im")
+                addInboxMessage(vKeys[i], smsgStored, append);
+            else
+                addOutboxMessage(vKeys[i], smsgStored, append);
+        };
+    }
 
-            SecMsgStored smsgStored;
-            MessageData msg;
-            QString label;
-            QString labelTo;
-            QString groupPrefix = QString::fromStdString("group_");
-            QDateTime sent_datetime;
-            QDateTime received_datetime;
+    void addInboxMessage(const std::vector<unsigned char>& vchKey, SecMsgStored& smsgStored, bool append)
+    {
+        MessageData msg;
+        QString label;
+        QString labelTo;
+        QString groupPrefix = QString::fromStdString("group_");
+        QDateTime sent_datetime;
+        QDateTime received_datetime;
 
-            std::string sPrefix("im");
-            leveldb::Iterator* it = dbSmsg.pdb->NewIterator(leveldb::ReadOptions());
-            while (dbSmsg.NextSmesg(it, sPrefix, chKey, smsgStored))
-            {
-                uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
-                if (SecureMsgDecrypt(false, smsgStored.sAddrTo, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
-                {
-                    if (fDebugSmsg)
-                        LogPrintf("refreshMessageTable: secureMsgDecrypt succesful\n");
-
-                    label = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(msg.sFromAddress));
-                    labelTo = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(smsgStored.sAddrTo)); //returns "" if not found.
-
-                    if (fDebugSmsg)
-                    {
-                        LogPrintf("refreshMessageTable: addressTo: %s\n", smsgStored.sAddrTo);
-                        LogPrintf("refreshMessageTable: addressFrom: %s\n", msg.sFromAddress);
-                    }
-
-                    std::string publicKey;
-                    int duplicateMessageFromOutBox = SecureMsgGetLocalPublicKey(msg.sFromAddress, publicKey);
-
-                    if((labelTo.startsWith(groupPrefix)) && (duplicateMessageFromOutBox == 0)) {
-                        //a message has been received to our group but it was one of our own. Just don't process this at all.
-                        if(fDebugSmsg)
-                            LogPrintf("refreshMessageTable: groupchat message, but duplicate. Label: %s, LabelTo: %s, SecureMsgGetLocalPublicKey: %i\n", label.toStdString(), labelTo.toStdString(), duplicateMessageFromOutBox);
-                        continue;
-                    } else if(labelTo.startsWith(groupPrefix) && (duplicateMessageFromOutBox == 4)) {
-                        //a message has been received to our group and it was NOT one of our own. Yet retrieving the public key of it was succesful.
-                        if(fDebugSmsg)
-                            LogPrintf("refreshMessageTable: grouchat message and it was not a duplicate. Label: %s, LabelTo: %s, SecureMsgGetLocalPublicKey: %i\n", label.toStdString(), labelTo.toStdString(), duplicateMessageFromOutBox);
-                    } else {
-                        if(fDebugSmsg)
-                           LogPrintf("refreshMessageTable: not groupchat. Label: %s, LabelTo: %s, SecureMsgGetLocalPublicKey: %i\n", label.toStdString(), labelTo.toStdString(), duplicateMessageFromOutBox);
-                    }
-
-                    sent_datetime    .setTime_t(msg.timestamp);
-                    received_datetime.setTime_t(smsgStored.timeReceived);
-
-                    memcpy(&vchKey[0], chKey, 18);
-
-                    addMessageEntry(MessageTableEntry(vchKey,
-                                                      MessageTableEntry::Received,
-                                                      label,
-                                                      labelTo,
-                                                      QString::fromStdString(smsgStored.sAddrTo),
-                                                      QString::fromStdString(msg.sFromAddress),
-                                                      sent_datetime,
-                                                      received_datetime,
-                                                      !(smsgStored.status & SMSG_MASK_UNREAD),
-                                                      (char*)&msg.vchMessage[0]),
-                                    true);
-                }
-            };
+        uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+        if (SecureMsgDecrypt(false, smsgStored.sAddrTo, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
+        {
+            if (fDebugSmsg)
+                LogPrintf("refreshMessageTable: secureMsgDecrypt succesful\n");
 
-            delete it;
+            label = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(msg.sFromAddress));
+            labelTo = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(smsgStored.sAddrTo)); //returns "" if not found.
 
-            sPrefix = "sm";
-            it = dbSmsg.pdb->NewIterator(leveldb::ReadOptions());
-            while (dbSmsg.NextSmesg(it, sPrefix, chKey, smsgStored))
+            if (fDebugSmsg)
             {
-                uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
-                if (SecureMsgDecrypt(false, smsgStored.sAddrOutbox, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
-                {
-                    label = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(smsgStored.sAddrTo));
-                    labelTo = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(msg.sFromAddress));
-
-                    if(fDebugSmsg)
-                        LogPrintf("refreshMessageTable: sendMessage: label: %s, labelTo: %s\n", label.toStdString(), labelTo.toStdString());
-
-                    sent_datetime    .setTime_t(msg.timestamp);
-                    received_datetime.setTime_t(smsgStored.timeReceived);
-
-                    memcpy(&vchKey[0], chKey, 18);
-
-                    addMessageEntry(MessageTableEntry(vchKey,
-                                                      MessageTableEntry::Sent,
-                                                      label,
-                                                      labelTo,
-                                                      QString::fromStdString(smsgStored.sAddrTo),
-                                                      QString::fromStdString(msg.sFromAddress),
-                                                      sent_datetime,
-                                                      received_datetime,
-                                                      !(smsgStored.status & SMSG_MASK_UNREAD),
-                                                      (char*)&msg.vchMessage[0]),
-                                    true);
-                }
-            };
+                LogPrintf("refreshMessageTable: addressTo: %s\n", smsgStored.sAddrTo);
+                LogPrintf("refreshMessageTable: addressFrom: %s\n", msg.sFromAddress);
+            }
+
+            std::string publicKey;
+            int duplicateMessageFromOutBox = SecureMsgGetLocalPublicKey(msg.sFromAddress, publicKey);
 
-            delete it;
+            if((labelTo.startsWith(groupPrefix)) && (duplicateMessageFromOutBox == 0)) {
+                //a message has been received to our group but it was one of our own. Just don't process this at all.
+                if(fDebugSmsg)
+                    LogPrintf("refreshMessageTable: groupchat message, but duplicate. Label: %s, LabelTo: %s, SecureMsgGetLocalPublicKey: %i\n", label.toStdString(), labelTo.toStdString(), duplicateMessageFromOutBox);
+                return;
+            } else if(labelTo.startsWith(groupPrefix) && (duplicateMessageFromOutBox == 4)) {
+                //a message has been received to our group and it was NOT one of our own. Yet retrieving the public key of it was succesful.
+                if(fDebugSmsg)
+                    LogPrintf("refreshMessageTable: grouchat message and it was not a duplicate. Label: %s, LabelTo: %s, SecureMsgGetLocalPublicKey: %i\n", label.toStdString(), labelTo.toStdString(), duplicateMessageFromOutBox);
+            } else {
+                if(fDebugSmsg)
+                   LogPrintf("refreshMessageTable: not groupchat. Label: %s, LabelTo: %s, SecureMsgGetLocalPublicKey: %i\n", label.toStdString(), labelTo.toStdString(), duplicateMessageFromOutBox);
+            }
+
+            sent_datetime    .setTime_t(msg.timestamp);
+            received_datetime.setTime_t(smsgStored.timeReceived);
+
+            addMessageEntry(MessageTableEntry(vchKey,
+                                              MessageTableEntry::Received,
+                                              label,
+                                              labelTo,
+                                              QString::fromStdString(smsgStored.sAddrTo),
+                                              QString::fromStdString(msg.sFromAddress),
+                                              sent_datetime,
+                                              received_datetime,
+                                              !(smsgStored.status & SMSG_MASK_UNREAD),
+                                              (char*)&msg.vchMessage[0]),
+                            append);
+        }
+    }
+
+    void addOutboxMessage(const std::vector<unsigned char>& vchKey, SecMsgStored& smsgStored, bool append)
+    {
+        MessageData msg;
+        QString label;
+        QString labelTo;
+        QDateTime sent_datetime;
+        QDateTime received_datetime;
+
+        uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+        if (SecureMsgDecrypt(false, smsgStored.sAddrOutbox, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
+        {
+            label = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(smsgStored.sAddrTo));
+            labelTo = parent->getWalletModel()->getAddressTableModel()->labelForAddress(QString::fromStdString(msg.sFromAddress));
+
+            if(fDebugSmsg)
+                LogPrintf("refreshMessageTable: sendMessage: label: %s, labelTo: %s\n", label.toStdString(), labelTo.toStdString());
+
+            sent_datetime    .setTime_t(msg.timestamp);
+            received_datetime.setTime_t(smsgStored.timeReceived);
+
+            addMessageEntry(MessageTableEntry(vchKey,
+                                              MessageTableEntry::Sent,
+                                              label,
+                                              labelTo,
+                                              QString::fromStdString(smsgStored.sAddrTo),
+                                              QString::fromStdString(msg.sFromAddress),
+                                              sent_datetime,
+                                              received_datetime,
+                                              !(smsgStored.status & SMSG_MASK_UNREAD),
+                                              (char*)&msg.vchMessage[0]),
+                            append);
         }
     }
 
     void newMessage(const SecMsgStored& inboxHdr)
     {
+        // -- newest first, the next page starts one further along
+        nInboxLoaded++;
+
         // we have to copy it, because it doesn't like constants going into Decrypt
         SecMsgStored smsgStored = inboxHdr;
         MessageData msg;
@@ -233,6 +274,7 @@ public:
 
     void newOutboxMessage(const SecMsgStored& outboxHdr)
     {
+        nOutboxLoaded++;
 
         SecMsgStored smsgStored = outboxHdr;
         MessageData msg;
@@ -528,6 +570,10 @@ bool MessageModel::removeRows(int row, int count, const QModelIndex & parent)
             return false;
 
         dbSmsg.EraseSmesg(&rec->chKey[0]);
+
+        uint32_t& nLoaded = rec->type == MessageTableEntry::Sent ? priv->nOutboxLoaded : priv->nInboxLoaded;
+        if (nLoaded > 0)
+            nLoaded--;
     }
 
     beginRemoveRows(parent, row, row);
@@ -537,6 +583,23 @@ bool MessageModel::removeRows(int row, int count, const QModelIndex & parent)
     return true;
 }
 
+bool MessageModel::canFetchMore(const QModelIndex & parent) const
+{
+    if (parent.isValid())
+        return false;
+
+    return priv->fInboxMore || priv->fOutboxMore;
+}
+
+void MessageModel::fetchMore(const QModelIndex & parent)
+{
+    if (parent.isValid()
+        || walletModel->getEncryptionStatus() == WalletModel::Locked)
+        return;
+
+    priv->loadMessages(false);
+}
+
 int MessageModel::rowCount(const QModelIndex &parent) const
 {
     return priv->cachedMessageTable.length();
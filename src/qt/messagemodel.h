@@ -145,6 +145,8 @@ public:
     QModelIndex index(int row, int column, const QModelIndex & parent = QModelIndex()) const;
     bool removeRows(int row, int count, const QModelIndex & parent = QModelIndex());
     Qt::ItemFlags flags(const QModelIndex & index) const;
+    bool canFetchMore(const QModelIndex & parent) const;
+    void fetchMore(const QModelIndex & parent);
     /*@}*/
 
 
@@ -2215,7 +2215,7 @@ QVariantMap SumcoinBridge::extKeySetDefault(QString extKeyID)
         // TODO: necessary?
         ExtKeyAccountMap::iterator mi = pwalletMain->mapExtAccounts.find(idNewDefault);
         if (mi == pwalletMain->mapExtAccounts.end())
-            pwalletMain->mapExtAccounts[idNewDefault] = sea;
+            pwalletMain->ExtKeyAddAccountToMaps(idNewDefault, sea);
         else
             delete sea;
 
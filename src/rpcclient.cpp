@@ -141,6 +141,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendalert", 6 },
     { "sendmany", 1 },
     { "sendmany", 2 },
+    { "sendbulk", 0 },
+    { "sendbulk", 1 },
     { "reservebalance", 0 },
     { "reservebalance", 1 },
     { "addmultisigaddress", 0 },
@@ -171,6 +173,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "checkkernel", 0 },
     { "checkkernel", 1 },
     { "submitblock", 1 },
+    { "smsgscanchain", 0 },
+    { "smsginbox", 1 },
+    { "smsginbox", 2 },
+    { "smsginbox", 3 },
+    { "smsgoutbox", 1 },
+    { "smsgoutbox", 2 },
+    { "smsgoutbox", 3 },
 };
 
 class CRPCConvertTable
@@ -1102,7 +1102,7 @@ Value extkey(const Array &params, bool fHelp)
             ExtKeyAccountMap::iterator mi = pwalletMain->mapExtAccounts.find(idNewDefault);
             if (mi == pwalletMain->mapExtAccounts.end())
             {
-                pwalletMain->mapExtAccounts[idNewDefault] = sea;
+                pwalletMain->ExtKeyAddAccountToMaps(idNewDefault, sea);
             } else
             {
                 delete sea;
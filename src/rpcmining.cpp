@@ -362,11 +362,14 @@ Value getworkex(const Array& params, bool fHelp)
         pblock->nNonce = pdata->nNonce;
 
         if(coinbase.size() == 0)
+        {
+            // -- vtx[0] may have been read from a submitted coinbase before, with its hash cached
             pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        else
+            pblock->vtx[0].UpdateHash();
+        } else
             CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0]; // FIXME - HACK!
 
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->hashMerkleRoot = pblock->UpdateMerkleTree(0);
 
         return CheckWork(pblock, *pwalletMain, *pMiningKey);
     }
@@ -485,7 +488,7 @@ Value getwork(const Array& params, bool fHelp)
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
         pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        pblock->hashMerkleRoot = pblock->UpdateMerkleTree(0);
 
         return CheckWork(pblock, *pwalletMain, reservekey);
     }
@@ -582,9 +585,10 @@ Value getblocktemplate(const Array& params, bool fHelp)
     map<uint256, int64_t> setTxIndex;
     int i = 0;
     CTxDB txdb("r");
+    const std::vector<uint256>& vMerkleTree = pblock->GetMerkleTree(); // txids first
     BOOST_FOREACH (CTransaction& tx, pblock->vtx)
     {
-        uint256 txHash = tx.GetHash();
+        uint256 txHash = vMerkleTree[i];
         setTxIndex[txHash] = i++;
 
         if (tx.IsCoinBase() || tx.IsCoinStake())
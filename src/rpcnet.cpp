@@ -90,6 +90,10 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("inbound", stats.fInbound));
         obj.push_back(Pair("chainheight", stats.nChainHeight));
         obj.push_back(Pair("banscore", stats.nMisbehavior));
+        obj.push_back(Pair("smsgqueued", (int64_t)stats.nSmsgQueued));
+        obj.push_back(Pair("smsgqueuedbytes", (int64_t)stats.nSmsgQueuedBytes));
+        obj.push_back(Pair("smsgbytessent", (int64_t)stats.nSmsgBytesSent));
+        obj.push_back(Pair("smsgbytesrecv", (int64_t)stats.nSmsgBytesRecv));
 
         ret.push_back(obj);
     }
@@ -495,8 +495,6 @@ Value signrawtransaction(const Array& params, bool fHelp)
         }
     }
 
-    const CKeyStore& keystore = (fGivenKeys ? tempKeystore : *pwalletMain);
-
     int nHashType = SIGHASH_ALL;
     if (params.size() > 3 && params[3].type() != null_type)
     {
@@ -518,23 +516,39 @@ Value signrawtransaction(const Array& params, bool fHelp)
 
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
-    // Sign what we can:
+    // Sign what we can, all inputs at once:
+    std::vector<CScript> vFromPubKey(mergedTx.vin.size());
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
         CTxIn& txin = mergedTx.vin[i];
         if (mapPrevOut.count(txin.prevout) == 0)
-        {
-            fComplete = false;
             continue;
-        };
-        const CScript& prevPubKey = mapPrevOut[txin.prevout];
 
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
+            vFromPubKey[i] = mapPrevOut[txin.prevout];
+    };
+
+    // -- the signing threads can't take cs_wallet, held here, so they sign from a copy of the wallet's keys
+    CBasicKeyStore walletKeystore;
+    if (!fGivenKeys)
+    {
+        for (unsigned int i = 0; i < vFromPubKey.size(); i++)
+            if (!vFromPubKey[i].empty())
+                CopySigningKeys(*pwalletMain, vFromPubKey[i], walletKeystore);
+    };
+    SignSignatures(fGivenKeys ? tempKeystore : walletKeystore, vFromPubKey, mergedTx, nHashType);
+
+    for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
+    {
+        CTxIn& txin = mergedTx.vin[i];
+        if (mapPrevOut.count(txin.prevout) == 0)
         {
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
-        }
+            fComplete = false;
+            continue;
+        };
+        const CScript& prevPubKey = mapPrevOut[txin.prevout];
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CTransaction& txv, txVariants)
@@ -308,6 +308,7 @@ static const CRPCCommand vRPCCommands[] =
     { "move",                   &movecmd,                false,     false,     false },
     { "sendfrom",               &sendfrom,               false,     false,     false },
     { "sendmany",               &sendmany,               false,     false,     false },
+    { "sendbulk",               &sendbulk,               false,     false,     false },
     { "addmultisigaddress",     &addmultisigaddress,     false,     false,     true  },
     { "createmultisig",         &createmultisig,         true,      false,     true  },
     { "addredeemscript",        &addredeemscript,        false,     false,     false },
@@ -358,6 +359,7 @@ static const CRPCCommand vRPCCommands[] =
     { "importstealthaddress",   &importstealthaddress,   false,     false,     false },
     { "sendtostealthaddress",   &sendtostealthaddress,   false,     false,     false },
     { "clearwallettransactions",&clearwallettransactions,false,     false,     false },
+    { "compactwallet",          &compactwallet,          false,     false,     false },
     { "scanforalltxns",         &scanforalltxns,         false,     false,     false },
     { "scanforstealthtxns",     &scanforstealthtxns,     false,     false,     false },
     
@@ -375,7 +377,7 @@ static const CRPCCommand vRPCCommands[] =
     { "smsgdisable",            &smsgdisable,            false,     false,     false },
     { "smsglocalkeys",          &smsglocalkeys,          false,     false,     false },
     { "smsgoptions",            &smsgoptions,            false,     false,     false },
-    { "smsgscanchain",          &smsgscanchain,          false,     false,     false },
+    { "smsgscanchain",          &smsgscanchain,          false,     true,      false },
     { "smsgscanbuckets",        &smsgscanbuckets,        false,     false,     false },
     { "smsgaddkey",             &smsgaddkey,             false,     false,     false },
     { "smsggetpubkey",          &smsggetpubkey,          false,     false,     false },
@@ -87,6 +87,10 @@ Value smsgoptions(const Array& params, bool fHelp)
 
         if (fDescriptions)
             result.push_back(Pair("scanIncoming", "Scan incoming blocks for public keys."));
+        result.push_back(Pair("option", std::string("compressDict = ") + (smsgOptions.fCompressDict ? "true" : "false")));
+
+        if (fDescriptions)
+            result.push_back(Pair("compressDict", "Compress sent messages with the shared dictionary, recipients must run a client that supports it."));
 
         result.push_back(Pair("result", "Success."));
     } else
@@ -141,6 +145,18 @@ Value smsgoptions(const Array& params, bool fHelp)
             };
             result.push_back(Pair("set option", std::string("scanIncoming = ") + (smsgOptions.fScanIncoming ? "true" : "false")));
         } else
+        if (optname == "compressdict")
+        {
+            if (GetStringBool(value, fValue))
+            {
+                smsgOptions.fCompressDict = fValue;
+            } else
+            {
+                result.push_back(Pair("result", "Unknown value."));
+                return result;
+            };
+            result.push_back(Pair("set option", std::string("compressDict = ") + (smsgOptions.fCompressDict ? "true" : "false")));
+        } else
         {
             result.push_back(Pair("result", "Option not found."));
             return result;
@@ -374,16 +390,19 @@ Value smsglocalkeys(const Array& params, bool fHelp)
 
 Value smsgscanchain(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw std::runtime_error(
-            "smsgscanchain \n"
-            "Look for public keys in the block chain.");
+            "smsgscanchain [fromgenesis=false]\n"
+            "Look for public keys in the block chain.\n"
+            "Continues from the last scanned block unless fromgenesis is true.");
 
     if (!fSecMsgEnabled)
         throw std::runtime_error("Secure messaging is disabled.");
 
+    bool fFromGenesis = params.size() > 0 ? params[0].get_bool() : false;
+
     Object result;
-    if (!SecureMsgScanBlockChain())
+    if (!SecureMsgScanBlockChain(!fFromGenesis))
     {
         result.push_back(Pair("result", "Scan Chain Failed."));
     } else
@@ -589,12 +608,44 @@ Value smsgsendanon(const Array& params, bool fHelp)
     return result;
 }
 
+static void GetPageParams(const Array& params, uint32_t& nOffset, uint32_t& nLimit, int64_t& nSince, std::string& sAddress)
+{
+    // -- [offset] [limit] [since] [address] following the mode parameter
+    nOffset = 0;
+    nLimit = 0;
+    nSince = 0;
+    sAddress = "";
+
+    if (params.size() > 1)
+    {
+        if (params[1].get_int() < 0)
+            throw std::runtime_error("offset must be positive.");
+        nOffset = params[1].get_int();
+    };
+
+    if (params.size() > 2)
+    {
+        if (params[2].get_int() < 0)
+            throw std::runtime_error("limit must be positive.");
+        nLimit = params[2].get_int();
+    };
+
+    if (params.size() > 3)
+        nSince = params[3].get_int64();
+
+    if (params.size() > 4)
+        sAddress = params[4].get_str();
+};
+
 Value smsginbox(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() > 1) // defaults to read
+    if (fHelp || params.size() > 5) // defaults to read
         throw std::runtime_error(
-            "smsginbox [all|unread|clear]\n"
-            "Decrypt and display all received messages.\n"
+            "smsginbox [all|unread|headers|clear] [offset=0] [limit=0] [since=0] [address]\n"
+            "Decrypt and display received messages.\n"
+            "headers lists sender and times, cached headers are listed without decrypting, others decrypt the message.\n"
+            "offset and limit page through messages sent at or after since, oldest first.\n"
+            "limit 0 returns all, address filters on the receiving address.\n"
             "Warning: clear will delete all messages.");
 
     if (!fSecMsgEnabled)
@@ -609,13 +660,13 @@ Value smsginbox(const Array& params, bool fHelp)
         mode = params[0].get_str();
     };
 
+    uint32_t nOffset, nLimit;
+    int64_t nSince;
+    std::string sAddress;
+    GetPageParams(params, nOffset, nLimit, nSince, sAddress);
 
     Object result;
 
-    std::vector<unsigned char> vchKey;
-    vchKey.resize(16);
-    memset(&vchKey[0], 0, 16);
-
     {
         LOCK(cs_smsgDB);
 
@@ -632,12 +683,13 @@ Value smsginbox(const Array& params, bool fHelp)
 
         if (mode == "clear")
         {
+            SecMsgStored smsgStored;
             dbInbox.TxnBegin();
 
             leveldb::Iterator* it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
-            while (dbInbox.NextSmesgKey(it, sPrefix, chKey))
+            while (dbInbox.NextSmesg(it, sPrefix, chKey, smsgStored))
             {
-                dbInbox.EraseSmesg(chKey);
+                dbInbox.EraseSmesg(chKey, &smsgStored);
                 nMessages++;
             };
             delete it;
@@ -646,23 +698,48 @@ Value smsginbox(const Array& params, bool fHelp)
             result.push_back(Pair("result", strprintf("Deleted %u messages.", nMessages)));
         } else
         if (mode == "all"
-            || mode == "unread")
+            || mode == "unread"
+            || mode == "headers")
         {
             int fCheckReadStatus = mode == "unread" ? 1 : 0;
+            bool fHeaders = mode == "headers";
 
             SecMsgStored smsgStored;
             MessageData msg;
 
+            std::vector<std::vector<uint8_t> > vKeys;
+            if (!dbInbox.ListSmesg(sPrefix, sAddress, fCheckReadStatus, nSince, nOffset, nLimit, false, vKeys))
+                throw std::runtime_error("Could not read index.");
+
             dbInbox.TxnBegin();
 
-            leveldb::Iterator* it = dbInbox.pdb->NewIterator(leveldb::ReadOptions());
             Array messageList;
 
-            while (dbInbox.NextSmesg(it, sPrefix, chKey, smsgStored))
+            for (std::vector<std::vector<uint8_t> >::iterator it = vKeys.begin(); it != vKeys.end(); ++it)
             {
-                if (fCheckReadStatus
-                    && !(smsgStored.status & SMSG_MASK_UNREAD))
+                memcpy(chKey, &(*it)[0], 18);
+                if (!dbInbox.ReadSmesg(chKey, smsgStored))
+                    continue;
+
+                if (fHeaders)
+                {
+                    Object objM;
+                    if (SecureMsgReadHeader(*it, smsgStored, msg) == 0)
+                    {
+                        objM.push_back(Pair("success", "1"));
+                        objM.push_back(Pair("received", getTimeString(smsgStored.timeReceived, cbuf, sizeof(cbuf))));
+                        objM.push_back(Pair("sent", getTimeString(msg.timestamp, cbuf, sizeof(cbuf))));
+                        objM.push_back(Pair("from", msg.sFromAddress));
+                        objM.push_back(Pair("to", smsgStored.sAddrTo));
+                        objM.push_back(Pair("read", !(smsgStored.status & SMSG_MASK_UNREAD)));
+                    } else
+                    {
+                        objM.push_back(Pair("success", "0"));
+                    };
+                    messageList.push_back(objM);
+                    nMessages++;
                     continue;
+                };
 
                 uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
                 if (SecureMsgDecrypt(false, smsgStored.sAddrTo, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
@@ -690,7 +767,6 @@ Value smsginbox(const Array& params, bool fHelp)
                 };
                 nMessages++;
             };
-            delete it;
             dbInbox.TxnCommit();
 
 
@@ -700,7 +776,7 @@ Value smsginbox(const Array& params, bool fHelp)
         } else
         {
             result.push_back(Pair("result", "Unknown Mode."));
-            result.push_back(Pair("expected", "[all|unread|clear]."));
+            result.push_back(Pair("expected", "[all|unread|headers|clear]."));
         };
     }
 
@@ -709,10 +785,13 @@ Value smsginbox(const Array& params, bool fHelp)
 
 Value smsgoutbox(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() > 1) // defaults to read
+    if (fHelp || params.size() > 5) // defaults to read
         throw std::runtime_error(
-            "smsgoutbox [all|clear]\n"
-            "Decrypt and display all sent messages.\n"
+            "smsgoutbox [all|headers|clear] [offset=0] [limit=0] [since=0] [address]\n"
+            "Decrypt and display sent messages.\n"
+            "headers lists sender and times, cached headers are listed without decrypting, others decrypt the message.\n"
+            "offset and limit page through messages sent at or after since, oldest first.\n"
+            "limit 0 returns all, address filters on the destination address.\n"
             "Warning: clear will delete all sent messages.");
 
     if (!fSecMsgEnabled)
@@ -727,6 +806,10 @@ Value smsgoutbox(const Array& params, bool fHelp)
         mode = params[0].get_str();
     }
 
+    uint32_t nOffset, nLimit;
+    int64_t nSince;
+    std::string sAddress;
+    GetPageParams(params, nOffset, nLimit, nSince, sAddress);
 
     Object result;
 
@@ -747,12 +830,13 @@ Value smsgoutbox(const Array& params, bool fHelp)
 
         if (mode == "clear")
         {
+            SecMsgStored smsgStored;
             dbOutbox.TxnBegin();
 
             leveldb::Iterator* it = dbOutbox.pdb->NewIterator(leveldb::ReadOptions());
-            while (dbOutbox.NextSmesgKey(it, sPrefix, chKey))
+            while (dbOutbox.NextSmesg(it, sPrefix, chKey, smsgStored))
             {
-                dbOutbox.EraseSmesg(chKey);
+                dbOutbox.EraseSmesg(chKey, &smsgStored);
                 nMessages++;
             };
             delete it;
@@ -761,26 +845,45 @@ Value smsgoutbox(const Array& params, bool fHelp)
 
             result.push_back(Pair("result", strprintf("Deleted %u messages.", nMessages)));
         } else
-        if (mode == "all")
+        if (mode == "all"
+            || mode == "headers")
         {
+            bool fHeaders = mode == "headers";
+
             SecMsgStored smsgStored;
             MessageData msg;
-            leveldb::Iterator* it = dbOutbox.pdb->NewIterator(leveldb::ReadOptions());
+
+            std::vector<std::vector<uint8_t> > vKeys;
+            if (!dbOutbox.ListSmesg(sPrefix, sAddress, false, nSince, nOffset, nLimit, false, vKeys))
+                throw std::runtime_error("Could not read index.");
 
             Array messageList;
 
-            while (dbOutbox.NextSmesg(it, sPrefix, chKey, smsgStored))
+            for (std::vector<std::vector<uint8_t> >::iterator it = vKeys.begin(); it != vKeys.end(); ++it)
             {
-                uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+                memcpy(chKey, &(*it)[0], 18);
+                if (!dbOutbox.ReadSmesg(chKey, smsgStored))
+                    continue;
 
-                if (SecureMsgDecrypt(false, smsgStored.sAddrOutbox, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg) == 0)
+                int rv;
+                if (fHeaders)
+                {
+                    rv = SecureMsgReadHeader(*it, smsgStored, msg);
+                } else
+                {
+                    uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+                    rv = SecureMsgDecrypt(false, smsgStored.sAddrOutbox, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg);
+                };
+
+                if (rv == 0)
                 {
                     Object objM;
                     objM.push_back(Pair("success", "1"));
                     objM.push_back(Pair("sent", getTimeString(msg.timestamp, cbuf, sizeof(cbuf))));
                     objM.push_back(Pair("from", msg.sFromAddress));
                     objM.push_back(Pair("to", smsgStored.sAddrTo));
-                    objM.push_back(Pair("text", std::string((char*)&msg.vchMessage[0]))); // ugh
+                    if (!fHeaders)
+                        objM.push_back(Pair("text", std::string((char*)&msg.vchMessage[0]))); // ugh
 
                     messageList.push_back(objM);
                 } else
@@ -791,14 +894,13 @@ Value smsgoutbox(const Array& params, bool fHelp)
                 };
                 nMessages++;
             };
-            delete it;
 
             result.push_back(Pair("messages" ,messageList));
             result.push_back(Pair("result", strprintf("%u", nMessages)));
         } else
         {
             result.push_back(Pair("result", "Unknown Mode."));
-            result.push_back(Pair("expected", "[all|clear]."));
+            result.push_back(Pair("expected", "[all|headers|clear]."));
         };
     }
 
@@ -13,6 +13,7 @@
 #include "ringsig.h"
 #include "smessage.h"
 #include <sstream>
+#include <boost/filesystem.hpp>
 
 using namespace json_spirit;
 
@@ -131,6 +132,17 @@ Value getinfo(const Array& params, bool fHelp)
             obj.push_back(Pair("walletlocked",      pwalletMain->IsCrypted() ?  pwalletMain->IsLocked() ? "Locked" : "Unlocked" : "Uncrypted"));
             obj.push_back(Pair("walletunlockedto",  pwalletMain->IsCrypted() ? !pwalletMain->IsLocked() ? strprintf("%d", (int64_t)nWalletUnlockTime / 1000).c_str() : "Locked" : "Uncrypted"));
 
+            Object filter;
+            {
+                LOCK(pwalletMain->cs_wallet);
+                filter.push_back(Pair("ids",            (int)pwalletMain->filterOwned.GetElements()));
+                filter.push_back(Pair("bytes",          (int)pwalletMain->filterOwned.GetSize()));
+                filter.push_back(Pair("checks",         (uint64_t)pwalletMain->nFilterChecks));
+                filter.push_back(Pair("rejected",       (uint64_t)pwalletMain->nFilterRejects));
+                filter.push_back(Pair("falsepositives", (uint64_t)pwalletMain->nFilterFalsePositives));
+            }
+            obj.push_back(Pair("ownedfilter",       filter));
+
             obj.push_back(Pair("errors",        GetWarnings("statusbar")));
 
             return obj;
@@ -760,6 +772,7 @@ Value movecmd(const Array& params, bool fHelp)
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
 
     int64_t nNow = GetAdjustedTime();
+    int64_t nOrderPosNextWas = pwalletMain->nOrderPosNext;
 
     // Debit
     CAccountingEntry debit;
@@ -769,7 +782,6 @@ Value movecmd(const Array& params, bool fHelp)
     debit.nTime = nNow;
     debit.strOtherAccount = strTo;
     debit.strComment = strComment;
-    walletdb.WriteAccountingEntry(debit);
 
     // Credit
     CAccountingEntry credit;
@@ -779,10 +791,22 @@ Value movecmd(const Array& params, bool fHelp)
     credit.nTime = nNow;
     credit.strOtherAccount = strFrom;
     credit.strComment = strComment;
-    walletdb.WriteAccountingEntry(credit);
 
-    if (!walletdb.TxnCommit())
+    bool fDebit = pwalletMain->AddAccountingEntry(debit, walletdb);
+    bool fCredit = fDebit && pwalletMain->AddAccountingEntry(credit, walletdb);
+
+    if (!fCredit || !walletdb.TxnCommit())
+    {
+        // -- the db rolled back, take both entries out of the in-memory log too
+        if (!fCredit)
+            walletdb.TxnAbort();
+        if (fDebit)
+            pwalletMain->EraseAccountingEntry(debit.nOrderPos);
+        if (fCredit)
+            pwalletMain->EraseAccountingEntry(credit.nOrderPos);
+        pwalletMain->nOrderPosNext = nOrderPosNextWas;
         throw JSONRPCError(RPC_DATABASE_ERROR, "database error");
+    };
 
     return true;
 }
@@ -876,7 +900,7 @@ Value sendmany(const Array& params, bool fHelp)
 
         totalAmount += nAmount;
 
-        vecSend.push_back(make_pair(scriptPubKey, nAmount));
+        vecSend.push_back(std::make_pair(scriptPubKey, nAmount));
     };
 
     EnsureWalletIsUnlocked();
@@ -902,6 +926,85 @@ Value sendmany(const Array& params, bool fHelp)
     return wtx.GetHash().GetHex();
 }
 
+Value sendbulk(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw std::runtime_error(
+            "sendbulk [{\"address\":address,\"amount\":amount},...] [maxtxbytes]\n"
+            "Pay many recipients at once, outputs are packed into as few transactions\n"
+            "of at most [maxtxbytes] as possible and written to the wallet together.\n"
+            "Recipients that can't be paid are listed in rejected, index is the position in the input.\n"
+            "amounts are double-precision floating point numbers"
+            + HelpRequiringPassphrase());
+
+    const Array& recipients = params[0].get_array();
+    unsigned int nMaxTxBytes = BULK_TX_MAX_SIZE;
+    if (params.size() > 1)
+        nMaxTxBytes = params[1].get_int();
+
+    std::vector<std::pair<CScript, int64_t> > vecSend;
+    std::vector<unsigned int> vIndex; // position in recipients of each vecSend entry
+    std::vector<std::pair<unsigned int, std::string> > vRejected;
+
+    for (unsigned int i = 0; i < recipients.size(); ++i)
+    {
+        try {
+            const Object& o = recipients[i].get_obj();
+            CBitcoinAddress address(find_value(o, "address").get_str());
+            if (!address.IsValid())
+            {
+                vRejected.push_back(std::make_pair(i, std::string("Invalid Sumcoin address")));
+                continue;
+            };
+
+            CScript scriptPubKey;
+            scriptPubKey.SetDestination(address.Get());
+            vecSend.push_back(std::make_pair(scriptPubKey, AmountFromValue(find_value(o, "amount"))));
+            vIndex.push_back(i);
+        } catch (std::exception& e)
+        {
+            vRejected.push_back(std::make_pair(i, std::string(e.what())));
+        } catch (Object& objError)
+        {
+            vRejected.push_back(std::make_pair(i, find_value(objError, "message").get_str()));
+        };
+    };
+
+    EnsureWalletIsUnlocked();
+
+    std::vector<CWalletTx> vwtx;
+    std::vector<std::pair<unsigned int, std::string> > vNotPaid;
+    int64_t nFee = 0;
+    if (!pwalletMain->CreateBulkTransactions(vecSend, vwtx, vNotPaid, nFee, nMaxTxBytes))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Transaction creation failed");
+
+    if (!pwalletMain->CommitBulkTransactions(vwtx))
+        throw JSONRPCError(RPC_WALLET_ERROR, "Transaction commit failed");
+
+    for (std::vector<std::pair<unsigned int, std::string> >::iterator it = vNotPaid.begin(); it != vNotPaid.end(); ++it)
+        vRejected.push_back(std::make_pair(vIndex[it->first], it->second));
+    std::sort(vRejected.begin(), vRejected.end());
+
+    Object result;
+    Array txids;
+    BOOST_FOREACH(const CWalletTx& wtx, vwtx)
+        txids.push_back(wtx.GetHash().GetHex());
+    result.push_back(Pair("txids", txids));
+    result.push_back(Pair("fee", ValueFromAmount(nFee)));
+    result.push_back(Pair("paid", (int)(recipients.size() - vRejected.size())));
+
+    Array rejected;
+    for (std::vector<std::pair<unsigned int, std::string> >::iterator it = vRejected.begin(); it != vRejected.end(); ++it)
+    {
+        Object entry;
+        entry.push_back(Pair("index", (int)it->first));
+        entry.push_back(Pair("error", it->second));
+        rejected.push_back(entry);
+    };
+    result.push_back(Pair("rejected", rejected));
+
+    return result;
+}
 
 /**
  * Used by addmultisigaddress / createmultisig:
@@ -1319,15 +1422,14 @@ Value listtransactions(const Array& params, bool fHelp)
 
     Array ret;
 
-    std::list<CAccountingEntry> acentries;
-    CWallet::TxItems txOrdered = pwalletMain->OrderedTxItems(acentries, strAccount, fShowCoinstake);
-
-    // iterate backwards until we have nCount items to return:
-    for (CWallet::TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+    // iterate backwards through the ordered index until we have nCount items to return:
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
+    for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
         CWalletTx *const pwtx = (*it).second.first;
 
-        if (pwtx != 0)
+        if (pwtx != 0
+            && (fShowCoinstake || !pwtx->IsCoinStake()))
             ListTransactions(*pwtx, strAccount, 0, true, ret);
         CAccountingEntry *const pacentry = (*it).second.second;
 
@@ -1402,9 +1504,8 @@ Value listaccounts(const Array& params, bool fHelp)
         };
     };
 
-    std::list<CAccountingEntry> acentries;
-    CWalletDB(pwalletMain->strWalletFile).ListAccountCreditDebit("*", acentries);
-    BOOST_FOREACH(const CAccountingEntry& entry, acentries)
+    // -- moves are held in memory with the ordered index, no need to read them from the db
+    BOOST_FOREACH(const CAccountingEntry& entry, pwalletMain->laccentries)
         mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
 
     Object ret;
@@ -1445,12 +1546,16 @@ Value listsinceblock(const Array& params, bool fHelp)
 
     Array transactions;
 
-    for (std::map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    // -- walk the ordered index so transactions are listed oldest to newest, as listtransactions does
+    const CWallet::TxItems& txOrdered = pwalletMain->wtxOrdered;
+    for (CWallet::TxItems::const_iterator it = txOrdered.begin(); it != txOrdered.end(); ++it)
     {
-        CWalletTx tx = (*it).second;
+        const CWalletTx *const pwtx = (*it).second.first;
+        if (!pwtx)
+            continue;
 
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions);
+        if (depth == -1 || pwtx->GetDepthInMainChain() < depth)
+            ListTransactions(*pwtx, "*", 0, true, transactions);
     };
 
     uint256 lastblock;
@@ -2269,71 +2374,30 @@ Value clearwallettransactions(const Array& params, bool fHelp)
 
         CWalletDB walletdb(pwalletMain->strWalletFile);
         walletdb.TxnBegin();
-        Dbc* pcursor = walletdb.GetTxnCursor();
+        CDBCursor* pcursor = walletdb.GetTxnCursor();
         if (!pcursor)
             throw std::runtime_error("Cannot get wallet DB cursor");
 
-        Dbt datKey;
-        Dbt datValue;
-
-        datKey.set_flags(DB_DBT_USERMEM);
-        datValue.set_flags(DB_DBT_USERMEM);
-
-        std::vector<unsigned char> vchKey;
         std::vector<unsigned char> vchType;
-        std::vector<unsigned char> vchKeyData;
-        std::vector<unsigned char> vchValueData;
-
-        vchKeyData.resize(100);
-        vchValueData.resize(100);
-
-        datKey.set_ulen(vchKeyData.size());
-        datKey.set_data(&vchKeyData[0]);
-
-        datValue.set_ulen(vchValueData.size());
-        datValue.set_data(&vchValueData[0]);
 
         unsigned int fFlags = DB_NEXT; // same as using DB_FIRST for new cursor
         while (true)
         {
-            int ret = pcursor->get(&datKey, &datValue, fFlags);
-
-            if (ret == ENOMEM
-                || ret == DB_BUFFER_SMALL)
-            {
-                if (datKey.get_size() > datKey.get_ulen())
-                {
-                    vchKeyData.resize(datKey.get_size());
-                    datKey.set_ulen(vchKeyData.size());
-                    datKey.set_data(&vchKeyData[0]);
-                };
-
-                if (datValue.get_size() > datValue.get_ulen())
-                {
-                    vchValueData.resize(datValue.get_size());
-                    datValue.set_ulen(vchValueData.size());
-                    datValue.set_data(&vchValueData[0]);
-                };
-                // -- try once more, when DB_BUFFER_SMALL cursor is not expected to move
-                ret = pcursor->get(&datKey, &datValue, fFlags);
-            };
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = walletdb.ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
 
             if (ret == DB_NOTFOUND)
                 break;
             else
-            if (datKey.get_data() == NULL || datValue.get_data() == NULL
-                || ret != 0)
+            if (ret != 0)
             {
+                pcursor->close();
                 snprintf(cbuf, sizeof(cbuf), "wallet DB error %d, %s", ret, db_strerror(ret));
                 throw std::runtime_error(cbuf);
             };
 
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            ssValue.SetType(SER_DISK);
-            ssValue.clear();
-            ssValue.write((char*)datKey.get_data(), datKey.get_size());
-
-            ssValue >> vchType;
+            ssKey >> vchType;
 
 
             std::string strType(vchType.begin(), vchType.end());
@@ -2343,7 +2407,7 @@ Value clearwallettransactions(const Array& params, bool fHelp)
             if (strType == "tx")
             {
                 uint256 hash;
-                ssValue >> hash;
+                ssKey >> hash;
 
                 if (fUnaccepted)
                 {
@@ -2355,6 +2419,7 @@ Value clearwallettransactions(const Array& params, bool fHelp)
                             LogPrintf("Delete transaction failed %d, %s\n", ret, db_strerror(ret));
                             continue;
                         }
+                        pwalletMain->EraseOrderedTx(hash);
                         pwalletMain->mapWallet.erase(hash);
                         pwalletMain->NotifyTransactionChanged(pwalletMain, hash, CT_DELETED);
                         nTransactions++;
@@ -2368,6 +2433,7 @@ Value clearwallettransactions(const Array& params, bool fHelp)
                     continue;
                 }
 
+                pwalletMain->EraseOrderedTx(hash);
                 pwalletMain->mapWallet.erase(hash);
                 pwalletMain->NotifyTransactionChanged(pwalletMain, hash, CT_DELETED);
 
@@ -2396,6 +2462,66 @@ Value clearwallettransactions(const Array& params, bool fHelp)
     return result;
 }
 
+static uint64_t GetWalletFileSize(const std::string& strFile)
+{
+    namespace fs = boost::filesystem;
+    uint64_t nSize = 0;
+    try {
+        if (bitdb.IsLevelDB(strFile))
+        {
+            fs::path pathLdb = bitdb.GetLevelDBPath(strFile);
+            for (fs::directory_iterator it(pathLdb); it != fs::directory_iterator(); ++it)
+                if (fs::is_regular_file(it->status()))
+                    nSize += fs::file_size(it->path());
+        } else
+        {
+            nSize = fs::file_size(GetDataDir() / strFile);
+        };
+    } catch (const fs::filesystem_error& e)
+    {
+        LogPrintf("GetWalletFileSize() : %s\n", e.what());
+    };
+    return nSize;
+}
+
+Value compactwallet(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw std::runtime_error(
+            "compactwallet\n"
+            "Remove the stored supporting transactions (vtxPrev) from all wallet transactions\n"
+            "and rewrite the wallet file, unconfirmed ancestors are looked up when relaying.\n"
+            "Set -storesupportingtxns=0 to stop storing them for new transactions.\n"
+            "Warning: Backup your wallet first!");
+
+    if (!pwalletMain->fFileBacked)
+        throw std::runtime_error("Wallet is not file backed.");
+
+    uint64_t nFileBefore = GetWalletFileSize(pwalletMain->strWalletFile);
+
+    uint32_t nTxns;
+    uint64_t nBytesBefore, nBytesAfter;
+    if (!pwalletMain->CompactSupportingTxns(nTxns, nBytesBefore, nBytesAfter))
+        throw std::runtime_error("CompactSupportingTxns failed.");
+
+    // -- release the freed pages
+    if (nTxns > 0
+        && !CDB::Rewrite(pwalletMain->strWalletFile))
+        throw std::runtime_error("Rewrite of wallet file failed.");
+
+    uint64_t nFileAfter = GetWalletFileSize(pwalletMain->strWalletFile);
+
+    Object result;
+    result.push_back(Pair("txns", (uint64_t)nTxns));
+    result.push_back(Pair("bytesbefore", nBytesBefore));
+    result.push_back(Pair("bytesafter", nBytesAfter));
+    result.push_back(Pair("saved", nBytesBefore - nBytesAfter));
+    result.push_back(Pair("filesizebefore", nFileBefore));
+    result.push_back(Pair("filesizeafter", nFileAfter));
+
+    return result;
+}
+
 Value scanforalltxns(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -21,7 +21,8 @@ using namespace boost;
 
 CScriptID::CScriptID(const CScript& in) : uint160(Hash160(in.begin(), in.end())) {}
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags,
+    const CSignatureHasher* phasher = NULL);
 
 static const valtype vchFalse(0);
 static const valtype vchZero(0);
@@ -399,7 +400,8 @@ static bool CheckLockTime(const CTransaction& txTo, unsigned int nIn, const CBig
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+    const CSignatureHasher* phasher)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -1137,7 +1139,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         return false;
 
                     bool fSuccess = CheckSignatureEncoding(vchSig, flags) && CheckPubKeyEncoding(vchPubKey) &&
-                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
 
                     popstack(stack);
                     popstack(stack);
@@ -1201,7 +1203,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                         // Check signature
                         bool fOk = CheckSignatureEncoding(vchSig, flags) && CheckPubKeyEncoding(vchPubKey) &&
-                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
 
                         if (fOk)
                         {
@@ -1273,64 +1275,128 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+static void SerializeScriptCode(CHashWriter& ss, const CScript& scriptCode)
 {
+    // In case concatenating two scripts ends up with two codeseparators,
+    // or an extra one at the end, this prevents all those possible incompatibilities.
+    // Find stops where FindAndDelete does, the script is only copied when there is one to remove.
+    if (scriptCode.Find(OP_CODESEPARATOR) == 0)
+    {
+        ss << scriptCode;
+        return;
+    };
+
+    CScript scriptStripped(scriptCode);
+    scriptStripped.FindAndDelete(CScript(OP_CODESEPARATOR));
+    ss << scriptStripped;
+}
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    // -- txTo is serialized straight into the hash with the substitutions made on the fly, the bytes
+    //    hashed are those of the modified copy of txTo the signature commits to.
     if (nIn >= txTo.vin.size())
     {
         LogPrintf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
 
-    // In case concatenating two scripts ends up with two codeseparators,
-    // or an extra one at the end, this prevents all those possible incompatibilities.
-    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+    bool fAnyoneCanPay = nHashType & SIGHASH_ANYONECANPAY;
+    bool fNone = (nHashType & 0x1f) == SIGHASH_NONE;
+    bool fSingle = (nHashType & 0x1f) == SIGHASH_SINGLE;
 
-    // Blank out other inputs' signatures
-    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
+    if (fSingle && nIn >= txTo.vout.size())
+    {
+        LogPrintf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
 
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    // Blank out other inputs completely with ANYONECANPAY, not recommended for open transactions,
+    // otherwise blank out their signatures
+    unsigned int nInputs = fAnyoneCanPay ? 1 : txTo.vin.size();
+    WriteCompactSize(ss, nInputs);
+    for (unsigned int i = 0; i < nInputs; i++)
     {
-        // Wildcard payee
-        txTmp.vout.clear();
+        unsigned int n = fAnyoneCanPay ? nIn : i;
+        const CTxIn& txin = txTo.vin[n];
+        ss << txin.prevout;
+        if (n == nIn)
+            SerializeScriptCode(ss, scriptCode);
+        else
+            ss << CScript();
 
         // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
-    }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+        if (n != nIn && (fNone || fSingle))
+            ss << (unsigned int)0;
+        else
+            ss << txin.nSequence;
+    };
+
+    if (fNone)
+    {
+        // Wildcard payee
+        WriteCompactSize(ss, 0);
+    } else
+    if (fSingle)
     {
         // Only lock-in the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
-        {
-            LogPrintf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
-        }
-        txTmp.vout.resize(nOut+1);
-        for (unsigned int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
+        WriteCompactSize(ss, nIn + 1);
+        for (unsigned int i = 0; i < nIn; i++)
+            ss << CTxOut();
+        ss << txTo.vout[nIn];
+    } else
+    {
+        ss << txTo.vout;
+    };
 
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
-    }
+    ss << txTo.nLockTime << nHashType;
+    return ss.GetHash();
+}
+
+CSignatureHasher::CSignatureHasher(const CTransaction& txToIn) : txTo(txToIn)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTo.nVersion << txTo.nTime;
+    WriteCompactSize(ss, txTo.vin.size());
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    CDataStream ssInputs(SER_GETHASH, 0);
+    vState.reserve(txTo.vin.size());
+    vInputEnd.reserve(txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
-    }
+        vState.push_back(ss);
+        const CTxIn& txin = txTo.vin[i];
+        ss << txin.prevout << CScript() << txin.nSequence;
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
+        vInputEnd.push_back(ssInputs.size());
+    };
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
+
+    CDataStream ssTail(SER_GETHASH, 0);
+    ssTail << txTo.vout << txTo.nLockTime;
+    vchTail.assign(ssTail.begin(), ssTail.end());
+}
 
-    // Serialize and hash
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << txTmp << nHashType;
+uint256 CSignatureHasher::SignatureHash(const CScript& scriptCode, unsigned int nIn, int nHashType) const
+{
+    if (nIn >= txTo.vin.size()
+        || (nHashType & SIGHASH_ANYONECANPAY)
+        || (nHashType & 0x1f) == SIGHASH_NONE
+        || (nHashType & 0x1f) == SIGHASH_SINGLE)
+        return ::SignatureHash(scriptCode, txTo, nIn, nHashType);
+
+    const CTxIn& txin = txTo.vin[nIn];
+    CHashWriter ss(vState[nIn]);
+    ss << txin.prevout;
+    SerializeScriptCode(ss, scriptCode);
+    ss << txin.nSequence;
+    if (vInputEnd[nIn] < vchInputs.size())
+        ss.write((const char*)&vchInputs[vInputEnd[nIn]], vchInputs.size() - vInputEnd[nIn]);
+    ss.write((const char*)&vchTail[0], vchTail.size());
+    ss << nHashType;
     return ss.GetHash();
 }
 
@@ -1392,7 +1458,7 @@ public:
 };
 
 bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHasher* phasher)
 {
     static CSignatureCache signatureCache;
 
@@ -1409,7 +1475,8 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubK
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = phasher ? phasher->SignatureHash(scriptCode, nIn, nHashType)
+                              : SignatureHash(scriptCode, txTo, nIn, nHashType);
 
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
@@ -1778,16 +1845,199 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
     return true;
 }
 
+// -- the elements a push only script leaves on the stack, as pointers into the script
+class CScriptPushes
+{
+public:
+    static const unsigned int MAX_PUSHES = 24;
+
+    unsigned int nPushes;
+    const unsigned char *vpBegin[MAX_PUSHES];
+    unsigned int vnSize[MAX_PUSHES];
+
+    // Fails for anything EvalScript wouldn't just push: other opcodes, small integers, oversized
+    // elements or scripts and more than MAX_PUSHES elements.
+    bool Set(const CScript& script)
+    {
+        nPushes = 0;
+        if (script.size() > 10000)
+            return false;
+        CScript::const_iterator pc = script.begin();
+        opcodetype opcode;
+        while (pc < script.end())
+        {
+            CScript::const_iterator pcOp = pc;
+            if (!script.GetOp2(pc, opcode, NULL)
+                || opcode > OP_PUSHDATA4
+                || nPushes >= MAX_PUSHES)
+                return false;
+            unsigned int nHeader = opcode < OP_PUSHDATA1 ? 1 : opcode == OP_PUSHDATA1 ? 2 : opcode == OP_PUSHDATA2 ? 3 : 5;
+            vpBegin[nPushes] = &pcOp[nHeader];
+            vnSize[nPushes] = pc - pcOp - nHeader;
+            if (vnSize[nPushes] > MAX_SCRIPT_ELEMENT_SIZE)
+                return false;
+            nPushes++;
+        };
+        return true;
+    };
+
+    valtype Get(unsigned int i) const
+    {
+        return valtype(vpBegin[i], vpBegin[i] + vnSize[i]);
+    };
+};
+
+// -- OP_CHECKSIG on one signature and key. Returns false where EvalScript fails the script.
+static bool CheckSigOp(const valtype& vchSig, const valtype& vchPubKey, const CScript& scriptCode, const CTransaction& txTo,
+    unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHasher* phasher, bool& fSuccess)
+{
+    bool fEncoding = CheckSignatureEncoding(vchSig, flags) && CheckPubKeyEncoding(vchPubKey);
+    if ((flags & SCRIPT_VERIFY_STRICTENC) && !fEncoding)
+        return false;
+
+    fSuccess = fEncoding && CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, phasher);
+    return true;
+}
+
+// Checks P2PKH, P2PK and P2SH multisig spends from the scripts directly, without building an
+// interpreter stack. Returns false when the scripts don't fit a template and EvalScript must run,
+// otherwise fValid is the result VerifyScript would have.
+//
+// The scriptCode these templates sign has the signatures removed by FindAndDelete, which can only
+// change it when a signature is exactly the size of a hash or key pushed in it, those fall back too.
+static bool VerifyStandardScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+    unsigned int flags, int nHashType, const CSignatureHasher* phasher, bool& fValid)
+{
+    CScriptPushes pushes;
+    if (!pushes.Set(scriptSig) || pushes.nPushes < 1)
+        return false;
+    unsigned int nTop = pushes.nPushes - 1;
+    const CScriptPushes& p = pushes;
+
+    // -- P2PKH: OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY OP_CHECKSIG
+    if (scriptPubKey.size() == 25
+        && scriptPubKey[0] == OP_DUP
+        && scriptPubKey[1] == OP_HASH160
+        && scriptPubKey[2] == 20
+        && scriptPubKey[23] == OP_EQUALVERIFY
+        && scriptPubKey[24] == OP_CHECKSIG)
+    {
+        if (p.nPushes < 2 || p.vnSize[nTop - 1] == 20)
+            return false;
+        uint160 hash = Hash160(p.vpBegin[nTop], p.vpBegin[nTop] + p.vnSize[nTop]);
+        if (memcmp(hash.begin(), &scriptPubKey[3], 20) != 0)
+        {
+            fValid = false;
+            return true;
+        };
+        bool fSuccess;
+        fValid = CheckSigOp(p.Get(nTop - 1), p.Get(nTop), scriptPubKey, txTo, nIn, flags, nHashType, phasher, fSuccess) && fSuccess;
+        return true;
+    };
+
+    // -- P2PK: <pubkey> OP_CHECKSIG
+    if ((scriptPubKey.size() == 35 && scriptPubKey[0] == 33 && scriptPubKey[34] == OP_CHECKSIG)
+        || (scriptPubKey.size() == 67 && scriptPubKey[0] == 65 && scriptPubKey[66] == OP_CHECKSIG))
+    {
+        if (p.vnSize[nTop] == scriptPubKey[0])
+            return false;
+        valtype vchPubKey(scriptPubKey.begin() + 1, scriptPubKey.end() - 1);
+        bool fSuccess;
+        fValid = CheckSigOp(p.Get(nTop), vchPubKey, scriptPubKey, txTo, nIn, flags, nHashType, phasher, fSuccess) && fSuccess;
+        return true;
+    };
+
+    // -- P2SH, redeemed by OP_m <pubkey>... OP_n OP_CHECKMULTISIG
+    if (!(flags & SCRIPT_VERIFY_P2SH) || !scriptPubKey.IsPayToScriptHash())
+        return false;
+
+    const unsigned char *pRedeem = p.vpBegin[nTop];
+    unsigned int nRedeem = p.vnSize[nTop];
+    uint160 hash = Hash160(pRedeem, pRedeem + nRedeem);
+    if (memcmp(hash.begin(), &scriptPubKey[2], 20) != 0)
+    {
+        fValid = false;
+        return true;
+    };
+
+    if (nRedeem < 37
+        || pRedeem[0] < OP_1 || pRedeem[0] > OP_16
+        || pRedeem[nRedeem - 2] < OP_1 || pRedeem[nRedeem - 2] > OP_16
+        || pRedeem[nRedeem - 1] != OP_CHECKMULTISIG)
+        return false;
+    int nSigsCount = pRedeem[0] - (OP_1 - 1);
+    int nKeysCount = pRedeem[nRedeem - 2] - (OP_1 - 1);
+
+    const unsigned char *vpKey[16];
+    int nKeys = 0;
+    unsigned int nPos = 1;
+    while (nPos < nRedeem - 2)
+    {
+        unsigned int nSize = pRedeem[nPos];
+        if ((nSize != 33 && nSize != 65) || nKeys >= nKeysCount || nPos + 1 + nSize > nRedeem - 2)
+            return false;
+        vpKey[nKeys++] = &pRedeem[nPos + 1];
+        nPos += 1 + nSize;
+    };
+    if (nKeys != nKeysCount || nSigsCount > nKeysCount)
+        return false;
+
+    // the signatures sit below the redeem script, with the extra element CHECKMULTISIG consumes under them
+    if ((int)nTop < nSigsCount + 1)
+        return false;
+    for (int k = 0; k < nSigsCount; k++)
+        if (p.vnSize[nTop - 1 - k] == 33 || p.vnSize[nTop - 1 - k] == 65)
+            return false;
+
+    CScript scriptCode(pRedeem, pRedeem + nRedeem);
+    int isig = nTop - 1, ikey = nKeysCount - 1;
+    bool fSuccess = true;
+    while (fSuccess && nSigsCount > 0)
+    {
+        valtype vchPubKey(vpKey[ikey], vpKey[ikey] + vpKey[ikey][-1]);
+        bool fOk;
+        if (!CheckSigOp(p.Get(isig), vchPubKey, scriptCode, txTo, nIn, flags, nHashType, phasher, fOk))
+        {
+            fValid = false;
+            return true;
+        };
+        if (fOk)
+        {
+            isig--;
+            nSigsCount--;
+        };
+        ikey--;
+        nKeysCount--;
+
+        // If there are more signatures left than keys left,
+        // then too many signatures have failed
+        if (nSigsCount > nKeysCount)
+            fSuccess = false;
+    };
+
+    if ((flags & SCRIPT_VERIFY_NULLDUMMY) && p.vnSize[nTop - 1 - (pRedeem[0] - (OP_1 - 1))])
+    {
+        fValid = error("CHECKMULTISIG dummy argument not null");
+        return true;
+    };
+    fValid = fSuccess;
+    return true;
+}
+
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, const CSignatureHasher* phasher)
 {
+    bool fValid;
+    if (VerifyStandardScript(scriptSig, scriptPubKey, txTo, nIn, flags, nHashType, phasher, fValid))
+        return fValid;
+
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, phasher))
         return false;
 
     stackCopy = stack;
 
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, phasher))
         return false;
     if (stack.empty())
         return false;
@@ -1805,7 +2055,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, phasher))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1816,17 +2066,15 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+static bool SignInput(const CKeyStore &keystore, const CScript& fromPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType,
+    const CSignatureHasher* phasher, CScript& scriptSigRet)
 {
-    assert(nIn < txTo.vin.size());
-    CTxIn& txin = txTo.vin[nIn];
-
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = phasher ? phasher->SignatureHash(fromPubKey, nIn, nHashType) : SignatureHash(fromPubKey, txTo, nIn, nHashType);
 
     txnouttype whichType;
-    if (!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
+    if (!Solver(keystore, fromPubKey, hash, nHashType, scriptSigRet, whichType))
         return false;
 
     if (whichType == TX_SCRIPTHASH)
@@ -1834,19 +2082,30 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         // Solver returns the subscript that need to be evaluated;
         // the final scriptSig is the signatures from that
         // and then the serialized subscript:
-        CScript subscript = txin.scriptSig;
+        CScript subscript = scriptSigRet;
 
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = phasher ? phasher->SignatureHash(subscript, nIn, nHashType) : SignatureHash(subscript, txTo, nIn, nHashType);
 
         txnouttype subType;
         bool fSolved =
-            Solver(keystore, subscript, hash2, nHashType, txin.scriptSig, subType) && subType != TX_SCRIPTHASH;
+            Solver(keystore, subscript, hash2, nHashType, scriptSigRet, subType) && subType != TX_SCRIPTHASH;
         // Append serialized subscript whether or not it is completely signed:
-        txin.scriptSig << static_cast<valtype>(subscript);
+        scriptSigRet << valtype(subscript.begin(), subscript.end());
         if (!fSolved) return false;
     }
 
+    return true;
+}
+
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    assert(nIn < txTo.vin.size());
+    CTxIn& txin = txTo.vin[nIn];
+
+    if (!SignInput(keystore, fromPubKey, txTo, nIn, nHashType, NULL, txin.scriptSig))
+        return false;
+
     // Test solution
     return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
 }
@@ -1861,7 +2120,104 @@ bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTrans
     return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
 }
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+void CopySigningKeys(const CKeyStore& keystore, const CScript& scriptPubKey, CBasicKeyStore& keystoreOut)
+{
+    // -- the keys and redeem scripts needed to sign for scriptPubKey, for signing threads that can't lock cs_wallet
+    txnouttype whichType;
+    std::vector<CTxDestination> vDest;
+    int nRequired;
+    if (!ExtractDestinations(scriptPubKey, whichType, vDest, nRequired))
+        return;
+
+    BOOST_FOREACH(const CTxDestination& dest, vDest)
+    {
+        if (const CKeyID* pkeyId = boost::get<CKeyID>(&dest))
+        {
+            CKey key;
+            CPubKey pubkey;
+            if (!keystoreOut.HaveKey(*pkeyId)
+                && keystore.GetKey(*pkeyId, key)
+                && keystore.GetPubKey(*pkeyId, pubkey))
+                keystoreOut.AddKeyPubKey(key, pubkey);
+        } else
+        if (const CScriptID* pscriptId = boost::get<CScriptID>(&dest))
+        {
+            CScript script;
+            if (!keystoreOut.HaveCScript(*pscriptId)
+                && keystore.GetCScript(*pscriptId, script))
+            {
+                keystoreOut.AddCScript(script);
+                CopySigningKeys(keystore, script, keystoreOut);
+            };
+        };
+    };
+}
+
+static void SignSignaturesThread(const CKeyStore* pkeystore, const std::vector<CScript>* pvFromPubKey, const CTransaction* ptxTo,
+    const CSignatureHasher* phasher, int nHashType, unsigned int nBegin, unsigned int nEnd,
+    std::vector<CScript>* pvScriptSig, std::vector<char>* pvfSigned)
+{
+    for (unsigned int i = nBegin; i < nEnd; i++)
+    {
+        const CScript& fromPubKey = (*pvFromPubKey)[i];
+        if (fromPubKey.empty())
+            continue;
+        (*pvfSigned)[i] = SignInput(*pkeystore, fromPubKey, *ptxTo, i, nHashType, phasher, (*pvScriptSig)[i])
+            && VerifyScript((*pvScriptSig)[i], fromPubKey, *ptxTo, i, STANDARD_SCRIPT_VERIFY_FLAGS, 0);
+    };
+}
+
+bool SignSignatures(const CKeyStore& keystore, const std::vector<CScript>& vFromPubKey, CTransaction& txTo, int nHashType,
+    std::vector<char>* pvfSigned, unsigned int nMaxThreads)
+{
+    // -- sign every input of txTo, vFromPubKey[i] is the output input i spends, inputs with an empty
+    //    script are left as they are. The signature hashes share one CSignatureHasher and the inputs
+    //    are split over up to nMaxThreads threads, 0 for one per core. keystore must be usable from
+    //    several threads at once without a lock the caller holds, pass a CopySigningKeys copy, not the wallet.
+    //    Returns true if every input given was signed and verifies.
+    assert(vFromPubKey.size() == txTo.vin.size());
+
+    unsigned int nInputs = txTo.vin.size();
+    std::vector<CScript> vScriptSig(nInputs);
+    std::vector<char> vfSigned(nInputs, 0);
+    CSignatureHasher hasher(txTo);
+
+    unsigned int nThreads = nMaxThreads ? nMaxThreads : boost::thread::hardware_concurrency();
+    nThreads = std::min(std::max(nThreads, 1u), nInputs / SIGN_INPUTS_PER_THREAD);
+    if (nThreads <= 1)
+    {
+        SignSignaturesThread(&keystore, &vFromPubKey, &txTo, &hasher, nHashType, 0, nInputs, &vScriptSig, &vfSigned);
+    } else
+    {
+        unsigned int nPer = nInputs / nThreads;
+        boost::thread_group threadGroup;
+        for (unsigned int t = 0; t < nThreads; t++)
+        {
+            unsigned int nEnd = (t == nThreads - 1) ? nInputs : (t + 1) * nPer;
+            threadGroup.create_thread(boost::bind(&SignSignaturesThread, &keystore, &vFromPubKey, &txTo, &hasher, nHashType,
+                t * nPer, nEnd, &vScriptSig, &vfSigned));
+        };
+        threadGroup.join_all();
+    };
+
+    bool fAllSigned = true;
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        if (vFromPubKey[i].empty())
+            continue;
+        // -- partial signatures are kept, as SignSignature does, for CombineSignatures
+        txTo.vin[i].scriptSig = vScriptSig[i];
+        if (!vfSigned[i])
+            fAllSigned = false;
+    };
+
+    if (pvfSigned)
+        pvfSigned->swap(vfSigned);
+    return fAllSigned;
+}
+
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+    const CSignatureHasher* phasher)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1872,7 +2228,7 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, flags, nHashType);
+    return VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, flags, nHashType, phasher);
 }
 
 static CScript PushAll(const vector<valtype>& values)
@@ -2050,9 +2406,9 @@ bool CScript::IsPayToScriptHash() const
 {
     // Extra-fast test for pay-to-script-hash CScripts:
     return (this->size() == 23 &&
-            this->at(0) == OP_HASH160 &&
-            this->at(1) == 0x14 &&
-            this->at(22) == OP_EQUAL);
+            (*this)[0] == OP_HASH160 &&
+            (*this)[1] == 0x14 &&
+            (*this)[22] == OP_EQUAL);
 }
 
 bool CScript::HasCanonicalPushes() const
@@ -14,12 +14,15 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include "prevector.h"
 #include "stealth.h"
 #include "extkey.h"
 #include "keystore.h"
 #include "bignum.h"
 #include "util.h"
 
+/** Interpreter stack element. Still a std::vector, only CScript uses prevector: the stack and
+ *  Solver's solutions are passed to VerifyScript, CombineSignatures, CPubKey and uint160 as vectors. */
 typedef std::vector<unsigned char> valtype;
 
 class CTransaction;
@@ -304,8 +307,12 @@ inline std::string StackString(const std::vector<std::vector<unsigned char> >& v
 
 
 
+/** Inline capacity of CScript. P2PKH (25 bytes) and P2SH (23 bytes) scriptPubKeys fit inline,
+ *  longer scripts are heap allocated as before. */
+typedef prevector<28, unsigned char> CScriptBase;
+
 /** Serialized script, used inside transaction inputs and outputs */
-class CScript : public std::vector<unsigned char>
+class CScript : public CScriptBase
 {
 protected:
     CScript& push_int64(int64_t n)
@@ -338,11 +345,9 @@ protected:
 
 public:
     CScript() { }
-    CScript(const CScript& b) : std::vector<unsigned char>(b.begin(), b.end()) { }
-    CScript(const_iterator pbegin, const_iterator pend) : std::vector<unsigned char>(pbegin, pend) { }
-#ifndef _MSC_VER
-    CScript(const unsigned char* pbegin, const unsigned char* pend) : std::vector<unsigned char>(pbegin, pend) { }
-#endif
+    CScript(const CScript& b) : CScriptBase(b.begin(), b.end()) { }
+    CScript(const_iterator pbegin, const_iterator pend) : CScriptBase(pbegin, pend) { }
+    CScript(std::vector<unsigned char>::const_iterator pbegin, std::vector<unsigned char>::const_iterator pend) : CScriptBase(pbegin, pend) { }
 
     CScript& operator+=(const CScript& b)
     {
@@ -643,16 +648,34 @@ public:
 
     CScriptID GetID() const
     {
-        return CScriptID(Hash160(*this));
+        return CScriptID(Hash160(begin(), end()));
     }
 
     void clear()
     {
-        // The default std::vector::clear() does not release memory.
-        std::vector<unsigned char>().swap(*this);
+        // The default prevector::clear() does not release memory.
+        CScriptBase::clear();
+        shrink_to_fit();
     }
 };
 
+inline unsigned int GetSerializeSize(const CScript& v, int nType, int nVersion)
+{
+    return GetSerializeSize((const CScriptBase&)v, nType, nVersion);
+}
+
+template<typename Stream>
+void Serialize(Stream& os, const CScript& v, int nType, int nVersion)
+{
+    Serialize(os, (const CScriptBase&)v, nType, nVersion);
+}
+
+template<typename Stream>
+void Unserialize(Stream& is, CScript& v, int nType, int nVersion)
+{
+    Unserialize(is, (CScriptBase&)v, nType, nVersion);
+}
+
 /** Compact serializer for scripts.
  *
  *  It detects common cases and encodes them much more efficiently.
@@ -727,8 +750,33 @@ public:
 };
 
 
+/** Inputs per thread below which SignSignatures signs on fewer threads */
+static const unsigned int SIGN_INPUTS_PER_THREAD = 8;
+
+/** SIGHASH_ALL hashes of all inputs of one txn. The serialization with blank scriptSigs is built once
+ *  and the hash state before every input is kept, so the hash of input n only continues from input n.
+ *  Other hash types go to ::SignatureHash. txTo must outlive the hasher and stay unchanged apart from
+ *  its scriptSigs, which the hash doesn't cover.
+ */
+class CSignatureHasher
+{
+public:
+    CSignatureHasher(const CTransaction& txToIn);
+
+    uint256 SignatureHash(const CScript& scriptCode, unsigned int nIn, int nHashType) const;
+
+private:
+    const CTransaction& txTo;
+    std::vector<CHashWriter> vState;        // before each input
+    std::vector<unsigned char> vchInputs;   // all inputs with blank scriptSigs
+    std::vector<size_t> vInputEnd;          // end of each input in vchInputs
+    std::vector<unsigned char> vchTail;     // vout and nLockTime
+};
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 bool IsDERSignature(const valtype &vchSig, bool haveHashType = true);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+    const CSignatureHasher* phasher=NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -737,9 +785,13 @@ bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+bool SignSignatures(const CKeyStore& keystore, const std::vector<CScript>& vFromPubKey, CTransaction& txTo, int nHashType=SIGHASH_ALL,
+    std::vector<char>* pvfSigned=NULL, unsigned int nMaxThreads=0);
+void CopySigningKeys(const CKeyStore& keystore, const CScript& scriptPubKey, CBasicKeyStore& keystoreOut);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                   unsigned int flags, int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+                   unsigned int flags, int nHashType, const CSignatureHasher* phasher=NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+    const CSignatureHasher* phasher=NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -196,3 +196,196 @@ uint256 scrypt_blockhash(const void* input)
     return scrypt_nosalt(input, 80, scratchpad);
 }
 
+
+/* Multi-lane scrypt_core, for hashing many headers at once (reindex, -loadblock, header sync).
+   The lanes are interleaved word by word, X[w * nLanes + l] is word w of lane l, so one vector
+   register holds the same word of every lane and Salsa20/8 runs on all of them together.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+
+#define SCRYPT_MULTI_LANE
+
+#define SALSA8_ROUNDS \
+    for (int r = 0; r < 8; r += 2) { \
+        /* Operate on columns. */ \
+        Q(x[ 4], x[ 0], x[12],  7); Q(x[ 9], x[ 5], x[ 1],  7); \
+        Q(x[14], x[10], x[ 6],  7); Q(x[ 3], x[15], x[11],  7); \
+        Q(x[ 8], x[ 4], x[ 0],  9); Q(x[13], x[ 9], x[ 5],  9); \
+        Q(x[ 2], x[14], x[10],  9); Q(x[ 7], x[ 3], x[15],  9); \
+        Q(x[12], x[ 8], x[ 4], 13); Q(x[ 1], x[13], x[ 9], 13); \
+        Q(x[ 6], x[ 2], x[14], 13); Q(x[11], x[ 7], x[ 3], 13); \
+        Q(x[ 0], x[12], x[ 8], 18); Q(x[ 5], x[ 1], x[13], 18); \
+        Q(x[10], x[ 6], x[ 2], 18); Q(x[15], x[11], x[ 7], 18); \
+        /* Operate on rows. */ \
+        Q(x[ 1], x[ 0], x[ 3],  7); Q(x[ 6], x[ 5], x[ 4],  7); \
+        Q(x[11], x[10], x[ 9],  7); Q(x[12], x[15], x[14],  7); \
+        Q(x[ 2], x[ 1], x[ 0],  9); Q(x[ 7], x[ 6], x[ 5],  9); \
+        Q(x[ 8], x[11], x[10],  9); Q(x[13], x[12], x[15],  9); \
+        Q(x[ 3], x[ 2], x[ 1], 13); Q(x[ 4], x[ 7], x[ 6], 13); \
+        Q(x[ 9], x[ 8], x[11], 13); Q(x[14], x[13], x[12], 13); \
+        Q(x[ 0], x[ 3], x[ 2], 18); Q(x[ 5], x[ 4], x[ 7], 18); \
+        Q(x[10], x[ 9], x[ 8], 18); Q(x[15], x[14], x[13], 18); \
+    }
+
+__attribute__((target("sse2")))
+static inline void xor_salsa8_4way(uint32_t *B, const uint32_t *Bx)
+{
+    __m128i x[16], b[16];
+    for (int k = 0; k < 16; k++)
+    {
+        b[k] = _mm_xor_si128(_mm_load_si128((const __m128i*)&B[k * 4]), _mm_load_si128((const __m128i*)&Bx[k * 4]));
+        x[k] = b[k];
+    };
+
+#define Q(d, a, b, n) { __m128i t = _mm_add_epi32(a, b); \
+    d = _mm_xor_si128(d, _mm_or_si128(_mm_slli_epi32(t, n), _mm_srli_epi32(t, 32 - (n)))); }
+    SALSA8_ROUNDS
+#undef Q
+
+    for (int k = 0; k < 16; k++)
+        _mm_store_si128((__m128i*)&B[k * 4], _mm_add_epi32(b[k], x[k]));
+}
+
+__attribute__((target("sse2")))
+static void scrypt_core_4way(uint32_t *X, uint32_t *V)
+{
+    unsigned int i, j[4], k, l;
+
+    for (i = 0; i < 1024; i++) {
+        memcpy(&V[i * 32 * 4], X, 128 * 4);
+        xor_salsa8_4way(&X[0], &X[16 * 4]);
+        xor_salsa8_4way(&X[16 * 4], &X[0]);
+    }
+    for (i = 0; i < 1024; i++) {
+        for (l = 0; l < 4; l++)
+            j[l] = 32 * (X[16 * 4 + l] & 1023);
+        for (k = 0; k < 32; k++)
+            for (l = 0; l < 4; l++)
+                X[k * 4 + l] ^= V[(j[l] + k) * 4 + l];
+        xor_salsa8_4way(&X[0], &X[16 * 4]);
+        xor_salsa8_4way(&X[16 * 4], &X[0]);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void xor_salsa8_8way(uint32_t *B, const uint32_t *Bx)
+{
+    __m256i x[16], b[16];
+    for (int k = 0; k < 16; k++)
+    {
+        b[k] = _mm256_xor_si256(_mm256_load_si256((const __m256i*)&B[k * 8]), _mm256_load_si256((const __m256i*)&Bx[k * 8]));
+        x[k] = b[k];
+    };
+
+#define Q(d, a, b, n) { __m256i t = _mm256_add_epi32(a, b); \
+    d = _mm256_xor_si256(d, _mm256_or_si256(_mm256_slli_epi32(t, n), _mm256_srli_epi32(t, 32 - (n)))); }
+    SALSA8_ROUNDS
+#undef Q
+
+    for (int k = 0; k < 16; k++)
+        _mm256_store_si256((__m256i*)&B[k * 8], _mm256_add_epi32(b[k], x[k]));
+}
+
+__attribute__((target("avx2")))
+static void scrypt_core_8way(uint32_t *X, uint32_t *V)
+{
+    unsigned int i, k;
+
+    for (i = 0; i < 1024; i++) {
+        memcpy(&V[i * 32 * 8], X, 128 * 8);
+        xor_salsa8_8way(&X[0], &X[16 * 8]);
+        xor_salsa8_8way(&X[16 * 8], &X[0]);
+    }
+
+    // -- lane l reads V[(j * 32 + k) * 8 + l], gathered for all lanes at once
+    const __m256i vLane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i vMask = _mm256_set1_epi32(1023);
+    for (i = 0; i < 1024; i++) {
+        __m256i vIndex = _mm256_load_si256((const __m256i*)&X[16 * 8]);
+        vIndex = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(vIndex, vMask), 8), vLane);
+        for (k = 0; k < 32; k++)
+        {
+            __m256i v = _mm256_i32gather_epi32((const int*)&V[k * 8], vIndex, 4);
+            _mm256_store_si256((__m256i*)&X[k * 8], _mm256_xor_si256(_mm256_load_si256((const __m256i*)&X[k * 8]), v));
+        };
+        xor_salsa8_8way(&X[0], &X[16 * 8]);
+        xor_salsa8_8way(&X[16 * 8], &X[0]);
+    }
+}
+
+#undef SALSA8_ROUNDS
+#endif
+
+unsigned int scrypt_blockhash_lanes()
+{
+    static unsigned int nLanes = 0;
+    if (nLanes)
+        return nLanes;
+
+#ifdef SCRYPT_MULTI_LANE
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        nLanes = 8;
+    else
+    if (__builtin_cpu_supports("sse2"))
+        nLanes = 4;
+    else
+        nLanes = 1;
+#else
+    nLanes = 1;
+#endif
+    return nLanes;
+}
+
+void scrypt_blockhash_many(const void* input, uint256* output, unsigned int nCount, unsigned int nMaxLanes)
+{
+    const unsigned char* pInput = (const unsigned char*)input;
+    unsigned int nLanes = scrypt_blockhash_lanes();
+    if (nMaxLanes && nMaxLanes < nLanes)
+        nLanes = nMaxLanes;
+
+    // -- one scratchpad for the whole run, 128KiB per lane
+    std::vector<unsigned char> vScratch(nLanes * (SCRYPT_BUFFER_SIZE - 63) + 63);
+    unsigned int n = 0;
+
+#ifdef SCRYPT_MULTI_LANE
+    if (nLanes >= 4)
+    {
+        uint32_t *V = (uint32_t *)(((uintptr_t)(&vScratch[0]) + 63) & ~ (uintptr_t)(63));
+        uint32_t X[32 * 8] __attribute__((aligned(64)));
+        uint32_t B[8][32];
+
+        while (nCount - n >= 4)
+        {
+            unsigned int nBatch = (nLanes >= 8 && nCount - n >= 8) ? 8 : 4;
+            const unsigned char* p = pInput + n * 80;
+
+            for (unsigned int l = 0; l < nBatch; l++)
+                PBKDF2_SHA256(p + l * 80, 80, p + l * 80, 80, 1, (uint8_t *)B[l], 128);
+            for (unsigned int w = 0; w < 32; w++)
+                for (unsigned int l = 0; l < nBatch; l++)
+                    X[w * nBatch + l] = B[l][w];
+
+            if (nBatch == 8)
+                scrypt_core_8way(X, V);
+            else
+                scrypt_core_4way(X, V);
+
+            for (unsigned int w = 0; w < 32; w++)
+                for (unsigned int l = 0; l < nBatch; l++)
+                    B[l][w] = X[w * nBatch + l];
+            for (unsigned int l = 0; l < nBatch; l++)
+            {
+                output[n + l] = 0;
+                PBKDF2_SHA256(p + l * 80, 80, (uint8_t *)B[l], 128, 1, (uint8_t *)&output[n + l], 32);
+            };
+            n += nBatch;
+        };
+    };
+#endif
+
+    for (; n < nCount; n++)
+        output[n] = scrypt_nosalt(pInput + n * 80, 80, &vScratch[0]);
+}
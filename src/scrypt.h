@@ -12,4 +12,9 @@ uint256 scrypt_salted_hash(const void* input, size_t inputlen, const void* salt,
 uint256 scrypt_hash(const void* input, size_t inputlen);
 uint256 scrypt_blockhash(const void* input);
 
+/* hash nCount 80 byte headers laid out back to back in input, several lanes at once when the cpu
+   has the vector units for it (AVX2: 8, SSE2: 4). nMaxLanes limits the lanes used, 0 for the most. */
+void scrypt_blockhash_many(const void* input, uint256* output, unsigned int nCount, unsigned int nMaxLanes = 0);
+unsigned int scrypt_blockhash_lanes();
+
 #endif // SCRYPT_MINE_H
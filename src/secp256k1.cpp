@@ -0,0 +1,1530 @@
+// Copyright (c) 2014-2015 The Sumcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+// Field elements and scalars are 4 64 bit limbs, least significant first, kept fully reduced.
+// Their arithmetic is branch free, so the same code serves verification and the constant time
+// signing. Verification splits both scalars with the curve endomorphism and runs the four halves
+// together as wNAF (Strauss), signing and public keys use a comb of precomputed multiples of G.
+
+#include "secp256k1.h"
+#include "pbkdf2.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/crypto.h>
+#include <openssl/sha.h>
+
+namespace {
+
+/** 64x64 -> 128 bit products and a 192 bit accumulator (c0,c1,c2) */
+
+#if defined(__SIZEOF_INT128__)
+static inline void mul64(uint64_t a, uint64_t b, uint64_t& hi, uint64_t& lo)
+{
+    unsigned __int128 t = (unsigned __int128)a * b;
+    lo = (uint64_t)t;
+    hi = (uint64_t)(t >> 64);
+}
+#else
+static inline void mul64(uint64_t a, uint64_t b, uint64_t& hi, uint64_t& lo)
+{
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    lo = (mid << 32) | (uint32_t)p00;
+    hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+#endif
+
+// (c0,c1,c2) += a * b
+static inline void muladd(uint64_t& c0, uint64_t& c1, uint64_t& c2, uint64_t a, uint64_t b)
+{
+    uint64_t hi, lo;
+    mul64(a, b, hi, lo);
+    c0 += lo;
+    hi += (c0 < lo); // hi <= 2^64 - 2
+    c1 += hi;
+    c2 += (c1 < hi);
+}
+
+// (c0,c1,c2) += a
+static inline void sumadd(uint64_t& c0, uint64_t& c1, uint64_t& c2, uint64_t a)
+{
+    c0 += a;
+    uint64_t over = (c0 < a);
+    c1 += over;
+    c2 += (c1 < over);
+}
+
+// returns c0 and shifts the accumulator down a limb
+static inline uint64_t extract(uint64_t& c0, uint64_t& c1, uint64_t& c2)
+{
+    uint64_t r = c0;
+    c0 = c1;
+    c1 = c2;
+    c2 = 0;
+    return r;
+}
+
+static void mul512(uint64_t l[8], const uint64_t a[4], const uint64_t b[4])
+{
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 7; k++)
+    {
+        for (int i = (k < 4 ? 0 : k - 3); i <= (k < 4 ? k : 3); i++)
+            muladd(c0, c1, c2, a[i], b[k - i]);
+        l[k] = extract(c0, c1, c2);
+    };
+    l[7] = c0;
+}
+
+static inline void load_b32(uint64_t d[4], const unsigned char b[32])
+{
+    for (int i = 0; i < 4; i++)
+    {
+        const unsigned char *p = &b[24 - i * 8];
+        d[i] = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) | ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32)
+             | ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) | ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+    };
+}
+
+static inline void store_b32(unsigned char b[32], const uint64_t d[4])
+{
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 8; j++)
+            b[24 - i * 8 + j] = (unsigned char)(d[i] >> (56 - j * 8));
+}
+
+
+/** Field elements mod p = 2^256 - 2^32 - 977 */
+
+struct fe
+{
+    uint64_t n[4];
+};
+
+static const uint64_t FE_C = 0x1000003D1ULL; // 2^256 - p
+
+static const fe FE_BETA = {{0xC1396C28719501EEULL, 0x9CF0497512F58995ULL, 0x6E64479EAC3434E9ULL, 0x7AE96A2B657C0710ULL}};
+static const fe FE_P_MINUS_ORDER = {{0x402DA1722FC9BAEEULL, 0x4551231950B75FC4ULL, 0x0000000000000001ULL, 0x0000000000000000ULL}};
+static const fe FE_GX = {{0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL, 0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL}};
+static const fe FE_GY = {{0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL, 0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL}};
+
+static inline void fe_set_int(fe& r, uint64_t a)
+{
+    r.n[0] = a;
+    r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+static inline bool fe_is_zero(const fe& a)
+{
+    return (a.n[0] | a.n[1] | a.n[2] | a.n[3]) == 0;
+}
+
+static inline bool fe_is_odd(const fe& a)
+{
+    return a.n[0] & 1;
+}
+
+static inline bool fe_equal(const fe& a, const fe& b)
+{
+    return ((a.n[0] ^ b.n[0]) | (a.n[1] ^ b.n[1]) | (a.n[2] ^ b.n[2]) | (a.n[3] ^ b.n[3])) == 0;
+}
+
+// r = a where mask is all ones, unchanged where it is 0
+static inline void fe_cmov(fe& r, const fe& a, uint64_t mask)
+{
+    for (int i = 0; i < 4; i++)
+        r.n[i] = (r.n[i] & ~mask) | (a.n[i] & mask);
+}
+
+// reduce r + carry * 2^256, which is below 2p
+static inline void fe_finish(fe& r, uint64_t carry)
+{
+    // r - p == r + C - 2^256, taken when r + C overflows or there was a carry
+    fe t;
+    uint64_t k;
+    t.n[0] = r.n[0] + FE_C; k = t.n[0] < FE_C;
+    t.n[1] = r.n[1] + k;    k = t.n[1] < k;
+    t.n[2] = r.n[2] + k;    k = t.n[2] < k;
+    t.n[3] = r.n[3] + k;    k = t.n[3] < k;
+    fe_cmov(r, t, -(carry | k));
+}
+
+static inline bool fe_set_b32(fe& r, const unsigned char b[32])
+{
+    // returns false for values >= p
+    load_b32(r.n, b);
+    return !(r.n[3] == ~0ULL && r.n[2] == ~0ULL && r.n[1] == ~0ULL && r.n[0] >= 0xFFFFFFFEFFFFFC2FULL);
+}
+
+static inline void fe_get_b32(unsigned char b[32], const fe& a)
+{
+    store_b32(b, a.n);
+}
+
+static inline void fe_add(fe& r, const fe& a, const fe& b)
+{
+    uint64_t k = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a.n[i] + k;
+        k = t < k;
+        r.n[i] = t + b.n[i];
+        k += r.n[i] < t;
+    };
+    fe_finish(r, k);
+}
+
+static inline void fe_sub(fe& r, const fe& a, const fe& b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t ai = a.n[i], bi = b.n[i];
+        uint64_t t = ai - bi;
+        uint64_t b1 = ai < bi;
+        r.n[i] = t - borrow;
+        borrow = b1 | (t < borrow);
+    };
+
+    // on a borrow add p, the same as subtracting C mod 2^256, and the result is above C then
+    uint64_t sub = FE_C & -borrow;
+    uint64_t k = r.n[0] < sub;
+    r.n[0] -= sub;
+    for (int i = 1; i < 4; i++)
+    {
+        uint64_t t = r.n[i];
+        r.n[i] = t - k;
+        k = t < k;
+    };
+}
+
+static inline void fe_negate(fe& r, const fe& a)
+{
+    fe zero;
+    fe_set_int(zero, 0);
+    fe_sub(r, zero, a);
+}
+
+static void fe_reduce512(fe& r, const uint64_t l[8])
+{
+    // 2^256 == C mod p: m = l[0..3] + l[4..7] * C, then fold the top limb of m in again
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    uint64_t m[4];
+    for (int i = 0; i < 4; i++)
+    {
+        sumadd(c0, c1, c2, l[i]);
+        muladd(c0, c1, c2, l[4 + i], FE_C);
+        m[i] = extract(c0, c1, c2);
+    };
+
+    uint64_t hi, lo, k;
+    mul64(c0, FE_C, hi, lo); // c0 < 2^34
+    r.n[0] = m[0] + lo;
+    k = (r.n[0] < lo) + hi;
+    r.n[1] = m[1] + k;
+    k = r.n[1] < k;
+    r.n[2] = m[2] + k;
+    k = r.n[2] < k;
+    r.n[3] = m[3] + k;
+    k = r.n[3] < k;
+
+    // a carry here leaves r small, adding C once more can't carry out again
+    uint64_t add = FE_C & -k;
+    r.n[0] += add;
+    k = r.n[0] < add;
+    for (int i = 1; i < 4; i++)
+    {
+        r.n[i] += k;
+        k = r.n[i] < k;
+    };
+    fe_finish(r, 0);
+}
+
+static inline void fe_mul(fe& r, const fe& a, const fe& b)
+{
+    uint64_t l[8];
+    mul512(l, a.n, b.n);
+    fe_reduce512(r, l);
+}
+
+static inline void fe_sqr(fe& r, const fe& a)
+{
+    // the cross products are computed once and doubled
+    uint64_t l[8];
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    const uint64_t *n = a.n;
+    muladd(c0, c1, c2, n[0], n[0]);
+    l[0] = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n[0], n[1]); muladd(c0, c1, c2, n[0], n[1]);
+    l[1] = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n[0], n[2]); muladd(c0, c1, c2, n[0], n[2]);
+    muladd(c0, c1, c2, n[1], n[1]);
+    l[2] = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n[0], n[3]); muladd(c0, c1, c2, n[0], n[3]);
+    muladd(c0, c1, c2, n[1], n[2]); muladd(c0, c1, c2, n[1], n[2]);
+    l[3] = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n[1], n[3]); muladd(c0, c1, c2, n[1], n[3]);
+    muladd(c0, c1, c2, n[2], n[2]);
+    l[4] = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n[2], n[3]); muladd(c0, c1, c2, n[2], n[3]);
+    l[5] = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n[3], n[3]);
+    l[6] = extract(c0, c1, c2);
+    l[7] = c0;
+    fe_reduce512(r, l);
+}
+
+static inline void fe_sqr_n(fe& r, const fe& a, int n)
+{
+    fe_sqr(r, a);
+    for (int i = 1; i < n; i++)
+        fe_sqr(r, r);
+}
+
+// a^(2^223 - 1), shared by fe_inv and fe_sqrt
+static void fe_pow_x223(fe& x223, fe& x22, fe& x2, const fe& a)
+{
+    fe x3, x6, x9, x11, x44, x88, x176, x220, t;
+    fe_sqr(t, a);          fe_mul(x2, t, a);
+    fe_sqr(t, x2);         fe_mul(x3, t, a);
+    fe_sqr_n(t, x3, 3);    fe_mul(x6, t, x3);
+    fe_sqr_n(t, x6, 3);    fe_mul(x9, t, x3);
+    fe_sqr_n(t, x9, 2);    fe_mul(x11, t, x2);
+    fe_sqr_n(t, x11, 11);  fe_mul(x22, t, x11);
+    fe_sqr_n(t, x22, 22);  fe_mul(x44, t, x22);
+    fe_sqr_n(t, x44, 44);  fe_mul(x88, t, x44);
+    fe_sqr_n(t, x88, 88);  fe_mul(x176, t, x88);
+    fe_sqr_n(t, x176, 44); fe_mul(x220, t, x44);
+    fe_sqr_n(t, x220, 3);  fe_mul(x223, t, x3);
+}
+
+static void fe_inv(fe& r, const fe& a)
+{
+    // a^(p - 2), the exponent is public so this is constant time in a
+    fe x223, x22, x2, t;
+    fe_pow_x223(x223, x22, x2, a);
+    fe_sqr_n(t, x223, 23); fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 5);     fe_mul(t, t, a);
+    fe_sqr_n(t, t, 3);     fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2);     fe_mul(r, t, a);
+}
+
+static bool fe_sqrt(fe& r, const fe& a)
+{
+    // a^((p + 1) / 4), p = 3 mod 4. Returns false when a has no square root.
+    fe x223, x22, x2, t;
+    fe_pow_x223(x223, x22, x2, a);
+    fe_sqr_n(t, x223, 23); fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 6);     fe_mul(t, t, x2);
+    fe_sqr_n(r, t, 2);
+    fe_sqr(t, r);
+    return fe_equal(t, a);
+}
+
+
+/** Scalars mod the group order n */
+
+struct scalar
+{
+    uint64_t d[4];
+};
+
+static const uint64_t N_0 = 0xBFD25E8CD0364141ULL;
+static const uint64_t N_1 = 0xBAAEDCE6AF48A03BULL;
+static const uint64_t N_2 = 0xFFFFFFFFFFFFFFFEULL;
+static const uint64_t N_3 = 0xFFFFFFFFFFFFFFFFULL;
+
+// 2^256 - n
+static const uint64_t NC_0 = 0x402DA1732FC9BEBFULL;
+static const uint64_t NC_1 = 0x4551231950B75FC4ULL;
+
+// n / 2
+static const uint64_t NH_0 = 0xDFE92F46681B20A0ULL;
+static const uint64_t NH_1 = 0x5D576E7357A4501DULL;
+static const uint64_t NH_2 = 0xFFFFFFFFFFFFFFFFULL;
+static const uint64_t NH_3 = 0x7FFFFFFFFFFFFFFFULL;
+
+// endomorphism: lambda * (x, y) = (beta * x, y), and the constants splitting k into k1 + k2 * lambda
+static const scalar SC_MINUS_LAMBDA = {{0xE0CFC810B51283CFULL, 0xA880B9FC8EC739C2ULL, 0x5AD9E3FD77ED9BA4ULL, 0xAC9C52B33FA3CF1FULL}};
+static const scalar SC_G1 = {{0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL}};
+static const scalar SC_G2 = {{0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL}};
+static const scalar SC_MINUS_B1 = {{0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0x0000000000000000ULL, 0x0000000000000000ULL}};
+static const scalar SC_MINUS_B2 = {{0xD765CDA83DB1562CULL, 0x8A280AC50774346DULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL}};
+
+static inline bool sc_is_zero(const scalar& a)
+{
+    return (a.d[0] | a.d[1] | a.d[2] | a.d[3]) == 0;
+}
+
+static inline uint64_t sc_check_overflow(const scalar& a)
+{
+    // 1 if a >= n
+    uint64_t yes = 0, no = 0;
+    no |= (a.d[3] < N_3);
+    no |= (a.d[2] < N_2);
+    yes |= (a.d[2] > N_2) & ~no;
+    no |= (a.d[1] < N_1);
+    yes |= (a.d[1] > N_1) & ~no;
+    yes |= (a.d[0] >= N_0) & ~no;
+    return yes;
+}
+
+static inline bool sc_is_high(const scalar& a)
+{
+    // a > n / 2
+    uint64_t yes = 0, no = 0;
+    no |= (a.d[3] < NH_3);
+    yes |= (a.d[3] > NH_3) & ~no;
+    no |= (a.d[2] < NH_2) & ~yes;
+    no |= (a.d[1] < NH_1) & ~yes;
+    yes |= (a.d[1] > NH_1) & ~no;
+    yes |= (a.d[0] > NH_0) & ~no;
+    return yes;
+}
+
+// r -= n when overflow is 1, as r + (2^256 - n) mod 2^256
+static inline void sc_reduce(scalar& r, uint64_t overflow)
+{
+    uint64_t c0 = r.d[0], c1 = 0, c2 = 0;
+    muladd(c0, c1, c2, overflow, NC_0);
+    r.d[0] = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, r.d[1]);
+    muladd(c0, c1, c2, overflow, NC_1);
+    r.d[1] = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, r.d[2]);
+    sumadd(c0, c1, c2, overflow);
+    r.d[2] = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, r.d[3]);
+    r.d[3] = c0;
+}
+
+static inline void sc_set_b32(scalar& r, const unsigned char b[32], bool* pfOverflow)
+{
+    load_b32(r.d, b);
+    uint64_t overflow = sc_check_overflow(r);
+    sc_reduce(r, overflow);
+    if (pfOverflow)
+        *pfOverflow = overflow;
+}
+
+static inline void sc_get_b32(unsigned char b[32], const scalar& a)
+{
+    store_b32(b, a.d);
+}
+
+static inline void sc_add(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t k = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a.d[i] + k;
+        k = t < k;
+        r.d[i] = t + b.d[i];
+        k += r.d[i] < t;
+    };
+    sc_reduce(r, k | sc_check_overflow(r));
+}
+
+static inline void sc_negate(scalar& r, const scalar& a)
+{
+    // n - a, 0 for 0
+    uint64_t mask = -(uint64_t)!sc_is_zero(a);
+    const uint64_t vn[4] = {N_0, N_1, N_2, N_3};
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t ai = a.d[i];
+        uint64_t t = vn[i] - ai;
+        uint64_t b1 = vn[i] < ai;
+        r.d[i] = (t - borrow) & mask;
+        borrow = b1 | (t < borrow);
+    };
+}
+
+static void sc_reduce512(scalar& r, const uint64_t l[8])
+{
+    // 2^256 == 2^256 - n mod n, folded in three times: 512 -> 385 -> 258 -> 256 bits
+    uint64_t n0 = l[4], n1 = l[5], n2 = l[6], n3 = l[7];
+    uint64_t m0, m1, m2, m3, m4, m5, m6;
+    uint64_t p0, p1, p2, p3, p4;
+    uint64_t c0, c1, c2;
+
+    c0 = l[0]; c1 = 0; c2 = 0;
+    muladd(c0, c1, c2, n0, NC_0);
+    m0 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, l[1]);
+    muladd(c0, c1, c2, n1, NC_0);
+    muladd(c0, c1, c2, n0, NC_1);
+    m1 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, l[2]);
+    muladd(c0, c1, c2, n2, NC_0);
+    muladd(c0, c1, c2, n1, NC_1);
+    sumadd(c0, c1, c2, n0);
+    m2 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, l[3]);
+    muladd(c0, c1, c2, n3, NC_0);
+    muladd(c0, c1, c2, n2, NC_1);
+    sumadd(c0, c1, c2, n1);
+    m3 = extract(c0, c1, c2);
+    muladd(c0, c1, c2, n3, NC_1);
+    sumadd(c0, c1, c2, n2);
+    m4 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, n3);
+    m5 = extract(c0, c1, c2);
+    m6 = c0;
+
+    c0 = m0; c1 = 0; c2 = 0;
+    muladd(c0, c1, c2, m4, NC_0);
+    p0 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, m1);
+    muladd(c0, c1, c2, m5, NC_0);
+    muladd(c0, c1, c2, m4, NC_1);
+    p1 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, m2);
+    muladd(c0, c1, c2, m6, NC_0);
+    muladd(c0, c1, c2, m5, NC_1);
+    sumadd(c0, c1, c2, m4);
+    p2 = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, m3);
+    muladd(c0, c1, c2, m6, NC_1);
+    sumadd(c0, c1, c2, m5);
+    p3 = extract(c0, c1, c2);
+    p4 = c0 + m6;
+
+    c0 = p0; c1 = 0; c2 = 0;
+    muladd(c0, c1, c2, p4, NC_0);
+    r.d[0] = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, p1);
+    muladd(c0, c1, c2, p4, NC_1);
+    r.d[1] = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, p2);
+    sumadd(c0, c1, c2, p4);
+    r.d[2] = extract(c0, c1, c2);
+    sumadd(c0, c1, c2, p3);
+    r.d[3] = extract(c0, c1, c2);
+
+    sc_reduce(r, c0 | sc_check_overflow(r));
+}
+
+static inline void sc_mul(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t l[8];
+    mul512(l, a.d, b.d);
+    sc_reduce512(r, l);
+}
+
+static void sc_inv(scalar& r, const scalar& a)
+{
+    // a^(n - 2), square and multiply over the public exponent, constant time in a
+    const uint64_t e[4] = {N_0 - 2, N_1, N_2, N_3};
+    scalar x = a;
+    bool fStarted = false;
+    for (int i = 255; i >= 0; i--)
+    {
+        if (fStarted)
+            sc_mul(x, x, x);
+        if ((e[i / 64] >> (i % 64)) & 1)
+        {
+            if (fStarted)
+                sc_mul(x, x, a);
+            fStarted = true;
+        };
+    };
+    r = x;
+}
+
+static inline bool u256_is_even(const uint64_t a[4])
+{
+    return !(a[0] & 1);
+}
+
+static inline bool u256_is_one(const uint64_t a[4])
+{
+    return a[0] == 1 && (a[1] | a[2] | a[3]) == 0;
+}
+
+static inline bool u256_ge(const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 3; i >= 0; i--)
+        if (a[i] != b[i])
+            return a[i] > b[i];
+    return true;
+}
+
+static inline uint64_t u256_add(uint64_t r[4], const uint64_t a[4], const uint64_t b[4])
+{
+    uint64_t k = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t t = a[i] + k;
+        k = t < k;
+        r[i] = t + b[i];
+        k += r[i] < t;
+    };
+    return k;
+}
+
+static inline void u256_sub(uint64_t r[4], const uint64_t a[4], const uint64_t b[4])
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t ai = a[i], bi = b[i];
+        uint64_t t = ai - bi;
+        uint64_t b1 = ai < bi;
+        r[i] = t - borrow;
+        borrow = b1 | (t < borrow);
+    };
+}
+
+static inline void u256_shr1(uint64_t a[4], uint64_t topbit)
+{
+    for (int i = 0; i < 3; i++)
+        a[i] = (a[i] >> 1) | (a[i + 1] << 63);
+    a[3] = (a[3] >> 1) | (topbit << 63);
+}
+
+// x / 2 mod m
+static inline void u256_half_mod(uint64_t x[4], const uint64_t m[4])
+{
+    if (u256_is_even(x))
+    {
+        u256_shr1(x, 0);
+        return;
+    };
+    uint64_t k = u256_add(x, x, m);
+    u256_shr1(x, k);
+}
+
+static void sc_inv_var(scalar& r, const scalar& a)
+{
+    // binary extended Euclid, variable time, for the public values of verification
+    const uint64_t m[4] = {N_0, N_1, N_2, N_3};
+    uint64_t u[4], v[4], x1[4] = {1, 0, 0, 0}, x2[4] = {0, 0, 0, 0};
+    memcpy(u, a.d, sizeof(u));
+    memcpy(v, m, sizeof(v));
+    while (!u256_is_one(u) && !u256_is_one(v))
+    {
+        while (u256_is_even(u))
+        {
+            u256_shr1(u, 0);
+            u256_half_mod(x1, m);
+        };
+        while (u256_is_even(v))
+        {
+            u256_shr1(v, 0);
+            u256_half_mod(x2, m);
+        };
+        if (u256_ge(u, v))
+        {
+            u256_sub(u, u, v);
+            if (u256_ge(x1, x2))
+                u256_sub(x1, x1, x2);
+            else
+            {
+                u256_sub(x1, x1, x2);
+                u256_add(x1, x1, m);
+            };
+        } else
+        {
+            u256_sub(v, v, u);
+            if (u256_ge(x2, x1))
+                u256_sub(x2, x2, x1);
+            else
+            {
+                u256_sub(x2, x2, x1);
+                u256_add(x2, x2, m);
+            };
+        };
+    };
+    memcpy(r.d, u256_is_one(u) ? x1 : x2, sizeof(r.d));
+}
+
+// round(a * b / 2^384)
+static inline void sc_mul_shift_384(scalar& r, const scalar& a, const scalar& b)
+{
+    uint64_t l[8];
+    mul512(l, a.d, b.d);
+    uint64_t round = l[5] >> 63;
+    r.d[0] = l[6] + round;
+    uint64_t k = r.d[0] < round;
+    r.d[1] = l[7] + k;
+    r.d[2] = r.d[1] < k;
+    r.d[3] = 0;
+}
+
+static void sc_split_lambda(scalar& r1, scalar& r2, const scalar& k)
+{
+    // k = r1 + r2 * lambda with r1, r2 or their negations below 2^128
+    scalar c1, c2;
+    sc_mul_shift_384(c1, k, SC_G1);
+    sc_mul_shift_384(c2, k, SC_G2);
+    sc_mul(c1, c1, SC_MINUS_B1);
+    sc_mul(c2, c2, SC_MINUS_B2);
+    sc_add(r2, c1, c2);
+    sc_mul(r1, r2, SC_MINUS_LAMBDA);
+    sc_add(r1, r1, k);
+}
+
+static inline int sc_get_bits(const scalar& a, int offset, int count)
+{
+    // count <= 32, may straddle two limbs
+    int limb = offset / 64, shift = offset % 64;
+    uint64_t v = a.d[limb] >> shift;
+    if (shift + count > 64 && limb < 3)
+        v |= a.d[limb + 1] << (64 - shift);
+    return (int)(v & ((1ULL << count) - 1));
+}
+
+
+/** Points, affine (ge) and jacobian (gej, x = X / Z^2, y = Y / Z^3) */
+
+struct ge
+{
+    fe x, y;
+    bool fInfinity;
+};
+
+struct gej
+{
+    fe x, y, z;
+    bool fInfinity;
+};
+
+static inline void gej_set_ge(gej& r, const ge& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    fe_set_int(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+static inline void ge_set_gej(ge& r, const gej& a)
+{
+    if (a.fInfinity)
+    {
+        r.fInfinity = true;
+        return;
+    };
+    fe zi, zi2, zi3;
+    fe_inv(zi, a.z);
+    fe_sqr(zi2, zi);
+    fe_mul(zi3, zi2, zi);
+    fe_mul(r.x, a.x, zi2);
+    fe_mul(r.y, a.y, zi3);
+    r.fInfinity = false;
+}
+
+static void ge_set_all_gej(ge *r, const gej *a, size_t n)
+{
+    // one inversion for all the points (Montgomery's trick), none may be infinity
+    std::vector<fe> vAcc(n);
+    fe acc;
+    fe_set_int(acc, 1);
+    for (size_t i = 0; i < n; i++)
+    {
+        vAcc[i] = acc;
+        fe_mul(acc, acc, a[i].z);
+    };
+    fe inv;
+    fe_inv(inv, acc);
+    for (size_t i = n; i-- > 0; )
+    {
+        fe zi, zi2, zi3;
+        fe_mul(zi, inv, vAcc[i]);
+        fe_mul(inv, inv, a[i].z);
+        fe_sqr(zi2, zi);
+        fe_mul(zi3, zi2, zi);
+        fe_mul(r[i].x, a[i].x, zi2);
+        fe_mul(r[i].y, a[i].y, zi3);
+        r[i].fInfinity = false;
+    };
+}
+
+static inline bool ge_is_valid(const ge& a)
+{
+    // y^2 == x^3 + 7
+    fe y2, x3, seven;
+    fe_sqr(y2, a.y);
+    fe_sqr(x3, a.x);
+    fe_mul(x3, x3, a.x);
+    fe_set_int(seven, 7);
+    fe_add(x3, x3, seven);
+    return fe_equal(y2, x3);
+}
+
+static bool ge_set_xo(ge& r, const fe& x, bool fOdd)
+{
+    fe y2, seven;
+    fe_sqr(y2, x);
+    fe_mul(y2, y2, x);
+    fe_set_int(seven, 7);
+    fe_add(y2, y2, seven);
+    r.x = x;
+    if (!fe_sqrt(r.y, y2))
+        return false;
+    if (fe_is_odd(r.y) != fOdd)
+        fe_negate(r.y, r.y);
+    r.fInfinity = false;
+    return true;
+}
+
+static inline void ge_negate(ge& r, const ge& a)
+{
+    r = a;
+    fe_negate(r.y, a.y);
+}
+
+static inline void gej_negate(gej& r, const gej& a)
+{
+    r = a;
+    fe_negate(r.y, a.y);
+}
+
+static void gej_double_nonzero(gej& r, const gej& a)
+{
+    // dbl-2009-l, secp256k1 has no points with y = 0, a must not be infinity
+    fe A, B, C, D, E, F, t, z3;
+    fe_sqr(A, a.x);
+    fe_sqr(B, a.y);
+    fe_sqr(C, B);
+    fe_add(t, a.x, B);
+    fe_sqr(t, t);
+    fe_sub(t, t, A);
+    fe_sub(t, t, C);
+    fe_add(D, t, t);
+    fe_add(E, A, A);
+    fe_add(E, E, A);
+    fe_sqr(F, E);
+    fe_mul(z3, a.y, a.z);
+    fe_add(r.z, z3, z3);
+    fe_sub(r.x, F, D);
+    fe_sub(r.x, r.x, D);
+    fe_add(C, C, C);
+    fe_add(C, C, C);
+    fe_add(C, C, C);
+    fe_sub(t, D, r.x);
+    fe_mul(t, E, t);
+    fe_sub(r.y, t, C);
+    r.fInfinity = false;
+}
+
+static void gej_double(gej& r, const gej& a)
+{
+    if (a.fInfinity)
+    {
+        r.fInfinity = true;
+        return;
+    };
+    gej_double_nonzero(r, a);
+}
+
+static void gej_add_ge(gej& r, const gej& a, const ge& b)
+{
+    // madd-2007-bl
+    if (a.fInfinity)
+    {
+        gej_set_ge(r, b);
+        return;
+    };
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    };
+    fe z1z1, u2, s2, h, hh, i, j, rr, v, t;
+    fe_sqr(z1z1, a.z);
+    fe_mul(u2, b.x, z1z1);
+    fe_mul(s2, b.y, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, a.x);
+    fe_sub(rr, s2, a.y);
+    if (fe_is_zero(h))
+    {
+        // exceptional cases, don't occur in signing but for a negligible probability
+        if (fe_is_zero(rr))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    };
+    fe_sqr(hh, h);
+    fe_add(i, hh, hh);
+    fe_add(i, i, i);
+    fe_mul(j, h, i);
+    fe_add(rr, rr, rr);
+    fe_mul(v, a.x, i);
+
+    fe y1j;
+    fe_mul(y1j, a.y, j);
+    fe_add(t, a.z, h);
+    fe_sqr(t, t);
+    fe_sub(t, t, z1z1);
+    fe_sub(r.z, t, hh);
+
+    fe_sqr(t, rr);
+    fe_sub(t, t, j);
+    fe_sub(t, t, v);
+    fe_sub(r.x, t, v);
+    fe_sub(t, v, r.x);
+    fe_mul(t, rr, t);
+    fe_sub(t, t, y1j);
+    fe_sub(r.y, t, y1j);
+    r.fInfinity = false;
+}
+
+static void gej_add_ge_ct(gej& r, const gej& a, const ge& b)
+{
+    // madd-2007-bl without branches on the points, for ecmult_gen. b must not be infinity.
+    // The exceptional cases are selected with masks: h = 0 and rr = 0 is a == b, the sum is 2a,
+    // h = 0 otherwise is a == -b, the sum is infinity, and a at infinity gives b.
+    fe z1z1, u2, s2, h, hh, i, j, rr, v, t, y1j;
+    fe_sqr(z1z1, a.z);
+    fe_mul(u2, b.x, z1z1);
+    fe_mul(s2, b.y, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, a.x);
+    fe_sub(rr, s2, a.y);
+    uint64_t fHZero = fe_is_zero(h);
+    uint64_t fRZero = fe_is_zero(rr);
+
+    gej sum;
+    fe_sqr(hh, h);
+    fe_add(i, hh, hh);
+    fe_add(i, i, i);
+    fe_mul(j, h, i);
+    fe_add(rr, rr, rr);
+    fe_mul(v, a.x, i);
+    fe_mul(y1j, a.y, j);
+    fe_add(t, a.z, h);
+    fe_sqr(t, t);
+    fe_sub(t, t, z1z1);
+    fe_sub(sum.z, t, hh);
+    fe_sqr(t, rr);
+    fe_sub(t, t, j);
+    fe_sub(t, t, v);
+    fe_sub(sum.x, t, v);
+    fe_sub(t, v, sum.x);
+    fe_mul(t, rr, t);
+    fe_sub(t, t, y1j);
+    fe_sub(sum.y, t, y1j);
+
+    gej dbl;
+    gej_double_nonzero(dbl, a);
+
+    uint64_t fAInfinity = a.fInfinity;
+    uint64_t maskDouble = -(fHZero & fRZero);
+    uint64_t maskA = -fAInfinity;
+    fe one;
+    fe_set_int(one, 1);
+    fe_cmov(sum.x, dbl.x, maskDouble);
+    fe_cmov(sum.y, dbl.y, maskDouble);
+    fe_cmov(sum.z, dbl.z, maskDouble);
+    fe_cmov(sum.x, b.x, maskA);
+    fe_cmov(sum.y, b.y, maskA);
+    fe_cmov(sum.z, one, maskA);
+    sum.fInfinity = fHZero & (fRZero ^ 1) & (fAInfinity ^ 1);
+    r = sum;
+}
+
+static void gej_add(gej& r, const gej& a, const gej& b)
+{
+    // add-2007-bl
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    };
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    };
+    fe z1z1, z2z2, u1, u2, s1, s2, h, i, j, rr, v, t;
+    fe_sqr(z1z1, a.z);
+    fe_sqr(z2z2, b.z);
+    fe_mul(u1, a.x, z2z2);
+    fe_mul(u2, b.x, z1z1);
+    fe_mul(s1, a.y, b.z);
+    fe_mul(s1, s1, z2z2);
+    fe_mul(s2, b.y, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, u1);
+    fe_sub(rr, s2, s1);
+    if (fe_is_zero(h))
+    {
+        if (fe_is_zero(rr))
+            gej_double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    };
+    fe_add(i, h, h);
+    fe_sqr(i, i);
+    fe_mul(j, h, i);
+    fe_add(rr, rr, rr);
+    fe_mul(v, u1, i);
+
+    fe s1j;
+    fe_mul(s1j, s1, j);
+    fe_add(t, a.z, b.z);
+    fe_sqr(t, t);
+    fe_sub(t, t, z1z1);
+    fe_sub(t, t, z2z2);
+    fe_mul(r.z, t, h);
+
+    fe_sqr(t, rr);
+    fe_sub(t, t, j);
+    fe_sub(t, t, v);
+    fe_sub(r.x, t, v);
+    fe_sub(t, v, r.x);
+    fe_mul(t, rr, t);
+    fe_sub(t, t, s1j);
+    fe_sub(r.y, t, s1j);
+    r.fInfinity = false;
+}
+
+
+/** Precomputed tables, built once on first use */
+
+static const int WINDOW_A = 5;                         // wNAF window for the public key
+static const int WINDOW_G = 10;                        // wNAF window for G
+static const int TABLE_SIZE_A = 1 << (WINDOW_A - 2);   // odd multiples 1..(2^(w-1) - 1)
+static const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+static const int WNAF_BITS = 130;                      // split scalars are below 2^129
+
+static const int COMB_TEETH = 64;                      // 4 bit windows over 256 bits
+static const int COMB_SPOKES = 16;
+
+class CSecp256k1Context
+{
+public:
+    ge vPreG[TABLE_SIZE_G];                  // odd multiples of G
+    ge vPreGLambda[TABLE_SIZE_G];            // and of lambda * G
+    ge vComb[COMB_TEETH][COMB_SPOKES];       // j * 16^i * G + offset_i, the offsets sum to 0
+
+    CSecp256k1Context()
+    {
+        gej g;
+        fe_set_int(g.z, 1);
+        g.x = FE_GX;
+        g.y = FE_GY;
+        g.fInfinity = false;
+
+        // -- odd multiples of G for verification
+        std::vector<gej> vPre(TABLE_SIZE_G);
+        gej g2;
+        gej_double(g2, g);
+        vPre[0] = g;
+        for (int i = 1; i < TABLE_SIZE_G; i++)
+            gej_add(vPre[i], vPre[i - 1], g2);
+        ge_set_all_gej(vPreG, &vPre[0], TABLE_SIZE_G);
+        for (int i = 0; i < TABLE_SIZE_G; i++)
+        {
+            vPreGLambda[i] = vPreG[i];
+            fe_mul(vPreGLambda[i].x, vPreG[i].x, FE_BETA);
+        };
+
+        // -- comb for k * G. Every entry carries an offset of a point H with no known discrete log,
+        //    so none is infinity and the exceptional cases of the addition are reached with negligible
+        //    probability only, gej_add_ge_ct handles them without branching anyway.
+        //    offset_i = 2^i * H for i < 63 and the last cancels the sum.
+        ge h;
+        unsigned char vchSeed[32];
+        const char *pszSeed = "Sumcoin secp256k1 comb offset";
+        SHA256((const unsigned char*)pszSeed, strlen(pszSeed), vchSeed);
+        fe x;
+        fe_set_b32(x, vchSeed);
+        fe one;
+        fe_set_int(one, 1);
+        while (!ge_set_xo(h, x, false))
+            fe_add(x, x, one);
+
+        std::vector<gej> vCombJ(COMB_TEETH * COMB_SPOKES);
+        gej base = g, offset, sum;
+        gej_set_ge(offset, h);
+        sum.fInfinity = true;
+        for (int i = 0; i < COMB_TEETH; i++)
+        {
+            gej start = offset;
+            if (i == COMB_TEETH - 1)
+                gej_negate(start, sum);
+            else
+                gej_add(sum, sum, offset);
+
+            vCombJ[i * COMB_SPOKES] = start;
+            for (int j = 1; j < COMB_SPOKES; j++)
+                gej_add(vCombJ[i * COMB_SPOKES + j], vCombJ[i * COMB_SPOKES + j - 1], base);
+
+            for (int k = 0; k < 4; k++)
+                gej_double(base, base);
+            gej_double(offset, offset);
+        };
+        ge_set_all_gej(&vComb[0][0], &vCombJ[0], vCombJ.size());
+    };
+};
+
+static const CSecp256k1Context& GetContext()
+{
+    static CSecp256k1Context context;
+    return context;
+}
+
+
+/** Multiplication */
+
+static int ecmult_wnaf(int wnaf[WNAF_BITS], const scalar& a, int w)
+{
+    // returns one past the highest nonzero digit, a must be below 2^(WNAF_BITS - 1)
+    memset(wnaf, 0, WNAF_BITS * sizeof(int));
+    int carry = 0, bit = 0, last = -1;
+    while (bit < WNAF_BITS)
+    {
+        if (sc_get_bits(a, bit, 1) == carry)
+        {
+            bit++;
+            continue;
+        };
+        int now = w;
+        if (now > WNAF_BITS - bit)
+            now = WNAF_BITS - bit;
+        int word = sc_get_bits(a, bit, now) + carry;
+        carry = (word >> (w - 1)) & 1;
+        word -= carry << w;
+        wnaf[bit] = word;
+        last = bit;
+        bit += now;
+    };
+    return last + 1;
+}
+
+// k < 2^129 after splitting, negated when above n / 2; the point is negated with it
+static inline bool sc_make_short(scalar& k)
+{
+    if (!sc_is_high(k))
+        return false;
+    sc_negate(k, k);
+    return true;
+}
+
+static void ecmult(gej& r, const gej& a, const scalar& na, const scalar& ng)
+{
+    // r = na * a + ng * G
+    const CSecp256k1Context& ctx = GetContext();
+
+    scalar na1, na2, ng1, ng2;
+    sc_split_lambda(na1, na2, na);
+    sc_split_lambda(ng1, ng2, ng);
+    bool fNegA1 = sc_make_short(na1), fNegA2 = sc_make_short(na2);
+    bool fNegG1 = sc_make_short(ng1), fNegG2 = sc_make_short(ng2);
+
+    int wnaf_a1[WNAF_BITS], wnaf_a2[WNAF_BITS], wnaf_g1[WNAF_BITS], wnaf_g2[WNAF_BITS];
+    int nBits = ecmult_wnaf(wnaf_a1, na1, WINDOW_A);
+    nBits = std::max(nBits, ecmult_wnaf(wnaf_a2, na2, WINDOW_A));
+    nBits = std::max(nBits, ecmult_wnaf(wnaf_g1, ng1, WINDOW_G));
+    nBits = std::max(nBits, ecmult_wnaf(wnaf_g2, ng2, WINDOW_G));
+
+    // odd multiples of a, lambda * a is (beta * X, Y, Z)
+    gej vPreA[TABLE_SIZE_A], vPreALambda[TABLE_SIZE_A];
+    gej a2;
+    gej_double(a2, a);
+    vPreA[0] = a;
+    for (int i = 1; i < TABLE_SIZE_A; i++)
+        gej_add(vPreA[i], vPreA[i - 1], a2);
+    for (int i = 0; i < TABLE_SIZE_A; i++)
+    {
+        vPreALambda[i] = vPreA[i];
+        fe_mul(vPreALambda[i].x, vPreA[i].x, FE_BETA);
+    };
+
+    r.fInfinity = true;
+    gej tj;
+    ge t;
+    for (int i = nBits - 1; i >= 0; i--)
+    {
+        gej_double(r, r);
+
+        int n;
+        if ((n = wnaf_a1[i]))
+        {
+            tj = vPreA[(abs(n) - 1) / 2];
+            if ((n < 0) != fNegA1)
+                gej_negate(tj, tj);
+            gej_add(r, r, tj);
+        };
+        if ((n = wnaf_a2[i]))
+        {
+            tj = vPreALambda[(abs(n) - 1) / 2];
+            if ((n < 0) != fNegA2)
+                gej_negate(tj, tj);
+            gej_add(r, r, tj);
+        };
+        if ((n = wnaf_g1[i]))
+        {
+            t = ctx.vPreG[(abs(n) - 1) / 2];
+            if ((n < 0) != fNegG1)
+                ge_negate(t, t);
+            gej_add_ge(r, r, t);
+        };
+        if ((n = wnaf_g2[i]))
+        {
+            t = ctx.vPreGLambda[(abs(n) - 1) / 2];
+            if ((n < 0) != fNegG2)
+                ge_negate(t, t);
+            gej_add_ge(r, r, t);
+        };
+    };
+}
+
+static void ecmult_gen(gej& r, const scalar& k)
+{
+    // r = k * G in constant time: every comb entry of a window is read and the digit's one kept,
+    // the first entry starts the sum and the rest are added with the branch free gej_add_ge_ct
+    const CSecp256k1Context& ctx = GetContext();
+    unsigned char vchK[32];
+    sc_get_b32(vchK, k);
+
+    ge t;
+    memset(&t, 0, sizeof(t));
+    for (int i = 0; i < COMB_TEETH; i++)
+    {
+        int nDigit = (vchK[31 - i / 2] >> ((i % 2) * 4)) & 0x0f;
+        for (int j = 0; j < COMB_SPOKES; j++)
+        {
+            uint64_t mask = -(uint64_t)(j == nDigit);
+            fe_cmov(t.x, ctx.vComb[i][j].x, mask);
+            fe_cmov(t.y, ctx.vComb[i][j].y, mask);
+        };
+        t.fInfinity = false;
+        if (i == 0)
+            gej_set_ge(r, t);
+        else
+            gej_add_ge_ct(r, r, t);
+    };
+
+    OPENSSL_cleanse(vchK, sizeof(vchK));
+    OPENSSL_cleanse(&t, sizeof(t));
+}
+
+
+/** Encodings */
+
+static bool pubkey_parse(ge& r, const unsigned char *p, size_t nLen)
+{
+    // the formats OpenSSL's o2i_ECPublicKey takes, hybrid keys need the parity their prefix says
+    fe x, y;
+    if (nLen == 33 && (p[0] == 0x02 || p[0] == 0x03))
+    {
+        if (!fe_set_b32(x, p + 1))
+            return false;
+        return ge_set_xo(r, x, p[0] == 0x03);
+    };
+
+    if (nLen == 65 && (p[0] == 0x04 || p[0] == 0x06 || p[0] == 0x07))
+    {
+        if (!fe_set_b32(x, p + 1) || !fe_set_b32(y, p + 33))
+            return false;
+        if (p[0] != 0x04 && fe_is_odd(y) != (p[0] == 0x07))
+            return false;
+        r.x = x;
+        r.y = y;
+        r.fInfinity = false;
+        return ge_is_valid(r);
+    };
+
+    return false;
+}
+
+static unsigned int pubkey_serialize(unsigned char *p, const ge& a, bool fCompressed)
+{
+    fe_get_b32(p + 1, a.x);
+    if (fCompressed)
+    {
+        p[0] = fe_is_odd(a.y) ? 0x03 : 0x02;
+        return 33;
+    };
+    p[0] = 0x04;
+    fe_get_b32(p + 33, a.y);
+    return 65;
+}
+
+static bool der_parse_integer(const unsigned char *pSig, size_t nSigLen, size_t& nPos, scalar& r)
+{
+    // a minimally encoded, non negative INTEGER in 1..n-1
+    if (nPos + 2 > nSigLen || pSig[nPos] != 0x02)
+        return false;
+    size_t nLen = pSig[nPos + 1];
+    if (nLen == 0 || nLen >= 0x80 || nPos + 2 + nLen > nSigLen)
+        return false;
+    const unsigned char *p = &pSig[nPos + 2];
+    if (p[0] & 0x80)
+        return false;
+    if (nLen > 1 && p[0] == 0 && !(p[1] & 0x80))
+        return false;
+    nPos += 2 + nLen;
+
+    if (p[0] == 0)
+    {
+        p++;
+        nLen--;
+    };
+    if (nLen > 32)
+        return false;
+    unsigned char b[32];
+    memset(b, 0, sizeof(b));
+    memcpy(b + 32 - nLen, p, nLen);
+    bool fOverflow;
+    sc_set_b32(r, b, &fOverflow);
+    return !fOverflow && !sc_is_zero(r);
+}
+
+static bool der_parse(const unsigned char *pSig, size_t nSigLen, scalar& r, scalar& s)
+{
+    // OpenSSL re-encodes what it parsed and rejects the signature unless the bytes match, so only
+    // DER with short lengths, minimal integers and nothing trailing can pass
+    if (nSigLen < 8 || pSig[0] != 0x30 || pSig[1] >= 0x80 || (size_t)pSig[1] != nSigLen - 2)
+        return false;
+    size_t nPos = 2;
+    if (!der_parse_integer(pSig, nSigLen, nPos, r)
+        || !der_parse_integer(pSig, nSigLen, nPos, s))
+        return false;
+    return nPos == nSigLen;
+}
+
+static void der_append_integer(std::vector<unsigned char>& vch, const scalar& a)
+{
+    unsigned char b[33];
+    b[0] = 0;
+    sc_get_b32(b + 1, a);
+    int nStart = 0;
+    while (nStart < 32 && b[nStart] == 0 && !(b[nStart + 1] & 0x80))
+        nStart++;
+    vch.push_back(0x02);
+    vch.push_back(33 - nStart);
+    vch.insert(vch.end(), b + nStart, b + 33);
+}
+
+
+/** RFC6979 nonces, HMAC-SHA256 */
+
+class CRFC6979
+{
+public:
+    unsigned char K[32];
+    unsigned char V[32];
+
+    CRFC6979(const unsigned char vchKey[32], const unsigned char vchHash[32])
+    {
+        memset(V, 0x01, sizeof(V));
+        memset(K, 0x00, sizeof(K));
+        Update(0x00, vchKey, vchHash);
+        Update(0x01, vchKey, vchHash);
+    };
+
+    ~CRFC6979()
+    {
+        OPENSSL_cleanse(K, sizeof(K));
+        OPENSSL_cleanse(V, sizeof(V));
+    };
+
+    void Generate(unsigned char vchOut[32])
+    {
+        if (fRetry)
+        {
+            Update(0x00, NULL, NULL);
+        };
+        Mac(V, V, 32, NULL, 0, NULL, 0);
+        memcpy(vchOut, V, 32);
+        fRetry = true;
+    };
+
+private:
+    bool fRetry;
+
+    void Mac(unsigned char vchOut[32], const unsigned char *p1, size_t n1, const unsigned char *p2, size_t n2,
+        const unsigned char *p3, size_t n3)
+    {
+        HMAC_SHA256_CTX ctx;
+        HMAC_SHA256_Init(&ctx, K, 32);
+        HMAC_SHA256_Update(&ctx, p1, n1);
+        if (n2)
+            HMAC_SHA256_Update(&ctx, p2, n2);
+        if (n3)
+            HMAC_SHA256_Update(&ctx, p3, n3);
+        HMAC_SHA256_Final(vchOut, &ctx);
+        OPENSSL_cleanse(&ctx, sizeof(ctx));
+    };
+
+    void Update(unsigned char nSep, const unsigned char *pKey, const unsigned char *pHash)
+    {
+        // K = HMAC_K(V || nSep || key || hash), V = HMAC_K(V)
+        unsigned char vchMsg[33];
+        memcpy(vchMsg, V, 32);
+        vchMsg[32] = nSep;
+        Mac(K, vchMsg, 33, pKey, pKey ? 32 : 0, pHash, pHash ? 32 : 0);
+        Mac(V, V, 32, NULL, 0, NULL, 0);
+        fRetry = false;
+    };
+};
+
+}; // end of anonymous namespace
+
+
+bool Secp256k1::Verify(const unsigned char *pPubKey, size_t nPubKeyLen, const unsigned char vchHash[32],
+    const unsigned char *pSig, size_t nSigLen)
+{
+    ge q;
+    scalar r, s, m;
+    if (!pPubKey || !pubkey_parse(q, pPubKey, nPubKeyLen))
+        return false;
+    if (!pSig || !der_parse(pSig, nSigLen, r, s))
+        return false;
+    sc_set_b32(m, vchHash, NULL);
+
+    scalar w, u1, u2;
+    sc_inv_var(w, s);
+    sc_mul(u1, m, w);
+    sc_mul(u2, r, w);
+
+    gej qj, pr;
+    gej_set_ge(qj, q);
+    ecmult(pr, qj, u2, u1);
+    if (pr.fInfinity)
+        return false;
+
+    // x(pr) mod n == r, compared as X == r * Z^2 without inverting Z, x may also be r + n when below p
+    unsigned char vchR[32];
+    fe xr, z2, t;
+    sc_get_b32(vchR, r);
+    fe_set_b32(xr, vchR);
+    fe_sqr(z2, pr.z);
+    fe_mul(t, xr, z2);
+    if (fe_equal(t, pr.x))
+        return true;
+
+    uint64_t vr[4];
+    memcpy(vr, xr.n, sizeof(vr));
+    if (u256_ge(vr, FE_P_MINUS_ORDER.n))
+        return false;
+    const uint64_t vn[4] = {N_0, N_1, N_2, N_3};
+    u256_add(xr.n, xr.n, vn);
+    fe_mul(t, xr, z2);
+    return fe_equal(t, pr.x);
+}
+
+bool Secp256k1::Sign(const unsigned char vchSecret[32], const unsigned char vchHash[32], std::vector<unsigned char>& vchSig)
+{
+    vchSig.clear();
+
+    scalar d, m;
+    bool fOverflow;
+    sc_set_b32(d, vchSecret, &fOverflow);
+    if (fOverflow || sc_is_zero(d))
+        return false;
+
+    // -- the nonce is derived from the secret and the hash reduced mod n, as RFC6979 bits2octets
+    unsigned char vchM[32];
+    sc_set_b32(m, vchHash, NULL);
+    sc_get_b32(vchM, m);
+
+    CRFC6979 rng(vchSecret, vchM);
+    scalar k, r, s;
+    for (;;)
+    {
+        unsigned char vchK[32];
+        rng.Generate(vchK);
+        sc_set_b32(k, vchK, &fOverflow);
+        OPENSSL_cleanse(vchK, sizeof(vchK));
+        if (fOverflow || sc_is_zero(k))
+            continue;
+
+        gej rj;
+        ge ra;
+        ecmult_gen(rj, k);
+        ge_set_gej(ra, rj);
+
+        unsigned char vchR[32];
+        fe_get_b32(vchR, ra.x);
+        sc_set_b32(r, vchR, NULL);
+        if (sc_is_zero(r))
+            continue;
+
+        // s = k^-1 * (m + r * d)
+        scalar kinv;
+        sc_inv(kinv, k);
+        sc_mul(s, r, d);
+        sc_add(s, s, m);
+        sc_mul(s, s, kinv);
+        OPENSSL_cleanse(&kinv, sizeof(kinv));
+        if (sc_is_zero(s))
+            continue;
+        break;
+    };
+    OPENSSL_cleanse(&k, sizeof(k));
+    OPENSSL_cleanse(&d, sizeof(d));
+
+    // enforce low S values, by negating the value (modulo the order) if above order/2.
+    if (sc_is_high(s))
+        sc_negate(s, s);
+
+    vchSig.push_back(0x30);
+    vchSig.push_back(0x00);
+    der_append_integer(vchSig, r);
+    der_append_integer(vchSig, s);
+    vchSig[1] = vchSig.size() - 2;
+    return true;
+}
+
+unsigned int Secp256k1::GetPubKey(const unsigned char vchSecret[32], bool fCompressed, unsigned char vchPubKey[65])
+{
+    scalar d;
+    bool fOverflow;
+    sc_set_b32(d, vchSecret, &fOverflow);
+    if (fOverflow || sc_is_zero(d))
+        return 0;
+
+    gej pj;
+    ge p;
+    ecmult_gen(pj, d);
+    ge_set_gej(p, pj);
+    OPENSSL_cleanse(&d, sizeof(d));
+    return pubkey_serialize(vchPubKey, p, fCompressed);
+}
+
+bool Secp256k1::SelfTest()
+{
+    // RFC6979 test vector: secret 1, SHA256("Satoshi Nakamoto")
+    static const unsigned char vchExpect[] = {
+        0x30,0x45,0x02,0x21,0x00,0x93,0x4b,0x1e,0xa1,0x0a,0x4b,0x3c,0x17,0x57,0xe2,0xb0,
+        0xc0,0x17,0xd0,0xb6,0x14,0x3c,0xe3,0xc9,0xa7,0xe6,0xa4,0xa4,0x98,0x60,0xd7,0xa6,
+        0xab,0x21,0x0e,0xe3,0xd8,0x02,0x20,0x24,0x42,0xce,0x9d,0x2b,0x91,0x60,0x64,0x10,
+        0x80,0x14,0x78,0x3e,0x92,0x3e,0xc3,0x6b,0x49,0x74,0x3e,0x2f,0xfa,0x1c,0x44,0x96,
+        0xf0,0x1a,0x51,0x2a,0xaf,0xd9,0xe5
+    };
+    unsigned char vchSecret[32];
+    memset(vchSecret, 0, sizeof(vchSecret));
+    vchSecret[31] = 1;
+    unsigned char vchHash[32];
+    const char *pszMsg = "Satoshi Nakamoto";
+    SHA256((const unsigned char*)pszMsg, strlen(pszMsg), vchHash);
+
+    std::vector<unsigned char> vchSig;
+    if (!Sign(vchSecret, vchHash, vchSig)
+        || vchSig.size() != sizeof(vchExpect)
+        || memcmp(&vchSig[0], vchExpect, sizeof(vchExpect)) != 0)
+        return false;
+
+    unsigned char vchPubKey[65];
+    if (GetPubKey(vchSecret, true, vchPubKey) != 33
+        || !Verify(vchPubKey, 33, vchHash, &vchSig[0], vchSig.size()))
+        return false;
+
+    vchHash[0] ^= 1;
+    return !Verify(vchPubKey, 33, vchHash, &vchSig[0], vchSig.size());
+}
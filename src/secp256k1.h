@@ -0,0 +1,34 @@
+// Copyright (c) 2014-2015 The Sumcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SECP256K1_H
+#define SECP256K1_H
+
+#include <stddef.h>
+#include <vector>
+
+/** ECDSA on secp256k1 with field and group arithmetic specialized for the curve, used by CKey and
+ *  CPubKey in place of OpenSSL's generic curve code. Hashes are the 32 bytes OpenSSL was given,
+ *  read as a big endian number.
+ */
+namespace Secp256k1
+{
+    // Accepts exactly what OpenSSL's ECDSA_verify does: a DER signature with nothing after it that
+    // re-encodes to the same bytes, 0 < r, s < order, high s allowed, and compressed, uncompressed or
+    // hybrid public keys on the curve.
+    bool Verify(const unsigned char *pPubKey, size_t nPubKeyLen, const unsigned char vchHash[32],
+        const unsigned char *pSig, size_t nSigLen);
+
+    // DER signature with an RFC6979 nonce and low s, constant time in the secret and the nonce.
+    bool Sign(const unsigned char vchSecret[32], const unsigned char vchHash[32], std::vector<unsigned char>& vchSig);
+
+    // Writes the 33 or 65 byte public key of vchSecret, constant time.
+    // Returns the length written, 0 if vchSecret isn't a valid secret.
+    unsigned int GetPubKey(const unsigned char vchSecret[32], bool fCompressed, unsigned char vchPubKey[65]);
+
+    // Known answer test, run by ECC_InitSanityCheck.
+    bool SelfTest();
+};
+
+#endif // SECP256K1_H
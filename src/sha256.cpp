@@ -0,0 +1,482 @@
+// Copyright (c) 2015 The Sumcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+// One SHA-256 block function serves CSHA256 and the miner: the SHA extensions, else OpenSSL's before
+// 3.0, else the portable one. Merkle
+// levels go through SHA256D64, which also has 4 and 8 lane versions hashing that many 64 byte
+// messages together, a message per vector lane. All are compiled with per-function target
+// attributes and picked at runtime, so the build flags stay as they are.
+
+#include "sha256.h"
+
+#include <string.h>
+
+#include <openssl/opensslv.h>
+
+// -- OpenSSL 3.0 deprecates SHA256_Init and SHA256_Transform, the portable block function stands in there
+#if OPENSSL_VERSION_NUMBER < 0x30000000L
+#define SHA256_OPENSSL
+#include <openssl/sha.h>
+#endif
+
+namespace {
+
+static const uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t IV[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// -- the second block of a 64 byte message, and of a 32 byte hash after its padding
+static const uint32_t PAD64[16] = { 0x80000000, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 512 };
+
+static inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+static inline void WriteBE64(unsigned char* p, uint64_t x)
+{
+    WriteBE32(p, x >> 32);
+    WriteBE32(p + 4, (uint32_t)x);
+}
+
+static inline uint32_t Ror(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+static void CompressWords(uint32_t* s, uint32_t* w)
+{
+    for (int i = 16; i < 64; i++)
+        w[i] = (Ror(w[i - 2], 17) ^ Ror(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7]
+            + (Ror(w[i - 15], 7) ^ Ror(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+    // -- eight rounds a pass, renaming the working variables instead of moving them
+#define Round(a, b, c, d, e, f, g, h, i) { \
+        uint32_t t1 = h + (Ror(e, 6) ^ Ror(e, 11) ^ Ror(e, 25)) + (g ^ (e & (f ^ g))) + K[i] + w[i]; \
+        uint32_t t2 = (Ror(a, 2) ^ Ror(a, 13) ^ Ror(a, 22)) + ((a & b) | (c & (a | b))); \
+        d += t1; h = t1 + t2; }
+    uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i += 8)
+    {
+        Round(a, b, c, d, e, f, g, h, i);
+        Round(h, a, b, c, d, e, f, g, i + 1);
+        Round(g, h, a, b, c, d, e, f, i + 2);
+        Round(f, g, h, a, b, c, d, e, i + 3);
+        Round(e, f, g, h, a, b, c, d, i + 4);
+        Round(d, e, f, g, h, a, b, c, i + 5);
+        Round(c, d, e, f, g, h, a, b, i + 6);
+        Round(b, c, d, e, f, g, h, a, i + 7);
+    };
+#undef Round
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+static void TransformPortable(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    uint32_t w[64];
+    for (; nBlocks; nBlocks--, chunk += 64)
+    {
+        for (int i = 0; i < 16; i++)
+            w[i] = ReadBE32(chunk + i * 4);
+        CompressWords(s, w);
+    };
+}
+
+#ifdef SHA256_OPENSSL
+// -- OpenSSL's block function, its assembly is quicker than the C above on cpus without the SHA extensions
+static void TransformOpenSSL(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    memcpy(ctx.h, s, sizeof(ctx.h));
+    for (; nBlocks; nBlocks--, chunk += 64)
+        SHA256_Transform(&ctx, chunk);
+    memcpy(s, ctx.h, sizeof(ctx.h));
+}
+#endif
+
+typedef void (*TransformFn)(uint32_t* s, const unsigned char* chunk, size_t nBlocks);
+typedef void (*TransformD64Fn)(unsigned char* out, const unsigned char* in);
+
+static TransformFn Transform = TransformPortable;
+
+// -- one message at a time through Transform, the padding blocks are known
+static void TransformD64OneWay(unsigned char* out, const unsigned char* in)
+{
+    static const unsigned char vchPad64[64] =
+    {
+        0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0,
+    };
+    static const unsigned char vchPad32[32] =
+    {
+        0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0,
+    };
+
+    uint32_t s[8];
+    unsigned char buf[64];
+    memcpy(s, IV, sizeof(s));
+    Transform(s, in, 1);
+    Transform(s, vchPad64, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(buf + i * 4, s[i]);
+    memcpy(buf + 32, vchPad32, 32);
+    memcpy(s, IV, sizeof(s));
+    Transform(s, buf, 1);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(out + i * 4, s[i]);
+}
+
+static TransformD64Fn TransformD64_4way = NULL;
+static TransformD64Fn TransformD64_8way = NULL;
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA256_X86
+
+// -- not every compiler's __builtin_cpu_supports knows the SHA extensions, cpuid leaf 7 has them in ebx bit 29
+static bool HaveSHANI()
+{
+    unsigned int a, b, c, d;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1 << 29));
+}
+
+/* SHA extensions, Intel's sequence. The state is kept as ABEF/CDGH, each sha256rnds2 does two rounds
+   and the message schedule runs four words ahead through sha256msg1/msg2.
+ */
+__attribute__((target("sha,sse4.1")))
+static void TransformSHANI(uint32_t* s, const unsigned char* chunk, size_t nBlocks)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; nBlocks; nBlocks--, chunk += 64)
+    {
+        __m128i save0 = state0, save1 = state1;
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 0)), MASK);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16)), MASK);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 32)), MASK);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 48)), MASK);
+
+        // four rounds on words 4i..4i+3, and the next four schedule words from the last sixteen
+#define QuadRound(i, m) { \
+            __m128i msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)&K[(i) * 4])); \
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E)); }
+#define Schedule(m0, m1, m2, m3) \
+            m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3)
+
+        QuadRound(0, m0); QuadRound(1, m1); QuadRound(2, m2); QuadRound(3, m3);
+        for (int i = 4; i < 16; i += 4)
+        {
+            Schedule(m0, m1, m2, m3); QuadRound(i, m0);
+            Schedule(m1, m2, m3, m0); QuadRound(i + 1, m1);
+            Schedule(m2, m3, m0, m1); QuadRound(i + 2, m2);
+            Schedule(m3, m0, m1, m2); QuadRound(i + 3, m3);
+        };
+#undef QuadRound
+#undef Schedule
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    };
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&s[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&s[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+/* Multi-lane double SHA-256 of 64 byte messages. Vector register k holds word k of every lane's
+   state or schedule, so the rounds run on all lanes together. The body is shared by the SSE4.1 and
+   AVX2 versions through the operation macros each defines.
+ */
+#define SHA256_LANES_ROUND(T, a, b, c, d, e, f, g, h, i) { \
+        T t1 = Add(Add(Add(Add(h, Xor(Xor(Ror(e, 6), Ror(e, 11)), Ror(e, 25))), Xor(g, And(e, Xor(f, g)))), Set1(K[i])), w[i]); \
+        T t2 = Add(Xor(Xor(Ror(a, 2), Ror(a, 13)), Ror(a, 22)), Or(And(a, b), And(c, Or(a, b)))); \
+        d = Add(d, t1); h = Add(t1, t2); }
+
+#define SHA256_LANES_COMPRESS(T) \
+    { \
+        for (int i = 16; i < 64; i++) \
+            w[i] = Add(Add(Add(Xor(Xor(Ror(w[i - 2], 17), Ror(w[i - 2], 19)), ShR(w[i - 2], 10)), w[i - 7]), \
+                Xor(Xor(Ror(w[i - 15], 7), Ror(w[i - 15], 18)), ShR(w[i - 15], 3))), w[i - 16]); \
+        T a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7]; \
+        for (int i = 0; i < 64; i += 8) \
+        { \
+            SHA256_LANES_ROUND(T, a, b, c, d, e, f, g, h, i); \
+            SHA256_LANES_ROUND(T, h, a, b, c, d, e, f, g, i + 1); \
+            SHA256_LANES_ROUND(T, g, h, a, b, c, d, e, f, i + 2); \
+            SHA256_LANES_ROUND(T, f, g, h, a, b, c, d, e, i + 3); \
+            SHA256_LANES_ROUND(T, e, f, g, h, a, b, c, d, i + 4); \
+            SHA256_LANES_ROUND(T, d, e, f, g, h, a, b, c, i + 5); \
+            SHA256_LANES_ROUND(T, c, d, e, f, g, h, a, b, i + 6); \
+            SHA256_LANES_ROUND(T, b, c, d, e, f, g, h, a, i + 7); \
+        }; \
+        s[0] = Add(s[0], a); s[1] = Add(s[1], b); s[2] = Add(s[2], c); s[3] = Add(s[3], d); \
+        s[4] = Add(s[4], e); s[5] = Add(s[5], f); s[6] = Add(s[6], g); s[7] = Add(s[7], h); \
+    }
+
+#define SHA256_LANES_D64(T, LANES) \
+    { \
+        T s[8], w[64]; \
+        for (int k = 0; k < 16; k++) \
+        { \
+            uint32_t v[LANES]; \
+            for (int l = 0; l < LANES; l++) \
+                v[l] = ReadBE32(in + l * 64 + k * 4); \
+            w[k] = Load(v); \
+        }; \
+        for (int k = 0; k < 8; k++) \
+            s[k] = Set1(IV[k]); \
+        SHA256_LANES_COMPRESS(T) \
+        for (int k = 0; k < 16; k++) \
+            w[k] = Set1(PAD64[k]); \
+        SHA256_LANES_COMPRESS(T) \
+        for (int k = 0; k < 8; k++) \
+        { \
+            w[k] = s[k]; \
+            s[k] = Set1(IV[k]); \
+        }; \
+        w[8] = Set1(0x80000000); \
+        for (int k = 9; k < 15; k++) \
+            w[k] = Set1(0); \
+        w[15] = Set1(256); \
+        SHA256_LANES_COMPRESS(T) \
+        for (int k = 0; k < 8; k++) \
+        { \
+            uint32_t v[LANES]; \
+            Store(v, s[k]); \
+            for (int l = 0; l < LANES; l++) \
+                WriteBE32(out + l * 32 + k * 4, v[l]); \
+        }; \
+    }
+
+__attribute__((target("sse4.1")))
+static void TransformD64SSE41(unsigned char* out, const unsigned char* in)
+{
+#define Add(a, b) _mm_add_epi32(a, b)
+#define Xor(a, b) _mm_xor_si128(a, b)
+#define Or(a, b) _mm_or_si128(a, b)
+#define And(a, b) _mm_and_si128(a, b)
+#define ShR(a, n) _mm_srli_epi32(a, n)
+#define Ror(a, n) _mm_or_si128(_mm_srli_epi32(a, n), _mm_slli_epi32(a, 32 - (n)))
+#define Set1(x) _mm_set1_epi32(x)
+#define Load(v) _mm_loadu_si128((const __m128i*)(v))
+#define Store(v, x) _mm_storeu_si128((__m128i*)(v), x)
+    SHA256_LANES_D64(__m128i, 4)
+#undef Add
+#undef Xor
+#undef Or
+#undef And
+#undef ShR
+#undef Ror
+#undef Set1
+#undef Load
+#undef Store
+}
+
+__attribute__((target("avx2")))
+static void TransformD64AVX2(unsigned char* out, const unsigned char* in)
+{
+#define Add(a, b) _mm256_add_epi32(a, b)
+#define Xor(a, b) _mm256_xor_si256(a, b)
+#define Or(a, b) _mm256_or_si256(a, b)
+#define And(a, b) _mm256_and_si256(a, b)
+#define ShR(a, n) _mm256_srli_epi32(a, n)
+#define Ror(a, n) _mm256_or_si256(_mm256_srli_epi32(a, n), _mm256_slli_epi32(a, 32 - (n)))
+#define Set1(x) _mm256_set1_epi32(x)
+#define Load(v) _mm256_loadu_si256((const __m256i*)(v))
+#define Store(v, x) _mm256_storeu_si256((__m256i*)(v), x)
+    SHA256_LANES_D64(__m256i, 8)
+#undef Add
+#undef Xor
+#undef Or
+#undef And
+#undef ShR
+#undef Ror
+#undef Set1
+#undef Load
+#undef Store
+}
+
+#undef SHA256_LANES_D64
+#undef SHA256_LANES_COMPRESS
+#undef SHA256_LANES_ROUND
+#endif
+
+// -- compares an implementation against the portable one on a few messages, before it's used
+static bool SelfTest(TransformFn fnTransform, TransformD64Fn fnD64, int nLanes)
+{
+    unsigned char in[8 * 64], out[8 * 32], outExpect[8 * 32];
+    for (unsigned int i = 0; i < sizeof(in); i++)
+        in[i] = (unsigned char)(i * 7 + (i >> 6));
+
+    if (fnTransform)
+    {
+        uint32_t s1[8], s2[8];
+        memcpy(s1, IV, sizeof(s1));
+        memcpy(s2, IV, sizeof(s2));
+        TransformPortable(s1, in, 8);
+        fnTransform(s2, in, 8);
+        if (memcmp(s1, s2, sizeof(s1)) != 0)
+            return false;
+    };
+
+    if (fnD64)
+    {
+        TransformFn fnSave = Transform;
+        Transform = TransformPortable;
+        for (int l = 0; l < nLanes; l++)
+            TransformD64OneWay(outExpect + l * 32, in + l * 64);
+        Transform = fnSave;
+        fnD64(out, in);
+        if (memcmp(out, outExpect, nLanes * 32) != 0)
+            return false;
+    };
+    return true;
+}
+
+} // namespace
+
+CSHA256::CSHA256()
+{
+    Reset();
+}
+
+CSHA256& CSHA256::Reset()
+{
+    memcpy(s, IV, sizeof(s));
+    nBytes = 0;
+    return *this;
+}
+
+CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    size_t nBufSize = nBytes % 64;
+    if (nBufSize && nBufSize + len >= 64)
+    {
+        // complete the buffered block
+        memcpy(buf + nBufSize, data, 64 - nBufSize);
+        nBytes += 64 - nBufSize;
+        data += 64 - nBufSize;
+        Transform(s, buf, 1);
+        nBufSize = 0;
+    };
+
+    if (end - data >= 64)
+    {
+        // whole blocks straight from the input
+        size_t nBlocks = (end - data) / 64;
+        Transform(s, data, nBlocks);
+        data += 64 * nBlocks;
+        nBytes += 64 * nBlocks;
+    };
+
+    if (end > data)
+    {
+        memcpy(buf + nBufSize, data, end - data);
+        nBytes += end - data;
+    };
+    return *this;
+}
+
+void CSHA256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    static const unsigned char pad[64] = {0x80};
+    unsigned char sizedesc[8];
+    WriteBE64(sizedesc, nBytes << 3);
+    Write(pad, 1 + ((119 - (nBytes % 64)) % 64));
+    Write(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(hash + i * 4, s[i]);
+}
+
+void SHA256Compress(uint32_t state[8], const unsigned char* pBlocks, size_t nBlocks)
+{
+    Transform(state, pBlocks, nBlocks);
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks)
+{
+    if (TransformD64_8way)
+    {
+        for (; nBlocks >= 8; nBlocks -= 8, in += 8 * 64, out += 8 * 32)
+            TransformD64_8way(out, in);
+    };
+    if (TransformD64_4way)
+    {
+        for (; nBlocks >= 4; nBlocks -= 4, in += 4 * 64, out += 4 * 32)
+            TransformD64_4way(out, in);
+    };
+    for (; nBlocks; nBlocks--, in += 64, out += 32)
+        TransformD64OneWay(out, in);
+}
+
+std::string SHA256AutoDetect(bool fAccel)
+{
+    Transform = TransformPortable;
+    TransformD64_4way = NULL;
+    TransformD64_8way = NULL;
+    if (!fAccel)
+        return "portable";
+
+#ifdef SHA256_OPENSSL
+    std::string strRet = "openssl";
+    if (SelfTest(TransformOpenSSL, NULL, 0))
+        Transform = TransformOpenSSL;
+    else
+        strRet = "portable";
+#else
+    std::string strRet = "portable";
+#endif
+
+#ifdef SHA256_X86
+    __builtin_cpu_init();
+    bool fSHANI = false;
+    if (HaveSHANI() && __builtin_cpu_supports("sse4.1") && SelfTest(TransformSHANI, NULL, 0))
+    {
+        Transform = TransformSHANI;
+        strRet = "shani";
+        fSHANI = true;
+    };
+
+    // -- one message at a time with the SHA extensions outruns four in SSE registers, not eight in AVX2
+    if (!fSHANI && __builtin_cpu_supports("sse4.1") && SelfTest(NULL, TransformD64SSE41, 4))
+    {
+        TransformD64_4way = TransformD64SSE41;
+        strRet += ",sse41(4way)";
+    };
+    if (__builtin_cpu_supports("avx2") && SelfTest(NULL, TransformD64AVX2, 8))
+    {
+        TransformD64_8way = TransformD64AVX2;
+        strRet += ",avx2(8way)";
+    };
+#endif
+    return strRet;
+}
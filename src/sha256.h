@@ -0,0 +1,43 @@
+// Copyright (c) 2015 The Sumcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/** SHA-256 for Hash, CHashWriter and the merkle trees. The block function is picked once at startup
+ *  by SHA256AutoDetect, until then (and off x86) the portable one is used.
+ */
+class CSHA256
+{
+private:
+    uint32_t s[8];
+    unsigned char buf[64];
+    uint64_t nBytes;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    CSHA256();
+    CSHA256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CSHA256& Reset();
+};
+
+// Compresses nBlocks 64 byte blocks into state, for callers keeping their own midstate.
+void SHA256Compress(uint32_t state[8], const unsigned char* pBlocks, size_t nBlocks);
+
+// SHA256(SHA256(x)) of nBlocks 64 byte messages, in + i * 64 to out + i * 32, as a merkle node hashes
+// its two children. Runs 8 (AVX2) or 4 (SSE4.1) messages at once where it can.
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t nBlocks);
+
+// Selects the fastest implementations the cpu has, each checked against the portable one first, and
+// returns their names for the log. fAccel false selects the portable ones. Not thread safe, call it
+// before anything else hashes.
+std::string SHA256AutoDetect(bool fAccel = true);
+
+#endif // SHA256_H
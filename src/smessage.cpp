@@ -83,6 +83,13 @@ CCriticalSection cs_smsgThreads;
 
 leveldb::DB *smsgDB = NULL;
 
+static int64_t nSmsgPeerRate  = SMSG_PEER_RATE * 1000;    // bytes per second, 0 for no limit
+static int64_t nSmsgTotalRate = SMSG_TOTAL_RATE * 1000;
+static SecMsgTokenBucket smsgTotalBucket;                // shared by all peers, cs_smsgRate
+static CCriticalSection cs_smsgRate;
+
+static std::map<std::vector<uint8_t>, MessageData> mapSmsgHeaders; // decrypted headers by db key, cs_smsgDB
+
 
 namespace fs = boost::filesystem;
 
@@ -104,6 +111,13 @@ bool SecMsgCrypter::SetKey(const uint8_t* chNewKey, uint8_t* chNewIV)
     return true;
 };
 
+bool SecMsgCrypter::InitCtx(bool fEncrypt)
+{
+    if (!ctx && !(ctx = EVP_CIPHER_CTX_new()))
+        return false;
+    return EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, &chKey[0], &chIV[0], fEncrypt ? 1 : 0);
+};
+
 bool SecMsgCrypter::Encrypt(uint8_t* chPlaintext, uint32_t nPlain, std::vector<uint8_t> &vchCiphertext)
 {
     if (!fKeySet)
@@ -115,20 +129,35 @@ bool SecMsgCrypter::Encrypt(uint8_t* chPlaintext, uint32_t nPlain, std::vector<u
     int nCLen = nLen + AES_BLOCK_SIZE, nFLen = 0;
     vchCiphertext = std::vector<uint8_t> (nCLen);
 
-    EVP_CIPHER_CTX ctx;
+    bool fOk = InitCtx(true);
+    if (fOk) fOk = EVP_EncryptUpdate(ctx, &vchCiphertext[0], &nCLen, chPlaintext, nLen);
+    if (fOk) fOk = EVP_EncryptFinal_ex(ctx, (&vchCiphertext[0])+nCLen, &nFLen);
 
-    bool fOk = true;
+    if (!fOk)
+        return false;
 
-    EVP_CIPHER_CTX_init(&ctx);
-    if (fOk) fOk = EVP_EncryptInit_ex(&ctx, EVP_aes_256_cbc(), NULL, &chKey[0], &chIV[0]);
-    if (fOk) fOk = EVP_EncryptUpdate(&ctx, &vchCiphertext[0], &nCLen, chPlaintext, nLen);
-    if (fOk) fOk = EVP_EncryptFinal_ex(&ctx, (&vchCiphertext[0])+nCLen, &nFLen);
-    EVP_CIPHER_CTX_cleanup(&ctx);
+    vchCiphertext.resize(nCLen + nFLen);
+
+    return true;
+};
+
+bool SecMsgCrypter::Encrypt(uint8_t* chData, uint32_t nPlain, uint32_t nBuffer, uint32_t& nCipher)
+{
+    // -- encrypt in place, chData must have room for nPlain + AES_BLOCK_SIZE bytes
+    if (!fKeySet
+        || nBuffer < nPlain + AES_BLOCK_SIZE)
+        return false;
+
+    int nCLen = 0, nFLen = 0;
+
+    bool fOk = InitCtx(true);
+    if (fOk) fOk = EVP_EncryptUpdate(ctx, chData, &nCLen, chData, nPlain);
+    if (fOk) fOk = EVP_EncryptFinal_ex(ctx, chData+nCLen, &nFLen);
 
     if (!fOk)
         return false;
 
-    vchCiphertext.resize(nCLen + nFLen);
+    nCipher = nCLen + nFLen;
 
     return true;
 };
@@ -143,15 +172,9 @@ bool SecMsgCrypter::Decrypt(uint8_t* chCiphertext, uint32_t nCipher, std::vector
 
     vchPlaintext.resize(nCipher);
 
-    EVP_CIPHER_CTX ctx;
-
-    bool fOk = true;
-
-    EVP_CIPHER_CTX_init(&ctx);
-    if (fOk) fOk = EVP_DecryptInit_ex(&ctx, EVP_aes_256_cbc(), NULL, &chKey[0], &chIV[0]);
-    if (fOk) fOk = EVP_DecryptUpdate(&ctx, &vchPlaintext[0], &nPLen, &chCiphertext[0], nCipher);
-    if (fOk) fOk = EVP_DecryptFinal_ex(&ctx, (&vchPlaintext[0])+nPLen, &nFLen);
-    EVP_CIPHER_CTX_cleanup(&ctx);
+    bool fOk = InitCtx(false);
+    if (fOk) fOk = EVP_DecryptUpdate(ctx, &vchPlaintext[0], &nPLen, &chCiphertext[0], nCipher);
+    if (fOk) fOk = EVP_DecryptFinal_ex(ctx, (&vchPlaintext[0])+nPLen, &nFLen);
 
     if (!fOk)
         return false;
@@ -161,6 +184,122 @@ bool SecMsgCrypter::Decrypt(uint8_t* chCiphertext, uint32_t nCipher, std::vector
     return true;
 };
 
+/*
+    Version 3 message payloads are compressed against a preset dictionary, short messages
+    rarely repeat enough of themselves for plain LZ4 to help.
+    Dictionaries are never changed once released, add a new id instead.
+    Most used strings are placed last, nearer the message data.
+    Dictionary 1 is hand-written from common chat phrases and coin terms, it was not trained on a corpus.
+*/
+static const char smsgDict1[] =
+    "0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZ abcdefghijklmnopqrstuvwxyz "
+    "https://www. .com/ .org/ .html?id= @gmail.com "
+    "Monday Tuesday Wednesday Thursday Friday Saturday Sunday "
+    "January February March April May June July August September October November December "
+    "transaction address wallet balance confirmations block chain stake staking "
+    "exchange price market order trade buy sell coins sent received payment invoice "
+    "private key public key signature encrypted message secure anonymous stealth "
+    "Sumcoin SUM BTC please send me the address for the payment. "
+    "I will send you the coins as soon as possible. "
+    "Could you please confirm that you have received it? "
+    "Do you have any questions about this? Let me know if there is anything else. "
+    "I have sent the payment to your address, the transaction id is "
+    "It should be confirmed within a few minutes. "
+    "I think that would be a good idea, what do you think about it? "
+    "I don't know, I'm not sure. I'm going to have to check with "
+    "Sorry for the late reply, I was away. Talk to you later. "
+    "Thank you very much for your help! Thanks for getting back to me. "
+    "Hello, how are you? Hi, I'm fine thanks, and you? "
+    "Yes, no problem. OK, great. Good morning, good evening, good night. "
+    "Best regards, Kind regards, Cheers, ";
+
+static const uint8_t* SecureMsgGetDict(uint8_t nDict, uint32_t& nDictLen)
+{
+    switch (nDict)
+    {
+        case 1:
+            nDictLen = sizeof(smsgDict1) - 1;
+            return (const uint8_t*) smsgDict1;
+        default:
+            break;
+    };
+
+    nDictLen = 0;
+    return NULL;
+};
+
+int SecureMsgCompressDict(uint8_t nDict, const uint8_t *pIn, uint32_t nIn, uint8_t *pOut, uint32_t nOutMax)
+{
+    /*
+    Compress nIn bytes into pOut, continuing an LZ4 stream primed with dictionary nDict.
+    No heap allocations, the stream state and window are on the stack.
+
+    returns compressed length, 0 on failure or if pOut is too small
+    */
+
+    uint32_t nDictLen;
+    const uint8_t* pDict = SecureMsgGetDict(nDict, nDictLen);
+    if (!pDict
+        || nDictLen > SMSG_MAX_DICT_BYTES
+        || nIn > SMSG_MAX_MSG_BYTES)
+        return 0;
+
+    // -- lz4.c is compiled into this unit, the stream state can be kept on the stack
+    LZ4_Data_Structure lz4ds;
+    char window[SMSG_MAX_DICT_BYTES + SMSG_MAX_MSG_BYTES];
+    char scratch[LZ4_COMPRESSBOUND(SMSG_MAX_DICT_BYTES)];
+
+    memcpy(window, pDict, nDictLen);
+    memcpy(window + nDictLen, pIn, nIn);
+
+    if (LZ4_resetStreamState(&lz4ds, window) != 0
+        || LZ4_compress_continue(&lz4ds, window, scratch, nDictLen) < 1)
+        return 0;
+
+    return LZ4_compress_limitedOutput_continue(&lz4ds, window + nDictLen, (char*) pOut, nIn, nOutMax);
+};
+
+int SecureMsgDecompressDict(uint8_t nDict, const uint8_t *pIn, uint32_t nIn, std::vector<uint8_t>& vchOut, uint32_t nOut)
+{
+    /*
+    Decompress into vchOut, vchOut is resized to nOut + 1, space for a null terminator.
+
+    Data is decoded on the stack right after a copy of the dictionary, the decoder is bounded to
+    the dictionary so a bad stream can't read outside the window.
+
+    returns
+        0 success
+        1 error
+        2 unknown dictionary
+    */
+
+    uint32_t nDictLen;
+    const uint8_t* pDict = SecureMsgGetDict(nDict, nDictLen);
+    if (!pDict)
+        return 2;
+
+    if (nDictLen > SMSG_MAX_DICT_BYTES
+        || nOut > SMSG_MAX_MSG_BYTES)
+        return 1;
+
+    char window[SMSG_MAX_DICT_BYTES + SMSG_MAX_MSG_BYTES];
+    memcpy(window, pDict, nDictLen);
+
+    if (LZ4_decompress_safe_withDict((const char*) pIn, window + nDictLen, nIn, nOut, nDictLen) != (int) nOut)
+        return 1;
+
+    try {
+        vchOut.resize(nOut + 1);
+    } catch (std::exception& e) {
+        return errorN(1, "%s: vchOut.resize %u threw: %s.", __func__, nOut + 1, e.what());
+    };
+
+    if (nOut > 0)
+        memcpy(&vchOut[0], window + nDictLen, nOut);
+
+    return 0;
+};
+
 void SecMsgBucket::hashBucket()
 {
     if (fDebugSmsg)
@@ -423,6 +562,206 @@ bool SecMsgDB::ExistsPK(CKeyID& addr)
 };
 
 
+bool SecMsgDB::ReadLastScanned(uint256& hashBlock)
+{
+    if (!pdb)
+        return false;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 's';
+    ssKey << 'c';
+    std::string strValue;
+
+    bool readFromDb = true;
+    if (activeBatch)
+    {
+        // -- check activeBatch first
+        bool deleted = false;
+        readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
+        if (deleted)
+            return false;
+    };
+
+    if (readFromDb)
+    {
+        leveldb::Status s = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &strValue);
+        if (!s.ok())
+        {
+            if (s.IsNotFound())
+                return false;
+            LogPrintf("LevelDB read failure: %s\n", s.ToString().c_str());
+            return false;
+        };
+    };
+
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> hashBlock;
+    } catch (std::exception& e) {
+        LogPrintf("SecMsgDB::ReadLastScanned() unserialize threw: %s.\n", e.what());
+        return false;
+    }
+
+    return true;
+};
+
+bool SecMsgDB::WriteLastScanned(const uint256& hashBlock)
+{
+    if (!pdb)
+        return false;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 's';
+    ssKey << 'c';
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << hashBlock;
+
+    if (activeBatch)
+    {
+        activeBatch->Put(ssKey.str(), ssValue.str());
+        return true;
+    };
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pdb->Put(writeOptions, ssKey.str(), ssValue.str());
+    if (!s.ok())
+    {
+        LogPrintf("SecMsgDB write failure: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    return true;
+};
+
+bool SecMsgDB::ReadIndexVersion(uint32_t& nVersion)
+{
+    if (!pdb)
+        return false;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 'x';
+    ssKey << 'v';
+    std::string strValue;
+
+    leveldb::Status s = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &strValue);
+    if (!s.ok())
+    {
+        if (s.IsNotFound())
+            return false;
+        LogPrintf("LevelDB read failure: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> nVersion;
+    } catch (std::exception& e) {
+        LogPrintf("SecMsgDB::ReadIndexVersion() unserialize threw: %s.\n", e.what());
+        return false;
+    }
+
+    return true;
+};
+
+bool SecMsgDB::WriteIndexVersion(uint32_t nVersion)
+{
+    if (!pdb)
+        return false;
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << 'x';
+    ssKey << 'v';
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    ssValue << nVersion;
+
+    if (activeBatch)
+    {
+        activeBatch->Put(ssKey.str(), ssValue.str());
+        return true;
+    };
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    leveldb::Status s = pdb->Put(writeOptions, ssKey.str(), ssValue.str());
+    if (!s.ok())
+    {
+        LogPrintf("SecMsgDB write failure: %s\n", s.ToString().c_str());
+        return false;
+    };
+
+    return true;
+};
+
+static bool SecureMsgIsIndexed(const uint8_t* chKey)
+{
+    // -- only the inbox and outbox are indexed
+    return chKey[1] == 'm'
+        && (chKey[0] == 'i' || chKey[0] == 's');
+};
+
+static std::string SecureMsgIndexPrefix(char type, char folder, const std::string& sAddress)
+{
+    std::string sIndex;
+    sIndex.reserve(4 + sAddress.size() + 8 + 18);
+    sIndex += 'x';
+    sIndex += type;
+    sIndex += folder;
+    if (type == SMSG_INDEX_ADDRESS)
+    {
+        sIndex += (char)sAddress.size();
+        sIndex += sAddress;
+    };
+    return sIndex;
+};
+
+static void SecureMsgIndexAppendTime(std::string& sIndex, int64_t nTime)
+{
+    // -- big endian so leveldb orders the index by time
+    for (int i = 7; i >= 0; --i)
+        sIndex += (char)(((uint64_t)nTime >> (i * 8)) & 0xFF);
+};
+
+static std::string SecureMsgIndexKey(char type, const uint8_t* chKey, const std::string& sAddress)
+{
+    int64_t nTime;
+    memcpy(&nTime, &chKey[2], 8);
+
+    std::string sIndex = SecureMsgIndexPrefix(type, chKey[0], sAddress);
+    SecureMsgIndexAppendTime(sIndex, nTime);
+    sIndex.append((const char*)chKey, 18);
+    return sIndex;
+};
+
+static void SecureMsgWriteIndex(leveldb::WriteBatch* batch, const uint8_t* chKey, const SecMsgStored& smsgStored, bool fErase)
+{
+    // -- index keys are derived from the primary key and fields that don't change once stored,
+    //    except for the read state, so they can be rewritten without reading the old record.
+    if (!SecureMsgIsIndexed(chKey))
+        return;
+
+    std::string sTime = SecureMsgIndexKey(SMSG_INDEX_TIME, chKey, "");
+    std::string sUnread = SecureMsgIndexKey(SMSG_INDEX_UNREAD, chKey, "");
+    bool fAddress = smsgStored.sAddrTo.size() > 0 && smsgStored.sAddrTo.size() < 256;
+
+    if (fErase)
+    {
+        batch->Delete(sTime);
+        batch->Delete(sUnread);
+        if (fAddress)
+            batch->Delete(SecureMsgIndexKey(SMSG_INDEX_ADDRESS, chKey, smsgStored.sAddrTo));
+        return;
+    };
+
+    batch->Put(sTime, "");
+    if (fAddress)
+        batch->Put(SecureMsgIndexKey(SMSG_INDEX_ADDRESS, chKey, smsgStored.sAddrTo), "");
+    if (smsgStored.status & SMSG_MASK_UNREAD)
+        batch->Put(sUnread, "");
+    else
+        batch->Delete(sUnread);
+};
+
 bool SecMsgDB::NextSmesg(leveldb::Iterator* it, std::string& prefix, uint8_t* chKey, SecMsgStored& smsgStored)
 {
     if (!pdb)
@@ -523,15 +862,19 @@ bool SecMsgDB::WriteSmesg(uint8_t* chKey, SecMsgStored& smsgStored)
     CDataStream ssValue(SER_DISK, CLIENT_VERSION);
     ssValue << smsgStored;
 
+    // -- the record and its index entries are written together
+    leveldb::WriteBatch batch;
+    leveldb::WriteBatch* pbatch = activeBatch ? activeBatch : &batch;
+
+    pbatch->Put(ssKey.str(), ssValue.str());
+    SecureMsgWriteIndex(pbatch, chKey, smsgStored, false);
+
     if (activeBatch)
-    {
-        activeBatch->Put(ssKey.str(), ssValue.str());
         return true;
-    };
 
     leveldb::WriteOptions writeOptions;
     writeOptions.sync = true;
-    leveldb::Status s = pdb->Put(writeOptions, ssKey.str(), ssValue.str());
+    leveldb::Status s = pdb->Write(writeOptions, &batch);
     if (!s.ok())
     {
         LogPrintf("SecMsgDB write failed: %s\n", s.ToString().c_str());
@@ -564,20 +907,33 @@ bool SecMsgDB::ExistsSmesg(uint8_t* chKey)
     return true;
 };
 
-bool SecMsgDB::EraseSmesg(uint8_t* chKey)
+bool SecMsgDB::EraseSmesg(uint8_t* chKey, const SecMsgStored* pStored)
 {
     CDataStream ssKey(SER_DISK, CLIENT_VERSION);
     ssKey.write((const char*)chKey, 18);
 
-    if (activeBatch)
+    leveldb::WriteBatch batch;
+    leveldb::WriteBatch* pbatch = activeBatch ? activeBatch : &batch;
+
+    if (SecureMsgIsIndexed(chKey))
     {
-        activeBatch->Delete(ssKey.str());
-        return true;
+        // -- the address index entry needs sAddrTo, read the record if the caller didn't pass it
+        SecMsgStored smsgStored;
+        if (!pStored
+            && ReadSmesg(chKey, smsgStored))
+            pStored = &smsgStored;
+        if (pStored)
+            SecureMsgWriteIndex(pbatch, chKey, *pStored, true);
     };
 
+    pbatch->Delete(ssKey.str());
+
+    if (activeBatch)
+        return true;
+
     leveldb::WriteOptions writeOptions;
     writeOptions.sync = true;
-    leveldb::Status s = pdb->Delete(writeOptions, ssKey.str());
+    leveldb::Status s = pdb->Write(writeOptions, &batch);
 
     if (s.ok() || s.IsNotFound())
         return true;
@@ -585,6 +941,76 @@ bool SecMsgDB::EraseSmesg(uint8_t* chKey)
     return false;
 };
 
+bool SecMsgDB::ListSmesg(const std::string& prefix, const std::string& sAddress, bool fUnreadOnly,
+    int64_t nSince, uint32_t nOffset, uint32_t nLimit, bool fNewestFirst, std::vector<std::vector<uint8_t> >& vKeys)
+{
+    // -- walk a secondary index, only the keys of the returned page are collected.
+    //    Filtering by address and unread together reads the records of the address index.
+    if (!pdb
+        || prefix.size() != 2
+        || sAddress.size() > 255)
+        return false;
+
+    char type = sAddress.size() > 0 ? SMSG_INDEX_ADDRESS
+              : fUnreadOnly ? SMSG_INDEX_UNREAD : SMSG_INDEX_TIME;
+    bool fCheckUnread = fUnreadOnly && type != SMSG_INDEX_UNREAD;
+
+    std::string sIndex = SecureMsgIndexPrefix(type, prefix[0], sAddress);
+    std::string sStart = sIndex;
+    SecureMsgIndexAppendTime(sStart, nSince);
+    size_t nKeyLen = sIndex.size() + 8 + 18;
+
+    leveldb::Iterator* it = pdb->NewIterator(leveldb::ReadOptions());
+    if (fNewestFirst)
+    {
+        std::string sEnd = sIndex;
+        sEnd.append(8 + 18, '\xff');
+        it->Seek(sEnd);
+        if (it->Valid())
+            it->Prev();
+        else
+            it->SeekToLast();
+    } else
+    {
+        it->Seek(sStart);
+    };
+
+    uint8_t chKey[18];
+    SecMsgStored smsgStored;
+    for (; it->Valid(); fNewestFirst ? it->Prev() : it->Next())
+    {
+        leveldb::Slice key = it->key();
+        if (key.size() != nKeyLen
+            || memcmp(key.data(), sIndex.data(), sIndex.size()) != 0)
+            break;
+
+        if (fNewestFirst
+            && memcmp(key.data(), sStart.data(), sStart.size()) < 0)
+            break; // older than nSince
+
+        memcpy(chKey, key.data() + nKeyLen - 18, 18);
+
+        if (fCheckUnread
+            && (!ReadSmesg(chKey, smsgStored)
+                || !(smsgStored.status & SMSG_MASK_UNREAD)))
+            continue;
+
+        if (nOffset > 0)
+        {
+            nOffset--;
+            continue;
+        };
+
+        vKeys.push_back(std::vector<uint8_t>(chKey, chKey + 18));
+        if (nLimit > 0
+            && vKeys.size() >= nLimit)
+            break;
+    };
+    delete it;
+
+    return true;
+};
+
 void ThreadSecureMsg()
 {
     // -- bucket management thread
@@ -784,6 +1210,57 @@ void ThreadSecureMsgPow()
     };
 };
 
+static void SecureMsgReadRates()
+{
+    nSmsgPeerRate = GetArg("-smsgmaxpeerrate", SMSG_PEER_RATE) * 1000;
+    nSmsgTotalRate = GetArg("-smsgmaxrate", SMSG_TOTAL_RATE) * 1000;
+    LogPrintf("Secure messaging relay limits: %d kB/s per peer, %d kB/s total.\n", nSmsgPeerRate / 1000, nSmsgTotalRate / 1000);
+};
+
+int SecureMsgBuildIndex()
+{
+    // -- index messages stored before the secondary indices were added
+    LOCK(cs_smsgDB);
+
+    SecMsgDB db;
+    if (!db.Open("cr+"))
+        return errorN(1, "%s: Could not open DB.", __func__);
+
+    uint32_t nVersion;
+    if (db.ReadIndexVersion(nVersion)
+        && nVersion == SMSG_INDEX_VERSION)
+        return 0;
+
+    int64_t nStart = GetTimeMillis();
+    uint32_t nMessages = 0;
+    uint8_t chKey[18];
+    SecMsgStored smsgStored;
+
+    db.TxnBegin();
+
+    const char* folders[] = {"im", "sm"};
+    for (size_t i = 0; i < sizeof(folders) / sizeof(folders[0]); ++i)
+    {
+        std::string sPrefix(folders[i]);
+        leveldb::Iterator* it = db.pdb->NewIterator(leveldb::ReadOptions());
+        while (db.NextSmesg(it, sPrefix, chKey, smsgStored))
+        {
+            SecureMsgWriteIndex(db.activeBatch, chKey, smsgStored, false);
+            nMessages++;
+        };
+        delete it;
+    };
+
+    db.WriteIndexVersion(SMSG_INDEX_VERSION);
+
+    if (!db.TxnCommit())
+        return errorN(1, "%s: Commit failed.", __func__);
+
+    LogPrintf("SecureMsgBuildIndex() indexed %u messages in %d ms.\n", nMessages, GetTimeMillis() - nStart);
+
+    return 0;
+};
+
 int SecureMsgBuildBucketSet()
 {
     /*
@@ -1040,6 +1517,10 @@ int SecureMsgReadIni()
         {
             smsgOptions.fScanIncoming = (strcmp(pValue, "true") == 0) ? true : false;
         } else
+        if (strcmp(pName, "compressDict") == 0)
+        {
+            smsgOptions.fCompressDict = (strcmp(pValue, "true") == 0) ? true : false;
+        } else
         if (strcmp(pName, "key") == 0)
         {
             int rv = sscanf(pValue, "%64[^|]|%d|%d", cAddress, &addrRecv, &addrRecvAnon);
@@ -1090,7 +1571,8 @@ int SecureMsgWriteIni()
 
     if (fprintf(fp, "newAddressRecv=%s\n", smsgOptions.fNewAddressRecv ? "true" : "false") < 0
         || fprintf(fp, "newAddressAnon=%s\n", smsgOptions.fNewAddressAnon ? "true" : "false") < 0
-        || fprintf(fp, "scanIncoming=%s\n", smsgOptions.fScanIncoming ? "true" : "false") < 0)
+        || fprintf(fp, "scanIncoming=%s\n", smsgOptions.fScanIncoming ? "true" : "false") < 0
+        || fprintf(fp, "compressDict=%s\n", smsgOptions.fCompressDict ? "true" : "false") < 0)
     {
         LogPrintf("fprintf error: %s\n", strerror(errno));
         fclose(fp);
@@ -1144,6 +1626,8 @@ bool SecureMsgStart(bool fDontStart, bool fScanChain)
     if (SecureMsgReadIni() != 0)
         LogPrintf("Failed to read smsg.ini\n");
 
+    SecureMsgReadRates();
+
     if (smsgAddresses.size() < 1)
     {
         LogPrintf("No address keys loaded.\n");
@@ -1156,9 +1640,12 @@ bool SecureMsgStart(bool fDontStart, bool fScanChain)
             LogPrintf("Loaded addresses from SMSG.ini\n");
     }
 
+    if (SecureMsgBuildIndex() != 0)
+        LogPrintf("Failed to index stored messages.\n");
+
     if (fScanChain)
     {
-        SecureMsgScanBlockChain();
+        SecureMsgScanBlockChain(true);
     };
 
     if (SecureMsgBuildBucketSet() != 0)
@@ -1195,6 +1682,7 @@ bool SecureMsgShutdown()
         LOCK(cs_smsgDB);
         delete smsgDB;
         smsgDB = NULL;
+        mapSmsgHeaders.clear();
     };
 
     return true;
@@ -1217,6 +1705,8 @@ bool SecureMsgEnable()
         if (SecureMsgReadIni() != 0)
             LogPrintf("Failed to read smsg.ini\n");
 
+        SecureMsgReadRates();
+
         if (smsgAddresses.size() < 1)
         {
             LogPrintf("No address keys loaded.\n");
@@ -1235,6 +1725,9 @@ bool SecureMsgEnable()
 
     } // cs_smsg
 
+    if (SecureMsgBuildIndex() != 0)
+        LogPrintf("SecureMsgEnable: failed to index stored messages.\n");
+
     // -- start threads
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg", &ThreadSecureMsg));
     threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg-pow", &ThreadSecureMsgPow));
@@ -1273,10 +1766,14 @@ bool SecureMsgDisable()
     {
         LOCK(cs_smsg);
         fSecMsgEnabled = false;
+    } // cs_smsg
 
-        threadGroupSmsg.interrupt_all();
-        threadGroupSmsg.join_all();
+    // -- join outside cs_smsg, the wallet locked scanner takes it between batches
+    threadGroupSmsg.interrupt_all();
+    threadGroupSmsg.join_all();
 
+    {
+        LOCK(cs_smsg);
         // -- clear smsgBuckets
         std::map<int64_t, SecMsgBucket>::iterator it;
         it = smsgBuckets.begin();
@@ -1314,13 +1811,76 @@ bool SecureMsgDisable()
         LOCK(cs_smsgDB);
         delete smsgDB;
         smsgDB = NULL;
+        mapSmsgHeaders.clear();
     };
 
 
-    LogPrintf("Secure messaging disabled.\n");
-    return true;
-};
+    LogPrintf("Secure messaging disabled.\n");
+    return true;
+};
+
+
+static void SecureMsgQueue(CNode* pnode, const char* pszCommand, const std::vector<uint8_t>& vchData)
+{
+    /*  Queue bucket traffic for pnode, SecureMsgSendData sends it as the rate limits allow.
+        If the peer's queue or the queues of all peers together are full the message is dropped,
+        the peers resync the bucket later.
+    */
+
+    LOCK(pnode->smsgData.cs_smsg_net);
+
+    if (!pnode->smsgData.QueueMessage(pszCommand, vchData, SMSG_MAX_QUEUE, SMSG_MAX_QUEUE_TOTAL))
+    {
+        if (fDebugSmsg)
+            LogPrintf("SecureMsgQueue() queue full for peer %d, %u bytes queued for all peers, dropping %s.\n",
+                pnode->id, SecMsgNode::GetQueuedTotal(), pszCommand);
+        return;
+    };
+};
+
+static void SecureMsgFlushQueue(CNode* pto)
+{
+    /*  Send queued smsg traffic while the peer and total token buckets allow.
+        Block and tx messages go first, smsg waits while more than SMSG_SEND_YIELD bytes are queued for the peer.
+
+        Called with pto->smsgData.cs_smsg_net held
+    */
+
+    SecMsgNode& smsgData = pto->smsgData;
+    if (smsgData.vSendQueue.empty())
+        return;
+
+    int64_t nTimeMicros = GetTimeMicros();
+    if (nSmsgPeerRate > 0)
+        smsgData.sendBucket.Refill(nTimeMicros, nSmsgPeerRate, nSmsgPeerRate);
+
+    while (!smsgData.vSendQueue.empty())
+    {
+        if (pto->nSendSize > SMSG_SEND_YIELD
+            || (nSmsgPeerRate > 0 && !smsgData.sendBucket.Ready()))
+            break;
+
+        std::pair<std::string, std::vector<uint8_t> >& msg = smsgData.vSendQueue.front();
+        int64_t nBytes = msg.second.size();
+
+        if (nSmsgTotalRate > 0)
+        {
+            LOCK(cs_smsgRate);
+            smsgTotalBucket.Refill(nTimeMicros, nSmsgTotalRate, nSmsgTotalRate);
+            if (!smsgTotalBucket.Ready())
+                break;
+            smsgTotalBucket.Take(nBytes);
+        };
+
+        if (nSmsgPeerRate > 0)
+            smsgData.sendBucket.Take(nBytes);
 
+        pto->PushMessage(msg.first.c_str(), msg.second);
+
+        smsgData.nBytesSent += nBytes;
+        smsgData.PopMessage();
+    };
+};
 
 bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRecv)
 {
@@ -1364,6 +1924,12 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
     if (fDebugSmsg)
         LogPrintf("SecureMsgReceiveData() %s %s.\n", pfrom->addrName.c_str(), strCommand.c_str());
 
+    if (strCommand.compare(0, 4, "smsg") == 0)
+    {
+        LOCK(pfrom->smsgData.cs_smsg_net);
+        pfrom->smsgData.nBytesRecv += vRecv.size();
+    };
+
 
 
     if (strCommand == "smsgInv")
@@ -1492,7 +2058,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         memcpy(&vchDataOut[0], &nShowBuckets, 4);
         if (vchDataOut.size() > 4)
         {
-            pfrom->PushMessage("smsgShow", vchDataOut);
+            SecureMsgQueue(pfrom, "smsgShow", vchDataOut);
         } else
         if (nLocked < 1) // Don't report buckets as matched if any are locked
         {
@@ -1500,7 +2066,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
             //    peer will still request buckets from this node if needed (< ncontent)
             vchDataOut.resize(8);
             memcpy(&vchDataOut[0], &now, 8);
-            pfrom->PushMessage("smsgMatch", vchDataOut);
+            SecureMsgQueue(pfrom, "smsgMatch", vchDataOut);
             if (fDebugSmsg)
                 LogPrintf("Sending smsgMatch, no locked buckets, time= %d.\n", now);
         } else
@@ -1566,7 +2132,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
                     p += 16;
                 };
             }
-            pfrom->PushMessage("smsgHave", vchDataOut);
+            SecureMsgQueue(pfrom, "smsgHave", vchDataOut);
         };
 
 
@@ -1658,7 +2224,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
                 smsgBuckets[time].nLockCount   = 3; // lock this bucket for at most 3 * SMSG_THREAD_DELAY seconds, unset when peer sends smsgMsg
                 smsgBuckets[time].nLockPeerId  = pfrom->id;
             }
-            pfrom->PushMessage("smsgWant", vchDataOut);
+            SecureMsgQueue(pfrom, "smsgWant", vchDataOut);
         };
     } else
     if (strCommand == "smsgWant")
@@ -1742,7 +2308,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
 
             memcpy(&vchBunch[0], &nBunch, 4);
             memcpy(&vchBunch[4], &time, 8);
-            pfrom->PushMessage("smsgMsg", vchBunch);
+            SecureMsgQueue(pfrom, "smsgMsg", vchBunch);
         };
     } else
     if (strCommand == "smsgMsg")
@@ -1816,6 +2382,7 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
         {
             LOCK(pfrom->smsgData.cs_smsg_net);
             pfrom->smsgData.fEnabled = false;
+            pfrom->smsgData.ClearQueue();
         }
 
         if (fDebugSmsg)
@@ -1877,10 +2444,14 @@ bool SecureMsgSendData(CNode* pto, bool fSendTrickle)
         pto->PushMessage("smsgPing");
         pto->smsgData.lastSeen = GetTime();
         return true;
-    } else
+    };
+
+    SecureMsgFlushQueue(pto);
+
     if (!pto->smsgData.fEnabled
         || now - pto->smsgData.lastSeen < SMSG_SEND_DELAY
-        || now < pto->smsgData.ignoreUntil)
+        || now < pto->smsgData.ignoreUntil
+        || !pto->smsgData.vSendQueue.empty()) // don't add bucket inventory behind a backlog
     {
         return true;
     };
@@ -1981,7 +2552,7 @@ bool SecureMsgSendData(CNode* pto, bool fSendTrickle)
                 if (fDebugSmsg)
                     LogPrintf("Sending %d bucket headers.\n", nBucketsShown);
 
-                pto->PushMessage("smsgInv", vchData);
+                SecureMsgQueue(pto, "smsgInv", vchData);
             };
         };
     } // cs_smsg
@@ -2048,16 +2619,16 @@ int SecureMsgInsertAddress(CKeyID& hashKey, CPubKey& pubKey)
 };
 
 
-static bool ScanBlock(CBlock& block, CTxDB& txdb, SecMsgDB& addrpkdb,
-    uint32_t& nTransactions, uint32_t& nElements, uint32_t& nPubkeys, uint32_t& nDuplicates)
+static void ExtractBlockPubKeys(const CBlock& block, std::vector<CPubKey>& vPubKeys,
+    uint32_t& nTransactions, uint32_t& nElements)
 {
-    AssertLockHeld(cs_smsgDB);
+    // -- touches no shared state, safe to run from several threads at once
 
     valtype vch;
     opcodetype opcode;
 
     // -- only scan inputs of standard txns and coinstakes
-    BOOST_FOREACH(CTransaction& tx, block.vtx)
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
     {
         // - harvest public keys from coinstake txns
         if (tx.IsCoinStake())
@@ -2080,12 +2651,7 @@ static bool ScanBlock(CBlock& block, CTxDB& txdb, SecMsgDB& addrpkdb,
                         continue;
                     };
 
-                    CKeyID addrKey = pubKey.GetID();
-                    switch (SecureMsgInsertAddress(addrKey, pubKey, addrpkdb))
-                    {
-                        case 0: nPubkeys++; break;      // added key
-                        case 4: nDuplicates++; break;   // duplicate key
-                    }
+                    vPubKeys.push_back(pubKey);
                     break;
                 };
             };
@@ -2099,12 +2665,10 @@ static bool ScanBlock(CBlock& block, CTxDB& txdb, SecMsgDB& addrpkdb,
                     && tx.vin[i].IsAnonInput())
                     continue; // skip anon inputs
 
-                CScript *script = &tx.vin[i].scriptSig;
+                const CScript *script = &tx.vin[i].scriptSig;
                 CScript::const_iterator pc = script->begin();
                 CScript::const_iterator pend = script->end();
 
-                CKey key;
-
                 while (pc < pend)
                 {
                     if (!script->GetOp(pc, opcode, vch))
@@ -2121,12 +2685,7 @@ static bool ScanBlock(CBlock& block, CTxDB& txdb, SecMsgDB& addrpkdb,
                             continue;
                         };
 
-                        CKeyID addrKey = pubKey.GetID();
-                        switch (SecureMsgInsertAddress(addrKey, pubKey, addrpkdb))
-                        {
-                            case 0: nPubkeys++; break;      // added key
-                            case 4: nDuplicates++; break;   // duplicate key
-                        }
+                        vPubKeys.push_back(pubKey);
                         break;
                     };
 
@@ -2136,12 +2695,27 @@ static bool ScanBlock(CBlock& block, CTxDB& txdb, SecMsgDB& addrpkdb,
             };
         };
         nTransactions++;
+    };
+};
+
+static bool ScanBlock(CBlock& block, SecMsgDB& addrpkdb,
+    uint32_t& nTransactions, uint32_t& nElements, uint32_t& nPubkeys, uint32_t& nDuplicates)
+{
+    AssertLockHeld(cs_smsgDB);
+
+    std::vector<CPubKey> vPubKeys;
+    ExtractBlockPubKeys(block, vPubKeys, nTransactions, nElements);
 
-        if (nTransactions % 10000 == 0) // for ScanChainForPublicKeys
+    for (std::vector<CPubKey>::iterator it = vPubKeys.begin(); it != vPubKeys.end(); ++it)
+    {
+        CKeyID addrKey = it->GetID();
+        switch (SecureMsgInsertAddress(addrKey, *it, addrpkdb))
         {
-            LogPrintf("Scanning transaction no. %u.\n", nTransactions);
-        };
+            case 0: nPubkeys++; break;      // added key
+            case 4: nDuplicates++; break;   // duplicate key
+        }
     };
+
     return true;
 };
 
@@ -2163,14 +2737,13 @@ bool SecureMsgScanBlock(CBlock& block)
 
     {
         LOCK(cs_smsgDB);
-        CTxDB txdb("r");
 
         SecMsgDB addrpkdb;
         if (!addrpkdb.Open("cw")
             || !addrpkdb.TxnBegin())
             return false;
 
-        ScanBlock(block, txdb, addrpkdb,
+        ScanBlock(block, addrpkdb,
             nTransactions, nElements, nPubkeys, nDuplicates);
 
         addrpkdb.TxnCommit();
@@ -2182,8 +2755,77 @@ bool SecureMsgScanBlock(CBlock& block)
     return true;
 };
 
+static void SecureMsgScanChainWorker(const std::vector<CBlockIndex*>* pvIndex, size_t nBegin, size_t nEnd,
+    std::vector<std::vector<CPubKey> >* pvBlockKeys, std::vector<uint32_t>* pvTransactions, std::vector<uint32_t>* pvElements,
+    std::vector<char>* pvfRead)
+{
+    for (size_t i = nBegin; i < nEnd; ++i)
+    {
+        CBlock block;
+        if (!block.ReadFromDisk((*pvIndex)[i], true))
+        {
+            // -- the batch is cut at the first unread block, nothing after it in this range is used
+            LogPrintf("ScanChainForPublicKeys() ReadFromDisk failed at height %d.\n", (*pvIndex)[i]->nHeight);
+            return;
+        };
+
+        ExtractBlockPubKeys(block, (*pvBlockKeys)[i], (*pvTransactions)[i], (*pvElements)[i]);
+        (*pvfRead)[i] = 1;
+    };
+};
+
+bool SecureMsgStoreScannedKeys(SecMsgDB& addrpkdb, CHash160Filter& filter, const std::vector<CPubKey>& vPubKeys,
+    const uint256& hashLast, uint32_t& nPubkeys, uint32_t& nDuplicates)
+{
+    // -- write the new keys from a batch of blocks and record hashLast as scanned, in one db txn
+    AssertLockHeld(cs_smsgDB);
+
+    // -- duplicates are found before the txn begins, ExistsPK is then a plain lookup instead of a scan of the write batch
+    std::set<CKeyID> setBatch;
+    std::vector<CPubKey> vNew;
+    for (std::vector<CPubKey>::const_iterator it = vPubKeys.begin(); it != vPubKeys.end(); ++it)
+    {
+        CKeyID addrKey = it->GetID();
+        if (!setBatch.insert(addrKey).second
+            || (filter.contains(addrKey) && addrpkdb.ExistsPK(addrKey)))
+        {
+            nDuplicates++;
+            continue;
+        };
+        vNew.push_back(*it);
+    };
+
+    if (!addrpkdb.TxnBegin())
+        return false;
+
+    for (std::vector<CPubKey>::iterator it = vNew.begin(); it != vNew.end(); ++it)
+    {
+        CKeyID addrKey = it->GetID();
+        if (!addrpkdb.WritePK(addrKey, *it))
+        {
+            LogPrintf("Write pair failed.\n");
+            continue;
+        };
+        filter.insert(addrKey);
+        nPubkeys++;
+    };
+
+    if (!addrpkdb.WriteLastScanned(hashLast)
+        || !addrpkdb.TxnCommit())
+        return false;
+
+    return true;
+};
+
 bool ScanChainForPublicKeys(CBlockIndex* pindexStart)
 {
+    /*
+    Blocks are read and scanned in parallel, SMSG_SCAN_CHAIN_BATCH at a time,
+    cs_main is only held while the next batch is taken from the main chain.
+    Keys are written and the last scanned block is recorded after each batch,
+    SecureMsgScanBlockChain resumes from there.
+    */
+
     LogPrintf("Scanning block chain for public keys.\n");
     int64_t nStart = GetTimeMillis();
 
@@ -2199,31 +2841,126 @@ bool ScanChainForPublicKeys(CBlockIndex* pindexStart)
     uint32_t nPubkeys       = 0;
     uint32_t nDuplicates    = 0;
 
+    uint32_t nChainBlocks = 0;
     {
-        LOCK(cs_smsgDB);
+        LOCK(cs_main);
+        if (pindexBest && pindexBest->nHeight >= pindexStart->nHeight)
+            nChainBlocks = pindexBest->nHeight - pindexStart->nHeight + 1;
+    } // cs_main
 
-        CTxDB txdb("r");
+    size_t nThreads = GetArg("-smsgscanthreads", boost::thread::hardware_concurrency());
+    if (nThreads < 1)
+        nThreads = 1;
 
+    // -- preload the filter with keys already in the db
+    CHash160Filter filter;
+    {
+        LOCK(cs_smsgDB);
         SecMsgDB addrpkdb;
-        if (!addrpkdb.Open("cw")
-            || !addrpkdb.TxnBegin())
+        if (!addrpkdb.Open("cw"))
             return false;
 
-        CBlockIndex* pindex = pindexStart;
-        while (pindex)
+        std::vector<CKeyID> vStoredKeys;
+        leveldb::Iterator* it = addrpkdb.pdb->NewIterator(leveldb::ReadOptions());
+        for (it->Seek(std::string("pk")); it->Valid() && it->key().starts_with("pk"); it->Next())
         {
-            nBlocks++;
-            CBlock block;
-            block.ReadFromDisk(pindex, true);
+            if (it->key().size() != 2 + sizeof(CKeyID))
+                continue;
+            CKeyID id;
+            memcpy(id.begin(), it->key().data() + 2, sizeof(CKeyID));
+            vStoredKeys.push_back(id);
+        };
+        delete it;
+
+        filter.Init(vStoredKeys.size() + nChainBlocks);
+        for (std::vector<CKeyID>::iterator it = vStoredKeys.begin(); it != vStoredKeys.end(); ++it)
+            filter.insert(*it);
+    } // cs_smsgDB
 
-            ScanBlock(block, txdb, addrpkdb,
-                nTransactions, nInputs, nPubkeys, nDuplicates);
+    if (fDebugSmsg)
+        LogPrintf("Loaded %u stored keys, scanning %u blocks with %u threads.\n", filter.GetElements(), nChainBlocks, nThreads);
 
-            pindex = pindex->pnext;
+    CBlockIndex* pindexNext = pindexStart;
+    while (pindexNext)
+    {
+        if (ShutdownRequested())
+        {
+            LogPrintf("ScanChainForPublicKeys() interrupted at height %d.\n", pindexNext->nHeight);
+            return false;
         };
 
-        addrpkdb.TxnCommit();
-    } // cs_smsgDB
+        std::vector<CBlockIndex*> vIndex;
+        {
+            LOCK(cs_main);
+            if (!pindexNext->IsInMainChain())
+            {
+                // -- reorganised away, a resumed scan restarts from the fork
+                LogPrintf("ScanChainForPublicKeys() height %d left the main chain, stopping.\n", pindexNext->nHeight);
+                return false;
+            };
+            vIndex.reserve(SMSG_SCAN_CHAIN_BATCH);
+            for (CBlockIndex* pindex = pindexNext; pindex && vIndex.size() < SMSG_SCAN_CHAIN_BATCH; pindex = pindex->pnext)
+                vIndex.push_back(pindex);
+            pindexNext = vIndex.back()->pnext;
+        } // cs_main
+
+        size_t nBatch = vIndex.size();
+        size_t nPerThread = (nBatch + nThreads - 1) / nThreads;
+
+        std::vector<std::vector<CPubKey> > vBlockKeys(nBatch);
+        std::vector<uint32_t> vTransactions(nBatch, 0);
+        std::vector<uint32_t> vInputs(nBatch, 0);
+        std::vector<char> vfRead(nBatch, 0);
+
+        {
+            boost::thread_group threadGroupScan;
+            for (size_t t = 1; t < nThreads; ++t)
+            {
+                size_t nBegin = std::min(t * nPerThread, nBatch);
+                size_t nEnd = std::min(nBegin + nPerThread, nBatch);
+                if (nBegin >= nEnd)
+                    break;
+                threadGroupScan.create_thread(boost::bind(&SecureMsgScanChainWorker, &vIndex, nBegin, nEnd,
+                    &vBlockKeys, &vTransactions, &vInputs, &vfRead));
+            };
+
+            SecureMsgScanChainWorker(&vIndex, 0, std::min(nPerThread, nBatch),
+                &vBlockKeys, &vTransactions, &vInputs, &vfRead);
+
+            threadGroupScan.join_all();
+        }
+
+        // -- keys are written in chain order, up to the first block that couldn't be read
+        size_t nRead = 0;
+        std::vector<CPubKey> vPubKeys;
+        for (; nRead < nBatch && vfRead[nRead]; ++nRead)
+        {
+            nTransactions += vTransactions[nRead];
+            nInputs += vInputs[nRead];
+            vPubKeys.insert(vPubKeys.end(), vBlockKeys[nRead].begin(), vBlockKeys[nRead].end());
+        };
+
+        if (nRead > 0)
+        {
+            LOCK(cs_smsgDB);
+
+            SecMsgDB addrpkdb;
+            if (!addrpkdb.Open("cw")
+                || !SecureMsgStoreScannedKeys(addrpkdb, filter, vPubKeys, vIndex[nRead-1]->GetBlockHash(), nPubkeys, nDuplicates))
+                return false;
+        } // cs_smsgDB
+
+        nBlocks += nRead;
+
+        if (nRead < nBatch)
+        {
+            // -- the last scanned block stays before the failure, a resumed scan retries from it
+            LogPrintf("ScanChainForPublicKeys() stopped at height %d.\n", vIndex[nRead]->nHeight);
+            return false;
+        };
+
+        LogPrintf("Scanned to height %d, %u transactions.\n", vIndex[nBatch-1]->nHeight, nTransactions);
+    };
 
     LogPrintf("Scanned %u blocks, %u transactions, %u inputs\n", nBlocks, nTransactions, nInputs);
     LogPrintf("Found %u public keys, %u duplicates.\n", nPubkeys, nDuplicates);
@@ -2232,30 +2969,56 @@ bool ScanChainForPublicKeys(CBlockIndex* pindexStart)
     return true;
 };
 
-bool SecureMsgScanBlockChain()
+bool SecureMsgScanBlockChain(bool fResume)
 {
-    TRY_LOCK(cs_main, lockMain);
-    if (lockMain)
+    CBlockIndex *pindexScan = NULL;
     {
-        CBlockIndex *pindexScan = pindexGenesisBlock;
+        LOCK(cs_main);
+        pindexScan = pindexGenesisBlock;
         if (pindexScan == NULL)
         {
             LogPrintf("Error: pindexGenesisBlock not set.\n");
             return false;
         };
 
+        uint256 hashLast;
+        if (fResume)
+        {
+            LOCK(cs_smsgDB);
+            SecMsgDB addrpkdb;
+            if (!addrpkdb.Open("cw")
+                || !addrpkdb.ReadLastScanned(hashLast))
+                hashLast = 0;
+        };
 
-        try { // -- in try to catch errors opening db,
-            if (!ScanChainForPublicKeys(pindexScan))
-                return false;
-        } catch (std::exception& e)
+        std::map<uint256, CBlockIndex*>::iterator mi;
+        if (hashLast != 0
+            && (mi = mapBlockIndex.find(hashLast)) != mapBlockIndex.end())
         {
-            LogPrintf("ScanChainForPublicKeys() threw: %s.\n", e.what());
-            return false;
+            // -- if the last scanned block was reorganised away, resume from the fork
+            CBlockIndex* pindex = mi->second;
+            while (pindex && !pindex->IsInMainChain())
+                pindex = pindex->pprev;
+
+            if (pindex)
+            {
+                if (!pindex->pnext)
+                {
+                    LogPrintf("ScanChainForPublicKeys() Already scanned to height %d.\n", pindex->nHeight);
+                    return true;
+                };
+                pindexScan = pindex->pnext;
+                LogPrintf("ScanChainForPublicKeys() Resuming from height %d.\n", pindexScan->nHeight);
+            };
         };
-    } else
+    } // cs_main
+
+    try { // -- in try to catch errors opening db,
+        if (!ScanChainForPublicKeys(pindexScan))
+            return false;
+    } catch (std::exception& e)
     {
-        LogPrintf("ScanChainForPublicKeys() Could not lock main.\n");
+        LogPrintf("ScanChainForPublicKeys() threw: %s.\n", e.what());
         return false;
     };
 
@@ -2410,148 +3173,462 @@ bool SecureMsgScanBuckets()
 }
 
 
-int SecureMsgWalletUnlocked()
+static bool SecureMsgMatchAddress(const std::vector<SecMsgAddress>& vAddresses, uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, std::string& addressTo)
 {
     /*
-    When the wallet is unlocked, scan messages received while wallet was locked.
+    Try each receiving address in vAddresses against the message.
+    Does not touch smsgAddresses, callers pass a copy or hold cs_smsg.
+
+    returns true if the message can be decrypted with an owned address, addressTo is set to the matching address.
     */
-    if (!fSecMsgEnabled)
-        return 0;
 
-    LogPrintf("SecureMsgWalletUnlocked()\n");
+    MessageData msg; // placeholder
 
-    if (pwalletMain->IsLocked())
+    for (std::vector<SecMsgAddress>::const_iterator it = vAddresses.begin(); it != vAddresses.end(); ++it)
     {
-        LogPrintf("Error: Wallet is locked.\n");
+        if (!it->fReceiveEnabled)
+            continue;
+
+        CBitcoinAddress coinAddress(it->sAddress);
+        addressTo = coinAddress.ToString();
+
+        if (!it->fReceiveAnon)
+        {
+            // -- have to do full decrypt to see address from
+            if (SecureMsgDecrypt(false, addressTo, pHeader, pPayload, nPayload, msg) == 0)
+            {
+                if (fDebugSmsg)
+                    LogPrintf("Decrypted message with %s.\n", addressTo.c_str());
+
+                if (msg.sFromAddress.compare("anon") != 0)
+                    return true;
+                return false;
+            };
+        } else
+        {
+
+            if (SecureMsgDecrypt(true, addressTo, pHeader, pPayload, nPayload, msg) == 0)
+            {
+                if (fDebugSmsg)
+                    LogPrintf("Decrypted message with %s.\n", addressTo.c_str());
+
+                return true;
+            };
+        }
+    };
+
+    return false;
+};
+
+static int SecureMsgStoreInbox(SecMsgDB& dbInbox, uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, const std::string& addressTo, SecMsgStored& smsgInbox)
+{
+    /*
+    Write a matched message to the inbox, dbInbox must be open, and cs_smsgDB held.
+
+    returns
+        0 success,
+        1 error
+        4 message is already in the inbox
+    */
+
+    AssertLockHeld(cs_smsgDB);
+
+    SecureMessage* psmsg = (SecureMessage*) pHeader;
+    std::string sPrefix("im");
+    uint8_t chKey[18];
+    memcpy(&chKey[0],  sPrefix.data(),    2);
+    memcpy(&chKey[2],  &psmsg->timestamp, 8);
+    memcpy(&chKey[10], pPayload,          8);
+
+    if (dbInbox.ExistsSmesg(chKey))
+    {
+        if (fDebugSmsg)
+            LogPrintf("Message already exists in inbox db.\n");
+        return 4;
+    };
+
+    smsgInbox.timeReceived  = GetTime();
+    smsgInbox.status        = (SMSG_MASK_UNREAD) & 0xFF;
+    smsgInbox.sAddrTo       = addressTo;
+
+    // -- data may not be contiguous
+    try {
+        smsgInbox.vchMessage.resize(SMSG_HDR_LEN + nPayload);
+    } catch (std::exception& e) {
+        LogPrintf("SecureMsgStoreInbox(): Could not resize vchData, %u, %s\n", SMSG_HDR_LEN + nPayload, e.what());
+        return 1;
+    };
+    memcpy(&smsgInbox.vchMessage[0], pHeader, SMSG_HDR_LEN);
+    memcpy(&smsgInbox.vchMessage[SMSG_HDR_LEN], pPayload, nPayload);
+
+    if (!dbInbox.WriteSmesg(chKey, smsgInbox))
         return 1;
+
+    return 0;
+};
+
+static void SecureMsgRunNotify(const std::string& addressTo)
+{
+    // notify an external script when a message comes in
+    std::string strCmd = GetArg("-smsgnotify", "");
+
+    //TODO: Format message
+    if (!strCmd.empty())
+    {
+        boost::replace_all(strCmd, "%s", addressTo);
+        boost::thread t(runCommand, strCmd); // thread runs free
+    };
+};
+
+class SecMsgScanItem
+{
+// -- A message read from a wallet locked file, waiting to be matched
+public:
+    SecMsgScanItem() : fMatched(false) {};
+
+    std::vector<uint8_t> vchData;   // header + payload
+    bool                 fMatched;
+    std::string          sAddrTo;
+};
+
+static void SecureMsgMatchWorker(std::vector<SecMsgScanItem>* pvItems, const std::vector<SecMsgAddress>* pvAddresses, size_t nStart, size_t nStride)
+{
+    for (size_t i = nStart; i < pvItems->size(); i += nStride)
+    {
+        SecMsgScanItem& item = (*pvItems)[i];
+        SecureMessage* psmsg = (SecureMessage*) &item.vchData[0];
+        item.fMatched = SecureMsgMatchAddress(*pvAddresses, &item.vchData[0], &item.vchData[SMSG_HDR_LEN], psmsg->nPayload, item.sAddrTo);
+    };
+};
+
+static void SecureMsgMatchBatch(std::vector<SecMsgScanItem>& vItems, const std::vector<SecMsgAddress>& vAddresses)
+{
+    // -- parallel address matcher, each thread tries all addresses against every nThreads'th message
+    size_t nThreads = GetArg("-smsgscanthreads", boost::thread::hardware_concurrency());
+    if (nThreads < 1)
+        nThreads = 1;
+    if (nThreads > vItems.size())
+        nThreads = vItems.size();
+
+    if (nThreads < 2)
+    {
+        SecureMsgMatchWorker(&vItems, &vAddresses, 0, 1);
+        return;
+    };
+
+    boost::thread_group threadGroupMatch;
+    for (size_t i = 1; i < nThreads; ++i)
+        threadGroupMatch.create_thread(boost::bind(&SecureMsgMatchWorker, &vItems, &vAddresses, i, nThreads));
+
+    SecureMsgMatchWorker(&vItems, &vAddresses, 0, nThreads);
+
+    // -- workers reference vItems, never leave before they finish
+    boost::this_thread::disable_interruption di;
+    threadGroupMatch.join_all();
+};
+
+static bool SecureMsgScanCancelled()
+{
+    boost::this_thread::interruption_point();
+    return !fSecMsgEnabled
+        || pwalletMain->IsLocked();
+};
+
+static int SecureMsgReadScanBatch(FILE* fp, std::vector<SecMsgScanItem>& vItems)
+{
+    /*
+    Read up to SMSG_SCAN_BATCH messages from a wl file, cs_smsg must be held.
+
+    returns
+        0 success, more messages may follow
+        1 error
+        2 end of file
+    */
+
+    AssertLockHeld(cs_smsg);
+
+    SecureMessage smsg;
+    vItems.clear();
+    while (vItems.size() < SMSG_SCAN_BATCH)
+    {
+        errno = 0;
+        if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
+        {
+            if (errno != 0)
+                return errorN(1, "fread header failed: %s", strerror(errno));
+            return 2;
+        };
+
+        if (smsg.nPayload > SMSG_MAX_MSG_WORST + SMSG_PL_HDR_LEN + AES_BLOCK_SIZE)
+            return errorN(1, "%s: Payload too large %u.", __func__, smsg.nPayload);
+
+        vItems.push_back(SecMsgScanItem());
+        SecMsgScanItem& item = vItems.back();
+        try { item.vchData.resize(SMSG_HDR_LEN + smsg.nPayload); } catch (std::exception& e)
+        {
+            return errorN(1, "%s: Could not resize vchData, %u, %s", __func__, smsg.nPayload, e.what());
+        };
+
+        memcpy(&item.vchData[0], &smsg.hash[0], SMSG_HDR_LEN);
+        if (fread(&item.vchData[SMSG_HDR_LEN], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
+            return errorN(1, "fread data failed: %s", strerror(errno));
     };
 
+    return 0;
+};
+
+static bool fSecMsgScanningUnscanned = false; // protected by cs_smsgThreads
+static boost::thread* pthreadScanUnscanned = NULL; // protected by cs_smsgThreads, last scan thread, still in threadGroupSmsg
+
+static bool SecureMsgScanUnscanned()
+{
+    /*
+    Scan messages received while the wallet was locked.
+    Stops early if the wallet is locked again, secure messaging is disabled or the thread is interrupted,
+    wl files are only removed once fully scanned, messages already in the inbox are skipped when rescanned.
+
+    returns false if cancelled
+    */
+
+    int64_t  nStart         = GetTimeMillis();
     int64_t  now            = GetTime();
     uint32_t nFiles         = 0;
     uint32_t nMessages      = 0;
     uint32_t nFoundMessages = 0;
+    bool     fCancelled     = false;
 
     fs::path pathSmsgDir = GetDataDir() / "smsgStore";
     fs::directory_iterator itend;
 
-    if (!fs::exists(pathSmsgDir)
-        || !fs::is_directory(pathSmsgDir))
+    std::vector<fs::path> vFiles;
+    if (fs::exists(pathSmsgDir)
+        && fs::is_directory(pathSmsgDir))
     {
-        LogPrintf("Message store directory does not exist.\n");
-        return 0; // not an error
+        for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd)
+        {
+            if (!fs::is_regular_file(itd->status())
+                || !boost::algorithm::ends_with(itd->path().filename().string(), "_wl.dat"))
+                continue;
+            vFiles.push_back(itd->path());
+        };
     };
 
-    SecureMessage smsg;
-    std::vector<uint8_t> vchData;
+    std::vector<SecMsgAddress> vAddresses;
+    std::vector<SecMsgScanItem> vItems;
+    vItems.reserve(SMSG_SCAN_BATCH);
 
-    for (fs::directory_iterator itd(pathSmsgDir) ; itd != itend ; ++itd)
+    for (std::vector<fs::path>::iterator itf = vFiles.begin(); itf != vFiles.end() && !fCancelled; ++itf)
     {
-        if (!fs::is_regular_file(itd->status()))
-            continue;
-
-        std::string fileName = (*itd).path().filename().string();
-
-        if (!boost::algorithm::ends_with(fileName, "_wl.dat"))
-            continue;
+        std::string fileName = itf->filename().string();
 
         if (fDebugSmsg)
             LogPrintf("Processing file: %s.\n", fileName.c_str());
 
         nFiles++;
 
-        // TODO files must be split if > 2GB
         // time_noFile_wl.dat
         size_t sep = fileName.find_first_of("_");
         if (sep == std::string::npos)
             continue;
 
-        std::string stime = fileName.substr(0, sep);
-
-        int64_t fileTime = boost::lexical_cast<int64_t>(stime);
+        int64_t fileTime = boost::lexical_cast<int64_t>(fileName.substr(0, sep));
 
-        if (fileTime < now - SMSG_RETENTION)
+        FILE *fp = NULL;
         {
-            LogPrintf("Dropping wallet locked file %s, expired.\n", fileName.c_str());
-            try {
-                fs::remove((*itd).path());
-            } catch (const boost::filesystem::filesystem_error& ex)
+            LOCK(cs_smsg);
+            if (fileTime < now - SMSG_RETENTION)
             {
-                LogPrintf("Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
-                return 1;
+                LogPrintf("Dropping wallet locked file %s, expired.\n", fileName.c_str());
+                try {
+                    fs::remove(*itf);
+                } catch (const boost::filesystem::filesystem_error& ex)
+                {
+                    LogPrintf("Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
+                };
+                continue;
             };
-            continue;
-        };
 
-        {
-            LOCK(cs_smsg);
-            FILE *fp;
             errno = 0;
-            if (!(fp = fopen((*itd).path().string().c_str(), "rb")))
+            if (!(fp = fopen(itf->string().c_str(), "rb")))
             {
                 LogPrintf("Error opening file: %s\n", strerror(errno));
                 continue;
             };
+        } // cs_smsg
 
-            for (;;)
+        for (;;)
+        {
+            if (SecureMsgScanCancelled())
             {
-                errno = 0;
-                if (fread(&smsg.hash[0], sizeof(uint8_t), SMSG_HDR_LEN, fp) != (size_t)SMSG_HDR_LEN)
+                fCancelled = true;
+                break;
+            };
+
+            int rv;
+            {
+                LOCK(cs_smsg);
+                rv = SecureMsgReadScanBatch(fp, vItems);
+                vAddresses = smsgAddresses;
+            } // cs_smsg
+
+            if (vItems.size() > 0)
+            {
+                SecureMsgMatchBatch(vItems, vAddresses);
+
+                std::vector<SecMsgStored> vStored;
                 {
-                    if (errno != 0)
+                    LOCK(cs_smsgDB);
+                    SecMsgDB dbInbox;
+
+                    if (!dbInbox.Open("cw")
+                        || !dbInbox.TxnBegin())
                     {
-                        LogPrintf("fread header failed: %s\n", strerror(errno));
-                    } else
+                        fCancelled = true;
+                        break;
+                    };
+
+                    for (std::vector<SecMsgScanItem>::iterator it = vItems.begin(); it != vItems.end(); ++it)
                     {
-                        //LogPrintf("End of file.\n");
+                        if (!it->fMatched)
+                            continue;
+
+                        SecureMessage* psmsg = (SecureMessage*) &it->vchData[0];
+                        SecMsgStored smsgInbox;
+                        if (SecureMsgStoreInbox(dbInbox, &it->vchData[0], &it->vchData[SMSG_HDR_LEN], psmsg->nPayload, it->sAddrTo, smsgInbox) == 0)
+                            vStored.push_back(smsgInbox);
                     };
-                    break;
-                };
 
-                try { vchData.resize(smsg.nPayload); } catch (std::exception& e)
-                {
-                    LogPrintf("SecureMsgWalletUnlocked(): Could not resize vchData, %u, %s\n", smsg.nPayload, e.what());
-                    fclose(fp);
-                    return 1;
-                };
+                    if (!dbInbox.TxnCommit())
+                    {
+                        fCancelled = true;
+                        break;
+                    };
 
-                if (fread(&vchData[0], sizeof(uint8_t), smsg.nPayload, fp) != smsg.nPayload)
+                    // -- report progress
+                    for (std::vector<SecMsgStored>::iterator it = vStored.begin(); it != vStored.end(); ++it)
+                        NotifySecMsgInboxChanged(*it);
+                } // cs_smsgDB
+
+                for (std::vector<SecMsgStored>::iterator it = vStored.begin(); it != vStored.end(); ++it)
+                    SecureMsgRunNotify(it->sAddrTo);
+
+                nMessages += vItems.size();
+                nFoundMessages += vStored.size();
+
+                if (fDebugSmsg)
+                    LogPrintf("Scanned %u messages, received %u.\n", nMessages, nFoundMessages);
+            };
+
+            if (rv == 0)
+                continue;
+
+            if (rv == 2)
+            {
+                LOCK(cs_smsg);
+                // -- messages can only be appended while the wallet is locked
+                if (SecureMsgScanCancelled())
                 {
-                    LogPrintf("fread data failed: %s\n", strerror(errno));
+                    fCancelled = true;
                     break;
                 };
 
-                // -- don't report to gui,
-                int rv = SecureMsgScanMessage(&smsg.hash[0], &vchData[0], smsg.nPayload, false);
-
-                if (rv == 0)
-                {
-                    nFoundMessages++;
-                } else
-                if (rv != 0)
+                if ((uintmax_t)ftell(fp) < fs::file_size(*itf))
                 {
-                    // SecureMsgScanMessage failed
+                    clearerr(fp);
+                    continue;
                 };
 
-                nMessages++;
+                // -- remove wl file when scanned
+                fclose(fp);
+                fp = NULL;
+                try {
+                    fs::remove(*itf);
+                } catch (const boost::filesystem::filesystem_error& ex)
+                {
+                    LogPrintf("Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
+                };
             };
+            break;
+        };
 
+        if (fp)
             fclose(fp);
+    };
 
-            // -- remove wl file when scanned
-            try {
-                fs::remove((*itd).path());
-            } catch (const boost::filesystem::filesystem_error& ex)
-            {
-                LogPrintf("Error removing wl file %s - %s\n", fileName.c_str(), ex.what());
-                return 1;
-            };
-        } // cs_smsg
+    LogPrintf("Processed %u files, scanned %u messages, received %u messages%s.\n", nFiles, nMessages, nFoundMessages, fCancelled ? ", cancelled" : "");
+    LogPrintf("Took %d ms\n", GetTimeMillis() - nStart);
+
+    return !fCancelled;
+};
+
+static void ThreadSecureMsgScanUnscanned()
+{
+    bool fCompleted;
+    try {
+        fCompleted = SecureMsgScanUnscanned();
+    } catch (...)
+    {
+        LOCK(cs_smsgThreads);
+        fSecMsgScanningUnscanned = false;
+        throw;
     };
 
-    LogPrintf("Processed %u files, scanned %u messages, received %u messages.\n", nFiles, nMessages, nFoundMessages);
+    {
+        LOCK(cs_smsgThreads);
+        fSecMsgScanningUnscanned = false;
+    }
 
     // -- notify gui
-    NotifySecMsgWalletUnlocked();
+    if (fCompleted)
+        NotifySecMsgWalletUnlocked();
+};
+
+int SecureMsgWalletUnlocked()
+{
+    /*
+    When the wallet is unlocked, scan messages received while wallet was locked.
+    The scan runs in the background, NotifySecMsgWalletUnlocked is fired once it completes.
+    */
+    if (!fSecMsgEnabled)
+        return 0;
+
+    LogPrintf("SecureMsgWalletUnlocked()\n");
+
+    if (pwalletMain->IsLocked())
+    {
+        LogPrintf("Error: Wallet is locked.\n");
+        return 1;
+    };
+
+    boost::thread* pthreadDone;
+    {
+        LOCK(cs_smsgThreads);
+        if (fSecMsgScanningUnscanned)
+        {
+            if (fDebugSmsg)
+                LogPrintf("Wallet locked messages are already being scanned.\n");
+            return 0;
+        };
+        fSecMsgScanningUnscanned = true;
+        pthreadDone = pthreadScanUnscanned;
+        pthreadScanUnscanned = NULL;
+    }
+
+    // -- the previous scan has finished, take it out of the group so threads don't pile up over unlocks
+    if (pthreadDone)
+    {
+        if (pthreadDone->joinable())
+            pthreadDone->join();
+        threadGroupSmsg.remove_thread(pthreadDone);
+        delete pthreadDone;
+    };
+
+    boost::thread* pthread = threadGroupSmsg.create_thread(boost::bind(&TraceThread<void (*)()>, "smsg-scanwl", &ThreadSecureMsgScanUnscanned));
+    {
+        LOCK(cs_smsgThreads);
+        pthreadScanUnscanned = pthread;
+    }
+
     return 0;
 };
 
@@ -2633,99 +3710,24 @@ int SecureMsgScanMessage(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload,
     };
 
     std::string addressTo;
-    MessageData msg; // placeholder
-    bool fOwnMessage = false;
-
-    for (std::vector<SecMsgAddress>::iterator it = smsgAddresses.begin(); it != smsgAddresses.end(); ++it)
-    {
-        if (!it->fReceiveEnabled)
-            continue;
-
-        CBitcoinAddress coinAddress(it->sAddress);
-        addressTo = coinAddress.ToString();
-
-        if (!it->fReceiveAnon)
-        {
-            // -- have to do full decrypt to see address from
-            if (SecureMsgDecrypt(false, addressTo, pHeader, pPayload, nPayload, msg) == 0)
-            {
-                if (fDebugSmsg)
-                    LogPrintf("Decrypted message with %s.\n", addressTo.c_str());
-
-                if (msg.sFromAddress.compare("anon") != 0)
-                    fOwnMessage = true;
-                break;
-            };
-        } else
-        {
-
-            if (SecureMsgDecrypt(true, addressTo, pHeader, pPayload, nPayload, msg) == 0)
-            {
-                if (fDebugSmsg)
-                    LogPrintf("Decrypted message with %s.\n", addressTo.c_str());
-
-                fOwnMessage = true;
-                break;
-            };
-        }
-    };
-
-    if (fOwnMessage)
+    if (SecureMsgMatchAddress(smsgAddresses, pHeader, pPayload, nPayload, addressTo))
     {
         // -- save to inbox
-        SecureMessage* psmsg = (SecureMessage*) pHeader;
-        std::string sPrefix("im");
-        uint8_t chKey[18];
-        memcpy(&chKey[0],  sPrefix.data(),    2);
-        memcpy(&chKey[2],  &psmsg->timestamp, 8);
-        memcpy(&chKey[10], pPayload,          8);
-
         SecMsgStored smsgInbox;
-        smsgInbox.timeReceived  = GetTime();
-        smsgInbox.status        = (SMSG_MASK_UNREAD) & 0xFF;
-        smsgInbox.sAddrTo       = addressTo;
-
-        // -- data may not be contiguous
-        try {
-            smsgInbox.vchMessage.resize(SMSG_HDR_LEN + nPayload);
-        } catch (std::exception& e) {
-            LogPrintf("SecureMsgScanMessage(): Could not resize vchData, %u, %s\n", SMSG_HDR_LEN + nPayload, e.what());
-            return 1;
-        };
-        memcpy(&smsgInbox.vchMessage[0], pHeader, SMSG_HDR_LEN);
-        memcpy(&smsgInbox.vchMessage[SMSG_HDR_LEN], pPayload, nPayload);
-
         {
             LOCK(cs_smsgDB);
             SecMsgDB dbInbox;
 
-            if (dbInbox.Open("cw"))
+            if (dbInbox.Open("cw")
+                && SecureMsgStoreInbox(dbInbox, pHeader, pPayload, nPayload, addressTo, smsgInbox) == 0)
             {
-                if (dbInbox.ExistsSmesg(chKey))
-                {
-                    if (fDebugSmsg)
-                        LogPrintf("Message already exists in inbox db.\n");
-                } else
-                {
-                    dbInbox.WriteSmesg(chKey, smsgInbox);
-
-                    if (reportToGui)
-                        NotifySecMsgInboxChanged(smsgInbox);
-                    LogPrintf("SecureMsg saved to inbox, received with %s.\n", addressTo.c_str());
-                };
+                if (reportToGui)
+                    NotifySecMsgInboxChanged(smsgInbox);
+                LogPrintf("SecureMsg saved to inbox, received with %s.\n", addressTo.c_str());
             };
         } // cs_smsgDB
 
-        // notify an external script when a message comes in
-        std::string strCmd = GetArg("-smsgnotify", "");
-
-        //TODO: Format message
-        if (!strCmd.empty())
-        {
-            boost::replace_all(strCmd, "%s", addressTo);
-            boost::thread t(runCommand, strCmd); // thread runs free
-        };
-
+        SecureMsgRunNotify(addressTo);
     };
 
     return 0;
@@ -3543,57 +4545,62 @@ int SecureMsgEncrypt(SecureMessage &smsg, const std::string &addressFrom, const
     std::vector<uint8_t> key_m(&vchHashed[32], &vchHashed[32]+32);
 
 
-    std::vector<uint8_t> vchPayload;
-    std::vector<uint8_t> vchCompressed;
-    uint8_t *pMsgData;
+    // -- The payload is built, compressed and encrypted in place in one buffer,
+    //    CBC padding can add up to a block.
+    uint32_t lenMsg = message.size();
+    uint32_t lenPlHdr = fSendAnonymous ? 9 : SMSG_PL_HDR_LEN;
+    uint32_t nBuffer = lenPlHdr + 1 + LZ4_compressBound(lenMsg) + AES_BLOCK_SIZE;
+
+    try { smsg.pPayload = new uint8_t[nBuffer]; } catch (std::exception& e)
+    {
+        return errorN(8, "%s: Could not allocate pPayload, exception: %s.", __func__, e.what());
+    };
+    memset(smsg.pPayload, 0, lenPlHdr);
+
+    uint8_t *pMsgData = smsg.pPayload + lenPlHdr;
     uint32_t lenMsgData;
 
-    uint32_t lenMsg = message.size();
-    if (lenMsg > 128)
+    if (smsgOptions.fCompressDict)
     {
-        // -- only compress if over 128 bytes
-        int worstCase = LZ4_compressBound(message.size());
-        try { vchCompressed.resize(worstCase); } catch (std::exception& e)
+        smsg.version[1] = 3; // Data prefixed with dictionary id
+
+        int lenComp = SecureMsgCompressDict(SMSG_DICT_CURRENT, (const uint8_t*)message.data(), lenMsg, pMsgData + 1, nBuffer - lenPlHdr - 1 - AES_BLOCK_SIZE);
+        if (lenComp > 0
+            && (uint32_t)lenComp < lenMsg)
         {
-            return errorN(8, "%s: vchCompressed.resize %u threw: %s.", __func__, worstCase, e.what());
+            pMsgData[0] = SMSG_DICT_CURRENT;
+            lenMsgData = 1 + lenComp;
+        } else
+        {
+            pMsgData[0] = SMSG_DICT_NONE;
+            memcpy(pMsgData + 1, message.data(), lenMsg);
+            lenMsgData = 1 + lenMsg;
         };
-
-        int lenComp = LZ4_compress((char*)message.c_str(), (char*)&vchCompressed[0], lenMsg);
+    } else
+    if (lenMsg > 128)
+    {
+        // -- only compress if over 128 bytes
+        int lenComp = LZ4_compress((char*)message.c_str(), (char*)pMsgData, lenMsg);
         if (lenComp < 1)
         {
             return errorN(9, "%s: Could not compress message data.", __func__);
         };
 
-        pMsgData = &vchCompressed[0];
         lenMsgData = lenComp;
-
     } else
     {
         // -- no compression
-        pMsgData = (uint8_t*)message.c_str();
+        memcpy(pMsgData, message.data(), lenMsg);
         lenMsgData = lenMsg;
     };
 
     if (fSendAnonymous)
     {
-        try { vchPayload.resize(9 + lenMsgData); } catch (std::exception& e)
-        {
-            return errorN(8, "%s: vchPayload.resize %u threw: %s.", __func__, 9 + lenMsgData, e.what());
-        };
-
-        memcpy(&vchPayload[9], pMsgData, lenMsgData);
-
-        vchPayload[0] = 250; // id as anonymous message
+        smsg.pPayload[0] = 250; // id as anonymous message
         // -- next 4 bytes are unused - there to ensure encrypted payload always > 8 bytes
-        memcpy(&vchPayload[5], &lenMsg, 4); // length of uncompressed plain text
+        memcpy(&smsg.pPayload[5], &lenMsg, 4); // length of uncompressed plain text
     } else
     {
-        try { vchPayload.resize(SMSG_PL_HDR_LEN + lenMsgData); } catch (std::exception& e)
-        {
-            return errorN(8, "%s: vchPayload.resize %u threw: %s.", __func__, SMSG_PL_HDR_LEN + lenMsgData, e.what());
-        };
-
-        memcpy(&vchPayload[SMSG_PL_HDR_LEN], pMsgData, lenMsgData);
         // -- compact signature proves ownership of from address and allows the public key to be recovered, recipient can always reply.
         if (!pwalletMain->GetKey(ckidFrom, keyFrom))
         {
@@ -3606,31 +4613,22 @@ int SecureMsgEncrypt(SecureMessage &smsg, const std::string &addressFrom, const
         keyFrom.SignCompact(Hash(message.begin(), message.end()), vchSignature);
 
         // -- Save some bytes by sending address raw
-        vchPayload[0] = (static_cast<CBitcoinAddress_B*>(&coinAddrFrom))->getVersion(); // vchPayload[0] = coinAddrDest.nVersion;
-        memcpy(&vchPayload[1], (static_cast<CKeyID_B*>(&ckidFrom))->GetPPN(), 20); // memcpy(&vchPayload[1], ckidDest.pn, 20);
+        smsg.pPayload[0] = (static_cast<CBitcoinAddress_B*>(&coinAddrFrom))->getVersion(); // vchPayload[0] = coinAddrDest.nVersion;
+        memcpy(&smsg.pPayload[1], (static_cast<CKeyID_B*>(&ckidFrom))->GetPPN(), 20); // memcpy(&vchPayload[1], ckidDest.pn, 20);
 
-        memcpy(&vchPayload[1+20], &vchSignature[0], vchSignature.size());
-        memcpy(&vchPayload[1+20+65], &lenMsg, 4); // length of uncompressed plain text
+        memcpy(&smsg.pPayload[1+20], &vchSignature[0], vchSignature.size());
+        memcpy(&smsg.pPayload[1+20+65], &lenMsg, 4); // length of uncompressed plain text
     };
 
 
     SecMsgCrypter crypter;
     crypter.SetKey(key_e, smsg.iv);
-    std::vector<uint8_t> vchCiphertext;
 
-    if (!crypter.Encrypt(&vchPayload[0], vchPayload.size(), vchCiphertext))
+    if (!crypter.Encrypt(smsg.pPayload, lenPlHdr + lenMsgData, nBuffer, smsg.nPayload))
     {
         return errorN(11, "%s: crypter.Encrypt failed.", __func__);
     };
 
-    try { smsg.pPayload = new uint8_t[vchCiphertext.size()]; } catch (std::exception& e)
-    {
-        return errorN(8, "%s: Could not allocate pPayload, exception: %s.", __func__, e.what());
-    };
-
-    memcpy(smsg.pPayload, &vchCiphertext[0], vchCiphertext.size());
-    smsg.nPayload = vchCiphertext.size();
-
 
     // -- Calculate a 32 byte MAC with HMACSHA256, using key_m as salt
     //    Message authentication code, (hash of timestamp + iv + destination + payload)
@@ -3642,7 +4640,7 @@ int SecureMsgEncrypt(SecureMessage &smsg, const std::string &addressFrom, const
     if (!HMAC_Init_ex(&ctx, &key_m[0], 32, EVP_sha256(), NULL)
         || !HMAC_Update(&ctx, (uint8_t*) &smsg.timestamp, sizeof(smsg.timestamp))
         || !HMAC_Update(&ctx, (uint8_t*) smsg.iv, sizeof(smsg.iv))
-        || !HMAC_Update(&ctx, &vchCiphertext[0], vchCiphertext.size())
+        || !HMAC_Update(&ctx, smsg.pPayload, smsg.nPayload)
         || !HMAC_Final(&ctx, smsg.mac, &nBytes)
         || nBytes != 32)
         fHmacOk = false;
@@ -3997,6 +4995,30 @@ int SecureMsgDecrypt(bool fTestOnly, std::string &address, uint8_t *pHeader, uin
     };
 
 
+    if (psmsg->version[1] >= 3)
+    {
+        // -- data is prefixed with the dictionary id
+        if (lenData < 1)
+            return errorN(1, "%s: Missing dictionary id.", __func__);
+
+        uint8_t nDict = pMsgData[0];
+        pMsgData++;
+        lenData--;
+
+        if (nDict == SMSG_DICT_NONE)
+        {
+            if (lenPlain > lenData)
+                return errorN(1, "%s: Message data is truncated.", __func__);
+            memcpy(&msg.vchMessage[0], pMsgData, lenPlain);
+        } else
+        {
+            int rv = SecureMsgDecompressDict(nDict, pMsgData, lenData, msg.vchMessage, lenPlain);
+            if (rv == 2)
+                return errorN(1, "%s: Unknown dictionary %u.", __func__, nDict);
+            if (rv != 0)
+                return errorN(1, "%s: Could not decompress message data.", __func__);
+        };
+    } else
     if (lenPlain > 128)
     {
         // -- decompress
@@ -4088,3 +5110,47 @@ int SecureMsgDecrypt(bool fTestOnly, std::string &address, SecureMessage &smsg,
 {
     return SecureMsgDecrypt(fTestOnly, address, &smsg.hash[0], smsg.pPayload, smsg.nPayload, msg);
 };
+
+int SecureMsgReadHeader(const std::vector<uint8_t>& vchKey, SecMsgStored& smsgStored, MessageData& msg)
+{
+    /*  Decrypt the sender and time of a stored message, results are cached by db key.
+        msg.vchMessage is only set when the message had to be decrypted.
+    */
+
+    AssertLockHeld(cs_smsgDB);
+
+    std::map<std::vector<uint8_t>, MessageData>::iterator mi = mapSmsgHeaders.find(vchKey);
+    if (mi != mapSmsgHeaders.end())
+    {
+        msg = mi->second;
+        return 0;
+    };
+
+    if (vchKey.size() != 18
+        || smsgStored.vchMessage.size() < SMSG_HDR_LEN)
+        return 1;
+
+    // -- outbox copies are encrypted to the sending address
+    std::string& sAddress = vchKey[0] == 's' ? smsgStored.sAddrOutbox : smsgStored.sAddrTo;
+
+    uint32_t nPayload = smsgStored.vchMessage.size() - SMSG_HDR_LEN;
+    int rv = SecureMsgDecrypt(false, sAddress, &smsgStored.vchMessage[0], &smsgStored.vchMessage[SMSG_HDR_LEN], nPayload, msg);
+    if (rv != 0)
+        return rv;
+
+    if (mapSmsgHeaders.size() >= SMSG_HDR_CACHE_SIZE)
+        mapSmsgHeaders.clear();
+
+    MessageData& hdr = mapSmsgHeaders[vchKey];
+    hdr.timestamp = msg.timestamp;
+    hdr.sToAddress = msg.sToAddress;
+    hdr.sFromAddress = msg.sFromAddress;
+
+    return 0;
+};
+
+void SecureMsgClearHeaders()
+{
+    LOCK(cs_smsgDB);
+    mapSmsgHeaders.clear();
+};
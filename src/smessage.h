@@ -21,6 +21,14 @@ const unsigned int SMSG_RETENTION      = 60 * 60 * 48;      // in seconds
 const unsigned int SMSG_SEND_DELAY     = 2;                 // in seconds, SecureMsgSendData will delay this long between firing
 const unsigned int SMSG_THREAD_DELAY   = 30;
 const unsigned int SMSG_THREAD_LOG_GAP = 6;
+const unsigned int SMSG_SCAN_BATCH     = 512;               // messages read from wallet locked files and committed to the inbox at once
+const unsigned int SMSG_SCAN_CHAIN_BATCH = 2000;            // blocks scanned for public keys between commits to the address db
+
+const unsigned int SMSG_PEER_RATE      = 64;                // default kB/s of smsg relay sent to one peer, -smsgmaxpeerrate
+const unsigned int SMSG_TOTAL_RATE     = 256;               // default kB/s of smsg relay sent to all peers, -smsgmaxrate
+const unsigned int SMSG_MAX_QUEUE      = 4 * 1024 * 1024;   // bytes of smsg relay that can wait for one peer
+const unsigned int SMSG_MAX_QUEUE_TOTAL = 32 * 1024 * 1024; // bytes of smsg relay that can wait for all peers together
+const unsigned int SMSG_SEND_YIELD     = 64 * 1024;         // smsg relay waits while more block and tx data than this is queued for a peer
 
 const unsigned int SMSG_TIME_LEEWAY    = 60;
 const unsigned int SMSG_TIME_IGNORE    = 90;                // seconds that a peer is ignored for if they fail to deliver messages for a smsgWant
@@ -32,6 +40,10 @@ const unsigned int SMSG_MAX_AMSG_BYTES = 512;               // the user input pa
 // max size of payload worst case compression
 const unsigned int SMSG_MAX_MSG_WORST = LZ4_COMPRESSBOUND(SMSG_MAX_MSG_BYTES+SMSG_PL_HDR_LEN);
 
+const uint8_t      SMSG_DICT_NONE      = 0;                 // version 3 messages, payload data is stored
+const uint8_t      SMSG_DICT_CURRENT   = 1;                 // dictionary used for new messages
+const unsigned int SMSG_MAX_DICT_BYTES = 2048;
+
 #define SMSG_MASK_UNREAD            (1 << 0)
 
 extern bool fSecMsgEnabled;
@@ -209,11 +221,13 @@ public:
         fNewAddressRecv = true;
         fNewAddressAnon = true;
         fScanIncoming   = true;
+        fCompressDict   = false;
     }
 
     bool fNewAddressRecv;
     bool fNewAddressAnon;
     bool fScanIncoming;
+    bool fCompressDict;     // send version 3 messages, nodes before version 3 can't read them
 };
 
 // Secure Message Crypter
@@ -223,10 +237,17 @@ private:
     uint8_t chKey[32];
     uint8_t chIV[16];
     bool fKeySet;
+    EVP_CIPHER_CTX* ctx; // allocated on first use and kept for every message the crypter handles
+
+    bool InitCtx(bool fEncrypt);
+
+    SecMsgCrypter(const SecMsgCrypter&);
+    SecMsgCrypter& operator=(const SecMsgCrypter&);
 public:
 
     SecMsgCrypter()
     {
+        ctx = NULL;
         // Try to keep the key data out of swap (and be a bit over-careful to keep the IV that we don't even use out of swap)
         // Note that this does nothing about suspend-to-disk (which will put all our key data on disk)
         // Note as well that at no point in this program is any attempt made to prevent stealing of keys by reading the memory of the running process.
@@ -241,6 +262,8 @@ public:
         memset(&chKey, 0, sizeof chKey);
         memset(&chIV, 0, sizeof chIV);
         fKeySet = false;
+        if (ctx)
+            EVP_CIPHER_CTX_free(ctx);
 
         LockedPageManager::instance.UnlockRange(&chKey[0], sizeof chKey);
         LockedPageManager::instance.UnlockRange(&chIV[0], sizeof chIV);
@@ -249,6 +272,7 @@ public:
     bool SetKey(const std::vector<uint8_t>& vchNewKey, uint8_t* chNewIV);
     bool SetKey(const uint8_t* chNewKey, uint8_t* chNewIV);
     bool Encrypt(uint8_t* chPlaintext,  uint32_t nPlain,  std::vector<uint8_t> &vchCiphertext);
+    bool Encrypt(uint8_t* chData, uint32_t nPlain, uint32_t nBuffer, uint32_t& nCipher);
     bool Decrypt(uint8_t* chCiphertext, uint32_t nCipher, std::vector<uint8_t>& vchPlaintext);
 };
 
@@ -274,6 +298,15 @@ public:
     );
 };
 
+// -- secondary indices over the inbox and outbox, maintained by SecMsgDB::WriteSmesg and EraseSmesg.
+//    keys are 'x' + type + folder [+ address length + address] + big endian time + primary key
+const char SMSG_INDEX_TIME      = 't';
+const char SMSG_INDEX_ADDRESS   = 'a';  // by sAddrTo
+const char SMSG_INDEX_UNREAD    = 'u';
+
+const uint32_t SMSG_INDEX_VERSION   = 1;
+const uint32_t SMSG_HDR_CACHE_SIZE  = 4096; // decrypted headers held in memory
+
 class SecMsgDB
 {
 public:
@@ -301,12 +334,21 @@ public:
     bool WritePK(CKeyID& addr, CPubKey& pubkey);
     bool ExistsPK(CKeyID& addr);
 
+    bool ReadLastScanned(uint256& hashBlock);
+    bool WriteLastScanned(const uint256& hashBlock);
+
+    bool ReadIndexVersion(uint32_t& nVersion);
+    bool WriteIndexVersion(uint32_t nVersion);
+
     bool NextSmesg(leveldb::Iterator* it, std::string& prefix, uint8_t* vchKey, SecMsgStored& smsgStored);
     bool NextSmesgKey(leveldb::Iterator* it, std::string& prefix, uint8_t* vchKey);
     bool ReadSmesg(uint8_t* chKey, SecMsgStored& smsgStored);
     bool WriteSmesg(uint8_t* chKey, SecMsgStored& smsgStored);
     bool ExistsSmesg(uint8_t* chKey);
-    bool EraseSmesg(uint8_t* chKey);
+    bool EraseSmesg(uint8_t* chKey, const SecMsgStored* pStored = NULL);
+
+    bool ListSmesg(const std::string& prefix, const std::string& sAddress, bool fUnreadOnly,
+        int64_t nSince, uint32_t nOffset, uint32_t nLimit, bool fNewestFirst, std::vector<std::vector<uint8_t> >& vKeys);
 
     leveldb::DB *pdb;       // points to the global instance
     leveldb::WriteBatch *activeBatch;
@@ -316,6 +358,8 @@ public:
 int SecureMsgBuildBucketSet();
 int SecureMsgAddWalletAddresses();
 
+int SecureMsgBuildIndex();
+
 int SecureMsgReadIni();
 int SecureMsgWriteIni();
 
@@ -329,8 +373,10 @@ bool SecureMsgReceiveData(CNode* pfrom, std::string strCommand, CDataStream& vRe
 bool SecureMsgSendData(CNode* pto, bool fSendTrickle);
 
 bool SecureMsgScanBlock(CBlock& block);
+bool SecureMsgStoreScannedKeys(SecMsgDB& addrpkdb, CHash160Filter& filter, const std::vector<CPubKey>& vPubKeys,
+    const uint256& hashLast, uint32_t& nPubkeys, uint32_t& nDuplicates);
 bool ScanChainForPublicKeys(CBlockIndex* pindexStart);
-bool SecureMsgScanBlockChain();
+bool SecureMsgScanBlockChain(bool fResume);
 bool SecureMsgScanBuckets();
 
 int SecureMsgWalletUnlocked();
@@ -357,10 +403,16 @@ int SecureMsgSend(std::string &addressFrom, std::string &addressTo, std::string
 int SecureMsgValidate(uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload);
 int SecureMsgSetHash (uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload);
 
+int SecureMsgCompressDict(uint8_t nDict, const uint8_t *pIn, uint32_t nIn, uint8_t *pOut, uint32_t nOutMax);
+int SecureMsgDecompressDict(uint8_t nDict, const uint8_t *pIn, uint32_t nIn, std::vector<uint8_t>& vchOut, uint32_t nOut);
+
 int SecureMsgEncrypt(SecureMessage &smsg, const std::string &addressFrom, const std::string &addressTo, const std::string &message);
 
 int SecureMsgDecrypt(bool fTestOnly, std::string &address, uint8_t *pHeader, uint8_t *pPayload, uint32_t nPayload, MessageData &msg);
 int SecureMsgDecrypt(bool fTestOnly, std::string &address, SecureMessage &smsg, MessageData &msg);
 
+int SecureMsgReadHeader(const std::vector<uint8_t>& vchKey, SecMsgStored& smsgStored, MessageData& msg);
+void SecureMsgClearHeaders();
+
 #endif // SEC_MESSAGE_H
 
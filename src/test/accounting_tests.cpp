@@ -129,4 +129,77 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+static void
+AddMove(CWallet& wallet, CWalletDB& walletdb, const std::string& strAccount, int64_t nAmount, CAccountingEntry& ae)
+{
+    ae.strAccount = strAccount;
+    ae.nCreditDebit = nAmount;
+    ae.nTime = 1333333340;
+    ae.strOtherAccount = "other";
+    ae.strComment = "";
+    ae.nOrderPos = wallet.IncOrderPosNext(&walletdb);
+    BOOST_CHECK(wallet.AddAccountingEntry(ae, walletdb));
+}
+
+BOOST_AUTO_TEST_CASE(acc_ordered_index)
+{
+    // -- txns and moves are interleaved in the index by nOrderPos, a rolled back move leaves it as it was
+    CWallet wallet("walletUT_acc.dat");
+    BOOST_CHECK(wallet.LoadWallet() == DB_LOAD_OK);
+
+    LOCK(wallet.cs_wallet);
+    CWalletDB walletdb(wallet.strWalletFile);
+    CAccountingEntry ae1, ae2, ae3;
+
+    CWalletTx wtx;
+    wtx.mapValue["comment"] = "a";
+    uint256 hash1 = wtx.GetHash();
+    wallet.AddToWallet(wtx, hash1);
+
+    AddMove(wallet, walletdb, "a", 1, ae1);
+
+    --wtx.nLockTime;
+    uint256 hash2 = wtx.GetHash();
+    wallet.AddToWallet(wtx, hash2);
+
+    AddMove(wallet, walletdb, "b", 2, ae2);
+
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 4);
+    BOOST_CHECK_EQUAL(wallet.laccentries.size(), 2);
+
+    std::vector<CWallet::TxPair> vItems;
+    int64_t nLastPos = -1;
+    for (CWallet::TxItems::const_iterator it = wallet.wtxOrdered.begin(); it != wallet.wtxOrdered.end(); ++it)
+    {
+        BOOST_CHECK(it->first > nLastPos);
+        nLastPos = it->first;
+        vItems.push_back(it->second);
+    };
+    BOOST_CHECK(vItems[0].first == &wallet.mapWallet[hash1] && !vItems[0].second);
+    BOOST_CHECK(!vItems[1].first && vItems[1].second && vItems[1].second->strAccount == "a");
+    BOOST_CHECK(vItems[2].first == &wallet.mapWallet[hash2] && !vItems[2].second);
+    BOOST_CHECK(!vItems[3].first && vItems[3].second && vItems[3].second->strAccount == "b");
+
+    // -- a move whose db txn is aborted, undone the way movecmd does it
+    int64_t nOrderPosNextWas = wallet.nOrderPosNext;
+    BOOST_CHECK(walletdb.TxnBegin());
+    AddMove(wallet, walletdb, "c", -3, ae3);
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 5);
+    BOOST_CHECK(walletdb.TxnAbort());
+    wallet.EraseAccountingEntry(ae3.nOrderPos);
+    wallet.nOrderPosNext = nOrderPosNextWas;
+
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 4);
+    BOOST_CHECK_EQUAL(wallet.laccentries.size(), 2);
+    BOOST_CHECK(!wallet.wtxOrdered.count(ae3.nOrderPos));
+    BOOST_FOREACH(const CAccountingEntry& entry, wallet.laccentries)
+        BOOST_CHECK(entry.strAccount != "c");
+
+    // -- the db holds only the committed moves, so a rebuilt index matches the one kept in memory
+    wallet.RebuildOrderedTxItems();
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 4);
+    BOOST_CHECK_EQUAL(wallet.laccentries.size(), 2);
+    BOOST_CHECK(!wallet.wtxOrdered.count(ae3.nOrderPos));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,239 @@
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "crypter.h"
+#include "pbkdf2.h"
+#include "scrypt.h"
+#include "wallet.h"
+#include "util.h"
+
+using namespace std;
+
+static CKeyingMaterial RandSecret(unsigned int nSize)
+{
+    CKeyingMaterial vch(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+        vch[i] = insecure_rand();
+    return vch;
+}
+
+class CTestCryptoKeyStore : public CCryptoKeyStore
+{
+public:
+    bool UnlockKeys(const CKeyingMaterial& vMasterKeyIn) { return Unlock(vMasterKeyIn); };
+};
+
+BOOST_AUTO_TEST_SUITE(crypter_tests)
+
+BOOST_AUTO_TEST_CASE(crypter_reuse)
+{
+    // -- one crypter across many secrets and both directions, as a new one for each
+    seed_insecure_rand(false);
+    CKeyingMaterial vMasterKey = RandSecret(WALLET_CRYPTO_KEY_SIZE);
+    CCrypter crypter;
+    for (int i = 0; i < 200; i++)
+    {
+        CKeyingMaterial vchSecret = RandSecret(i % 3 ? 32 : i % 40 + 1);
+        uint256 nIV = GetRandHash();
+        vector<unsigned char> vchIV(nIV.begin(), nIV.end()), vchCiphertext, vchExpect;
+        BOOST_CHECK(crypter.SetKey(vMasterKey, vchIV));
+        BOOST_CHECK(crypter.Encrypt(vchSecret, vchCiphertext));
+        BOOST_CHECK(EncryptSecret(vMasterKey, vchSecret, nIV, vchExpect));
+        BOOST_CHECK(vchCiphertext == vchExpect);
+
+        CKeyingMaterial vchPlaintext;
+        for (int k = 0; k < 2; k++)
+        {
+            BOOST_CHECK(crypter.Decrypt(vchCiphertext, vchPlaintext));
+            BOOST_CHECK(vchPlaintext == vchSecret);
+        };
+    };
+}
+
+BOOST_AUTO_TEST_CASE(crypter_batch)
+{
+    seed_insecure_rand(false);
+    CKeyingMaterial vMasterKey = RandSecret(WALLET_CRYPTO_KEY_SIZE);
+    vector<vector<unsigned char> > vCrypted(1000);
+    vector<uint256> vIV(vCrypted.size());
+    vector<CKeyingMaterial> vSecret(vCrypted.size());
+    for (unsigned int i = 0; i < vCrypted.size(); i++)
+    {
+        vSecret[i] = RandSecret(i % 5 ? 32 : i % 33 + 1);
+        vIV[i] = GetRandHash();
+        BOOST_CHECK(EncryptSecret(vMasterKey, vSecret[i], vIV[i], vCrypted[i]));
+    };
+
+    vector<const vector<unsigned char>*> vpCrypted;
+    for (unsigned int i = 0; i < vCrypted.size(); i++)
+        vpCrypted.push_back(&vCrypted[i]);
+    vector<CKeyingMaterial> vPlaintext;
+    BOOST_CHECK(DecryptSecrets(vMasterKey, vpCrypted, vIV, vPlaintext));
+    BOOST_CHECK(vPlaintext == vSecret);
+
+    // -- damaged ciphertexts fail alone and as DecryptSecret fails them
+    for (unsigned int i = 0; i < vCrypted.size(); i += 7)
+        vCrypted[i].back() ^= 1 + i % 255;
+    for (unsigned int i = 0; i < vCrypted.size(); i += 29)
+        vCrypted[i].resize(vCrypted[i].size() - 1);
+    vCrypted[1].clear();
+    BOOST_CHECK(!DecryptSecrets(vMasterKey, vpCrypted, vIV, vPlaintext));
+    BOOST_REQUIRE(vPlaintext.size() == vCrypted.size());
+    for (unsigned int i = 0; i < vCrypted.size(); i++)
+    {
+        CKeyingMaterial vchPlaintext;
+        if (DecryptSecret(vMasterKey, vCrypted[i], vIV[i], vchPlaintext))
+            BOOST_CHECK(vPlaintext[i] == vchPlaintext);
+        else
+            BOOST_CHECK(vPlaintext[i].empty());
+    };
+}
+
+BOOST_AUTO_TEST_CASE(crypter_keystore_unlock)
+{
+    // -- the master key is checked against the first expanded crypted key, unexpanded keys are skipped
+    seed_insecure_rand(false);
+    CKeyingMaterial vMasterKey = RandSecret(WALLET_CRYPTO_KEY_SIZE);
+    CKeyingMaterial vOtherKey = RandSecret(WALLET_CRYPTO_KEY_SIZE);
+
+    CKey keyUnexpanded;
+    keyUnexpanded.MakeNewKey(true);
+
+    CTestCryptoKeyStore keystoreUnexpanded;
+    BOOST_CHECK(keystoreUnexpanded.AddCryptedKey(keyUnexpanded.GetPubKey(), vector<unsigned char>()));
+    BOOST_CHECK(!keystoreUnexpanded.UnlockKeys(vMasterKey));
+    BOOST_CHECK(keystoreUnexpanded.IsLocked());
+
+    CTestCryptoKeyStore keystore;
+    BOOST_CHECK(keystore.AddCryptedKey(keyUnexpanded.GetPubKey(), vector<unsigned char>()));
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        CPubKey pubkey = key.GetPubKey();
+        vector<unsigned char> vchCrypted;
+        BOOST_CHECK(EncryptSecret(vMasterKey, CKeyingMaterial(key.begin(), key.end()), pubkey.GetHash(), vchCrypted));
+        BOOST_CHECK(keystore.AddCryptedKey(pubkey, vchCrypted));
+    };
+
+    BOOST_CHECK(!keystore.UnlockKeys(vOtherKey));
+    BOOST_CHECK(keystore.IsLocked());
+    BOOST_CHECK(keystore.UnlockKeys(vMasterKey));
+    BOOST_CHECK(!keystore.IsLocked());
+
+    // -- a secret under another key's IV decrypts to the wrong public key
+    CKey keyA, keyB;
+    keyA.MakeNewKey(true);
+    keyB.MakeNewKey(true);
+    vector<unsigned char> vchCrypted;
+    BOOST_CHECK(EncryptSecret(vMasterKey, CKeyingMaterial(keyB.begin(), keyB.end()), keyA.GetPubKey().GetHash(), vchCrypted));
+    CTestCryptoKeyStore keystoreBad;
+    BOOST_CHECK(keystoreBad.AddCryptedKey(keyA.GetPubKey(), vchCrypted));
+    BOOST_CHECK(!keystoreBad.UnlockKeys(vMasterKey));
+    BOOST_CHECK(keystoreBad.IsLocked());
+}
+
+BOOST_AUTO_TEST_CASE(crypter_extkey_unlock)
+{
+    // -- crypted ext keys unlock over several threads, a wrong master key unlocks none
+    CWallet wallet;
+    CKeyingMaterial vMasterKey = RandSecret(WALLET_CRYPTO_KEY_SIZE);
+    CKeyingMaterial vOtherKey = RandSecret(WALLET_CRYPTO_KEY_SIZE);
+
+    CExtKey evMaster;
+    uint256 nSeed = GetRandHash();
+    evMaster.SetMaster(nSeed.begin(), 32);
+
+    const unsigned int nKeys = UNLOCK_KEYS_CHUNK * 4 + 3;
+    vector<CStoredExtKey> vStored(nKeys);
+    vector<CStoredExtKey*> vKeys;
+    vector<CPubKey> vPubKey;
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        CExtKey evChild;
+        BOOST_REQUIRE(evMaster.Derive(evChild, i));
+        vStored[i].kp = CExtKeyPair(evChild);
+        vPubKey.push_back(vStored[i].kp.pubkey);
+        BOOST_CHECK(wallet.ExtKeyEncrypt(&vStored[i], vMasterKey, true) == 0);
+        BOOST_CHECK(vStored[i].fLocked && !vStored[i].kp.IsValidV());
+        vKeys.push_back(&vStored[i]);
+    };
+    vKeys.push_back(&vStored[0]); // listed twice
+
+    BOOST_CHECK(wallet.ExtKeyUnlock(vKeys, vOtherKey) != 0);
+    for (unsigned int i = 0; i < nKeys; i++)
+        BOOST_CHECK(vStored[i].fLocked);
+
+    int64_t nStart = GetTimeMicros();
+    BOOST_CHECK(wallet.ExtKeyUnlock(vKeys, vMasterKey) == 0);
+    int64_t nBatch = GetTimeMicros() - nStart;
+    for (unsigned int i = 0; i < nKeys; i++)
+    {
+        BOOST_CHECK(!vStored[i].fLocked);
+        BOOST_CHECK(vStored[i].kp.key.GetPubKey() == vPubKey[i]);
+    };
+
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nKeys; i++)
+        BOOST_CHECK(wallet.ExtKeyUnlock(&vStored[i], vMasterKey) == 0);
+    int64_t nSingle = GetTimeMicros() - nStart;
+
+    BOOST_MESSAGE("unlock of " << nKeys << " ext keys: one at a time " << nSingle << "us, batched on "
+        << boost::thread::hardware_concurrency() << " threads " << nBatch << "us");
+}
+
+BOOST_AUTO_TEST_CASE(crypter_scrypt_lanes)
+{
+    // -- derivation method 2 gives the lanes computed one after another, whatever the threads
+    SecureString strPassphrase("correct horse battery staple");
+    vector<unsigned char> vchSalt(WALLET_CRYPTO_SALT_SIZE, 0x5a);
+    const unsigned int nRounds = 3;
+    CKeyingMaterial vchPlaintext = RandSecret(32);
+    vector<unsigned char> vchLast;
+
+    for (unsigned int nLanes = 1; nLanes <= 5; nLanes++)
+    {
+        CMasterKey kMasterKey(2);
+        BOOST_CHECK(kMasterKey.nDerivationMethod == 2 && kMasterKey.vchOtherDerivationParameters.size() == 4);
+        kMasterKey.SetLanes(nLanes);
+
+        vector<unsigned char> vchLaneSalt(nLanes * 32);
+        PBKDF2_SHA256((const uint8_t*)strPassphrase.c_str(), strPassphrase.size(), &vchSalt[0], vchSalt.size(), 1, &vchLaneSalt[0], vchLaneSalt.size());
+        vector<uint256> vLaneHash;
+        for (unsigned int i = 0; i < nLanes; i++)
+            vLaneHash.push_back(scrypt_salted_multiround_hash(strPassphrase.c_str(), strPassphrase.size(), &vchLaneSalt[i * 32], 32, nRounds));
+        unsigned char chDerived[64];
+        PBKDF2_SHA256((const uint8_t*)strPassphrase.c_str(), strPassphrase.size(), (const uint8_t*)&vLaneHash[0], nLanes * 32, 1, chDerived, 64);
+
+        CCrypter crypter, crypterExpect;
+        BOOST_CHECK(crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, nRounds, 2, kMasterKey.vchOtherDerivationParameters));
+        BOOST_CHECK(crypterExpect.SetKey(CKeyingMaterial(chDerived, chDerived + 32), vector<unsigned char>(chDerived + 32, chDerived + 64)));
+        vector<unsigned char> vchCiphertext, vchExpect;
+        BOOST_CHECK(crypter.Encrypt(vchPlaintext, vchCiphertext));
+        BOOST_CHECK(crypterExpect.Encrypt(vchPlaintext, vchExpect));
+        BOOST_CHECK(vchCiphertext == vchExpect);
+        BOOST_CHECK(vchCiphertext != vchLast);
+        vchLast = vchCiphertext;
+    };
+
+    CCrypter crypter;
+    BOOST_CHECK(!crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, nRounds, 2));
+    BOOST_CHECK(!crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, nRounds, 2, vector<unsigned char>(4, 0)));
+    BOOST_CHECK(!crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, nRounds, 2, vector<unsigned char>(4, 0xff)));
+
+    // -- the same wall clock time buys about one lane of work per core
+    CMasterKey kMasterKey(2);
+    int64_t nStart = GetTimeMicros();
+    BOOST_CHECK(crypter.SetKeyFromPassphrase(strPassphrase, vchSalt, WALLET_SCRYPT_MIN_ROUNDS, 2, kMasterKey.vchOtherDerivationParameters));
+    int64_t nTime = GetTimeMicros() - nStart;
+    BOOST_MESSAGE("scrypt lanes: " << (unsigned int)kMasterKey.vchOtherDerivationParameters[0] << " lanes of "
+        << WALLET_SCRYPT_MIN_ROUNDS << " rounds in " << nTime << "us");
+
+    // -- both scrypt methods get the scrypt floor, only sha512 needs thousands of rounds
+    BOOST_CHECK(CMasterKey(0).GetMinIterations() == 25000);
+    BOOST_CHECK(CMasterKey(1).GetMinIterations() == WALLET_SCRYPT_MIN_ROUNDS);
+    BOOST_CHECK(CMasterKey(2).GetMinIterations() == WALLET_SCRYPT_MIN_ROUNDS);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
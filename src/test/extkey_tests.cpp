@@ -546,6 +546,40 @@ void RunSerialiseTests()
     
 }
 
+void RunDeriveManyTests()
+{
+    CExtKey58 eKey58;
+    BOOST_CHECK(0 == eKey58.Set58("SUMpmphCJNSUos9rNqn6FNi3ztvMW1wft1PVbifvBrwhm6JnhD9yk8rSNFTGfozGbmBsr8vZv9mGYSTfmEMpbfTTMb8TQfj7JRABmvBFKgA2xG8J"));
+
+    CStoredExtKey sk;
+    sk.kp = eKey58.GetKey();
+
+    // - batched derivation must match deriving one key at a time, both single threaded and split over threads
+    uint32_t aCounts[] = {1, 5, EXTKEY_DERIVE_CHUNK * 4 + 3};
+    for (size_t c = 0; c < sizeof(aCounts) / sizeof(aCounts[0]); ++c)
+    {
+        std::vector<CPubKey> vKeys;
+        std::vector<uint32_t> vChildren;
+        BOOST_CHECK(0 == sk.DeriveKeys(vKeys, vChildren, 7, aCounts[c]));
+        BOOST_CHECK(vKeys.size() == aCounts[c]);
+        BOOST_CHECK(vChildren.size() == vKeys.size());
+
+        for (size_t k = 0; k < vKeys.size(); ++k)
+        {
+            CPubKey pk;
+            uint32_t nChild;
+            BOOST_CHECK(0 == sk.DeriveKey(pk, vChildren[k], nChild, false));
+            BOOST_CHECK(nChild == vChildren[k]);
+            BOOST_CHECK_MESSAGE(pk == vKeys[k], "key " << k << " child " << vChildren[k]);
+        };
+    };
+
+    // - can't run past the non-hardened range
+    std::vector<CPubKey> vKeys;
+    std::vector<uint32_t> vChildren;
+    BOOST_CHECK(1 == sk.DeriveKeys(vKeys, vChildren, (1u << 31) - 2, 3));
+}
+
 BOOST_AUTO_TEST_SUITE(extkey_tests)
 
 BOOST_AUTO_TEST_CASE(extkey_path)
@@ -558,6 +592,11 @@ BOOST_AUTO_TEST_CASE(extkey_derive)
     RunDeriveTests();
 }
 
+BOOST_AUTO_TEST_CASE(extkey_derive_many)
+{
+    RunDeriveManyTests();
+}
+
 BOOST_AUTO_TEST_CASE(extkey_serialise)
 {
     RunSerialiseTests();
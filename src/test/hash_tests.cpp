@@ -2,6 +2,7 @@
 
 #include "hash.h"
 #include "util.h"
+#include "main.h"
 
 #include <vector>
 
@@ -44,4 +45,126 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(hash_memoized)
+{
+    // -- a legacy (scrypt) block of 200 txns, read back from a stream as ProcessBlock gets it
+    CBlock block;
+    block.nVersion = 6;
+    block.nTime = 1400000000;
+    block.nBits = 0x1e0fffff;
+    for (int i = 0; i < 200; i++)
+    {
+        CTransaction tx;
+        tx.vin.push_back(CTxIn(Hash(BEGIN(i), END(i)), 0));
+        tx.vin.push_back(CTxIn(Hash(BEGIN(i), END(i)), 1));
+        tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, i);
+        tx.vout.push_back(CTxOut(i, CScript() << OP_TRUE));
+        tx.vout.push_back(CTxOut(i + 1, CScript() << OP_TRUE));
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CBlock blockRead;
+    ss >> blockRead;
+
+    // -- each round stands for one pass over the block, as made by CheckBlock, AcceptBlock, ConnectBlock ...
+    const int nRounds = 10;
+    int64_t nStart = GetTimeMicros();
+    for (int r = 0; r < nRounds; r++)
+    {
+        scrypt_blockhash(CVOIDBEGIN(block.nVersion));
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            SerializeHash(tx);
+    }
+    int64_t nUncached = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int r = 0; r < nRounds; r++)
+    {
+        BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+        BOOST_FOREACH(const CTransaction& tx, blockRead.vtx)
+            tx.GetHash();
+    }
+    int64_t nCached = GetTimeMicros() - nStart;
+
+    BOOST_MESSAGE("hash computations per block over " << nRounds << " passes: "
+        << nRounds * (1 + block.vtx.size()) << " before, " << 1 + block.vtx.size() << " after; "
+        << nUncached / 1000 << "ms before, " << nCached / 1000 << "ms after");
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(blockRead.vtx[i].GetHash() == SerializeHash(block.vtx[i]));
+
+    // -- header changes are picked up without invalidation
+    uint256 hashBefore = blockRead.GetHash();
+    blockRead.nNonce++;
+    BOOST_CHECK(blockRead.GetHash() != hashBefore);
+    BOOST_CHECK(blockRead.GetHash() == scrypt_blockhash(CVOIDBEGIN(blockRead.nVersion)));
+    blockRead.nVersion = 7;
+    BOOST_CHECK(blockRead.GetHash() == Hash(BEGIN(blockRead.nVersion), END(blockRead.nNonce)));
+
+    // -- a copy doesn't take the cache, a txn changed in place needs UpdateHash
+    CTransaction& txRead = blockRead.vtx[0];
+    CTransaction txCopy(txRead);
+    txCopy.nLockTime = 1;
+    BOOST_CHECK(txCopy.GetHash() == SerializeHash(txCopy));
+    BOOST_CHECK(txCopy.GetHash() != txRead.GetHash());
+
+    txRead.nLockTime = 1;
+    txRead.UpdateHash();
+    BOOST_CHECK(txRead.GetHash() == txCopy.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_many)
+{
+    // -- 37 legacy headers, enough for full 8 and 4 lane batches and a single lane remainder
+    const unsigned int nHeaders = 37;
+    std::vector<CBlockHeader> vHeaders(nHeaders);
+    std::vector<unsigned char> vData;
+    for (unsigned int i = 0; i < nHeaders; i++)
+    {
+        CBlockHeader& header = vHeaders[i];
+        header.nVersion = 6;
+        header.hashPrevBlock = Hash(BEGIN(i), END(i));
+        header.nTime = 1400000000 + i;
+        header.nBits = 0x1e0fffff;
+        header.nNonce = i * 7919;
+        vData.insert(vData.end(), BEGIN(header.nVersion), END(header.nNonce));
+    }
+
+    std::vector<uint256> vExpect(nHeaders);
+    int64_t nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nHeaders; i++)
+        vExpect[i] = scrypt_blockhash(&vData[i * 80]);
+    int64_t nSingle = GetTimeMicros() - nStart;
+    BOOST_MESSAGE("scrypt_blockhash: " << nHeaders * 1000000 / std::max(nSingle, (int64_t)1) << " hashes/s");
+
+    for (unsigned int nLanes = 1; nLanes <= scrypt_blockhash_lanes(); nLanes *= 2)
+    {
+        std::vector<uint256> vHashes(nHeaders);
+        nStart = GetTimeMicros();
+        scrypt_blockhash_many(&vData[0], &vHashes[0], nHeaders, nLanes);
+        int64_t nMany = GetTimeMicros() - nStart;
+        BOOST_MESSAGE("scrypt_blockhash_many, " << nLanes << " lanes: "
+            << nHeaders * 1000000 / std::max(nMany, (int64_t)1) << " hashes/s on one core");
+
+        for (unsigned int i = 0; i < nHeaders; i++)
+            BOOST_CHECK(vHashes[i] == vExpect[i]);
+    }
+
+    // -- prehashed headers answer GetHash from their cache, v7+ headers are left alone
+    vHeaders[0].nVersion = 7;
+    std::vector<const CBlockHeader*> vpHeaders;
+    for (unsigned int i = 0; i < nHeaders; i++)
+        vpHeaders.push_back(&vHeaders[i]);
+    PrehashHeaders(vpHeaders);
+    BOOST_CHECK(!vHeaders[0].fHashCached);
+    for (unsigned int i = 1; i < nHeaders; i++)
+    {
+        BOOST_CHECK(vHeaders[i].fHashCached);
+        BOOST_CHECK(vHeaders[i].GetHash() == vExpect[i]);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
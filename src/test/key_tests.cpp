@@ -4,6 +4,8 @@
 #include <vector>
 
 #include "key.h"
+#include "eckey.h"
+#include "secp256k1.h"
 #include "base58.h"
 #include "uint256.h"
 #include "util.h"
@@ -160,4 +162,119 @@ BOOST_AUTO_TEST_CASE(key_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(secp256k1_crosscheck)
+{
+    BOOST_CHECK(Secp256k1::SelfTest());
+
+    seed_insecure_rand(false);
+    for (int n = 0; n < 200; n++)
+    {
+        CKey key;
+        key.MakeNewKey(n % 2);
+        CECKey eckey;
+        eckey.SetSecretBytes(key.begin());
+
+        CPubKey pubkey = key.GetPubKey(), pubkeyCheck;
+        eckey.GetPubKey(pubkeyCheck, key.IsCompressed());
+        BOOST_CHECK(pubkey == pubkeyCheck);
+
+        uint256 hash = GetRandHash();
+        if (n % 7 == 0)
+            hash = ~uint256(0); // above the order
+
+        vector<unsigned char> vchSig, vchSigCheck;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        BOOST_CHECK(eckey.Sign(hash, vchSigCheck));
+        CECKey eckeyPub;
+        BOOST_CHECK(eckeyPub.SetPubKey(pubkey));
+        BOOST_CHECK(eckeyPub.Verify(hash, vchSig));
+        BOOST_CHECK(pubkey.Verify(hash, vchSigCheck));
+
+        // -- RFC6979 nonces, signing again gives the same signature
+        vector<unsigned char> vchSig2;
+        BOOST_CHECK(key.Sign(hash, vchSig2) && vchSig2 == vchSig);
+
+        // -- damaged signatures and hashes, both must agree
+        for (int i = 0; i < 20; i++)
+        {
+            vector<unsigned char> vchBad = vchSigCheck;
+            uint256 hashBad = hash;
+            switch (insecure_rand() % 4)
+            {
+                case 0: vchBad[insecure_rand() % vchBad.size()] ^= 1 << (insecure_rand() % 8); break;
+                case 1: vchBad[insecure_rand() % vchBad.size()] = insecure_rand(); break;
+                case 2: vchBad.push_back(0); break;
+                case 3: *(hashBad.begin() + insecure_rand() % 32) ^= 1; break;
+            };
+            BOOST_CHECK(pubkey.Verify(hashBad, vchBad) == eckeyPub.Verify(hashBad, vchBad));
+        };
+
+        // -- padded integer, not DER
+        vector<unsigned char> vchPadded(vchSigCheck.begin(), vchSigCheck.begin() + 4);
+        vchPadded.push_back(0);
+        vchPadded.insert(vchPadded.end(), vchSigCheck.begin() + 4, vchSigCheck.end());
+        vchPadded[1]++;
+        vchPadded[3]++;
+        BOOST_CHECK(!pubkey.Verify(hash, vchPadded));
+        BOOST_CHECK(!eckeyPub.Verify(hash, vchPadded));
+
+        // -- hybrid encoding, the prefix must match the parity of y
+        if (!key.IsCompressed())
+        {
+            vector<unsigned char> vchHybrid(pubkey.begin(), pubkey.end());
+            vchHybrid[0] = 0x06 | (vchHybrid[64] & 1);
+            BOOST_CHECK(Secp256k1::Verify(&vchHybrid[0], 65, hash.begin(), &vchSig[0], vchSig.size()));
+            vchHybrid[0] ^= 1;
+            BOOST_CHECK(!Secp256k1::Verify(&vchHybrid[0], 65, hash.begin(), &vchSig[0], vchSig.size()));
+        };
+    };
+
+    // -- x not on the curve
+    vector<unsigned char> vchPubKey(33, 0);
+    vchPubKey[0] = 0x02;
+    vchPubKey[32] = 5;
+    vector<unsigned char> vchSig;
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    BOOST_CHECK(!Secp256k1::Verify(&vchPubKey[0], 33, hash.begin(), &vchSig[0], vchSig.size()));
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_bench)
+{
+    const int nRuns = 500;
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    CECKey eckey, eckeyPub;
+    eckey.SetSecretBytes(key.begin());
+    eckeyPub.SetPubKey(pubkey);
+    uint256 hash = GetRandHash();
+    vector<unsigned char> vchSig, vchSigCheck;
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < nRuns; i++)
+        key.Sign(hash, vchSig);
+    int64_t nSign = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRuns; i++)
+        BOOST_CHECK(pubkey.Verify(hash, vchSig));
+    int64_t nVerify = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRuns; i++)
+        eckey.Sign(hash, vchSigCheck);
+    int64_t nSignCheck = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRuns; i++)
+        BOOST_CHECK(eckeyPub.Verify(hash, vchSigCheck));
+    int64_t nVerifyCheck = GetTimeMicros() - nStart;
+
+    BOOST_MESSAGE("secp256k1 sign " << nSign / nRuns << "us, verify " << nVerify / nRuns << "us; OpenSSL sign "
+        << nSignCheck / nRuns << "us, verify " << nVerifyCheck / nRuns << "us");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,210 @@
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "keystore.h"
+#include "prevector.h"
+#include "util.h"
+
+using namespace std;
+
+// -- count the heap allocations of the test binary, to see what the inline storage saves
+static uint64_t nAllocations = 0;
+
+void* operator new(size_t n)
+{
+    nAllocations++;
+    void* p = malloc(n);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw()
+{
+    free(p);
+}
+
+typedef prevector<28, unsigned char> prevector28;
+
+static void CheckEqual(const prevector28& pv, const vector<unsigned char>& v)
+{
+    BOOST_REQUIRE(pv.size() == v.size());
+    BOOST_CHECK(vector<unsigned char>(pv.begin(), pv.end()) == v);
+    BOOST_CHECK(pv == prevector28(v.begin(), v.end()));
+}
+
+BOOST_AUTO_TEST_SUITE(prevector_tests)
+
+BOOST_AUTO_TEST_CASE(prevector_random)
+{
+    // -- the same random operations on a prevector and a vector, across the inline / heap boundary
+    seed_insecure_rand(false);
+    for (int i = 0; i < 2000; i++)
+    {
+        prevector28 pv;
+        vector<unsigned char> v;
+        for (int j = 0; j < 50; j++)
+        {
+            unsigned char c = insecure_rand();
+            unsigned int nPos = insecure_rand() % (v.size() + 1);
+            switch (insecure_rand() % 10)
+            {
+                case 0: pv.push_back(c); v.push_back(c); break;
+                case 1: if (!v.empty()) { pv.pop_back(); v.pop_back(); } break;
+                case 2: { unsigned int n = insecure_rand() % 80; pv.resize(n); v.resize(n); } break;
+                case 3: pv.insert(pv.begin() + nPos, c); v.insert(v.begin() + nPos, c); break;
+                case 4:
+                {
+                    vector<unsigned char> vIns(insecure_rand() % 50, c);
+                    pv.insert(pv.begin() + nPos, vIns.begin(), vIns.end());
+                    v.insert(v.begin() + nPos, vIns.begin(), vIns.end());
+                } break;
+                case 5:
+                {
+                    unsigned int nEnd = nPos + insecure_rand() % (v.size() - nPos + 1);
+                    pv.erase(pv.begin() + nPos, pv.begin() + nEnd);
+                    v.erase(v.begin() + nPos, v.begin() + nEnd);
+                } break;
+                case 6: { prevector28 pvCopy(pv); pv = pvCopy; } break;
+                case 7: pv.shrink_to_fit(); break;
+                case 8: { prevector28 pvSwap; pvSwap.swap(pv); CheckEqual(pvSwap, v); pv.swap(pvSwap); } break;
+                case 9: pv.reserve(insecure_rand() % 100); break;
+            };
+            CheckEqual(pv, v);
+        };
+    };
+}
+
+BOOST_AUTO_TEST_CASE(prevector_script)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(key.GetPubKey().GetID());
+    BOOST_CHECK(scriptPubKey.size() <= 28);
+
+    // -- short scripts are copied without touching the heap
+    uint64_t nStart = nAllocations;
+    CScript scriptCopy(scriptPubKey);
+    scriptCopy = scriptPubKey;
+    BOOST_CHECK(nAllocations == nStart);
+    BOOST_CHECK(scriptCopy == scriptPubKey);
+
+    // -- and serialize as before
+    CScript scriptLong = scriptPubKey;
+    scriptLong << vector<unsigned char>(72, 1) << OP_DROP;
+    for (int i = 0; i < 2; i++)
+    {
+        const CScript& script = i ? scriptLong : scriptPubKey;
+        CDataStream ss(SER_DISK, CLIENT_VERSION), ssVector(SER_DISK, CLIENT_VERSION);
+        ss << script;
+        ssVector << vector<unsigned char>(script.begin(), script.end());
+        BOOST_CHECK(ss.str() == ssVector.str());
+        BOOST_CHECK(ss.size() == ::GetSerializeSize(script, SER_DISK, CLIENT_VERSION));
+        CScript scriptRead;
+        ss >> scriptRead;
+        BOOST_CHECK(scriptRead == script);
+    };
+
+    scriptLong.clear();
+    BOOST_CHECK(scriptLong.empty() && scriptLong.allocated_memory() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(prevector_block_replay_bench)
+{
+    // -- a block of 400 transactions spending two P2PKH outputs each, read and verified as when connecting it
+    const int nTxns = 400;
+    CBasicKeyStore keystore;
+    vector<CScript> vScriptPubKey;
+    for (int i = 0; i < 10; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        CScript scriptPubKey;
+        scriptPubKey.SetDestination(key.GetPubKey().GetID());
+        vScriptPubKey.push_back(scriptPubKey);
+    };
+
+    CBlock block;
+    vector<vector<CScript> > vPrevScripts;
+    for (int i = 0; i < nTxns; i++)
+    {
+        CTransaction tx;
+        vector<CScript> vPrev;
+        for (int j = 0; j < 2; j++)
+        {
+            tx.vin.push_back(CTxIn(GetRandHash(), j));
+            vPrev.push_back(vScriptPubKey[(i + j) % vScriptPubKey.size()]);
+            tx.vout.push_back(CTxOut(1 * COIN, vScriptPubKey[(i * 3 + j) % vScriptPubKey.size()]));
+        };
+        for (int j = 0; j < 2; j++)
+            BOOST_CHECK(SignSignature(keystore, vPrev[j], tx, j));
+        block.vtx.push_back(tx);
+        vPrevScripts.push_back(vPrev);
+    };
+
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+
+    // -- reading the block
+    const int nPasses = 10;
+    uint64_t nStart = nAllocations;
+    int64_t nStartTime = GetTimeMicros();
+    for (int i = 0; i < nPasses; i++)
+    {
+        CDataStream ss(ssBlock);
+        CBlock blockRead;
+        ss >> blockRead;
+        BOOST_CHECK(blockRead.vtx.size() == (unsigned int)nTxns);
+    };
+    int64_t nReadTime = GetTimeMicros() - nStartTime;
+    uint64_t nReadAllocs = nAllocations - nStart;
+
+    // -- the same scripts held in vectors, as CScript did before
+    uint64_t nScriptAllocs = 0, nVectorAllocs = 0;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+        {
+            nStart = nAllocations;
+            CScript script(tx.vin[j].scriptSig);
+            nScriptAllocs += nAllocations - nStart;
+            nStart = nAllocations;
+            vector<unsigned char> v(tx.vin[j].scriptSig.begin(), tx.vin[j].scriptSig.end());
+            nVectorAllocs += nAllocations - nStart;
+        };
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+        {
+            nStart = nAllocations;
+            CScript script(tx.vout[j].scriptPubKey);
+            nScriptAllocs += nAllocations - nStart;
+            nStart = nAllocations;
+            vector<unsigned char> v(tx.vout[j].scriptPubKey.begin(), tx.vout[j].scriptPubKey.end());
+            nVectorAllocs += nAllocations - nStart;
+        };
+    };
+    BOOST_CHECK(nScriptAllocs < nVectorAllocs);
+
+    // -- verifying every input, the signatures are cached from signing so this is mostly script overhead
+    nStart = nAllocations;
+    nStartTime = GetTimeMicros();
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction& tx = block.vtx[i];
+        for (unsigned int j = 0; j < tx.vin.size(); j++)
+            BOOST_CHECK(VerifyScript(tx.vin[j].scriptSig, vPrevScripts[i][j], tx, j, STANDARD_SCRIPT_VERIFY_FLAGS, 0));
+    };
+    int64_t nVerifyTime = GetTimeMicros() - nStartTime;
+    uint64_t nVerifyAllocs = nAllocations - nStart;
+
+    BOOST_MESSAGE("block replay of " << nTxns << " txns: read " << nReadAllocs / (nPasses * nTxns) << " allocations/txn, "
+        << (nReadTime ? (int64_t)nPasses * nTxns * 1000000 / nReadTime : 0) << " txns/s; scripts copied "
+        << nScriptAllocs << " allocations, as vectors " << nVectorAllocs << "; verify " << nVerifyAllocs / (2 * nTxns)
+        << " allocations/input, " << (nVerifyTime ? (int64_t)2 * nTxns * 1000000 / nVerifyTime : 0) << " inputs/s");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -12,7 +12,7 @@
 using namespace std;
 
 // Test routines internal to script.cpp:
-extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+extern uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 //extern bool VerifyScriptVerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
 //                         bool fValidatePayToScriptHash, int nHashType);
 
@@ -20,7 +20,7 @@ extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsig
 static std::vector<unsigned char>
 Serialize(const CScript& s)
 {
-    std::vector<unsigned char> sSerialized(s);
+    std::vector<unsigned char> sSerialized(s.begin(), s.end());
     return sSerialized;
 }
 
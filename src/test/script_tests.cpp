@@ -19,7 +19,8 @@ using namespace std;
 using namespace json_spirit;
 using namespace boost::algorithm;
 
-extern uint256 SignatureHash(CScript scriptSig, const CTransaction& txTo, unsigned int nIn, int nHashType);
+extern uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+extern bool CastToBool(const valtype& vch);
 
 static const unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC;
 
@@ -118,6 +119,44 @@ read_json(const std::string& filename)
     return v.get_array();
 }
 
+// VerifyScript without the template fast paths, running EvalScript for everything
+static bool VerifyScriptEval(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
+                             unsigned int flags, int nHashType)
+{
+    vector<vector<unsigned char> > stack, stackCopy;
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+        return false;
+    stackCopy = stack;
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+        return false;
+    if (stack.empty() || CastToBool(stack.back()) == false)
+        return false;
+
+    if ((flags & SCRIPT_VERIFY_P2SH) && scriptPubKey.IsPayToScriptHash())
+    {
+        if (!scriptSig.IsPushOnly())
+            return false;
+        const valtype& pubKeySerialized = stackCopy.back();
+        CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
+        stackCopy.pop_back();
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+            return false;
+        if (stackCopy.empty())
+            return false;
+        return CastToBool(stackCopy.back());
+    }
+    return true;
+}
+
+static void CheckFastPath(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, int nHashType, const string& strTest)
+{
+    static const unsigned int vFlags[] = {SCRIPT_VERIFY_NONE, SCRIPT_VERIFY_P2SH, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC,
+        STANDARD_SCRIPT_VERIFY_FLAGS, STANDARD_SCRIPT_VERIFY_FLAGS | SCRIPT_VERIFY_ALLOW_EMPTY_SIG | SCRIPT_VERIFY_FIX_HASHTYPE};
+    for (unsigned int i = 0; i < sizeof(vFlags) / sizeof(vFlags[0]); i++)
+        BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, txTo, 0, vFlags[i], nHashType)
+            == VerifyScriptEval(scriptSig, scriptPubKey, txTo, 0, vFlags[i], nHashType), strTest << " flags " << vFlags[i]);
+}
+
 BOOST_AUTO_TEST_SUITE(script_tests)
 
 BOOST_AUTO_TEST_CASE(script_valid)
@@ -145,6 +184,7 @@ BOOST_AUTO_TEST_CASE(script_valid)
 
         CTransaction tx;
         BOOST_CHECK_MESSAGE(VerifyScript(scriptSig, scriptPubKey, tx, 0, flags, SIGHASH_NONE), strTest);
+        CheckFastPath(scriptSig, scriptPubKey, tx, SIGHASH_NONE, strTest);
     }
 }
 
@@ -169,6 +209,7 @@ BOOST_AUTO_TEST_CASE(script_invalid)
 
         CTransaction tx;
         BOOST_CHECK_MESSAGE(!VerifyScript(scriptSig, scriptPubKey, tx, 0, flags, SIGHASH_NONE), strTest);
+        CheckFastPath(scriptSig, scriptPubKey, tx, SIGHASH_NONE, strTest);
     }
 }
 
@@ -389,7 +430,7 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     combined = CombineSignatures(scriptPubKey, txTo, 0, scriptSigCopy, scriptSig);
     BOOST_CHECK(combined == scriptSigCopy || combined == scriptSig);
     // dummy scriptSigCopy with placeholder, should always choose non-placeholder:
-    scriptSigCopy = CScript() << OP_0 << static_cast<vector<unsigned char> >(pkSingle);
+    scriptSigCopy = CScript() << OP_0 << vector<unsigned char>(pkSingle.begin(), pkSingle.end());
     combined = CombineSignatures(scriptPubKey, txTo, 0, scriptSigCopy, scriptSig);
     BOOST_CHECK(combined == scriptSig);
     combined = CombineSignatures(scriptPubKey, txTo, 0, scriptSig, scriptSigCopy);
@@ -448,4 +489,166 @@ BOOST_AUTO_TEST_CASE(script_combineSigs)
     BOOST_CHECK(combined == partial3c);
 }
 
+BOOST_AUTO_TEST_CASE(script_sign_parallel)
+{
+    // 500 inputs spending P2PKH outputs of 10 keys, signed one at a time and with SignSignatures
+    const unsigned int nInputs = 500;
+    CBasicKeyStore keystore;
+    std::vector<CScript> vScriptPubKey;
+    for (int i = 0; i < 10; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        keystore.AddKey(key);
+        CScript scriptPubKey;
+        scriptPubKey.SetDestination(key.GetPubKey().GetID());
+        vScriptPubKey.push_back(scriptPubKey);
+    }
+
+    CTransaction txTo;
+    std::vector<CScript> vFromPubKey;
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        uint256 hashPrev = Hash(BEGIN(i), END(i));
+        txTo.vin.push_back(CTxIn(hashPrev, i % 3));
+        vFromPubKey.push_back(vScriptPubKey[i % vScriptPubKey.size()]);
+    }
+    txTo.vout.push_back(CTxOut(1 * COIN, vScriptPubKey[0]));
+    txTo.vout.push_back(CTxOut(2 * COIN, vScriptPubKey[1]));
+
+    CSignatureHasher hasher(txTo);
+    for (unsigned int i = 0; i < nInputs; i += 37)
+    {
+        BOOST_CHECK(hasher.SignatureHash(vFromPubKey[i], i, SIGHASH_ALL) == SignatureHash(vFromPubKey[i], txTo, i, SIGHASH_ALL));
+        BOOST_CHECK(hasher.SignatureHash(vFromPubKey[i], i, SIGHASH_SINGLE) == SignatureHash(vFromPubKey[i], txTo, i, SIGHASH_SINGLE));
+    }
+
+    CTransaction txSerial(txTo);
+    int64_t nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nInputs; i++)
+        BOOST_CHECK(SignSignature(keystore, vFromPubKey[i], txSerial, i));
+    int64_t nSerial = GetTimeMicros() - nStart;
+
+    CTransaction txParallel(txTo);
+    std::vector<char> vfSigned;
+    nStart = GetTimeMicros();
+    BOOST_CHECK(SignSignatures(keystore, vFromPubKey, txParallel, SIGHASH_ALL, &vfSigned));
+    int64_t nParallel = GetTimeMicros() - nStart;
+
+    BOOST_CHECK(vfSigned.size() == nInputs);
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        BOOST_CHECK(vfSigned[i]);
+        BOOST_CHECK(VerifyScript(txParallel.vin[i].scriptSig, vFromPubKey[i], txParallel, i, flags, 0));
+    }
+
+    BOOST_MESSAGE("sign " << nInputs << " inputs: SignSignature " << nSerial / 1000 << "ms, SignSignatures "
+        << nParallel / 1000 << "ms on " << boost::thread::hardware_concurrency() << " threads");
+}
+
+BOOST_AUTO_TEST_CASE(script_standard_fast_paths)
+{
+    // -- signed P2PKH, P2PK and P2SH multisig spends, then damaged, must verify as EvalScript does
+    CBasicKeyStore keystore;
+    vector<CKey> keys;
+    vector<CPubKey> pubkeys;
+    for (int i = 0; i < 3; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i != 1);
+        keystore.AddKey(key);
+        keys.push_back(key);
+        pubkeys.push_back(key.GetPubKey());
+    }
+
+    vector<CScript> vScriptPubKey;
+    CScript script;
+    script.SetDestination(pubkeys[0].GetID());
+    vScriptPubKey.push_back(script);
+    script.SetDestination(pubkeys[1].GetID());
+    vScriptPubKey.push_back(script);
+    vScriptPubKey.push_back(CScript() << pubkeys[0] << OP_CHECKSIG);
+    vScriptPubKey.push_back(CScript() << pubkeys[1] << OP_CHECKSIG);
+    for (int nRequired = 1; nRequired <= 3; nRequired++)
+    {
+        CScript redeemScript = GetScriptForMultisig(nRequired, pubkeys);
+        keystore.AddCScript(redeemScript);
+        script.SetDestination(redeemScript.GetID());
+        vScriptPubKey.push_back(script);
+    }
+
+    seed_insecure_rand(false);
+    BOOST_FOREACH(const CScript& scriptPubKey, vScriptPubKey)
+    {
+        CTransaction txTo;
+        txTo.vin.push_back(CTxIn(GetRandHash(), 0));
+        txTo.vout.push_back(CTxOut(1 * COIN, vScriptPubKey[0]));
+        BOOST_CHECK(SignSignature(keystore, scriptPubKey, txTo, 0));
+        const CScript scriptSig = txTo.vin[0].scriptSig;
+        string strTest = scriptPubKey.ToString();
+
+        BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0));
+        CheckFastPath(scriptSig, scriptPubKey, txTo, 0, strTest);
+        CheckFastPath(scriptSig, scriptPubKey, txTo, SIGHASH_ALL, strTest);
+        CheckFastPath(scriptSig, scriptPubKey, txTo, SIGHASH_NONE, strTest);
+
+        // -- a different transaction
+        CTransaction txOther(txTo);
+        txOther.vout[0].nValue++;
+        BOOST_CHECK(!VerifyScript(scriptSig, scriptPubKey, txOther, 0, flags, 0));
+        CheckFastPath(scriptSig, scriptPubKey, txOther, 0, strTest);
+
+        // -- flipped bits, dropped and added elements
+        for (int i = 0; i < 200; i++)
+        {
+            CScript scriptBad = scriptSig;
+            scriptBad[insecure_rand() % scriptBad.size()] ^= 1 << (insecure_rand() % 8);
+            CheckFastPath(scriptBad, scriptPubKey, txTo, 0, strTest + " flipped");
+        }
+        vector<vector<unsigned char> > stack;
+        BOOST_CHECK(EvalScript(stack, scriptSig, txTo, 0, SCRIPT_VERIFY_NONE, 0));
+        for (unsigned int i = 0; i < stack.size(); i++)
+        {
+            CScript scriptDropped, scriptAdded, scriptEmpty, scriptHash;
+            for (unsigned int j = 0; j < stack.size(); j++)
+            {
+                if (j != i)
+                    scriptDropped << stack[j];
+                if (j == i)
+                {
+                    scriptAdded << stack[j];
+                    scriptEmpty << vector<unsigned char>();
+                    scriptHash << vector<unsigned char>(20, 1);
+                }
+                scriptAdded << stack[j];
+                if (j != i)
+                {
+                    scriptEmpty << stack[j];
+                    scriptHash << stack[j];
+                }
+            }
+            CheckFastPath(scriptDropped, scriptPubKey, txTo, 0, strTest + " dropped");
+            CheckFastPath(scriptAdded, scriptPubKey, txTo, 0, strTest + " added");
+            CheckFastPath(scriptEmpty, scriptPubKey, txTo, 0, strTest + " emptied");
+            CheckFastPath(scriptHash, scriptPubKey, txTo, 0, strTest + " hash sized");
+        }
+
+        // -- signatures swapped, dummy not null
+        if (stack.size() >= 4)
+        {
+            CScript scriptSwapped, scriptDummy;
+            scriptDummy << OP_1;
+            for (unsigned int j = 0; j < stack.size(); j++)
+            {
+                scriptSwapped << stack[j == 1 ? 2 : j == 2 ? 1 : j];
+                if (j > 0)
+                    scriptDummy << stack[j];
+            }
+            BOOST_CHECK(!VerifyScript(scriptSwapped, scriptPubKey, txTo, 0, flags, 0));
+            CheckFastPath(scriptSwapped, scriptPubKey, txTo, 0, strTest + " swapped");
+            CheckFastPath(scriptDummy, scriptPubKey, txTo, 0, strTest + " dummy");
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,224 @@
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <openssl/sha.h>
+
+#include "main.h"
+#include "sha256.h"
+#include "util.h"
+
+using namespace std;
+
+// The merkle root as BuildMerkleTree computed it before, a node pair at a time
+static uint256 MerkleRootPairwise(vector<uint256> vLevel)
+{
+    while (vLevel.size() > 1)
+    {
+        vector<uint256> vNext;
+        for (unsigned int i = 0; i < vLevel.size(); i += 2)
+        {
+            unsigned int i2 = std::min(i + 1, (unsigned int)vLevel.size() - 1);
+            vNext.push_back(Hash(BEGIN(vLevel[i]), END(vLevel[i]), BEGIN(vLevel[i2]), END(vLevel[i2])));
+        };
+        vLevel.swap(vNext);
+    };
+    return vLevel.empty() ? 0 : vLevel[0];
+}
+
+static void CheckSHA256(const string& strIn, const string& strHexOut)
+{
+    unsigned char hash[32];
+    CSHA256().Write((const unsigned char*)strIn.data(), strIn.size()).Finalize(hash);
+    BOOST_CHECK(HexStr(hash, hash + 32) == strHexOut);
+}
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+BOOST_AUTO_TEST_CASE(sha256_vectors)
+{
+    for (int fAccel = 0; fAccel < 2; fAccel++)
+    {
+        BOOST_MESSAGE("sha256: " << SHA256AutoDetect(fAccel));
+
+        CheckSHA256("", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        CheckSHA256("abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CheckSHA256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+        CheckSHA256(string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+        // -- against OpenSSL, split into random writes
+        seed_insecure_rand(false);
+        for (int i = 0; i < 1000; i++)
+        {
+            vector<unsigned char> vch(insecure_rand() % 300 + 1);
+            for (unsigned int j = 0; j < vch.size(); j++)
+                vch[j] = insecure_rand();
+            unsigned char hash[32], hashExpect[32];
+            SHA256(&vch[0], vch.size(), hashExpect);
+            CSHA256 sha;
+            for (unsigned int nPos = 0; nPos < vch.size(); )
+            {
+                unsigned int n = std::min((unsigned int)(insecure_rand() % 100), (unsigned int)vch.size() - nPos);
+                sha.Write(&vch[nPos], n);
+                nPos += n;
+            };
+            sha.Finalize(hash);
+            BOOST_CHECK(memcmp(hash, hashExpect, 32) == 0);
+        };
+
+        // -- SHA256D64 as Hash, across the 8 and 4 lane batches and the single leftovers
+        for (unsigned int nBlocks = 0; nBlocks < 30; nBlocks++)
+        {
+            vector<unsigned char> vIn(nBlocks * 64 + 1);
+            vector<uint256> vOut(nBlocks + 1);
+            for (unsigned int j = 0; j < vIn.size(); j++)
+                vIn[j] = insecure_rand();
+            SHA256D64((unsigned char*)&vOut[0], &vIn[0], nBlocks);
+            for (unsigned int j = 0; j < nBlocks; j++)
+                BOOST_CHECK(vOut[j] == Hash(&vIn[j * 64], &vIn[j * 64 + 64]));
+        };
+    };
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_CASE(sha256_merkle)
+{
+    seed_insecure_rand(false);
+    for (unsigned int nTxns = 1; nTxns < 70; nTxns++)
+    {
+        CBlock block;
+        vector<uint256> vTxid;
+        for (unsigned int i = 0; i < nTxns; i++)
+        {
+            CTransaction tx;
+            tx.nLockTime = i;
+            block.vtx.push_back(tx);
+            vTxid.push_back(tx.GetHash());
+        };
+        uint256 hashRoot = block.BuildMerkleTree();
+        BOOST_CHECK(hashRoot == MerkleRootPairwise(vTxid));
+
+        // -- the partial tree hashes its unmatched subtrees level by level too
+        vector<bool> vMatch(nTxns);
+        for (unsigned int i = 0; i < nTxns; i++)
+            vMatch[i] = insecure_rand() % 3 == 0;
+        CPartialMerkleTree tree(vTxid, vMatch);
+        vector<uint256> vMatchTxid;
+        BOOST_CHECK(tree.ExtractMatches(vMatchTxid) == hashRoot);
+    };
+}
+
+BOOST_AUTO_TEST_CASE(merkle_tree_threads)
+{
+    // -- 3001 txns, split over threads in subtrees of 256 to 2048 txids and an odd end
+    CBlock block;
+    vector<uint256> vTxid;
+    for (unsigned int i = 0; i < 3001; i++)
+    {
+        CTransaction tx;
+        tx.nLockTime = i;
+        block.vtx.push_back(tx);
+        vTxid.push_back(tx.GetHash());
+    };
+    uint256 hashRoot = MerkleRootPairwise(vTxid);
+
+    BOOST_CHECK(block.BuildMerkleTree(1) == hashRoot);
+    vector<uint256> vTree = block.vMerkleTree;
+    BOOST_CHECK(vTree.size() == CBlock::GetMerkleTreeSize(block.vtx.size()));
+    for (unsigned int nThreads = 2; nThreads <= 12; nThreads++)
+    {
+        BOOST_CHECK(block.BuildMerkleTree(nThreads) == hashRoot);
+        BOOST_CHECK(block.vMerkleTree == vTree);
+    };
+
+    // -- branches come from the cached tree
+    for (unsigned int i = 0; i < block.vtx.size(); i += 97)
+        BOOST_CHECK(CBlock::CheckMerkleBranch(vTxid[i], block.GetMerkleBranch(i), i) == hashRoot);
+
+    // -- a new coinbase rehashes its path only
+    block.vtx[0].nLockTime = 12345;
+    vTxid[0] = block.vtx[0].GetHash();
+    hashRoot = MerkleRootPairwise(vTxid);
+    BOOST_CHECK(block.UpdateMerkleTree(0) == hashRoot);
+    vTree = block.vMerkleTree;
+    BOOST_CHECK(block.BuildMerkleTree() == hashRoot);
+    BOOST_CHECK(block.vMerkleTree == vTree);
+
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < 10; i++)
+        block.BuildMerkleTree(1);
+    int64_t nSingle = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < 10; i++)
+        block.BuildMerkleTree();
+    int64_t nThreaded = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (int i = 0; i < 10; i++)
+        block.UpdateMerkleTree(0);
+    int64_t nUpdate = GetTimeMicros() - nStart;
+    BOOST_MESSAGE("merkle tree of " << block.vtx.size() << " txns: 1 thread " << nSingle / 10 << "us, "
+        << boost::thread::hardware_concurrency() << " threads " << nThreaded / 10 << "us, coinbase update " << nUpdate / 10 << "us");
+
+    // -- a partial tree taken from the whole one is the same as one hashed from the txids
+    vector<bool> vMatch(block.vtx.size());
+    for (unsigned int i = 0; i < vMatch.size(); i++)
+        vMatch[i] = (i % 301 == 7);
+    CDataStream ss1(SER_NETWORK, PROTOCOL_VERSION), ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss1 << CPartialMerkleTree(vTxid, vMatch);
+    ss2 << CPartialMerkleTree(block.GetMerkleTree(), block.vtx.size(), vMatch);
+    BOOST_CHECK(ss1.str() == ss2.str());
+
+    // -- reading a block over this one drops its tree
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    CBlock blockSmall;
+    blockSmall.vtx.push_back(block.vtx[1]);
+    ssBlock << blockSmall;
+    ssBlock >> block;
+    BOOST_CHECK(block.vMerkleTree.empty());
+    BOOST_CHECK(block.GetMerkleTree().size() == 1 && block.GetMerkleTree()[0] == vTxid[1]);
+}
+
+BOOST_AUTO_TEST_CASE(sha256_bench)
+{
+    vector<unsigned char> vch(1 << 20, 0x5a);
+    vector<uint256> vTxid(4000);
+    for (unsigned int i = 0; i < vTxid.size(); i++)
+        vTxid[i] = Hash(BEGIN(i), END(i));
+
+    for (int fAccel = 0; fAccel < 2; fAccel++)
+    {
+        string strImpl = SHA256AutoDetect(fAccel);
+        unsigned char hash[32];
+        int64_t nStart = GetTimeMicros();
+        for (int i = 0; i < 20; i++)
+            CSHA256().Write(&vch[0], vch.size()).Finalize(hash);
+        int64_t nStream = GetTimeMicros() - nStart;
+
+        uint256 hashPairwise, hashLevels;
+        nStart = GetTimeMicros();
+        for (int i = 0; i < 20; i++)
+            hashPairwise = MerkleRootPairwise(vTxid);
+        int64_t nPairwise = GetTimeMicros() - nStart;
+
+        nStart = GetTimeMicros();
+        for (int i = 0; i < 20; i++)
+        {
+            vector<uint256> vLevel(vTxid), vNext;
+            while (vLevel.size() > 1)
+            {
+                vNext.resize((vLevel.size() + 1) / 2);
+                MerkleHashLevel(&vLevel[0], vLevel.size(), &vNext[0]);
+                vLevel.swap(vNext);
+            };
+            hashLevels = vLevel[0];
+        };
+        int64_t nLevels = GetTimeMicros() - nStart;
+        BOOST_CHECK(hashLevels == hashPairwise);
+
+        BOOST_MESSAGE("sha256 " << strImpl << ": " << (nStream ? (int64_t)20 * 1000000 / nStream : 0) << " MB/s, merkle root of "
+            << vTxid.size() << " txids pairwise " << nPairwise / 20 << "us, by level " << nLevels / 20 << "us");
+    };
+    SHA256AutoDetect();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,158 @@
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// Old script.cpp SignatureHash function, copies txTo
+static uint256 SignatureHashOld(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    if (nIn >= txTo.vin.size())
+        return 1;
+    CTransaction txTmp(txTo);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+    txTmp.vin[nIn].scriptSig = scriptCode;
+
+    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    {
+        txTmp.vout.clear();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    {
+        unsigned int nOut = nIn;
+        if (nOut >= txTmp.vout.size())
+            return 1;
+        txTmp.vout.resize(nOut+1);
+        for (unsigned int i = 0; i < nOut; i++)
+            txTmp.vout[i].SetNull();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+
+    if (nHashType & SIGHASH_ANYONECANPAY)
+    {
+        txTmp.vin[0] = txTmp.vin[nIn];
+        txTmp.vin.resize(1);
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTmp << nHashType;
+    return ss.GetHash();
+}
+
+static void RandomScript(CScript& script)
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    script = CScript();
+    int ops = (insecure_rand() % 10);
+    for (int i = 0; i < ops; i++)
+    {
+        if (insecure_rand() % 4 == 0)
+            script << std::vector<unsigned char>(insecure_rand() % 80, (unsigned char)insecure_rand());
+        else
+            script << oplist[insecure_rand() % (sizeof(oplist)/sizeof(oplist[0]))];
+    }
+}
+
+static void RandomTransaction(CTransaction& tx, bool fSingle)
+{
+    tx.nVersion = insecure_rand();
+    tx.nTime = insecure_rand();
+    tx.vin.clear();
+    tx.vout.clear();
+    tx.nLockTime = (insecure_rand() % 2) ? insecure_rand() : 0;
+    int ins = (insecure_rand() % 4) + 1;
+    int outs = fSingle ? ins : (insecure_rand() % 4) + 1;
+    for (int in = 0; in < ins; in++)
+    {
+        tx.vin.push_back(CTxIn());
+        CTxIn& txin = tx.vin.back();
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = insecure_rand() % 4;
+        RandomScript(txin.scriptSig);
+        txin.nSequence = (insecure_rand() % 2) ? insecure_rand() : (unsigned int)-1;
+    }
+    for (int out = 0; out < outs; out++)
+    {
+        tx.vout.push_back(CTxOut());
+        CTxOut& txout = tx.vout.back();
+        txout.nValue = insecure_rand() % 100000000;
+        RandomScript(txout.scriptPubKey);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_test)
+{
+    seed_insecure_rand(false);
+
+    int nRandomTests = 50000;
+    for (int i = 0; i < nRandomTests; i++)
+    {
+        int nHashType = insecure_rand();
+        CTransaction txTo;
+        RandomTransaction(txTo, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        int nIn = insecure_rand() % txTo.vin.size();
+
+        uint256 sho = SignatureHashOld(scriptCode, txTo, nIn, nHashType);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType) == sho);
+
+        CSignatureHasher hasher(txTo);
+        BOOST_CHECK(hasher.SignatureHash(scriptCode, nIn, nHashType) == sho);
+    }
+
+    // -- out of range inputs and SIGHASH_SINGLE without a matching output hash to one, as before
+    CTransaction txTo;
+    RandomTransaction(txTo, false);
+    txTo.vout.resize(1);
+    txTo.vin.resize(2);
+    BOOST_CHECK(SignatureHash(CScript(), txTo, 2, SIGHASH_ALL) == 1);
+    BOOST_CHECK(SignatureHash(CScript(), txTo, 1, SIGHASH_SINGLE) == 1);
+    BOOST_CHECK(SignatureHashOld(CScript(), txTo, 1, SIGHASH_SINGLE) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(sighash_bench)
+{
+    // -- hash every input of a 500 input txn, as validating it does
+    const unsigned int nInputs = 500;
+    CTransaction txTo;
+    CScript scriptCode = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    for (unsigned int i = 0; i < nInputs; i++)
+        txTo.vin.push_back(CTxIn(Hash(BEGIN(i), END(i)), 0, CScript() << std::vector<unsigned char>(72, i) << std::vector<unsigned char>(33, i)));
+    txTo.vout.push_back(CTxOut(1 * COIN, scriptCode));
+
+    int64_t nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nInputs; i++)
+        SignatureHashOld(scriptCode, txTo, i, SIGHASH_ALL);
+    int64_t nOld = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < nInputs; i++)
+        SignatureHash(scriptCode, txTo, i, SIGHASH_ALL);
+    int64_t nStream = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    CSignatureHasher hasher(txTo);
+    for (unsigned int i = 0; i < nInputs; i++)
+        BOOST_CHECK(hasher.SignatureHash(scriptCode, i, SIGHASH_ALL) == SignatureHash(scriptCode, txTo, i, SIGHASH_ALL));
+    int64_t nHasher = GetTimeMicros() - nStart - nStream;
+
+    BOOST_MESSAGE("signature hashes of " << nInputs << " inputs: copied " << nOld / 1000 << "ms, streamed "
+        << nStream / 1000 << "ms, cached prefix " << nHasher / 1000 << "ms");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
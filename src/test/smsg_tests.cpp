@@ -1,6 +1,8 @@
 #include <boost/test/unit_test.hpp>
 
 #include <boost/atomic.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "smessage.h"
 #include "init.h" // for pwalletMain
@@ -74,6 +76,23 @@ BOOST_AUTO_TEST_CASE(smsg_test)
         BOOST_CHECK_MESSAGE(1 == (rv = SecureMsgDecrypt(false, sAddrFail, smsg, msg)), "SecureMsgDecrypt " << rv);
     };
     
+    // -- version 3, dictionary compressed
+    smsgOptions.fCompressDict = true;
+    {
+        SecureMessage smsg;
+        MessageData msg;
+        std::string sAddrFrom = CBitcoinAddress(keyOwn[0].GetPubKey().GetID()).ToString();
+        std::string sAddrTo = sAddrFrom;
+        
+        BOOST_CHECK_MESSAGE(0 == (rv = SecureMsgEncrypt(smsg, sAddrFrom, sAddrTo, sTestMessage)), "SecureMsgEncrypt " << rv);
+        BOOST_CHECK(smsg.version[1] == 3);
+        
+        BOOST_CHECK_MESSAGE(0 == (rv = SecureMsgDecrypt(false, sAddrTo, smsg, msg)), "SecureMsgDecrypt " << rv);
+        
+        BOOST_CHECK(msg.vchMessage.size()-1 == sTestMessage.size()
+            && 0 == memcmp(&msg.vchMessage[0], sTestMessage.data(), msg.vchMessage.size()-1));
+    }
+    smsgOptions.fCompressDict = false;
     
     UnregisterWallet(&keystore);
     pwalletMain = pwalletMainOld;
@@ -81,4 +100,318 @@ BOOST_AUTO_TEST_CASE(smsg_test)
     fSecMsgEnabled = false;
 }
 
+BOOST_AUTO_TEST_CASE(smsg_dict_test)
+{
+    // -- round trip and compare against plain LZ4 over typical message sizes
+    const std::string sCorpus[] = {
+        "Hi, how are you?",
+        "Yes, no problem. I will send you the coins as soon as possible.",
+        "Hello, I have sent the payment to your address, the transaction id is "
+        "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b. Best regards,",
+        "Thanks for getting back to me. Could you please confirm that you have received it? "
+        "It should be confirmed within a few minutes, the exchange was slow today. "
+        "Let me know if there is anything else, talk to you later. Cheers, ",
+    };
+
+    for (size_t i = 0; i < sizeof(sCorpus) / sizeof(sCorpus[0]); ++i)
+    {
+        const std::string& sMsg = sCorpus[i];
+        std::vector<uint8_t> vchComp(LZ4_compressBound(sMsg.size()));
+        std::vector<uint8_t> vchPlain;
+
+        int64_t nStart = GetTimeMicros();
+        int nRuns = 1000, lenDict = 0;
+        for (int k = 0; k < nRuns; ++k)
+            lenDict = SecureMsgCompressDict(SMSG_DICT_CURRENT, (const uint8_t*)sMsg.data(), sMsg.size(), &vchComp[0], vchComp.size());
+        int64_t nCompress = GetTimeMicros() - nStart;
+
+        BOOST_CHECK(lenDict > 0);
+
+        nStart = GetTimeMicros();
+        for (int k = 0; k < nRuns; ++k)
+            BOOST_CHECK(0 == SecureMsgDecompressDict(SMSG_DICT_CURRENT, &vchComp[0], lenDict, vchPlain, sMsg.size()));
+        int64_t nDecompress = GetTimeMicros() - nStart;
+
+        BOOST_CHECK(vchPlain.size() == sMsg.size() + 1
+            && 0 == memcmp(&vchPlain[0], sMsg.data(), sMsg.size()));
+
+        int lenLz4 = LZ4_compress(sMsg.c_str(), (char*)&vchComp[0], sMsg.size());
+
+        BOOST_MESSAGE("size " << sMsg.size() << ", lz4 " << lenLz4 << ", dict " << lenDict
+            << ", compress " << nCompress / nRuns << "us, decompress " << nDecompress / nRuns << "us");
+    };
+
+    // -- truncated and corrupt streams must fail cleanly
+    std::vector<uint8_t> vchPlain;
+    const uint8_t vchBad[] = {0x0f, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00, 0x00};
+    BOOST_CHECK(0 != SecureMsgDecompressDict(SMSG_DICT_CURRENT, vchBad, sizeof(vchBad), vchPlain, 64));
+    BOOST_CHECK(2 == SecureMsgDecompressDict(0xFF, vchBad, sizeof(vchBad), vchPlain, 64));
+
+    // -- a match offset reaching back past the start of the dictionary must fail, not read the stack
+    const uint8_t vchFar[] = {0x10, 'A', 0xff, 0xff, 0x80, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
+    BOOST_CHECK(1 == SecureMsgDecompressDict(SMSG_DICT_CURRENT, vchFar, sizeof(vchFar), vchPlain, 13));
+}
+
+BOOST_AUTO_TEST_CASE(smsg_index_test)
+{
+    // -- paged listing through the secondary indices
+    LOCK(cs_smsgDB);
+    SecMsgDB db;
+    BOOST_REQUIRE(db.Open("cr+"));
+
+    const int nMessages = 10;
+    std::vector<std::vector<uint8_t> > vKeys;
+    for (int i = 0; i < nMessages; ++i)
+    {
+        int64_t nTime = 1400000000 + i;
+        uint8_t chKey[18];
+        memcpy(&chKey[0], "im", 2);
+        memcpy(&chKey[2], &nTime, 8);
+        memset(&chKey[10], i, 8);
+
+        SecMsgStored smsgStored;
+        smsgStored.timeReceived = nTime;
+        smsgStored.status = (i % 2) ? SMSG_MASK_UNREAD : 0;
+        smsgStored.folderId = 0;
+        smsgStored.sAddrTo = (i < 4) ? "addrA" : "addrB";
+        BOOST_CHECK(db.WriteSmesg(chKey, smsgStored));
+        vKeys.push_back(std::vector<uint8_t>(chKey, chKey + 18));
+    };
+
+    std::vector<std::vector<uint8_t> > vPage;
+    BOOST_CHECK(db.ListSmesg("im", "", false, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage == vKeys);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", false, 0, 2, 3, false, vPage));
+    BOOST_CHECK(vPage.size() == 3 && vPage[0] == vKeys[2] && vPage[2] == vKeys[4]);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", false, 0, 1, 2, true, vPage));
+    BOOST_CHECK(vPage.size() == 2 && vPage[0] == vKeys[8] && vPage[1] == vKeys[7]);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", false, 1400000007, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.size() == 3 && vPage[0] == vKeys[7]);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", false, 1400000007, 0, 0, true, vPage));
+    BOOST_CHECK(vPage.size() == 3 && vPage[0] == vKeys[9]);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", true, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.size() == 5 && vPage[0] == vKeys[1]);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "addrA", false, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.size() == 4 && vPage[3] == vKeys[3]);
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "addrA", true, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.size() == 2 && vPage[0] == vKeys[1] && vPage[1] == vKeys[3]);
+
+    // -- marking read drops the unread entry
+    SecMsgStored smsgStored;
+    BOOST_CHECK(db.ReadSmesg(&vKeys[1][0], smsgStored));
+    smsgStored.status &= ~SMSG_MASK_UNREAD;
+    BOOST_CHECK(db.WriteSmesg(&vKeys[1][0], smsgStored));
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", true, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.size() == 4 && vPage[0] == vKeys[3]);
+
+    // -- erasing removes all index entries
+    for (int i = 0; i < nMessages; ++i)
+        BOOST_CHECK(db.EraseSmesg(&vKeys[i][0]));
+
+    vPage.clear();
+    BOOST_CHECK(db.ListSmesg("im", "", false, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.empty());
+    BOOST_CHECK(db.ListSmesg("im", "addrB", false, 0, 0, 0, false, vPage));
+    BOOST_CHECK(vPage.empty());
+}
+
+BOOST_AUTO_TEST_CASE(smsg_ratelimit_test)
+{
+    SecMsgTokenBucket bucket;
+    const int64_t nRate = 1000;
+
+    // -- starts full
+    bucket.Refill(1000000, nRate, nRate);
+    BOOST_CHECK(bucket.Ready() && bucket.nTokens == nRate);
+
+    // -- a large message overdraws, nothing more until the debt is repaid
+    bucket.Take(2500);
+    BOOST_CHECK(!bucket.Ready());
+    bucket.Refill(2000000, nRate, nRate);
+    BOOST_CHECK(!bucket.Ready() && bucket.nTokens == -500);
+    bucket.Refill(2600000, nRate, nRate);
+    BOOST_CHECK(bucket.Ready() && bucket.nTokens == 100);
+
+    // -- idle time is capped at the burst size
+    bucket.Refill(60000000, nRate, nRate);
+    BOOST_CHECK(bucket.nTokens == nRate);
+
+    // -- clock going backwards adds nothing
+    bucket.Refill(50000000, nRate, nRate);
+    BOOST_CHECK(bucket.nTokens == nRate);
+}
+
+BOOST_AUTO_TEST_CASE(smsg_queue_cap_test)
+{
+    // -- the per peer and node wide queue limits, bytes are released when sent, cleared or the peer goes
+    const std::vector<uint8_t> vchData(100, 0x01);
+    uint64_t nTotalWas = SecMsgNode::GetQueuedTotal();
+
+    SecMsgNode* pnodeA = new SecMsgNode();
+    SecMsgNode nodeB;
+
+    BOOST_CHECK(pnodeA->QueueMessage("smsgMsg", vchData, 250, nTotalWas + 400));
+    BOOST_CHECK(pnodeA->QueueMessage("smsgMsg", vchData, 250, nTotalWas + 400));
+    BOOST_CHECK(!pnodeA->QueueMessage("smsgMsg", vchData, 250, nTotalWas + 400)); // peer limit
+    BOOST_CHECK(pnodeA->nQueuedBytes == 200 && pnodeA->vSendQueue.size() == 2);
+
+    BOOST_CHECK(nodeB.QueueMessage("smsgMsg", vchData, 250, nTotalWas + 400));
+    BOOST_CHECK(nodeB.QueueMessage("smsgMsg", vchData, 250, nTotalWas + 400));
+    BOOST_CHECK(!nodeB.QueueMessage("smsgMsg", vchData, 1000, nTotalWas + 400)); // node limit
+    BOOST_CHECK(SecMsgNode::GetQueuedTotal() == nTotalWas + 400);
+
+    pnodeA->PopMessage();
+    BOOST_CHECK(pnodeA->nQueuedBytes == 100 && SecMsgNode::GetQueuedTotal() == nTotalWas + 300);
+    BOOST_CHECK(nodeB.QueueMessage("smsgMsg", vchData, 1000, nTotalWas + 400));
+
+    delete pnodeA;
+    BOOST_CHECK(SecMsgNode::GetQueuedTotal() == nTotalWas + 300);
+
+    nodeB.ClearQueue();
+    BOOST_CHECK(nodeB.nQueuedBytes == 0 && nodeB.vSendQueue.empty());
+    BOOST_CHECK(SecMsgNode::GetQueuedTotal() == nTotalWas);
+}
+
+BOOST_AUTO_TEST_CASE(smsg_scanchain_store_test)
+{
+    LOCK(cs_smsgDB);
+    SecMsgDB db;
+    BOOST_REQUIRE(db.Open("cr+"));
+
+    std::vector<CPubKey> vKeys;
+    for (int i = 0; i < 4; ++i)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        vKeys.push_back(key.GetPubKey());
+    };
+
+    CHash160Filter filter;
+    filter.Init(64);
+    uint32_t nPubkeys = 0, nDuplicates = 0;
+
+    // -- a key seen twice in one batch is written once
+    std::vector<CPubKey> vBatch;
+    vBatch.push_back(vKeys[0]);
+    vBatch.push_back(vKeys[1]);
+    vBatch.push_back(vKeys[0]);
+    uint256 hashFirst = Hash(vKeys[0].begin(), vKeys[0].end());
+    BOOST_CHECK(SecureMsgStoreScannedKeys(db, filter, vBatch, hashFirst, nPubkeys, nDuplicates));
+    BOOST_CHECK(nPubkeys == 2 && nDuplicates == 1);
+
+    uint256 hashRead;
+    BOOST_CHECK(db.ReadLastScanned(hashRead) && hashRead == hashFirst);
+
+    // -- a resumed scan skips keys stored by the previous batch, with the filter kept or not yet built
+    CHash160Filter filterUnbuilt;
+    vBatch.clear();
+    vBatch.push_back(vKeys[1]);
+    vBatch.push_back(vKeys[2]);
+    uint256 hashSecond = Hash(vKeys[2].begin(), vKeys[2].end());
+    BOOST_CHECK(SecureMsgStoreScannedKeys(db, filterUnbuilt, vBatch, hashSecond, nPubkeys, nDuplicates));
+    BOOST_CHECK(nPubkeys == 3 && nDuplicates == 2);
+
+    vBatch.clear();
+    vBatch.push_back(vKeys[2]);
+    vBatch.push_back(vKeys[3]);
+    uint256 hashThird = Hash(vKeys[3].begin(), vKeys[3].end());
+    BOOST_CHECK(SecureMsgStoreScannedKeys(db, filter, vBatch, hashThird, nPubkeys, nDuplicates));
+    BOOST_CHECK(nPubkeys == 4 && nDuplicates == 3);
+
+    BOOST_CHECK(db.ReadLastScanned(hashRead) && hashRead == hashThird);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        CKeyID id = vKeys[i].GetID();
+        CPubKey pkRead;
+        BOOST_CHECK(db.ReadPK(id, pkRead) && pkRead == vKeys[i]);
+    };
+}
+
+extern boost::thread_group threadGroupSmsg;
+
+BOOST_AUTO_TEST_CASE(smsg_unlock_scan_test)
+{
+    // -- a message stored while locked reaches the inbox after SecureMsgWalletUnlocked, finished scan threads leave the group
+    fSecMsgEnabled = true;
+    CWallet keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    {
+        LOCK(keystore.cs_wallet);
+        keystore.AddKey(key);
+    }
+
+    CWallet *pwalletMainOld = pwalletMain;
+    UnregisterWallet(pwalletMain);
+    pwalletMain = &keystore;
+    RegisterWallet(&keystore);
+
+    std::string sAddr = CBitcoinAddress(key.GetPubKey().GetID()).ToString();
+    std::vector<SecMsgAddress> vAddressesOld;
+    {
+        LOCK(cs_smsg);
+        vAddressesOld = smsgAddresses;
+        smsgAddresses.push_back(SecMsgAddress(sAddr, true, false));
+    }
+
+    SecureMessage smsg;
+    BOOST_REQUIRE(0 == SecureMsgEncrypt(smsg, sAddr, sAddr, "Received while the wallet was locked."));
+    BOOST_REQUIRE(0 == SecureMsgStoreUnscanned(&smsg.hash[0], smsg.pPayload, smsg.nPayload));
+
+    uint8_t chKey[18];
+    memcpy(&chKey[0], "im", 2);
+    memcpy(&chKey[2], &smsg.timestamp, 8);
+    memcpy(&chKey[10], smsg.pPayload, 8);
+
+    size_t nThreadsWas = threadGroupSmsg.size();
+
+    BOOST_CHECK(0 == SecureMsgWalletUnlocked());
+    threadGroupSmsg.join_all();
+    BOOST_CHECK_EQUAL(threadGroupSmsg.size(), nThreadsWas + 1);
+    {
+        LOCK(cs_smsgDB);
+        SecMsgDB db;
+        BOOST_REQUIRE(db.Open("cw"));
+        BOOST_CHECK(db.ExistsSmesg(chKey));
+        db.EraseSmesg(chKey);
+    }
+
+    int64_t bucket = smsg.timestamp - (smsg.timestamp % SMSG_BUCKET_LEN);
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "smsgStore" / (boost::lexical_cast<std::string>(bucket) + "_01_wl.dat")));
+
+    // -- each unlock replaces the finished scan thread rather than adding to the group
+    for (int i = 0; i < 3; ++i)
+    {
+        BOOST_CHECK(0 == SecureMsgWalletUnlocked());
+        threadGroupSmsg.join_all();
+        BOOST_CHECK_EQUAL(threadGroupSmsg.size(), nThreadsWas + 1);
+    };
+
+    {
+        LOCK(cs_smsg);
+        smsgAddresses = vAddressesOld;
+    }
+    UnregisterWallet(&keystore);
+    pwalletMain = pwalletMainOld;
+    RegisterWallet(pwalletMain);
+    fSecMsgEnabled = false;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -33,6 +33,7 @@ struct TestingSetup {
         fDebugPoS = true;
         
         noui_connect();
+        SHA256AutoDetect();
         bitdb.MakeMock();
         
         LoadBlockIndex(true);
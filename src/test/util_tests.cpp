@@ -1,6 +1,7 @@
 #include <vector>
 #include <boost/test/unit_test.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
 
 #include "main.h"
 #include "wallet.h"
@@ -8,6 +9,13 @@
 
 using namespace std;
 
+static bool MarkRange(vector<int>* pvHits, size_t nFail, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+        (*pvHits)[i]++;
+    return nFail < nBegin || nFail >= nEnd;
+}
+
 BOOST_AUTO_TEST_SUITE(util_tests)
 
 BOOST_AUTO_TEST_CASE(util_criticalsection)
@@ -261,4 +269,21 @@ BOOST_AUTO_TEST_CASE(util_IsHex)
     BOOST_CHECK(!IsHex("0x0000"));
 }
 
+BOOST_AUTO_TEST_CASE(util_SplitOverThreads)
+{
+    // -- every index is visited once, a failing part fails the whole
+    for (size_t n = 0; n < 100; n += 7)
+    {
+        vector<int> vHits(n, 0);
+        BOOST_CHECK(SplitOverThreads(n, 4, boost::bind(&MarkRange, &vHits, n, _1, _2)));
+        BOOST_CHECK(std::count(vHits.begin(), vHits.end(), 1) == (int)n);
+
+        if (n == 0)
+            continue;
+        vHits.assign(n, 0);
+        BOOST_CHECK(!SplitOverThreads(n, 4, boost::bind(&MarkRange, &vHits, n - 1, _1, _2)));
+        BOOST_CHECK(std::count(vHits.begin(), vHits.end(), 1) == (int)n);
+    };
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1,10 +1,14 @@
 #include <boost/test/unit_test.hpp>
 
 #include "main.h"
+#include "txdb.h"
 #include "wallet.h"
+#include "walletdb.h"
 
 #include "allocators.h"
 
+#include "json/json_spirit_writer_template.h"
+
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
 #define RUN_TESTS 100
 
@@ -14,6 +18,9 @@
 #define RANDOM_REPEATS 5
 
 using namespace std;
+using namespace json_spirit;
+
+extern Array read_json(const std::string& filename);
 
 typedef set<pair<const CWalletTx*,unsigned int> > CoinSet;
 
@@ -311,5 +318,516 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     delete pwallet;
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_bnb_tests)
+{
+    pwallet = new CWallet("walletUT_test.dat");
+
+    static CoinSet setCoinsRet;
+    static int64_t nValueRet;
+    unsigned int nSpendTime = GetAdjustedTime();
+
+    empty_wallet();
+    for (int i = 0; i < 50; i++)
+        add_coin(3 * CENT);
+    add_coin(7 * CENT);
+    add_coin(11 * CENT);
+
+    // 18 cents can be made without change as 7+11, branch and bound should find the two coin solution
+    BOOST_CHECK(pwallet->SelectCoinsMinConf(18 * CENT, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 18 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2);
+
+    // an overshoot of up to GetCostOfChange is accepted as changeless
+    BOOST_CHECK(pwallet->SelectCoinsMinConf(18 * CENT - GetCostOfChange(), nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 18 * CENT);
+
+    // the cost of change follows the fee rate
+    int64_t nTransactionFeeWas = nTransactionFee;
+    BOOST_CHECK_EQUAL(GetCostOfChange(), MIN_TX_FEE * COINSELECT_CHANGE_BYTES / 1000);
+    nTransactionFee = 20 * MIN_TX_FEE;
+    BOOST_CHECK_EQUAL(GetCostOfChange(), 20 * MIN_TX_FEE * COINSELECT_CHANGE_BYTES / 1000);
+    BOOST_CHECK(pwallet->SelectCoinsMinConf(18 * CENT - GetCostOfChange(), nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 18 * CENT);
+    nTransactionFee = nTransactionFeeWas;
+
+    // the equal valued 3 cent coins must not blow up the search
+    BOOST_CHECK(pwallet->SelectCoinsMinConf(150 * CENT, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 150 * CENT);
+
+    // with consolidation enabled, transactions with change also sweep up small coins
+    mapArgs["-coinselect"] = "knapsack";
+    mapArgs["-consolidateinputs"] = "5";
+    BOOST_CHECK(pwallet->SelectCoinsMinConf(8 * CENT, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_GT(setCoinsRet.size(), 5);
+
+    // but an exact match needs no change and is left as it is
+    BOOST_CHECK(pwallet->SelectCoinsMinConf(6 * CENT, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 6 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2);
+    mapArgs.erase("-coinselect");
+    mapArgs.erase("-consolidateinputs");
+
+    empty_wallet();
+    delete pwallet;
+}
+
+// Replays recorded utxo sets through both coin selection engines and reports time, inputs and change outputs.
+// Entries are [comment, [coin values], [targets]], values are in satoshi, or in coins as listunspent prints them.
+BOOST_AUTO_TEST_CASE(coin_selection_replay)
+{
+    pwallet = new CWallet("walletUT_test.dat");
+
+    CoinSet setCoinsRet;
+    int64_t nValueRet;
+    unsigned int nSpendTime = GetAdjustedTime();
+
+    Array tests = read_json("coinselect_replay.json");
+    BOOST_FOREACH(Value& tv, tests)
+    {
+        Array test = tv.get_array();
+        if (test.size() < 3)
+        {
+            BOOST_ERROR("Bad test: " << write_string(tv, false));
+            continue;
+        };
+
+        empty_wallet();
+        Array coins = test[1].get_array();
+        BOOST_FOREACH(Value& v, coins)
+            add_coin(v.type() == real_type ? roundint64(v.get_real() * COIN) : v.get_int64());
+
+        const char *aModes[] = {"bnb", "knapsack"};
+        for (int m = 0; m < 2; ++m)
+        {
+            mapArgs["-coinselect"] = aModes[m];
+
+            int64_t nTime = 0;
+            unsigned int nInputs = 0, nChange = 0;
+            Array targets = test[2].get_array();
+            BOOST_FOREACH(Value& t, targets)
+            {
+                int64_t nTarget = t.type() == real_type ? roundint64(t.get_real() * COIN) : t.get_int64();
+
+                int64_t nStart = GetTimeMicros();
+                BOOST_CHECK(pwallet->SelectCoinsMinConf(nTarget, nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+                nTime += GetTimeMicros() - nStart;
+
+                BOOST_CHECK(nValueRet >= nTarget);
+                nInputs += setCoinsRet.size();
+                if (nValueRet - nTarget > GetCostOfChange())
+                    nChange++;
+            };
+
+            BOOST_MESSAGE(test[0].get_str() << ", " << aModes[m] << ": " << targets.size() << " targets, "
+                << nTime << "us, " << nInputs << " inputs, " << nChange << " with change");
+        };
+    };
+
+    mapArgs.erase("-coinselect");
+    empty_wallet();
+    delete pwallet;
+}
+
+BOOST_AUTO_TEST_CASE(coin_selection_large)
+{
+    // -- a 100k utxo wallet, the branch and bound search stays bounded by COINSELECT_BNB_TRIES
+    pwallet = new CWallet("walletUT_test.dat");
+
+    CoinSet setCoinsRet;
+    int64_t nValueRet;
+    unsigned int nSpendTime = GetAdjustedTime();
+
+    empty_wallet();
+    seed_insecure_rand(true);
+    for (int i = 0; i < 100000; i++)
+        add_coin(CENT / 10 + insecure_rand() % (10 * CENT));
+
+    const int64_t aTargets[] = {COIN / 3, 7 * COIN + 12345, 250 * COIN};
+    const char *aModes[] = {"bnb", "knapsack"};
+    for (int m = 0; m < 2; ++m)
+    {
+        mapArgs["-coinselect"] = aModes[m];
+        for (unsigned int t = 0; t < sizeof(aTargets) / sizeof(aTargets[0]); ++t)
+        {
+            int64_t nStart = GetTimeMicros();
+            BOOST_CHECK(pwallet->SelectCoinsMinConf(aTargets[t], nSpendTime, 1, 1, vCoins, setCoinsRet, nValueRet));
+            int64_t nTime = GetTimeMicros() - nStart;
+
+            BOOST_CHECK(nValueRet >= aTargets[t]);
+            BOOST_MESSAGE("100k utxos, " << aModes[m] << ": target " << FormatMoney(aTargets[t]) << ", " << nTime << "us, "
+                << setCoinsRet.size() << " inputs, " << (nValueRet - aTargets[t] > GetCostOfChange() ? "change" : "changeless"));
+        };
+    };
+
+    mapArgs.erase("-coinselect");
+    seed_insecure_rand(false);
+    empty_wallet();
+    delete pwallet;
+}
+
+BOOST_AUTO_TEST_CASE(commit_bulk_rollback)
+{
+    // -- a txn failing to write part way through a bulk commit leaves the wallet as it was
+    CWallet wallet("walletUT_bulk.dat");
+    BOOST_CHECK(wallet.LoadWallet() == DB_LOAD_OK);
+
+    CWalletTx wtxFund;
+    wtxFund.vout.resize(3);
+    for (unsigned int i = 0; i < wtxFund.vout.size(); i++)
+        wtxFund.vout[i].nValue = (i + 1) * COIN;
+    uint256 hashFund = wtxFund.GetHash();
+    {
+        LOCK(wallet.cs_wallet);
+        wallet.mapWallet[hashFund] = wtxFund;
+        wallet.mapWallet[hashFund].BindWallet(&wallet);
+    }
+
+    vector<CWalletTx> vwtx;
+    for (unsigned int i = 0; i < wtxFund.vout.size(); i++)
+    {
+        CWalletTx wtx;
+        wtx.vin.push_back(CTxIn(hashFund, i));
+        wtx.vout.push_back(CTxOut(i * COIN + CENT, CScript() << OP_TRUE));
+        vwtx.push_back(wtx);
+    };
+
+    int64_t nOrderPosNext = wallet.nOrderPosNext;
+    size_t nOrdered = wallet.wtxOrdered.size();
+
+    // a stripped txn can't be written, there is no stored record to take the dropped fields from
+    vwtx[1].fStripped = true;
+    BOOST_CHECK(!wallet.CommitBulkTransactions(vwtx));
+    for (unsigned int i = 0; i < vwtx.size(); i++)
+    {
+        BOOST_CHECK(!wallet.mapWallet.count(vwtx[i].GetHash()));
+        BOOST_CHECK(!wallet.mapWallet[hashFund].IsSpent(i));
+    };
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), 1);
+    BOOST_CHECK_EQUAL(wallet.nOrderPosNext, nOrderPosNext);
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), nOrdered);
+
+    vwtx[1].fStripped = false;
+    BOOST_CHECK(wallet.CommitBulkTransactions(vwtx));
+    for (unsigned int i = 0; i < vwtx.size(); i++)
+    {
+        BOOST_CHECK(wallet.mapWallet.count(vwtx[i].GetHash()));
+        BOOST_CHECK(wallet.mapWallet[hashFund].IsSpent(i));
+    };
+    BOOST_CHECK_EQUAL(wallet.nOrderPosNext, nOrderPosNext + (int64_t)vwtx.size());
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), nOrdered + vwtx.size());
+}
+
+BOOST_AUTO_TEST_CASE(stripped_txn_merge)
+{
+    // -- a stripped txn is read back whole, and a move to another block replaces its stored branch
+    CWallet wallet("walletUT_lazy.dat");
+    BOOST_CHECK(wallet.LoadWallet() == DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+
+    CWalletTx wtx;
+    wtx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+    wtx.vOrderForm.push_back(make_pair(string("Message"), string("lazy")));
+    uint256 hash = wtx.GetHash();
+    BOOST_CHECK(wallet.AddToWallet(wtx, hash));
+
+    vector<uint256> vBranchA(2, uint256(1)), vBranchB(3, uint256(2));
+    CWalletTx wtxInA(wtx);
+    wtxInA.hashBlock = 100;
+    wtxInA.nIndex = 1;
+    wtxInA.vMerkleBranch = vBranchA;
+    BOOST_CHECK(wallet.AddToWallet(wtxInA, hash));
+
+    // strip as StripWalletTxns does
+    CWalletTx& wtxMem = wallet.mapWallet[hash];
+    vector<uint256>().swap(wtxMem.vMerkleBranch);
+    vector<pair<string, string> >().swap(wtxMem.vOrderForm);
+    wtxMem.fStripped = true;
+
+    CWalletTx wtxFull;
+    BOOST_CHECK(wallet.GetFullWalletTx(hash, wtxFull));
+    BOOST_CHECK(!wtxFull.fStripped);
+    BOOST_CHECK(wtxFull.vMerkleBranch == vBranchA);
+    BOOST_CHECK(wtxFull.vOrderForm.size() == 1 && wtxFull.vOrderForm[0].second == "lazy");
+
+    // the same txn reorganised into another block at the same index
+    CWalletTx wtxInB(wtx);
+    wtxInB.hashBlock = 200;
+    wtxInB.nIndex = 1;
+    wtxInB.vMerkleBranch = vBranchB;
+    BOOST_CHECK(wallet.AddToWallet(wtxInB, hash));
+    BOOST_CHECK(wtxMem.hashBlock == 200 && wtxMem.vMerkleBranch == vBranchB);
+
+    BOOST_CHECK(wallet.GetFullWalletTx(hash, wtxFull));
+    BOOST_CHECK(wtxFull.hashBlock == 200 && wtxFull.vMerkleBranch == vBranchB);
+
+    CWalletTx wtxStored;
+    BOOST_CHECK(CWalletDB(wallet.strWalletFile, "r").ReadTx(hash, wtxStored));
+    BOOST_CHECK(wtxStored.hashBlock == 200 && wtxStored.vMerkleBranch == vBranchB);
+    BOOST_CHECK(wtxStored.vOrderForm.size() == 1);
+
+    // a stored branch isn't carried over to a record of another block
+    wtxMem.hashBlock = 300;
+    vector<uint256>().swap(wtxMem.vMerkleBranch);
+    BOOST_CHECK(CWalletDB(wallet.strWalletFile).WriteTx(hash, wtxMem));
+    BOOST_CHECK(CWalletDB(wallet.strWalletFile, "r").ReadTx(hash, wtxStored));
+    BOOST_CHECK(wtxStored.hashBlock == 300 && wtxStored.vMerkleBranch.empty());
+    BOOST_CHECK(wtxStored.vOrderForm.size() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(compact_supporting_txns)
+{
+    // -- compactwallet drops vtxPrev from the stored records and from memory
+    CWallet wallet("walletUT_compact.dat");
+    BOOST_CHECK(wallet.LoadWallet() == DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+
+    CTransaction txParent;
+    txParent.vout.push_back(CTxOut(2 * COIN, CScript() << OP_TRUE));
+
+    CWalletTx wtx;
+    wtx.vin.push_back(CTxIn(txParent.GetHash(), 0));
+    wtx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+    wtx.vtxPrev.push_back(CMerkleTx(txParent));
+    uint256 hash = wtx.GetHash();
+    BOOST_CHECK(wallet.AddToWallet(wtx, hash));
+
+    CWalletTx wtxStored;
+    BOOST_CHECK(CWalletDB(wallet.strWalletFile, "r").ReadTx(hash, wtxStored));
+    BOOST_CHECK_EQUAL(wtxStored.vtxPrev.size(), 1);
+
+    uint32_t nTxns;
+    uint64_t nBytesBefore, nBytesAfter;
+    BOOST_CHECK(wallet.CompactSupportingTxns(nTxns, nBytesBefore, nBytesAfter));
+    BOOST_CHECK_EQUAL(nTxns, 1);
+    BOOST_CHECK(nBytesAfter < nBytesBefore);
+    BOOST_CHECK(wallet.mapWallet[hash].vtxPrev.empty());
+
+    BOOST_CHECK(CWalletDB(wallet.strWalletFile, "r").ReadTx(hash, wtxStored));
+    BOOST_CHECK(wtxStored.vtxPrev.empty());
+    BOOST_CHECK(wtxStored.vout == wtx.vout);
+
+    // nothing left to compact
+    BOOST_CHECK(wallet.CompactSupportingTxns(nTxns, nBytesBefore, nBytesAfter));
+    BOOST_CHECK_EQUAL(nTxns, 0);
+}
+
+BOOST_AUTO_TEST_CASE(relay_without_vtxprev)
+{
+    // -- with -storesupportingtxns=0 the unconfirmed ancestors to relay come from the wallet and the mempool
+    bool fStoreWas = fStoreSupportingTxns;
+    fStoreSupportingTxns = false;
+
+    CWallet wallet("walletUT_relay.dat");
+    BOOST_CHECK(wallet.LoadWallet() == DB_LOAD_OK);
+
+    // grandparent only in the mempool, parent in the wallet, child spends the parent
+    CTransaction txGrandparent;
+    txGrandparent.vout.push_back(CTxOut(3 * COIN, CScript() << OP_TRUE));
+    uint256 hashGrandparent = txGrandparent.GetHash();
+    {
+        LOCK(mempool.cs);
+        mempool.addUnchecked(hashGrandparent, txGrandparent);
+    }
+
+    CWalletTx wtxParent;
+    wtxParent.vin.push_back(CTxIn(hashGrandparent, 0));
+    wtxParent.vout.push_back(CTxOut(2 * COIN, CScript() << OP_TRUE));
+    uint256 hashParent = wtxParent.GetHash();
+
+    CWalletTx wtx;
+    wtx.vin.push_back(CTxIn(hashParent, 0));
+    wtx.vin.push_back(CTxIn(uint256(3), 0)); // unknown to wallet and mempool, skipped
+    wtx.vout.push_back(CTxOut(COIN, CScript() << OP_TRUE));
+    uint256 hash = wtx.GetHash();
+    {
+        LOCK(wallet.cs_wallet);
+        BOOST_CHECK(wallet.AddToWallet(wtxParent, hashParent));
+        BOOST_CHECK(wallet.AddToWallet(wtx, hash));
+    }
+
+    const CWalletTx& wtxMem = wallet.mapWallet[hash];
+    BOOST_CHECK(wtxMem.vtxPrev.empty());
+
+    CTxDB txdb("r");
+    vector<CMerkleTx> vtxFetched;
+    wtxMem.GetUnconfirmedAncestors(txdb, vtxFetched);
+    BOOST_CHECK_EQUAL(vtxFetched.size(), 2);
+    if (vtxFetched.size() == 2)
+    {
+        BOOST_CHECK(vtxFetched[0].GetHash() == hashGrandparent);
+        BOOST_CHECK(vtxFetched[1].GetHash() == hashParent);
+    };
+
+    mempool.remove(txGrandparent);
+    wtxMem.GetUnconfirmedAncestors(txdb, vtxFetched);
+    BOOST_CHECK_EQUAL(vtxFetched.size(), 1);
+    if (vtxFetched.size() == 1)
+        BOOST_CHECK(vtxFetched[0].GetHash() == hashParent);
+
+    fStoreSupportingTxns = fStoreWas;
+}
+
+BOOST_AUTO_TEST_CASE(balance_cache_invalidation)
+{
+    // -- cached balances and the unspent set follow a reorg, a conflicting txn and a spend by another copy of the wallet
+    CWallet wallet("walletUT_balance.dat");
+    BOOST_CHECK(wallet.LoadWallet() == DB_LOAD_OK);
+
+    LOCK2(cs_main, wallet.cs_wallet);
+    BOOST_REQUIRE(pindexBest);
+
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKey(key));
+    CScript scriptMine, scriptOther;
+    scriptMine.SetDestination(key.GetPubKey().GetID());
+    scriptOther.SetDestination(keyOther.GetPubKey().GetID());
+
+    CWalletTx wtxFund;
+    wtxFund.vout.push_back(CTxOut(10 * COIN, scriptMine));
+    wtxFund.vout.push_back(CTxOut(5 * COIN, scriptMine));
+    uint256 hashFund = wtxFund.GetHash();
+
+    // a block holding only wtxFund on top of the best chain, the merkle root of a single txn is its hash
+    uint256 hashBlockA = Hash(BEGIN(hashFund), END(hashFund));
+    CBlockIndex indexA;
+    indexA.phashBlock = &hashBlockA;
+    indexA.pprev = pindexBest;
+    indexA.nHeight = pindexBest->nHeight + 1;
+    indexA.hashMerkleRoot = hashFund;
+    mapBlockIndex[hashBlockA] = &indexA;
+
+    CBlockIndex* pindexBestWas = pindexBest;
+    uint256 hashBestChainWas = hashBestChain;
+    int nBestHeightWas = nBestHeight;
+    pindexBest = &indexA;
+    hashBestChain = hashBlockA;
+    nBestHeight = indexA.nHeight;
+
+    wtxFund.hashBlock = hashBlockA;
+    wtxFund.nIndex = 0;
+    BOOST_CHECK(wallet.AddToWallet(wtxFund, hashFund));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 15 * COIN);
+    BOOST_CHECK(wallet.setUnspentTx.count(hashFund));
+
+    // reorg, block A leaves the main chain and wtxFund isn't in the mempool
+    pindexBest = pindexBestWas;
+    hashBestChain = hashBestChainWas;
+    nBestHeight = nBestHeightWas;
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+
+    pindexBest = &indexA;
+    hashBestChain = hashBlockA;
+    nBestHeight = indexA.nHeight;
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 15 * COIN);
+
+    // another copy of the wallet spent fund:1, seen when its signature is verified
+    CTransaction txExternal;
+    txExternal.vin.push_back(CTxIn(hashFund, 1));
+    txExternal.vout.push_back(CTxOut(5 * COIN, scriptOther));
+    wallet.WalletUpdateSpent(txExternal);
+    BOOST_CHECK(wallet.mapWallet[hashFund].IsSpent(1));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 10 * COIN);
+
+    // a coinstake spends fund:0, wtxFund leaves the unspent set and comes back when the coinstake is disconnected
+    CWalletTx wtxStake;
+    wtxStake.vin.push_back(CTxIn(hashFund, 0));
+    wtxStake.vout.push_back(CTxOut(0, CScript()));
+    wtxStake.vout.push_back(CTxOut(11 * COIN, scriptMine));
+    BOOST_CHECK(wtxStake.IsCoinStake());
+    BOOST_CHECK(wallet.AddToWallet(wtxStake, wtxStake.GetHash()));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+    BOOST_CHECK(!wallet.setUnspentTx.count(hashFund));
+
+    wallet.DisableTransaction(wtxStake);
+    BOOST_CHECK(!wallet.mapWallet[hashFund].IsSpent(0));
+    BOOST_CHECK(wallet.setUnspentTx.count(hashFund));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 10 * COIN);
+
+    // our spend of fund:0 is in the mempool, its change counts until a conflicting txn evicts it
+    CWalletTx wtxSpend;
+    wtxSpend.vin.push_back(CTxIn(hashFund, 0));
+    wtxSpend.vout.push_back(CTxOut(3 * COIN, scriptOther));
+    wtxSpend.vout.push_back(CTxOut(7 * COIN, scriptMine));
+    wtxSpend.vtxPrev.push_back(wallet.mapWallet[hashFund]);
+    uint256 hashSpend = wtxSpend.GetHash();
+    {
+        LOCK(mempool.cs);
+        mempool.addUnchecked(hashSpend, wtxSpend);
+    }
+    BOOST_CHECK(wallet.AddToWallet(wtxSpend, hashSpend));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 7 * COIN);
+
+    CTransaction txConflict;
+    txConflict.vin.push_back(CTxIn(hashFund, 0));
+    txConflict.vout.push_back(CTxOut(10 * COIN, scriptOther));
+    mempool.removeConflicts(txConflict);
+    BOOST_CHECK(!mempool.exists(hashSpend));
+    BOOST_CHECK_EQUAL(wallet.GetBalance(), 0);
+
+    pindexBest = pindexBestWas;
+    hashBestChain = hashBestChainWas;
+    nBestHeight = nBestHeightWas;
+    mapBlockIndex.erase(hashBlockA);
+}
+
+BOOST_AUTO_TEST_CASE(owned_filter)
+{
+    // -- ids added after the filter was built are found without a recount
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(wallet.AddKey(key));
+    BOOST_CHECK(wallet.MayOwn(key.GetPubKey().GetID()));
+
+    unsigned int nRejects = 0;
+    for (int i = 0; i < 100; i++)
+        if (!wallet.MayOwn(Hash160(BEGIN(i), END(i))))
+            nRejects++;
+    BOOST_CHECK_GT(nRejects, 90);
+
+    CKey keyNew;
+    keyNew.MakeNewKey(true);
+    CScript scriptPubKey;
+    scriptPubKey.SetDestination(keyNew.GetPubKey().GetID());
+    BOOST_CHECK(!IsMine(wallet, scriptPubKey));
+    BOOST_CHECK(wallet.AddKey(keyNew));
+    BOOST_CHECK(wallet.MayOwn(keyNew.GetPubKey().GetID()));
+    BOOST_CHECK(IsMine(wallet, scriptPubKey));
+
+    CScript redeemScript;
+    redeemScript << OP_1 << keyNew.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+    BOOST_CHECK(wallet.AddCScript(redeemScript));
+    BOOST_CHECK(wallet.MayOwn(redeemScript.GetID()));
+
+    // -- the generation is per wallet, temporary keystores and other wallets don't bump it
+    unsigned int nGeneration = wallet.nOwnedIdsAdded;
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CBasicKeyStore keystoreTemp;
+    BOOST_CHECK(keystoreTemp.AddKey(keyOther));
+    BOOST_CHECK(keystoreTemp.AddCScript(redeemScript));
+    CWallet walletOther;
+    {
+        LOCK(walletOther.cs_wallet);
+        BOOST_CHECK(walletOther.AddKey(keyOther));
+    }
+    BOOST_CHECK(wallet.nOwnedIdsAdded == nGeneration);
+    BOOST_CHECK(walletOther.nOwnedIdsAdded == 1);
+
+    // -- an account added to the wallet bumps it, and so do keys the account adds later
+    CExtKeyAccount *sea = new CExtKeyAccount();
+    CKeyID idAccount = keyOther.GetPubKey().GetID();
+    BOOST_CHECK(0 == wallet.ExtKeyAddAccountToMaps(idAccount, sea));
+    BOOST_CHECK(wallet.nOwnedIdsAdded == nGeneration + 1);
+    BOOST_CHECK(sea->pnOwnedIdsAdded == &wallet.nOwnedIdsAdded);
+    sea->OwnedIdsAdded();
+    BOOST_CHECK(wallet.nOwnedIdsAdded == nGeneration + 2);
+    wallet.mapExtAccounts.erase(idAccount);
+    delete sea;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,145 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "walletdb.h"
+#include "wallet.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+BOOST_AUTO_TEST_SUITE(walletdb_tests)
+
+static const int64_t nRecords = 5000;
+
+static CPubKey GetTestPubKey()
+{
+    CKey key;
+    key.MakeNewKey(true);
+    return key.GetPubKey();
+}
+
+static void WriteRecords(const std::string& strFile, const CPubKey& pk, int64_t nBegin, int64_t nEnd, bool fTxn)
+{
+    CWalletDB wdb(strFile, "cr+");
+    if (fTxn)
+        BOOST_CHECK(wdb.TxnBegin());
+
+    for (int64_t i = nBegin; i < nEnd; ++i)
+    {
+        CKeyPool keypool(pk);
+        keypool.nTime = i;
+        BOOST_CHECK(wdb.WritePool(i, keypool));
+    };
+
+    if (fTxn)
+        BOOST_CHECK(wdb.TxnCommit());
+}
+
+static int64_t ScanRecords(const std::string& strFile)
+{
+    // -- walk every record as CWalletDB::LoadWallet does
+    CWalletDB wdb(strFile, "r");
+    CDBCursor* pcursor = wdb.GetAtCursor();
+    BOOST_REQUIRE(pcursor);
+
+    int64_t nPool = 0;
+    while (true)
+    {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (wdb.ReadAtCursor(pcursor, ssKey, ssValue) != 0)
+            break;
+        std::string strType;
+        ssKey >> strType;
+        if (strType == "pool")
+            nPool++;
+    };
+    pcursor->close();
+    return nPool;
+}
+
+static void CheckRecords(const std::string& strFile, const CPubKey& pk)
+{
+    CWalletDB wdb(strFile, "r");
+    for (int64_t i = 0; i < nRecords; ++i)
+    {
+        CKeyPool keypool;
+        BOOST_REQUIRE(wdb.ReadPool(i, keypool));
+        BOOST_CHECK(keypool.nTime == i);
+        BOOST_CHECK(keypool.vchPubKey == pk);
+    };
+}
+
+static void RunBackend(const std::string& strFile, const CPubKey& pk)
+{
+    int64_t nStart = GetTimeMicros();
+    WriteRecords(strFile, pk, 0, nRecords / 2, false);
+    int64_t nSingle = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    WriteRecords(strFile, pk, nRecords / 2, nRecords, true);
+    int64_t nBatched = GetTimeMicros() - nStart;
+
+    nStart = GetTimeMicros();
+    BOOST_CHECK(ScanRecords(strFile) == nRecords);
+    int64_t nScan = GetTimeMicros() - nStart;
+
+    CheckRecords(strFile, pk);
+
+    BOOST_MESSAGE(strFile << ": " << nRecords / 2 << " writes " << nSingle / 1000 << "ms, "
+        << nRecords / 2 << " writes in txn " << nBatched / 1000 << "ms, "
+        << "scan " << nScan / 1000 << "ms");
+}
+
+BOOST_AUTO_TEST_CASE(walletdb_leveldb)
+{
+    std::string strBdb = "test_bdb.dat";
+    std::string strLdb = "test_ldb.dat";
+    fs::remove_all(bitdb.GetLevelDBPath(strBdb));
+    fs::remove_all(bitdb.GetLevelDBPath(strLdb));
+
+    CPubKey pk = GetTestPubKey();
+
+    // -- same workload against both backends, the LevelDB store is selected by its directory existing
+    BOOST_CHECK(!bitdb.IsLevelDB(strBdb));
+    RunBackend(strBdb, pk);
+
+    fs::create_directories(bitdb.GetLevelDBPath(strLdb));
+    BOOST_CHECK(bitdb.IsLevelDB(strLdb));
+    RunBackend(strLdb, pk);
+
+    {
+        // -- txn reads see their own writes, aborted writes are dropped
+        CWalletDB wdb(strLdb, "r+");
+        CKeyPool keypool(pk);
+        keypool.nTime = -1;
+        BOOST_CHECK(wdb.TxnBegin());
+        BOOST_CHECK(wdb.WritePool(nRecords, keypool));
+        BOOST_CHECK(wdb.ErasePool(0));
+        BOOST_CHECK(wdb.ReadPool(nRecords, keypool) && keypool.nTime == -1);
+        BOOST_CHECK(!wdb.ReadPool(0, keypool));
+        BOOST_CHECK(wdb.TxnAbort());
+        BOOST_CHECK(!wdb.ReadPool(nRecords, keypool));
+        BOOST_CHECK(wdb.ReadPool(0, keypool));
+
+        uint32_t nAffected = 0;
+        BOOST_CHECK(wdb.EraseRange("pool", nAffected));
+        BOOST_CHECK(nAffected == nRecords);
+        BOOST_CHECK(!wdb.ReadPool(0, keypool));
+    }
+
+    // -- migrated store must hold every record of the Berkeley DB file
+    int64_t nStart = GetTimeMicros();
+    BOOST_CHECK(CDB::MigrateToLevelDB(strBdb));
+    BOOST_MESSAGE("migrated " << strBdb << " in " << (GetTimeMicros() - nStart) / 1000 << "ms");
+    BOOST_CHECK(bitdb.IsLevelDB(strBdb));
+    BOOST_CHECK(ScanRecords(strBdb) == nRecords);
+    CheckRecords(strBdb, pk);
+    BOOST_CHECK(!CDB::MigrateToLevelDB(strBdb));
+
+    bitdb.CloseLevelDB();
+    fs::remove_all(bitdb.GetLevelDBPath(strBdb));
+    fs::remove_all(bitdb.GetLevelDBPath(strLdb));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -16,6 +16,7 @@
 #include "tinyformat.h"
 
 #include <inttypes.h>
+#include <algorithm>
 #include <map>
 #include <vector>
 #include <string>
@@ -635,5 +636,48 @@ template <typename Callable, typename T> void TraceThread(const char* name, Call
     };
 };
 
+
+// Split [0, n) into one part per core, each part at least nMinPerThread long, and call func(nBegin, nEnd)
+// for each part on its own thread. A single part runs on the calling thread.
+// Returns true if func returned true for every part.
+// Use it like:
+//   fOk = SplitOverThreads(vItems.size(), 32, boost::bind(&ProcessRange, &vItems, _1, _2));
+template <typename Callable> class CThreadRangePart
+{
+public:
+    CThreadRangePart(Callable funcIn, size_t nBeginIn, size_t nEndIn, char* pfOkIn)
+        : func(funcIn), nBegin(nBeginIn), nEnd(nEndIn), pfOk(pfOkIn) {};
+
+    void operator()() { *pfOk = func(nBegin, nEnd); };
+
+private:
+    Callable func;
+    size_t nBegin, nEnd;
+    char* pfOk;
+};
+
+template <typename Callable> bool SplitOverThreads(size_t n, size_t nMinPerThread, Callable func)
+{
+    size_t nThreads = std::max((size_t)boost::thread::hardware_concurrency(), (size_t)1);
+    nThreads = std::min(nThreads, n / std::max(nMinPerThread, (size_t)1));
+    if (nThreads <= 1)
+        return func((size_t)0, n);
+
+    std::vector<char> vfOk(nThreads, 0);
+    size_t nPer = n / nThreads;
+    boost::thread_group threadGroup;
+    for (size_t t = 0; t < nThreads; ++t)
+    {
+        size_t nEnd = (t == nThreads - 1) ? n : (t + 1) * nPer;
+        threadGroup.create_thread(CThreadRangePart<Callable>(func, t * nPer, nEnd, &vfOk[t]));
+    };
+    threadGroup.join_all();
+
+    for (size_t t = 0; t < nThreads; ++t)
+        if (!vfOk[t])
+            return false;
+    return true;
+};
+
 #endif
 
@@ -15,6 +15,7 @@
 #include "coincontrol.h"
 #include "pbkdf2.h"
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 
 using namespace std;
 
@@ -184,6 +185,9 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 bool fWalletUnlockStakingOnly = false;
 bool fWalletUnlockMessagingEnabled = false;
 
+// when false vtxPrev is not kept, unconfirmed ancestors are looked up when relaying instead
+bool fStoreSupportingTxns = true;
+
 bool CWallet::LoadCScript(const CScript& redeemScript)
 {
     /* A sanity check was added in pull #3843 to avoid adding redeemScripts
@@ -236,7 +240,13 @@ bool CWallet::Lock()
         };
         ExtKeyLock();
     }
-    return LockKeyStore();
+
+    bool fLocked = LockKeyStore();
+
+    // -- drop decrypted smsg headers once the keys are gone, so none can be cached again after the clear
+    SecureMsgClearHeaders();
+
+    return fLocked;
 };
 
 bool CWallet::Unlock(const SecureString& strWalletPassphrase)
@@ -252,15 +262,18 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
     CKeyingMaterial vMasterKey;
 
     LogPrintf("Unlocking wallet.\n");
+    int64_t nStart = GetTimeMillis();
+    int64_t nDerived = nStart, nKeys;
 
     {
         LOCK2(cs_main, cs_wallet);
         BOOST_FOREACH(const MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
-            if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+            if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod, pMasterKey.second.vchOtherDerivationParameters))
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 return false;
+            nDerived = GetTimeMillis();
             if (!CCryptoKeyStore::Unlock(vMasterKey))
                 return false;
             break;
@@ -268,6 +281,7 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 
         UnlockStealthAddresses(vMasterKey);
         ExtKeyUnlock(vMasterKey);
+        nKeys = GetTimeMillis();
         ProcessLockedAnonOutputs();
         SecureMsgWalletUnlocked();
 
@@ -283,6 +297,8 @@ bool CWallet::Unlock(const SecureString& strWalletPassphrase)
 
     } // cs_main, cs_wallet
 
+    LogPrintf("Wallet unlocked in %dms, passphrase %dms, keys %dms.\n", GetTimeMillis() - nStart, nDerived - nStart, nKeys - nDerived);
+
     return true;
 }
 
@@ -298,7 +314,7 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
         CKeyingMaterial vMasterKey;
         BOOST_FOREACH(MasterKeyMap::value_type& pMasterKey, mapMasterKeys)
         {
-            if (!crypter.SetKeyFromPassphrase(strOldWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+            if (!crypter.SetKeyFromPassphrase(strOldWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod, pMasterKey.second.vchOtherDerivationParameters))
                 return false;
             if (!crypter.Decrypt(pMasterKey.second.vchCryptedKey, vMasterKey))
                 return false;
@@ -306,19 +322,19 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
                 && UnlockStealthAddresses(vMasterKey))
             {
                 int64_t nStartTime = GetTimeMillis();
-                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod);
+                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod, pMasterKey.second.vchOtherDerivationParameters);
                 pMasterKey.second.nDeriveIterations = pMasterKey.second.nDeriveIterations * (100 / ((double)(GetTimeMillis() - nStartTime)));
 
                 nStartTime = GetTimeMillis();
-                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod);
+                crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod, pMasterKey.second.vchOtherDerivationParameters);
                 pMasterKey.second.nDeriveIterations = (pMasterKey.second.nDeriveIterations + pMasterKey.second.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
 
-                if (pMasterKey.second.nDeriveIterations < 25000)
-                    pMasterKey.second.nDeriveIterations = 25000;
+                if (pMasterKey.second.nDeriveIterations < pMasterKey.second.GetMinIterations())
+                    pMasterKey.second.nDeriveIterations = pMasterKey.second.GetMinIterations();
 
                 LogPrintf("Wallet passphrase changed to an nDeriveIterations of %i\n", pMasterKey.second.nDeriveIterations);
 
-                if (!crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod))
+                if (!crypter.SetKeyFromPassphrase(strNewWalletPassphrase, pMasterKey.second.vchSalt, pMasterKey.second.nDeriveIterations, pMasterKey.second.nDerivationMethod, pMasterKey.second.vchOtherDerivationParameters))
                     return false;
                 if (!crypter.Encrypt(vMasterKey, pMasterKey.second.vchCryptedKey))
                     return false;
@@ -402,21 +418,22 @@ bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
     kMasterKey.vchSalt.resize(WALLET_CRYPTO_SALT_SIZE);
     RAND_bytes(&kMasterKey.vchSalt[0], WALLET_CRYPTO_SALT_SIZE);
 
+    // -- timed on the wall clock, with method 2 that is all lanes running at once
     CCrypter crypter;
     int64_t nStartTime = GetTimeMillis();
-    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, 25000, kMasterKey.nDerivationMethod);
-    kMasterKey.nDeriveIterations = 2500000 / ((double)(GetTimeMillis() - nStartTime));
+    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.GetMinIterations(), kMasterKey.nDerivationMethod, kMasterKey.vchOtherDerivationParameters);
+    kMasterKey.nDeriveIterations = kMasterKey.GetMinIterations() * 100 / ((double)(GetTimeMillis() - nStartTime));
 
     nStartTime = GetTimeMillis();
-    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod);
+    crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod, kMasterKey.vchOtherDerivationParameters);
     kMasterKey.nDeriveIterations = (kMasterKey.nDeriveIterations + kMasterKey.nDeriveIterations * 100 / ((double)(GetTimeMillis() - nStartTime))) / 2;
 
-    if (kMasterKey.nDeriveIterations < 25000)
-        kMasterKey.nDeriveIterations = 25000;
+    if (kMasterKey.nDeriveIterations < kMasterKey.GetMinIterations())
+        kMasterKey.nDeriveIterations = kMasterKey.GetMinIterations();
 
-    LogPrintf("Encrypting Wallet with an nDeriveIterations of %i\n", kMasterKey.nDeriveIterations);
+    LogPrintf("Encrypting Wallet with derivation method %u and an nDeriveIterations of %i\n", kMasterKey.nDerivationMethod, kMasterKey.nDeriveIterations);
 
-    if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod))
+    if (!crypter.SetKeyFromPassphrase(strWalletPassphrase, kMasterKey.vchSalt, kMasterKey.nDeriveIterations, kMasterKey.nDerivationMethod, kMasterKey.vchOtherDerivationParameters))
         return false;
     if (!crypter.Encrypt(vMasterKey, kMasterKey.vchCryptedKey))
         return false;
@@ -515,35 +532,85 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb)
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount, bool fShowCoinstake)
+void CWallet::RebuildOrderedTxItems()
 {
     AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
 
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
+    wtxOrdered.clear();
+    laccentries.clear();
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
     for (WalletTxMap::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
     {
         CWalletTx* wtx = &((*it).second);
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+    };
 
-        if (!fShowCoinstake
-            && wtx->IsCoinStake())
-            continue;
+    if (fFileBacked)
+    {
+        CWalletDB walletdb(strWalletFile);
+        walletdb.ListAccountCreditDebit("*", laccentries);
+    };
 
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
+    {
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
     };
+}
+
+void CWallet::EraseOrderedTx(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet); // mapWallet
 
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH(CAccountingEntry& entry, acentries)
+    WalletTxMap::iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return;
+
+    CWalletTx* pwtx = &mi->second;
+    std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(pwtx->nOrderPos);
+    for (TxItems::iterator it = range.first; it != range.second; ++it)
     {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+        if (it->second.first != pwtx)
+            continue;
+        wtxOrdered.erase(it);
+        break;
     };
+}
 
-    return txOrdered;
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
+{
+    AssertLockHeld(cs_wallet);
+
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
+
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+
+    return true;
+}
+
+void CWallet::EraseAccountingEntry(int64_t nOrderPos)
+{
+    // -- drop an entry AddAccountingEntry added to memory, when its db txn didn't commit
+    AssertLockHeld(cs_wallet);
+
+    std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(nOrderPos);
+    for (TxItems::iterator it = range.first; it != range.second; ++it)
+    {
+        CAccountingEntry* pentry = it->second.second;
+        if (!pentry)
+            continue;
+        wtxOrdered.erase(it);
+        for (std::list<CAccountingEntry>::iterator li = laccentries.begin(); li != laccentries.end(); ++li)
+        {
+            if (&*li != pentry)
+                continue;
+            laccentries.erase(li);
+            break;
+        };
+        break;
+    };
 }
 
 void CWallet::WalletUpdateSpent(const CTransaction &tx, bool fBlock)
@@ -614,10 +681,191 @@ void CWallet::MarkDirty()
         LOCK(cs_wallet);
         BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
             item.second.MarkDirty();
+        RebuildUnspent();
+    }
+}
+
+void CWallet::RebuildUnspent() const
+{
+    AssertLockHeld(cs_wallet);
+
+    setUnspentTx.clear();
+    for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        setUnspentTx.insert(setUnspentTx.end(), it->first);
+    nBalanceGeneration++;
+}
+
+bool CWallet::HasUnspent(const CWalletTx& wtx) const
+{
+    // -- true if wtx may still contribute to a balance or to AvailableCoins
+    for (unsigned int i = 0; i < wtx.vout.size(); ++i)
+    {
+        if (!wtx.IsSpent(i) && IsMine(wtx.vout[i]))
+            return true;
+    };
+
+    if (wtx.nVersion == ANON_TXN_VERSION
+        && wtx.GetAvailableSumcoinCredit() > 0)
+        return true;
+
+    return false;
+}
+
+const CWalletBalances& CWallet::UpdateBalances() const
+{
+    // -- recompute the balance totals if anything they depend on has changed
+    //    the totals depend on the chain tip (depth, maturity), the mempool (depth -1, IsTrusted) and the txns themselves
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    unsigned int nMempool = mempool.GetTransactionsUpdated();
+    if (fBalancesCached
+        && hashBalancesBest == hashBestChain
+        && nBalancesMempool == nMempool
+        && nBalancesGeneration == nBalanceGeneration
+        && nBalancesTxns == mapWallet.size())
+        return cachedBalances;
+
+    CWalletBalances balances;
+    bool fTimeDependent = false;
+
+    std::set<uint256>::iterator it = setUnspentTx.begin();
+    while (it != setUnspentTx.end())
+    {
+        WalletTxMap::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end()
+            || !HasUnspent(mi->second))
+        {
+            setUnspentTx.erase(it++);
+            continue;
+        };
+        ++it;
+
+        const CWalletTx& wtx = mi->second;
+
+        bool fFinal = wtx.IsFinal();
+        if (wtx.nLockTime != 0 && !fFinal)
+            fTimeDependent = true; // IsFinal may change without the tip changing
+
+        bool fTrusted = wtx.IsTrusted();
+        if (fTrusted)
+        {
+            balances.nBalance += wtx.GetAvailableCredit();
+            if (wtx.nVersion == ANON_TXN_VERSION)
+                balances.nSumcoinBalance += wtx.GetAvailableSumcoinCredit();
+        };
+
+        int nDepth = wtx.GetDepthInMainChain();
+        if (!fFinal || (!fTrusted && nDepth == 0))
+            balances.nUnconfirmed += wtx.GetAvailableCredit();
+
+        if ((wtx.IsCoinBase() || wtx.IsCoinStake())
+            && nDepth > 0
+            && wtx.GetBlocksToMaturity() > 0)
+        {
+            int64_t nCredit = GetCredit(wtx);
+            if (wtx.IsCoinBase())
+            {
+                balances.nImmature += nCredit;
+                balances.nNewMint += nCredit;
+            } else
+            {
+                balances.nStake += nCredit;
+            };
+        };
+    };
+
+    cachedBalances = balances;
+    fBalancesCached = !fTimeDependent;
+    hashBalancesBest = hashBestChain;
+    nBalancesMempool = nMempool;
+    nBalancesGeneration = nBalanceGeneration;
+    nBalancesTxns = mapWallet.size();
+
+    return cachedBalances;
+}
+
+size_t CWallet::OwnedCount() const
+{
+    // -- total of every map an owned key or script can be in, sizes filterOwned
+    AssertLockHeld(cs_wallet);
+
+    size_t nCount = mapExtAccounts.size();
+    {
+        LOCK(cs_KeyStore);
+        nCount += mapKeys.size() + mapCryptedKeys.size() + mapScripts.size();
     }
+
+    for (ExtKeyAccountMap::const_iterator it = mapExtAccounts.begin(); it != mapExtAccounts.end(); ++it)
+    {
+        const CExtKeyAccount *sea = it->second;
+        LOCK(sea->cs_account);
+        nCount += sea->mapKeys.size() + sea->mapLookAhead.size() + sea->mapStealthChildKeys.size();
+    };
+
+    return nCount;
 }
 
-bool CWallet::AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn)
+void CWallet::RebuildOwnedFilter() const
+{
+    AssertLockHeld(cs_wallet);
+
+    // -- read before the maps, ids added during the rebuild bump it again
+    nFilterOwnedGeneration = nOwnedIdsAdded;
+
+    size_t nCount = OwnedCount();
+    filterOwned.Init(nCount + 1000); // headroom, ids are usually added in small batches
+
+    {
+        LOCK(cs_KeyStore);
+        for (KeyMap::const_iterator mi = mapKeys.begin(); mi != mapKeys.end(); ++mi)
+            filterOwned.insert(mi->first);
+        for (CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin(); mi != mapCryptedKeys.end(); ++mi)
+            filterOwned.insert(mi->first);
+        for (ScriptMap::const_iterator mi = mapScripts.begin(); mi != mapScripts.end(); ++mi)
+            filterOwned.insert(mi->first);
+    }
+
+    for (ExtKeyAccountMap::const_iterator it = mapExtAccounts.begin(); it != mapExtAccounts.end(); ++it)
+    {
+        const CExtKeyAccount *sea = it->second;
+        LOCK(sea->cs_account);
+        for (AccKeyMap::const_iterator mi = sea->mapKeys.begin(); mi != sea->mapKeys.end(); ++mi)
+            filterOwned.insert(mi->first);
+        for (AccKeyMap::const_iterator mi = sea->mapLookAhead.begin(); mi != sea->mapLookAhead.end(); ++mi)
+            filterOwned.insert(mi->first);
+        for (AccKeySCMap::const_iterator mi = sea->mapStealthChildKeys.begin(); mi != sea->mapStealthChildKeys.end(); ++mi)
+            filterOwned.insert(mi->first);
+    };
+
+    if (fDebug)
+        LogPrintf("RebuildOwnedFilter() %u ids, %u bytes.\n", filterOwned.GetElements(), filterOwned.GetSize());
+}
+
+bool CWallet::MayOwn(const uint160& id) const
+{
+    // -- false if id is certainly not a key or script of this wallet
+    LOCK(cs_wallet);
+
+    if (filterOwned.GetSize() == 0
+        || nFilterOwnedGeneration != nOwnedIdsAdded)
+        RebuildOwnedFilter();
+
+    nFilterChecks++;
+    if (filterOwned.contains(id))
+        return true;
+
+    nFilterRejects++;
+    return false;
+}
+
+void CWallet::CountFilterFalsePositive() const
+{
+    LOCK(cs_wallet);
+    nFilterFalsePositives++;
+}
+
+bool CWallet::AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn, CWalletDB* pwalletdb)
 {
     //uint256 hashIn = wtxIn.GetHash();
     {
@@ -627,11 +875,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn)
         pair<WalletTxMap::iterator, bool> ret = mapWallet.insert(make_pair(hashIn, wtxIn));
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
+        TxChanged(hashIn);
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
             wtx.nTimeReceived = GetAdjustedTime();
-            wtx.nOrderPos = IncOrderPosNext();
+            wtx.nOrderPos = IncOrderPosNext(pwalletdb);
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0)
@@ -674,9 +924,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn)
 
                     // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                     int64_t latestTolerated = latestNow + 300;
-                    std::list<CAccountingEntry> acentries;
-                    TxItems txOrdered = OrderedTxItems(acentries);
-                    for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
+                    for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it)
                     {
                         CWalletTx *const pwtx = (*it).second.first;
                         if (pwtx == &wtx)
@@ -718,13 +966,16 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn)
         if (!fInsertedNew)
         {
             // Merge
-            if (wtxIn.hashBlock != 0 && wtxIn.hashBlock != wtx.hashBlock)
+            bool fNewBlock = wtxIn.hashBlock != 0 && wtxIn.hashBlock != wtx.hashBlock;
+            if (fNewBlock)
             {
                 wtx.hashBlock = wtxIn.hashBlock;
                 fUpdated = true;
             };
 
-            if (wtxIn.nIndex != -1 && (wtxIn.vMerkleBranch != wtx.vMerkleBranch || wtxIn.nIndex != wtx.nIndex))
+            // -- a stripped txn may have no merkle branch in memory, only a block change is an update,
+            //    the branch it gets here is kept in memory and overrides the stored one
+            if (wtxIn.nIndex != -1 && (fNewBlock || (!wtx.fStripped && wtxIn.vMerkleBranch != wtx.vMerkleBranch) || wtxIn.nIndex != wtx.nIndex))
             {
                 wtx.vMerkleBranch = wtxIn.vMerkleBranch;
                 wtx.nIndex = wtxIn.nIndex;
@@ -746,7 +997,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn)
         // Write to disk
         if (fInsertedNew || fUpdated)
         {
-            if (!wtx.WriteToDisk())
+            if (!wtx.WriteToDisk(pwalletdb))
                 return false;
         };
 
@@ -922,6 +1173,7 @@ bool CWallet::EraseFromWallet(uint256 hash)
 
     {
         LOCK(cs_wallet);
+        EraseOrderedTx(hash);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -1226,6 +1478,9 @@ void CWalletTx::AddSupportingTransactions(CTxDB& txdb)
 {
     vtxPrev.clear();
 
+    if (!fStoreSupportingTxns)
+        return;
+
     const int COPY_DEPTH = 3;
     if (SetMerkleBranch() < COPY_DEPTH)
     {
@@ -1281,8 +1536,10 @@ void CWalletTx::AddSupportingTransactions(CTxDB& txdb)
     reverse(vtxPrev.begin(), vtxPrev.end());
 }
 
-bool CWalletTx::WriteToDisk()
+bool CWalletTx::WriteToDisk(CWalletDB* pwalletdb)
 {
+    if (pwalletdb)
+        return pwalletdb->WriteTx(GetHash(), *this);
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
@@ -1443,9 +1700,57 @@ void CWallet::ReacceptWalletTransactions()
     };
 }
 
+void CWalletTx::GetUnconfirmedAncestors(CTxDB& txdb, std::vector<CMerkleTx>& vtxOut) const
+{
+    // -- stand in for vtxPrev: txns this one depends on that are not in the txindex yet,
+    //    parents before children. Confirmed ancestors end the walk, peers already have them.
+    //    Parents the wallet doesn't hold, e.g. an unconfirmed txn that paid us, come from the mempool.
+    vtxOut.clear();
+    if (!pwallet)
+        return;
+
+    std::vector<uint256> vWorkQueue;
+    BOOST_FOREACH(const CTxIn& txin, vin)
+        vWorkQueue.push_back(txin.prevout.hash);
+
+    LOCK(pwallet->cs_wallet);
+    set<uint256> setAlreadyDone;
+    for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+    {
+        uint256 hash = vWorkQueue[i];
+        if (setAlreadyDone.count(hash))
+            continue;
+        setAlreadyDone.insert(hash);
+
+        if (txdb.ContainsTx(hash))
+            continue;
+
+        WalletTxMap::const_iterator mi = pwallet->mapWallet.find(hash);
+        if (mi != pwallet->mapWallet.end())
+        {
+            vtxOut.push_back(mi->second);
+        } else
+        {
+            CTransaction txPool;
+            if (!mempool.lookup(hash, txPool))
+                continue;
+            vtxOut.push_back(CMerkleTx(txPool));
+        };
+
+        BOOST_FOREACH(const CTxIn& txin, vtxOut.back().vin)
+            vWorkQueue.push_back(txin.prevout.hash);
+    };
+
+    std::reverse(vtxOut.begin(), vtxOut.end());
+}
+
 void CWalletTx::RelayWalletTransaction(CTxDB& txdb)
 {
-    BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
+    std::vector<CMerkleTx> vtxFetched;
+    if (vtxPrev.empty())
+        GetUnconfirmedAncestors(txdb, vtxFetched);
+
+    BOOST_FOREACH(const CMerkleTx& tx, vtxPrev.empty() ? vtxFetched : vtxPrev)
     {
         if (!(tx.IsCoinBase() || tx.IsCoinStake()))
         {
@@ -1535,67 +1840,27 @@ void CWallet::ResendWalletTransactions(bool fForce)
 
 int64_t CWallet::GetBalance() const
 {
-    int64_t nTotal = 0;
-
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        };
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nBalance;
 }
 
 int64_t CWallet::GetSumcoinBalance() const
 {
-    int64_t nTotal = 0;
-
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (pcoin->IsTrusted() && pcoin->nVersion == ANON_TXN_VERSION)
-                nTotal += pcoin->GetAvailableSumcoinCredit();
-        };
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nSumcoinBalance;
 };
 
 
 int64_t CWallet::GetUnconfirmedBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (!pcoin->IsFinal() || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
-                nTotal += pcoin->GetAvailableCredit();
-        };
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nUnconfirmed;
 }
 
 int64_t CWallet::GetImmatureBalance() const
 {
-    int64_t nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx& pcoin = (*it).second;
-            if (pcoin.IsCoinBase() && pcoin.GetBlocksToMaturity() > 0 && pcoin.IsInMainChain())
-                nTotal += GetCredit(pcoin);
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return UpdateBalances().nImmature;
 }
 
 // populate vCoins with vector of spendable COutputs
@@ -1605,9 +1870,12 @@ void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed,
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (std::set<uint256>::const_iterator it = setUnspentTx.begin(); it != setUnspentTx.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            WalletTxMap::const_iterator mi = mapWallet.find(*it);
+            if (mi == mapWallet.end())
+                continue;
+            const CWalletTx* pcoin = &mi->second;
 
             if (!pcoin->IsFinal())
                 continue;
@@ -1624,7 +1892,7 @@ void CWallet::AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed,
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++)
                 if (!(pcoin->IsSpent(i)) && IsMine(pcoin->vout[i]) && pcoin->vout[i].nValue >= nMinimumInputValue &&
-                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected((*it).first, i)))
+                (!coinControl || !coinControl->HasSelected() || coinControl->IsSelected(*it, i)))
                     vCoins.push_back(COutput(pcoin, i, nDepth));
 
         }
@@ -1637,9 +1905,12 @@ void CWallet::AvailableCoinsForStaking(std::vector<COutput>& vCoins, unsigned in
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (std::set<uint256>::const_iterator it = setUnspentTx.begin(); it != setUnspentTx.end(); ++it)
         {
-            const CWalletTx* pcoin = &(*it).second;
+            WalletTxMap::const_iterator mi = mapWallet.find(*it);
+            if (mi == mapWallet.end())
+                continue;
+            const CWalletTx* pcoin = &mi->second;
 
             // Filtering by tx timestamp instead of block timestamp may give false positives but never false negatives
             if (pcoin->nTime + nStakeMinAge > nSpendTime)
@@ -1664,6 +1935,81 @@ void CWallet::AvailableCoinsForStaking(std::vector<COutput>& vCoins, unsigned in
     }
 }
 
+int64_t GetCostOfChange()
+{
+    // -- what a change output costs to create and to spend, at the rate sent txns pay (-paytxfee)
+    return std::max(nTransactionFee, MIN_TX_FEE) * COINSELECT_CHANGE_BYTES / 1000;
+}
+
+static bool SelectCoinsBnB(
+    const std::vector<pair<int64_t, pair<const CWalletTx*,unsigned int> > >& vValue, int64_t nTotalLower, int64_t nTargetValue,
+    int64_t nCostOfChange, std::vector<char>& vfBest, int64_t& nBest)
+{
+    // -- depth first search for a changeless selection, nTargetValue <= total <= nTargetValue + nCostOfChange
+    //    vValue must be sorted by descending value, nTotalLower is the sum of vValue
+    //    the inclusion branch is explored first, a coin is never tried in place of an equal valued coin
+    //    that was just omitted, so runs of equal coins cost one branch each.
+    //    Prefers the least excess, then the fewest inputs.
+
+    std::vector<size_t> vSelected;
+    size_t nBestCount = 0;
+    int64_t nSelected = 0;
+    int64_t nRemaining = nTotalLower;
+    bool fFound = false;
+
+    size_t i = 0;
+    for (int nTries = 0; nTries < COINSELECT_BNB_TRIES; ++nTries, ++i)
+    {
+        bool fBacktrack = false;
+        if (nSelected + nRemaining < nTargetValue
+            || nSelected > nTargetValue + nCostOfChange)
+        {
+            fBacktrack = true;
+        } else
+        if (nSelected >= nTargetValue)
+        {
+            if (!fFound
+                || nSelected < nBest
+                || (nSelected == nBest && vSelected.size() < nBestCount))
+            {
+                fFound = true;
+                nBest = nSelected;
+                nBestCount = vSelected.size();
+                vfBest.assign(vValue.size(), false);
+                for (size_t k = 0; k < vSelected.size(); ++k)
+                    vfBest[vSelected[k]] = true;
+            };
+            fBacktrack = true;
+        };
+
+        if (fBacktrack)
+        {
+            if (vSelected.empty())
+                break; // search space exhausted
+
+            // -- return the omitted coins to the lookahead, then take the omission branch of the last included coin
+            for (--i; i > vSelected.back(); --i)
+                nRemaining += vValue[i].first;
+
+            nSelected -= vValue[i].first;
+            vSelected.pop_back();
+            continue;
+        };
+
+        nRemaining -= vValue[i].first;
+
+        if (vSelected.empty()
+            || i - 1 == vSelected.back()
+            || vValue[i].first != vValue[i - 1].first)
+        {
+            vSelected.push_back(i);
+            nSelected += vValue[i].first;
+        };
+    };
+
+    return fFound;
+}
+
 static void ApproximateBestSubset(
     std::vector<pair<int64_t, pair<const CWalletTx*,unsigned int> > >vValue, int64_t nTotalLower, int64_t nTargetValue,
     std::vector<char>& vfBest, int64_t& nBest, int iterations = 1000)
@@ -1706,28 +2052,14 @@ static void ApproximateBestSubset(
 // ppcoin: total coins staked (non-spendable until maturity)
 int64_t CWallet::GetStake() const
 {
-    int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinStake() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
-    };
-    return nTotal;
+    return UpdateBalances().nStake;
 }
 
 int64_t CWallet::GetNewMint() const
 {
-    int64_t nTotal = 0;
     LOCK2(cs_main, cs_wallet);
-    for (WalletTxMap::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-    {
-        const CWalletTx* pcoin = &(*it).second;
-        if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0 && pcoin->GetDepthInMainChain() > 0)
-            nTotal += CWallet::GetCredit(*pcoin);
-    };
-    return nTotal;
+    return UpdateBalances().nNewMint;
 }
 
 bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const
@@ -1797,11 +2129,50 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
         return true;
     }
 
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    // stable: equal valued coins keep their shuffled order
+    stable_sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     std::vector<char> vfBest;
     int64_t nBest;
 
+    int nConsolidate = std::min((int)GetArg("-consolidateinputs", 0), COINSELECT_MAX_CONSOLIDATE);
+
+    // Try for a selection that needs no change output
+    if (GetArg("-coinselect", "bnb") != "knapsack"
+        && SelectCoinsBnB(vValue, nTotalLower, nTargetValue, GetCostOfChange(), vfBest, nBest))
+    {
+        for (unsigned int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+            {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            };
+
+        if (fDebug && GetBoolArg("-printpriority"))
+            LogPrintf("SelectCoins() changeless subset of %u coins, total %s\n", setCoinsRet.size(), FormatMoney(nBest).c_str());
+        return true;
+    };
+
+    // Very large candidate sets are cut down to the largest coins that can still cover the target with change,
+    // the stochastic approximation is O(n) per iteration and smaller coins only make the transaction bigger.
+    std::vector<std::pair<int64_t, std::pair<const CWalletTx*,unsigned int> > > vSmall; // coins cut, kept for consolidation
+    if (vValue.size() > COINSELECT_MAX_KNAPSACK)
+    {
+        int64_t nSum = 0;
+        unsigned int nKeep = 0;
+        while (nKeep < vValue.size()
+            && (nKeep < COINSELECT_MAX_KNAPSACK || nSum < nTargetValue + CENT))
+            nSum += vValue[nKeep++].first;
+
+        if (nKeep < vValue.size())
+        {
+            if (nConsolidate > 0)
+                vSmall.assign(vValue.end() - std::min((size_t)nConsolidate, vValue.size() - nKeep), vValue.end());
+            vValue.resize(nKeep);
+            nTotalLower = nSum;
+        };
+    };
+
+    // Solve subset sum by stochastic approximation
     ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
         ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
@@ -1834,6 +2205,20 @@ bool CWallet::SelectCoinsMinConf(int64_t nTargetValue, unsigned int nSpendTime,
         }
     }
 
+    // -- consolidation: the transaction needs change anyway, sweep in up to nConsolidate of the smallest coins,
+    //    an exact match stays changeless
+    if (nConsolidate > 0 && nValueRet != nTargetValue)
+    {
+        vSmall.insert(vSmall.begin(), vValue.begin(), vValue.end());
+        for (int i = (int)vSmall.size() - 1; i >= 0 && nConsolidate > 0; --i)
+        {
+            if (!setCoinsRet.insert(vSmall[i].second).second)
+                continue;
+            nValueRet += vSmall[i].first;
+            nConsolidate--;
+        };
+    };
+
     return true;
 }
 
@@ -1921,6 +2306,9 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
         // txdb must be opened before the mapWallet lock
         CTxDB txdb("r");
         {
+            CBasicKeyStore keystoreSign;
+            bool fCoinSelectBnB = GetArg("-coinselect", "bnb") != "knapsack";
+            int64_t nCostOfChange = GetCostOfChange();
             nFeeRet = nTransactionFee;
             while (true)
             {
@@ -1959,6 +2347,14 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                     nFeeRet += nMoveToFee;
                 };
 
+                // a change output worth less than the cost of creating and spending it goes to the fee,
+                // as branch and bound selects, knapsack keeps the old behaviour
+                if (fCoinSelectBnB && nChange > 0 && nChange <= nCostOfChange)
+                {
+                    nFeeRet += nChange;
+                    nChange = 0;
+                };
+
                 if (nChange > 0)
                 {
                     // Fill a vout to ourself
@@ -2008,14 +2404,19 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
                     wtxNew.vin.push_back(CTxIn(coin.first->GetHash(),coin.second));
 
-                // Sign
-                int nIn = 0;
+                // Sign, in parallel for larger txns
+                std::vector<CScript> vFromPubKey;
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
-                    if (!SignSignature(*this, *coin.first, wtxNew, nIn++))
-                    {
-                        LogPrintf("%s: Error SignSignature failed.\n", __func__);
-                        return false;
-                    };
+                {
+                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
+                    vFromPubKey.push_back(scriptPubKey);
+                    CopySigningKeys(*this, scriptPubKey, keystoreSign);
+                };
+                if (!SignSignatures(keystoreSign, vFromPubKey, wtxNew))
+                {
+                    LogPrintf("%s: Error SignSignature failed.\n", __func__);
+                    return false;
+                };
                 // Limit size
                 unsigned int nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION);
                 if (nBytes >= MAX_BLOCK_SIZE_GEN/5)
@@ -2025,59 +2426,293 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64_t> >&
                 };
                 dPriority /= nBytes;
 
-                // Check that enough fee is included
+                // Check that enough fee is included
+                int64_t nPayFee = nTransactionFee * (1 + (int64_t)nBytes / 1000);
+                int64_t nMinFee = wtxNew.GetMinFee(1, GMF_SEND, nBytes);
+
+                if (nFeeRet < max(nPayFee, nMinFee))
+                {
+                    nFeeRet = max(nPayFee, nMinFee);
+                    continue;
+                };
+
+                // Fill vtxPrev by copying from previous transactions vtxPrev
+                wtxNew.AddSupportingTransactions(txdb);
+                wtxNew.fTimeReceivedIsTxTime = true;
+
+                break;
+            };
+        }
+    }
+    return true;
+}
+
+
+
+
+bool CWallet::CreateTransaction(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, int64_t& nFeeRet, const CCoinControl* coinControl)
+{
+    std::vector<std::pair<CScript, int64_t> > vecSend;
+    vecSend.push_back(make_pair(scriptPubKey, nValue));
+
+    if (sNarr.length() > 0)
+    {
+        std::vector<uint8_t> vNarr(sNarr.c_str(), sNarr.c_str() + sNarr.length());
+        std::vector<uint8_t> vNDesc;
+
+        vNDesc.resize(2);
+        vNDesc[0] = 'n';
+        vNDesc[1] = 'p';
+
+        CScript scriptN = CScript() << OP_RETURN << vNDesc << OP_RETURN << vNarr;
+
+        vecSend.push_back(make_pair(scriptN, 0));
+    };
+
+    // -- CreateTransaction won't place change between value and narr output.
+    //    narration output will be for preceding output
+
+    int nChangePos;
+    bool rv = CreateTransaction(vecSend, wtxNew, nFeeRet, nChangePos, coinControl);
+
+    // -- narration will be added to mapValue later in FindStealthTransactions From CommitTransaction
+    return rv;
+}
+
+
+static unsigned int EstimateSignedInputSize(const CScript& scriptPubKey)
+{
+    // -- upper bounds: prevout, sequence and the largest scriptSig an input of that type signs to
+    txnouttype whichType;
+    std::vector<valtype> vSolutions;
+    if (Solver(scriptPubKey, whichType, vSolutions))
+    {
+        if (whichType == TX_PUBKEYHASH)
+            return 41 + 74 + 66;
+        if (whichType == TX_PUBKEY)
+            return 41 + 74;
+    };
+    return 43 + 500; // IsStandard limit
+}
+
+static bool SignTxnsRange(const CKeyStore* pkeystore, std::vector<CWalletTx>* pvwtx,
+    const std::vector<std::vector<const CScript*> >* pvScripts, unsigned int nMaxThreads, size_t nBegin, size_t nEnd)
+{
+    // -- SignSignatures signs the inputs of one txn with a single CSignatureHasher
+    for (size_t nTx = nBegin; nTx < nEnd; ++nTx)
+    {
+        std::vector<CScript> vFromPubKey;
+        for (size_t nIn = 0; nIn < (*pvScripts)[nTx].size(); ++nIn)
+            vFromPubKey.push_back(*(*pvScripts)[nTx][nIn]);
+        if (!SignSignatures(*pkeystore, vFromPubKey, (*pvwtx)[nTx], SIGHASH_ALL, NULL, nMaxThreads))
+            return false;
+    };
+    return true;
+};
+
+static bool SignBulkInputs(const CKeyStore& keystore, std::vector<CWalletTx>& vwtx, const std::vector<std::vector<const CScript*> >& vScripts)
+{
+    // -- one level of threads: with a txn per core they are shared out whole and each is signed on its thread,
+    //    fewer txns are signed one after another, each over all cores
+    if (vwtx.size() < std::max(boost::thread::hardware_concurrency(), 1u))
+        return SignTxnsRange(&keystore, &vwtx, &vScripts, 0, 0, vwtx.size());
+    return SplitOverThreads(vwtx.size(), 1, boost::bind(&SignTxnsRange, &keystore, &vwtx, &vScripts, 1, _1, _2));
+};
+
+bool CWallet::CreateBulkTransactions(const std::vector<std::pair<CScript, int64_t> >& vecSend, std::vector<CWalletTx>& vwtxNew,
+    std::vector<std::pair<unsigned int, std::string> >& vRejected, int64_t& nFeeRet, unsigned int nMaxTxBytes)
+{
+    // -- pay many recipients in as few txns as fit in nMaxTxBytes.
+    //    Coins are selected from one AvailableCoins snapshot, keys are copied out of the wallet once and
+    //    all inputs are signed in parallel at the end. Recipients that can't be paid are returned in
+    //    vRejected as (index into vecSend, reason).
+    vwtxNew.clear();
+    vRejected.clear();
+    nFeeRet = 0;
+
+    if (IsLocked())
+        return error("%s: Wallet locked, unable to create transaction.", __func__);
+    if (fWalletUnlockStakingOnly)
+        return error("%s: Wallet unlocked for staking only, unable to create transaction.", __func__);
+
+    nMaxTxBytes = std::min(nMaxTxBytes, MAX_BLOCK_SIZE_GEN/5 - 1);
+    int64_t nStart = GetTimeMillis();
+
+    // -- outputs of a chunk fill at most half of nMaxTxBytes, the rest is left for the inputs
+    std::vector<std::vector<unsigned int> > vChunks;
+    unsigned int nChunkBytes = 0;
+    for (unsigned int i = 0; i < vecSend.size(); ++i)
+    {
+        const CTxOut txout(vecSend[i].second, vecSend[i].first);
+        txnouttype whichType;
+        if (txout.nValue <= 0 || !MoneyRange(txout.nValue))
+        {
+            vRejected.push_back(std::make_pair(i, std::string("Invalid amount")));
+            continue;
+        };
+        if (!::IsStandard(txout.scriptPubKey, whichType)
+            || whichType == TX_NULL_DATA)
+        {
+            vRejected.push_back(std::make_pair(i, std::string("Non-standard output script")));
+            continue;
+        };
+
+        unsigned int nOutBytes = ::GetSerializeSize(txout, SER_NETWORK, PROTOCOL_VERSION);
+        if (vChunks.empty()
+            || nChunkBytes + nOutBytes > nMaxTxBytes / 2)
+        {
+            vChunks.push_back(std::vector<unsigned int>());
+            nChunkBytes = 0;
+        };
+        vChunks.back().push_back(i);
+        nChunkBytes += nOutBytes;
+    };
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        CTxDB txdb("r");
+
+        std::vector<COutput> vCoins;
+        AvailableCoins(vCoins, true);
+
+        int64_t nValueAvailable = 0;
+        BOOST_FOREACH(const COutput& out, vCoins)
+            nValueAvailable += out.tx->vout[out.i].nValue;
+
+        CBasicKeyStore keystoreSign;
+        std::vector<std::vector<const CScript*> > vScripts;
+        bool fCoinSelectBnB = GetArg("-coinselect", "bnb") != "knapsack";
+        int64_t nCostOfChange = GetCostOfChange();
+
+        // -- vChunks grows when a chunk has to be split
+        for (size_t c = 0; c < vChunks.size(); ++c)
+        {
+            std::vector<unsigned int> vChunk;
+            vChunk.swap(vChunks[c]);
+
+            CWalletTx wtxNew;
+            wtxNew.BindWallet(this);
+            wtxNew.fFromMe = true;
+
+            int64_t nValue = 0;
+            BOOST_FOREACH(unsigned int i, vChunk)
+            {
+                wtxNew.vout.push_back(CTxOut(vecSend[i].second, vecSend[i].first));
+                nValue += vecSend[i].second;
+            };
+
+            set<pair<const CWalletTx*,unsigned int> > setCoins;
+            int64_t nValueIn = 0;
+            int64_t nFee = nTransactionFee;
+            unsigned int nBytes = 0;
+            bool fSelected = false;
+            while (nValue + nFee <= nValueAvailable)
+            {
+                if (!(SelectCoinsMinConf(nValue + nFee, wtxNew.nTime, 1, 10, vCoins, setCoins, nValueIn)
+                    || SelectCoinsMinConf(nValue + nFee, wtxNew.nTime, 1, 1, vCoins, setCoins, nValueIn)
+                    || SelectCoinsMinConf(nValue + nFee, wtxNew.nTime, 0, 1, vCoins, setCoins, nValueIn)))
+                    break;
+
+                // -- size with a change output and every input signed
+                nBytes = ::GetSerializeSize(*(CTransaction*)&wtxNew, SER_NETWORK, PROTOCOL_VERSION) + 34;
+                BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
+                    nBytes += EstimateSignedInputSize(coin.first->vout[coin.second].scriptPubKey);
+
                 int64_t nPayFee = nTransactionFee * (1 + (int64_t)nBytes / 1000);
                 int64_t nMinFee = wtxNew.GetMinFee(1, GMF_SEND, nBytes);
-
-                if (nFeeRet < max(nPayFee, nMinFee))
+                if (nFee < max(nPayFee, nMinFee))
                 {
-                    nFeeRet = max(nPayFee, nMinFee);
+                    nFee = max(nPayFee, nMinFee);
                     continue;
                 };
 
-                // Fill vtxPrev by copying from previous transactions vtxPrev
-                wtxNew.AddSupportingTransactions(txdb);
-                wtxNew.fTimeReceivedIsTxTime = true;
-
+                fSelected = true;
                 break;
             };
-        }
-    }
-    return true;
-}
 
+            if (!fSelected || nBytes > nMaxTxBytes)
+            {
+                if (vChunk.size() > 1)
+                {
+                    // -- retry as two smaller txns
+                    size_t nHalf = vChunk.size() / 2;
+                    vChunks.push_back(std::vector<unsigned int>(vChunk.begin(), vChunk.begin() + nHalf));
+                    vChunks.push_back(std::vector<unsigned int>(vChunk.begin() + nHalf, vChunk.end()));
+                    continue;
+                };
+                vRejected.push_back(std::make_pair(vChunk[0], std::string(fSelected ? "Transaction too large" : "Insufficient funds")));
+                continue;
+            };
 
+            int64_t nChange = nValueIn - nValue - nFee;
+            if (nFee < MIN_TX_FEE && nChange > 0 && nChange < CENT)
+            {
+                int64_t nMoveToFee = min(nChange, MIN_TX_FEE - nFee);
+                nChange -= nMoveToFee;
+                nFee += nMoveToFee;
+            };
 
+            if (fCoinSelectBnB && nChange > 0 && nChange <= nCostOfChange)
+            {
+                nFee += nChange;
+                nChange = 0;
+            };
 
-bool CWallet::CreateTransaction(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, int64_t& nFeeRet, const CCoinControl* coinControl)
-{
-    std::vector<std::pair<CScript, int64_t> > vecSend;
-    vecSend.push_back(make_pair(scriptPubKey, nValue));
+            if (nChange > 0)
+            {
+                CPubKey vchPubKey;
+                if (0 != GetChangeAddress(vchPubKey))
+                    return error("%s: GetChangeAddress failed.", __func__);
 
-    if (sNarr.length() > 0)
-    {
-        std::vector<uint8_t> vNarr(sNarr.c_str(), sNarr.c_str() + sNarr.length());
-        std::vector<uint8_t> vNDesc;
+                CScript scriptChange;
+                scriptChange.SetDestination(vchPubKey.GetID());
+                wtxNew.vout.insert(wtxNew.vout.begin() + GetRandInt(wtxNew.vout.size() + 1), CTxOut(nChange, scriptChange));
+            };
 
-        vNDesc.resize(2);
-        vNDesc[0] = 'n';
-        vNDesc[1] = 'p';
+            vScripts.push_back(std::vector<const CScript*>());
+            BOOST_FOREACH(const PAIRTYPE(const CWalletTx*,unsigned int)& coin, setCoins)
+            {
+                const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
+                wtxNew.vin.push_back(CTxIn(coin.first->GetHash(), coin.second));
+                vScripts.back().push_back(&scriptPubKey);
+                CopySigningKeys(*this, scriptPubKey, keystoreSign);
+            };
 
-        CScript scriptN = CScript() << OP_RETURN << vNDesc << OP_RETURN << vNarr;
+            // -- spent coins leave the snapshot
+            for (size_t k = 0; k < vCoins.size(); )
+            {
+                if (setCoins.count(make_pair(vCoins[k].tx, (unsigned int)vCoins[k].i)))
+                {
+                    vCoins[k] = vCoins.back();
+                    vCoins.pop_back();
+                } else
+                {
+                    ++k;
+                };
+            };
+            nValueAvailable -= nValueIn;
 
-        vecSend.push_back(make_pair(scriptN, 0));
-    };
+            wtxNew.fTimeReceivedIsTxTime = true;
+            nFeeRet += nFee;
+            vwtxNew.push_back(wtxNew);
+        };
 
-    // -- CreateTransaction won't place change between value and narr output.
-    //    narration output will be for preceding output
+        int64_t nSelected = GetTimeMillis();
+        if (!SignBulkInputs(keystoreSign, vwtxNew, vScripts))
+        {
+            vwtxNew.clear();
+            return error("%s: Signing failed.", __func__);
+        };
 
-    int nChangePos;
-    bool rv = CreateTransaction(vecSend, wtxNew, nFeeRet, nChangePos, coinControl);
+        BOOST_FOREACH(CWalletTx& wtx, vwtxNew)
+            wtx.AddSupportingTransactions(txdb);
 
-    // -- narration will be added to mapValue later in FindStealthTransactions From CommitTransaction
-    return rv;
-}
+        LogPrintf("%s: %u recipients, %u txns, %u rejected, select %dms, sign %dms\n", __func__,
+            vecSend.size(), vwtxNew.size(), vRejected.size(), nSelected - nStart, GetTimeMillis() - nSelected);
+    }
 
+    return true;
+}
 
 bool CWallet::AddStealthAddress(CStealthAddress& sxAddr)
 {
@@ -3133,6 +3768,7 @@ bool CWallet::UndoAnonTransaction(const CTransaction& tx)
         return false;
     };
 
+    EraseOrderedTx(txnHash);
     mapWallet.erase(txnHash);
 
     return true;
@@ -5087,7 +5723,7 @@ bool CWallet::ProcessLockedAnonOutputs()
 
     CWalletDB walletdb(strWalletFile, "cr+");
     walletdb.TxnBegin();
-    Dbc *pcursor = walletdb.GetTxnCursor();
+    CDBCursor *pcursor = walletdb.GetTxnCursor();
 
     if (!pcursor)
         throw runtime_error(strprintf("%s : cannot create DB cursor.", __func__).c_str());
@@ -5201,7 +5837,7 @@ int CWallet::ListUnspentAnonOutputs(std::list<COwnedAnonOutput>& lUAnonOutputs,
 {
     CWalletDB walletdb(strWalletFile, "r");
 
-    Dbc* pcursor = walletdb.GetAtCursor();
+    CDBCursor* pcursor = walletdb.GetAtCursor();
     if (!pcursor)
         throw runtime_error("CWallet::ListUnspentAnonOutputs() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -5465,7 +6101,7 @@ int CWallet::CountOwnedAnonOutputs(std::map<int64_t, int>& mOwnedOutputCounts, b
 
     CWalletDB walletdb(strWalletFile, "r");
 
-    Dbc* pcursor = walletdb.GetAtCursor();
+    CDBCursor* pcursor = walletdb.GetAtCursor();
     if (!pcursor)
         throw runtime_error("CWallet::CountOwnedAnonOutputs() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -6101,6 +6737,112 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew)
 }
 
 
+bool CWallet::CommitBulkTransactions(std::vector<CWalletTx>& vwtxNew)
+{
+    // -- all wallet records are written in one db txn, nothing is relayed unless it commits
+    if (!fFileBacked)
+        return error("%s: Wallet is not file backed.", __func__);
+
+    BOOST_FOREACH(CWalletTx& wtx, vwtxNew)
+    {
+        if (!wtx.CheckTransaction())
+            return error("%s: CheckTransaction() failed %s.", __func__, wtx.GetHash().ToString().c_str());
+    };
+
+    LOCK2(cs_main, cs_wallet);
+
+    {
+        CWalletDB walletdb(strWalletFile, "r+");
+        if (!walletdb.TxnBegin())
+            return error("%s: TxnBegin failed.", __func__);
+
+        // -- spent flags are set first so AddToWallet -> WalletUpdateSpent has nothing left to write
+        std::set<uint256> setSpentTx;
+        BOOST_FOREACH(const CWalletTx& wtx, vwtxNew)
+        {
+            BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+            {
+                CWalletTx& coin = mapWallet[txin.prevout.hash];
+                coin.BindWallet(this);
+                coin.MarkSpent(txin.prevout.n);
+                setSpentTx.insert(txin.prevout.hash);
+            };
+        };
+
+        // -- AddToWallet inserts into mapWallet before writing, a txn failing at the write is rolled back too
+        bool fOk = true;
+        int64_t nOrderPosNextWas = nOrderPosNext;
+        std::vector<uint256> vAdded;
+        BOOST_FOREACH(CWalletTx& wtx, vwtxNew)
+        {
+            uint256 hash = wtx.GetHash();
+            if (!mapWallet.count(hash))
+                vAdded.push_back(hash);
+            if (!AddToWallet(wtx, hash, &walletdb))
+            {
+                fOk = error("%s: AddToWallet failed %s.", __func__, hash.ToString().c_str());
+                break;
+            };
+        };
+
+        for (std::set<uint256>::iterator it = setSpentTx.begin(); fOk && it != setSpentTx.end(); ++it)
+        {
+            if (!walletdb.WriteTx(*it, mapWallet[*it]))
+                fOk = error("%s: WriteTx failed %s.", __func__, it->ToString().c_str());
+        };
+
+        if (fOk && !walletdb.TxnCommit())
+            fOk = error("%s: TxnCommit failed.", __func__);
+
+        if (!fOk)
+        {
+            walletdb.TxnAbort();
+            BOOST_FOREACH(const uint256& hash, vAdded)
+            {
+                EraseOrderedTx(hash);
+                mapWallet.erase(hash);
+                NotifyTransactionChanged(this, hash, CT_DELETED);
+            };
+            nOrderPosNext = nOrderPosNextWas;
+            BOOST_FOREACH(const CWalletTx& wtx, vwtxNew)
+                BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+                    mapWallet[txin.prevout.hash].MarkUnspent(txin.prevout.n);
+            return false;
+        };
+
+        BOOST_FOREACH(const uint256& hash, setSpentTx)
+            NotifyTransactionChanged(this, hash, CT_UPDATED);
+    }
+
+    CTxDB txdb("r");
+    BOOST_FOREACH(CWalletTx& wtx, vwtxNew)
+    {
+        uint256 hash = wtx.GetHash();
+        mapRequestCount[hash] = 0;
+
+        CWalletTx& wtxStored = mapWallet[hash];
+        if (!wtxStored.AcceptToMemoryPool(txdb))
+        {
+            // -- recorded already, ResendWalletTransactions retries it
+            LogPrintf("%s: Error: Transaction not valid %s.\n", __func__, hash.ToString().c_str());
+            continue;
+        };
+        wtxStored.RelayWalletTransaction(txdb);
+
+        if (!pBloomFilter)
+            continue;
+        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        {
+            CTxDestination txoutAddr;
+            if (IsChange(txout)
+                && ExtractDestination(txout.scriptPubKey, txoutAddr))
+                AddKeyToMerkleFilters(txoutAddr);
+        };
+    };
+
+    return true;
+}
+
 
 
 std::string CWallet::SendMoney(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, bool fAskFee)
@@ -6199,9 +6941,178 @@ DBErrors CWallet::LoadWallet()
 
     if (nLoadWalletRet != DB_LOAD_OK)
         return nLoadWalletRet;
+
+    {
+        LOCK(cs_wallet);
+        RebuildUnspent();
+        RebuildOrderedTxItems();
+    }
+
+    if (!fStoreSupportingTxns)
+    {
+        LOCK(cs_wallet);
+        for (WalletTxMap::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            std::vector<CMerkleTx>().swap(it->second.vtxPrev);
+    };
+
+    if (GetBoolArg("-lazywallet", false))
+        StripWalletTxns();
+
     return DB_LOAD_OK;
 }
 
+size_t CWallet::StripWalletTxns()
+{
+    // -- drop the parts of deeply buried txns that are only needed to relay or re-verify them,
+    //    vtxPrev, the merkle branch and vOrderForm stay in the wallet db and are read back by
+    //    GetFullWalletTx, CWalletDB::WriteTx puts them back when a stripped txn is rewritten.
+    LOCK2(cs_main, cs_wallet);
+
+    int64_t nStart = GetTimeMillis();
+    size_t nStripped = 0;
+    for (WalletTxMap::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        CWalletTx& wtx = it->second;
+        if (wtx.fStripped
+            || wtx.GetDepthInMainChain() < LAZY_WALLETTX_DEPTH
+            || !wtx.fMerkleVerified)
+            continue;
+
+        std::vector<CMerkleTx>().swap(wtx.vtxPrev);
+        std::vector<uint256>().swap(wtx.vMerkleBranch);
+        std::vector<std::pair<std::string, std::string> >().swap(wtx.vOrderForm);
+        wtx.fStripped = true;
+        nStripped++;
+    };
+
+    LogPrintf("StripWalletTxns() : %u of %u txns stripped %dms\n", nStripped, mapWallet.size(), GetTimeMillis() - nStart);
+    return nStripped;
+}
+
+bool CWallet::GetFullWalletTx(const uint256& hash, CWalletTx& wtxOut) const
+{
+    LOCK(cs_wallet);
+
+    WalletTxMap::const_iterator mi = mapWallet.find(hash);
+    if (mi == mapWallet.end())
+        return false;
+
+    wtxOut = mi->second;
+    if (!wtxOut.fStripped)
+        return true;
+
+    std::map<uint256, CWalletTx>::iterator mic = mapFullTxCache.find(hash);
+    if (mic != mapFullTxCache.end())
+    {
+        lFullTxCache.remove(hash);
+    } else
+    {
+        CWalletTx wtxStored;
+        if (!fFileBacked
+            || !CWalletDB(strWalletFile, "r").ReadTx(hash, wtxStored))
+            return error("GetFullWalletTx() : Can't read %s.", hash.ToString().c_str());
+
+        if (mapFullTxCache.size() >= LAZY_WALLETTX_CACHE)
+        {
+            mapFullTxCache.erase(lFullTxCache.back());
+            lFullTxCache.pop_back();
+        };
+        mic = mapFullTxCache.insert(std::make_pair(hash, wtxStored)).first;
+    };
+    lFullTxCache.push_front(hash);
+
+    // -- only the stripped fields come from the stored record, the in memory state is newer
+    const CWalletTx& wtxStored = mic->second;
+    wtxOut.vtxPrev = wtxStored.vtxPrev;
+    wtxOut.vOrderForm = wtxStored.vOrderForm;
+    if (wtxOut.vMerkleBranch.empty()
+        && wtxOut.hashBlock == wtxStored.hashBlock
+        && wtxOut.nIndex == wtxStored.nIndex)
+        wtxOut.vMerkleBranch = wtxStored.vMerkleBranch;
+    wtxOut.fStripped = false;
+
+    return true;
+}
+
+bool CWallet::CompactSupportingTxns(uint32_t& nTxns, uint64_t& nBytesBefore, uint64_t& nBytesAfter)
+{
+    // -- rewrite every stored txn that still carries vtxPrev without it,
+    //    nBytesBefore/After are the serialized sizes of the rewritten records
+    nTxns = 0;
+    nBytesBefore = 0;
+    nBytesAfter = 0;
+
+    if (!fFileBacked)
+        return false;
+
+    LOCK(cs_wallet);
+
+    int64_t nStart = GetTimeMillis();
+    const uint32_t nTxnsPerCommit = 1000;
+    std::vector<CWalletTx*> vPending; // written in the open db txn, vtxPrev is dropped from memory once it commits
+    CWalletDB walletdb(strWalletFile);
+    walletdb.TxnBegin();
+    for (WalletTxMap::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+    {
+        CWalletTx wtxStored;
+        if (!walletdb.ReadTx(it->first, wtxStored))
+        {
+            LogPrintf("CompactSupportingTxns() : Can't read %s.\n", it->first.ToString().c_str());
+            continue;
+        };
+
+        if (wtxStored.vtxPrev.empty())
+            continue;
+
+        nBytesBefore += ::GetSerializeSize(wtxStored, SER_DISK, CLIENT_VERSION);
+        std::vector<CMerkleTx>().swap(wtxStored.vtxPrev);
+        nBytesAfter += ::GetSerializeSize(wtxStored, SER_DISK, CLIENT_VERSION);
+
+        // -- write the in memory state, fields dropped by -lazywallet come from the stored record
+        CWalletTx& wtx = it->second;
+        CWalletTx wtxWrite(wtx);
+        std::vector<CMerkleTx>().swap(wtxWrite.vtxPrev);
+        if (wtxWrite.fStripped)
+        {
+            wtxWrite.vOrderForm.swap(wtxStored.vOrderForm);
+            if (wtxWrite.vMerkleBranch.empty()
+                && wtxWrite.hashBlock == wtxStored.hashBlock
+                && wtxWrite.nIndex == wtxStored.nIndex)
+                wtxWrite.vMerkleBranch.swap(wtxStored.vMerkleBranch);
+            wtxWrite.fStripped = false;
+        };
+
+        if (!walletdb.WriteTx(it->first, wtxWrite))
+        {
+            walletdb.TxnAbort();
+            return error("CompactSupportingTxns() : WriteTx %s failed.", it->first.ToString().c_str());
+        };
+        vPending.push_back(&wtx);
+
+        if (++nTxns % nTxnsPerCommit == 0)
+        {
+            if (!walletdb.TxnCommit())
+                return error("CompactSupportingTxns() : TxnCommit failed.");
+            for (size_t i = 0; i < vPending.size(); ++i)
+                std::vector<CMerkleTx>().swap(vPending[i]->vtxPrev);
+            vPending.clear();
+            walletdb.TxnBegin();
+        };
+    };
+
+    if (!walletdb.TxnCommit())
+        return error("CompactSupportingTxns() : TxnCommit failed.");
+    for (size_t i = 0; i < vPending.size(); ++i)
+        std::vector<CMerkleTx>().swap(vPending[i]->vtxPrev);
+
+    mapFullTxCache.clear();
+    lFullTxCache.clear();
+
+    LogPrintf("CompactSupportingTxns() : %u txns, %d -> %d bytes %dms\n",
+        nTxns, nBytesBefore, nBytesAfter, GetTimeMillis() - nStart);
+    return true;
+}
+
 
 bool CWallet::SetAddressBookName(const CTxDestination& address, const string& strName, CWalletDB *pwdb, bool fAddKeyToMerkleFilters, bool fManual)
 {
@@ -7475,7 +8386,7 @@ int CWallet::ExtKeyEncryptAll(CWalletDB *pwdb, const CKeyingMaterial &vMKey)
     // Encrypt loose and account extkeys stored in wallet
     // skip invalid private keys
 
-    Dbc *pcursor = pwdb->GetTxnCursor();
+    CDBCursor *pcursor = pwdb->GetTxnCursor();
 
     if (!pcursor)
         return errorN(1, "%s : cannot create DB cursor.", __func__);
@@ -7573,17 +8484,7 @@ int CWallet::ExtKeyUnlock(CExtKeyAccount *sea)
 
 int CWallet::ExtKeyUnlock(CExtKeyAccount *sea, const CKeyingMaterial &vMKey)
 {
-    std::vector<CStoredExtKey*>::iterator it;
-    for (it = sea->vExtKeys.begin(); it != sea->vExtKeys.end(); ++it)
-    {
-        CStoredExtKey *sek = *it;
-        if (!(sek->nFlags & EAF_IS_CRYPTED))
-            continue;
-        if (ExtKeyUnlock(sek, vMKey) != 0)
-            return 1;
-    };
-
-    return 0;
+    return ExtKeyUnlock(sea->vExtKeys, vMKey);
 };
 
 int CWallet::ExtKeyUnlock(CStoredExtKey *sek)
@@ -7591,18 +8492,10 @@ int CWallet::ExtKeyUnlock(CStoredExtKey *sek)
     return ExtKeyUnlock(sek, vMasterKey);
 };
 
-int CWallet::ExtKeyUnlock(CStoredExtKey *sek, const CKeyingMaterial &vMKey)
+static int ExtKeySetSecret(CStoredExtKey *sek, const CKeyingMaterial &vchSecret)
 {
-    if (!(sek->nFlags & EAF_IS_CRYPTED)) // is not necessary to unlock
-        return 0;
-
-    CSecret vchSecret;
-    uint256 iv = Hash(sek->kp.pubkey.begin(), sek->kp.pubkey.end());
-    if (!DecryptSecret(vMKey, sek->vchCryptedSecret, iv, vchSecret)
-        || vchSecret.size() != 32)
-    {
+    if (vchSecret.size() != 32)
         return errorN(1, "Failed decrypting ext key %s", sek->GetIDString58().c_str());
-    };
 
     sek->kp.key.Set(vchSecret.begin(), vchSecret.end(), true);
 
@@ -7617,28 +8510,86 @@ int CWallet::ExtKeyUnlock(CStoredExtKey *sek, const CKeyingMaterial &vMKey)
     return 0;
 };
 
+int CWallet::ExtKeyUnlock(CStoredExtKey *sek, const CKeyingMaterial &vMKey)
+{
+    if (!(sek->nFlags & EAF_IS_CRYPTED)) // is not necessary to unlock
+        return 0;
+
+    CSecret vchSecret;
+    uint256 iv = Hash(sek->kp.pubkey.begin(), sek->kp.pubkey.end());
+    if (!DecryptSecret(vMKey, sek->vchCryptedSecret, iv, vchSecret))
+        return errorN(1, "Failed decrypting ext key %s", sek->GetIDString58().c_str());
+
+    return ExtKeySetSecret(sek, vchSecret);
+};
+
+static bool ExtKeyUnlockRange(const std::vector<CStoredExtKey*>* pvKeys, const CKeyingMaterial* pvMKey,
+    size_t nBegin, size_t nEnd)
+{
+    // -- each thread decrypts its keys in one batch, then derives and compares their public keys
+    std::vector<const std::vector<unsigned char>*> vCiphertext;
+    std::vector<uint256> vIV;
+    for (size_t i = nBegin; i < nEnd; ++i)
+    {
+        CStoredExtKey *sek = (*pvKeys)[i];
+        vCiphertext.push_back(&sek->vchCryptedSecret);
+        vIV.push_back(Hash(sek->kp.pubkey.begin(), sek->kp.pubkey.end()));
+    };
+
+    std::vector<CKeyingMaterial> vSecret;
+    DecryptSecrets(*pvMKey, vCiphertext, vIV, vSecret);
+    vSecret.resize(vCiphertext.size()); // secrets that didn't decrypt are empty and fail below
+
+    bool fOk = true;
+    for (size_t i = 0; i < vSecret.size(); ++i)
+    {
+        if (ExtKeySetSecret((*pvKeys)[nBegin + i], vSecret[i]) != 0)
+            fOk = false;
+    };
+    return fOk;
+};
+
+int CWallet::ExtKeyUnlock(const std::vector<CStoredExtKey*> &vKeys, const CKeyingMaterial &vMKey)
+{
+    // -- a key may be listed more than once, it must go to one thread only
+    std::vector<CStoredExtKey*> vCrypted;
+    for (size_t i = 0; i < vKeys.size(); ++i)
+    {
+        if (vKeys[i]->nFlags & EAF_IS_CRYPTED)
+            vCrypted.push_back(vKeys[i]);
+    };
+    std::sort(vCrypted.begin(), vCrypted.end());
+    vCrypted.erase(std::unique(vCrypted.begin(), vCrypted.end()), vCrypted.end());
+
+    if (vCrypted.empty())
+        return 0;
+
+    if (!SplitOverThreads(vCrypted.size(), UNLOCK_KEYS_CHUNK, boost::bind(&ExtKeyUnlockRange, &vCrypted, &vMKey, _1, _2)))
+        return 1;
+
+    return 0;
+};
+
 int CWallet::ExtKeyUnlock(const CKeyingMaterial &vMKey)
 {
     if (fDebug)
         LogPrintf("ExtKeyUnlock.\n");
 
-    if (pEkMaster
-        && pEkMaster->nFlags & EAF_IS_CRYPTED)
-    {
-        if (ExtKeyUnlock(pEkMaster, vMKey) != 0)
-            return 1;
-    };
+    // -- the master and every account's keys are unlocked together, so they can be shared out over threads
+    std::vector<CStoredExtKey*> vKeys;
+    if (pEkMaster)
+        vKeys.push_back(pEkMaster);
 
     ExtKeyAccountMap::iterator mi;
-    mi = mapExtAccounts.begin();
     for (mi = mapExtAccounts.begin(); mi != mapExtAccounts.end(); ++mi)
     {
         CExtKeyAccount *sea = mi->second;
-
-        if (ExtKeyUnlock(sea, vMKey) != 0)
-            return errorN(1, "ExtKeyUnlock() account failed.");
+        vKeys.insert(vKeys.end(), sea->vExtKeys.begin(), sea->vExtKeys.end());
     };
 
+    if (ExtKeyUnlock(vKeys, vMKey) != 0)
+        return errorN(1, "ExtKeyUnlock() failed.");
+
     return 0;
 };
 
@@ -7777,7 +8728,7 @@ int CWallet::ExtKeyLoadAccounts()
         LogPrintf("Warning: No default ext account set.\n");
     };
 
-    Dbc *pcursor;
+    CDBCursor *pcursor;
     if (!(pcursor = wdb.GetAtCursor()))
         throw std::runtime_error(strprintf("%s: cannot create DB cursor", __func__).c_str());
 
@@ -7903,6 +8854,8 @@ int CWallet::ExtKeyAddAccountToMaps(CKeyID &idAccount, CExtKeyAccount *sea)
     };
     assert(sea);
 
+    sea->pnOwnedIdsAdded = &nOwnedIdsAdded;
+
     for (size_t i = 0; i < sea->vExtKeys.size(); ++i)
     {
         CStoredExtKey *sek = sea->vExtKeys[i];
@@ -7926,6 +8879,7 @@ int CWallet::ExtKeyAddAccountToMaps(CKeyID &idAccount, CExtKeyAccount *sea)
     };
 
     mapExtAccounts[idAccount] = sea;
+    nOwnedIdsAdded++;
     return 0;
 };
 
@@ -7937,7 +8891,7 @@ int CWallet::ExtKeyLoadAccountPacks()
 
     CWalletDB wdb(strWalletFile);
 
-    Dbc *pcursor;
+    CDBCursor *pcursor;
     if (!(pcursor = wdb.GetAtCursor()))
         throw std::runtime_error(strprintf("%s : cannot create DB cursor", __func__).c_str());
 
@@ -7989,6 +8943,7 @@ int CWallet::ExtKeyLoadAccountPacks()
         {
             sea->mapKeys[it->id] = it->ak;
         };
+        nOwnedIdsAdded++;
     };
 
     ssKey.clear();
@@ -8065,6 +9020,7 @@ int CWallet::ExtKeyLoadAccountPacks()
         {
             sea->mapStealthChildKeys[it->id] = it->asck;
         };
+        nOwnedIdsAdded++;
     };
 
     pcursor->close();
@@ -8940,7 +9896,9 @@ bool IsMine(const CWallet &wallet, const CScript& scriptPubKey)
     if (!Solver(scriptPubKey, whichType, vSolutions))
         return false;
 
+    // -- wallet.MayOwn rejects most ids that aren't ours without touching the keystore
     CKeyID keyID;
+    bool fMine;
     switch (whichType)
     {
     case TX_NONSTANDARD:
@@ -8948,15 +9906,29 @@ bool IsMine(const CWallet &wallet, const CScript& scriptPubKey)
         return false;
     case TX_PUBKEY:
         keyID = CPubKey(vSolutions[0]).GetID();
-        return wallet.HaveKey(keyID);
+        if (!wallet.MayOwn(keyID))
+            return false;
+        if (!(fMine = wallet.HaveKey(keyID)))
+            wallet.CountFilterFalsePositive();
+        return fMine;
     case TX_PUBKEYHASH:
         keyID = CKeyID(uint160(vSolutions[0]));
-        return wallet.HaveKey(keyID);
+        if (!wallet.MayOwn(keyID))
+            return false;
+        if (!(fMine = wallet.HaveKey(keyID)))
+            wallet.CountFilterFalsePositive();
+        return fMine;
     case TX_SCRIPTHASH:
     {
+        CScriptID scriptID = CScriptID(uint160(vSolutions[0]));
+        if (!wallet.MayOwn(scriptID))
+            return false;
         CScript subscript;
-        if (!wallet.GetCScript(CScriptID(uint160(vSolutions[0])), subscript))
+        if (!wallet.GetCScript(scriptID, subscript))
+        {
+            wallet.CountFilterFalsePositive();
             return false;
+        };
         return IsMine(wallet, subscript);
     }
     case TX_MULTISIG:
@@ -8967,6 +9939,9 @@ bool IsMine(const CWallet &wallet, const CScript& scriptPubKey)
         // them) enable spend-out-from-under-you attacks, especially
         // in shared-wallet situations.
         std::vector<valtype> keys(vSolutions.begin()+1, vSolutions.begin()+vSolutions.size()-1);
+        BOOST_FOREACH(const valtype& pubkey, keys)
+            if (!wallet.MayOwn(CPubKey(pubkey).GetID()))
+                return false;
         return HaveKeys(keys, wallet) == keys.size();
     }
     }
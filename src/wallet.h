@@ -21,11 +21,13 @@
 #include "walletdb.h"
 #include "stealth.h"
 #include "smessage.h"
+#include "bloom.h"
 
 
 extern bool fWalletUnlockStakingOnly;
 extern bool fWalletUnlockMessagingEnabled;
 extern bool fConfChange;
+extern bool fStoreSupportingTxns;
 class CAccountingEntry;
 class CWalletTx;
 class CReserveKey;
@@ -39,6 +41,23 @@ typedef std::map<uint256, CWalletTx> WalletTxMap;
 typedef std::map<CKeyID, CExtKeyAccount*>  ExtKeyAccountMap;
 typedef std::map<CKeyID, CStoredExtKey*>  ExtKeyMap;
 
+/** Most nodes the branch and bound coin selection visits before falling back to the knapsack */
+static const int COINSELECT_BNB_TRIES = 100000;
+/** Bytes of a change output plus the input that spends it later, priced at the fee rate by GetCostOfChange */
+static const int64_t COINSELECT_CHANGE_BYTES = 34 + 148;
+/** Candidate limit for the knapsack, larger sets are cut down to their largest coins */
+static const unsigned int COINSELECT_MAX_KNAPSACK = 1000;
+/** Upper bound for -consolidateinputs */
+static const int COINSELECT_MAX_CONSOLIDATE = 100;
+/** With -lazywallet, txns at least this deep keep only their compact part in memory */
+static const int LAZY_WALLETTX_DEPTH = 500;
+/** Number of fully materialized lazy txns kept by GetFullWalletTx */
+static const size_t LAZY_WALLETTX_CACHE = 64;
+/** Default size bound for the txns built by CreateBulkTransactions */
+static const unsigned int BULK_TX_MAX_SIZE = MAX_BLOCK_SIZE_GEN/10;
+/** Fewest crypted ext keys per thread when unlocking decrypts and checks them in parallel */
+static const unsigned int UNLOCK_KEYS_CHUNK = 32;
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -80,6 +99,36 @@ public:
 bool IsDestMine(const CWallet &wallet, const CTxDestination &dest);
 bool IsMine(const CWallet& wallet, const CScript& scriptPubKey);
 
+/** A changeless selection may overshoot the target by this much, the excess goes to the fee */
+int64_t GetCostOfChange();
+
+/** Balance totals over the wallet's unspent transactions, see CWallet::UpdateBalances */
+class CWalletBalances
+{
+public:
+    CWalletBalances()
+    {
+        SetNull();
+    };
+
+    void SetNull()
+    {
+        nBalance = 0;
+        nSumcoinBalance = 0;
+        nUnconfirmed = 0;
+        nImmature = 0;
+        nStake = 0;
+        nNewMint = 0;
+    };
+
+    int64_t nBalance;
+    int64_t nSumcoinBalance;
+    int64_t nUnconfirmed;
+    int64_t nImmature;
+    int64_t nStake;
+    int64_t nNewMint;
+};
+
 /** A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
  */
@@ -129,6 +178,26 @@ public:
     
     WalletTxMap mapWallet;
     int64_t nOrderPosNext;
+
+    // -- hashes of txns in mapWallet which may hold unspent outputs, a superset, stale entries are dropped in UpdateBalances
+    mutable std::set<uint256> setUnspentTx;
+    // -- bumped whenever a txn changes in a way that could alter the balances
+    mutable uint64_t nBalanceGeneration;
+    mutable CWalletBalances cachedBalances;
+    mutable bool fBalancesCached;
+    mutable uint256 hashBalancesBest;
+    mutable unsigned int nBalancesMempool;
+    mutable uint64_t nBalancesGeneration;
+    mutable size_t nBalancesTxns;
+
+    // -- prefilter for IsMine over all owned key ids, script ids and ext account keys, see MayOwn
+    mutable CHash160Filter filterOwned;
+    mutable unsigned int nFilterOwnedGeneration; // nOwnedIdsAdded when filterOwned was built
+    mutable uint64_t nFilterChecks, nFilterRejects, nFilterFalsePositives;
+
+    // -- most recently materialized lazy txns, see GetFullWalletTx
+    mutable std::map<uint256, CWalletTx> mapFullTxCache;
+    mutable std::list<uint256> lFullTxCache;
     std::map<uint256, int> mapRequestCount;
 
     std::map<CTxDestination, std::string> mapAddressBook;
@@ -161,7 +230,12 @@ public:
         nOrderPosNext = 0;
         nTimeFirstKey = 0;
         nLastFilteredHeight = 0;
-        
+        nBalanceGeneration = 0;
+        fBalancesCached = false;
+        nFilterOwnedGeneration = 0;
+        nFilterChecks = 0;
+        nFilterRejects = 0;
+        nFilterFalsePositives = 0;
     }
     
     int Finalise();
@@ -214,14 +288,36 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
 
-    /** Get the wallet's activity log
-        @return multimap of ordered transactions and accounting entries
-        @warning Returned pointers are *only* valid within the scope of passed acentries
+    /** The wallet's activity log, all transactions and accounting entries ordered by nOrderPos.
+        Maintained as transactions arrive, walk it from rbegin() to page through recent activity.
+        Guarded by cs_wallet, pointers are valid until the txn is erased.
      */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "", bool fShowCoinstake = true);
+    TxItems wtxOrdered;
+    std::list<CAccountingEntry> laccentries;
+
+    void RebuildOrderedTxItems();
+    void EraseOrderedTx(const uint256& hash);
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
+    void EraseAccountingEntry(int64_t nOrderPos);
 
     void MarkDirty();
-    bool AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn);
+
+    void InvalidateBalances() const { nBalanceGeneration++; };
+    void TxChanged(const uint256& hash) const { setUnspentTx.insert(hash); nBalanceGeneration++; };
+    void RebuildUnspent() const;
+    bool HasUnspent(const CWalletTx& wtx) const;
+    const CWalletBalances& UpdateBalances() const;
+
+    size_t StripWalletTxns();
+    bool GetFullWalletTx(const uint256& hash, CWalletTx& wtxOut) const;
+    bool CompactSupportingTxns(uint32_t& nTxns, uint64_t& nBytesBefore, uint64_t& nBytesAfter);
+
+    size_t OwnedCount() const;
+    void RebuildOwnedFilter() const;
+    bool MayOwn(const uint160& id) const;
+    void CountFilterFalsePositive() const;
+
+    bool AddToWallet(const CWalletTx& wtxIn, const uint256& hashIn, CWalletDB* pwalletdb = NULL);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const uint256& hash, const void* pblock, bool fUpdate = false, bool fFindBlock = false);
     
     bool EraseFromWallet(uint256 hash);
@@ -241,6 +337,9 @@ public:
     bool CreateTransaction(CScript scriptPubKey, int64_t nValue, std::string& sNarr, CWalletTx& wtxNew, int64_t& nFeeRet, const CCoinControl *coinControl=NULL);
     
     bool CommitTransaction(CWalletTx& wtxNew);
+    bool CreateBulkTransactions(const std::vector<std::pair<CScript, int64_t> >& vecSend, std::vector<CWalletTx>& vwtxNew,
+        std::vector<std::pair<unsigned int, std::string> >& vRejected, int64_t& nFeeRet, unsigned int nMaxTxBytes = BULK_TX_MAX_SIZE);
+    bool CommitBulkTransactions(std::vector<CWalletTx>& vwtxNew);
     
 
     uint64_t GetStakeWeight() const;
@@ -480,6 +579,7 @@ public:
     int ExtKeyUnlock(CStoredExtKey *sek);
     int ExtKeyUnlock(CStoredExtKey *sek, const CKeyingMaterial &vMKey);
     int ExtKeyUnlock(const CKeyingMaterial &vMKey);
+    int ExtKeyUnlock(const std::vector<CStoredExtKey*> &vKeys, const CKeyingMaterial &vMKey);
     
     int ExtKeyCreateInitial(CWalletDB *pwdb);
     int ExtKeyLoadMaster();
@@ -606,6 +706,7 @@ public:
     int64_t nOrderPos;  // position in ordered transaction list
     
     // memory only
+    bool fStripped; // vtxPrev, vMerkleBranch and vOrderForm were dropped and are only in the wallet db, see CWallet::StripWalletTxns
     mutable int8_t fDebitCached; // overload for force update message
     mutable bool fCreditCached;
     mutable bool fAvailableCreditCached;
@@ -669,6 +770,7 @@ public:
         nAvailableSumcoinCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
+        fStripped = false;
     }
 
     IMPLEMENT_SERIALIZE
@@ -748,6 +850,8 @@ public:
                 fAvailableCreditCached = false;
             };
         };
+        if (fReturn && pwallet)
+            pwallet->InvalidateBalances();
         return fReturn;
     }
 
@@ -760,6 +864,8 @@ public:
         fDebitCached = false;
         fChangeCached = false;
         fCreditSplitCached = false;
+        if (pwallet)
+            pwallet->InvalidateBalances();
     }
     
     bool ForceUpdate()
@@ -783,6 +889,8 @@ public:
         {
             vfSpent[nOut] = true;
             fAvailableCreditCached = false;
+            if (pwallet)
+                pwallet->InvalidateBalances();
         };
     }
 
@@ -796,6 +904,8 @@ public:
         {
             vfSpent[nOut] = false;
             fAvailableCreditCached = false;
+            if (pwallet)
+                pwallet->TxChanged(GetHash());
         };
     }
 
@@ -991,12 +1101,13 @@ public:
         return true;
     }
 
-    bool WriteToDisk();
+    bool WriteToDisk(CWalletDB* pwalletdb = NULL);
 
     int64_t GetTxTime() const;
     int GetRequestCount() const;
 
     void AddSupportingTransactions(CTxDB& txdb);
+    void GetUnconfirmedAncestors(CTxDB& txdb, std::vector<CMerkleTx>& vtxOut) const;
 
     bool AcceptWalletTransaction(CTxDB& txdb);
     bool AcceptWalletTransaction();
@@ -8,6 +8,9 @@
 #include <boost/version.hpp>
 #include <boost/filesystem.hpp>
 
+#include <leveldb/db.h>
+#include <leveldb/write_batch.h>
+
 using namespace std;
 namespace fs = boost::filesystem;
 
@@ -33,12 +36,44 @@ bool CWalletDB::EraseName(const string& strAddress)
     return Erase(make_pair(string("name"), strAddress));
 }
 
+bool CWalletDB::WriteTx(uint256 hash, const CWalletTx& wtx)
+{
+    nWalletDBUpdated++;
+
+    if (!wtx.fStripped)
+    {
+        if (fStoreSupportingTxns || wtx.vtxPrev.empty())
+            return Write(make_pair(string("tx"), hash), wtx);
+
+        // -- supporting txns are fetched on demand, see CWalletTx::GetUnconfirmedAncestors
+        CWalletTx wtxWrite(wtx);
+        std::vector<CMerkleTx>().swap(wtxWrite.vtxPrev);
+        return Write(make_pair(string("tx"), hash), wtxWrite);
+    };
+
+    // -- wtx only holds the compact part, take the dropped fields from the stored record
+    CWalletTx wtxStored;
+    if (!ReadTx(hash, wtxStored))
+        return error("WriteTx() : Can't read stored record of stripped txn %s.", hash.ToString().c_str());
+
+    CWalletTx wtxWrite(wtx);
+    if (fStoreSupportingTxns)
+        wtxWrite.vtxPrev.swap(wtxStored.vtxPrev);
+    wtxWrite.vOrderForm.swap(wtxStored.vOrderForm);
+    if (wtxWrite.vMerkleBranch.empty()
+        && wtxWrite.hashBlock == wtxStored.hashBlock
+        && wtxWrite.nIndex == wtxStored.nIndex)
+        wtxWrite.vMerkleBranch.swap(wtxStored.vMerkleBranch); // the stored branch is only valid for the block it was stored with
+
+    return Write(make_pair(string("tx"), hash), wtxWrite);
+}
+
 bool CWalletDB::EraseRange(const std::string& sPrefix, uint32_t &nAffected)
 {
 
     TxnBegin();
 
-    Dbc* pcursor = GetTxnCursor();
+    CDBCursor* pcursor = GetTxnCursor();
 
     if (!pcursor)
         throw runtime_error("EraseAllAnonData() : cannot create DB cursor");
@@ -48,26 +83,28 @@ bool CWalletDB::EraseRange(const std::string& sPrefix, uint32_t &nAffected)
     if (nLenPrefix > 252) // fit in 256 and compressed int is 1 byte
     {
         LogPrintf("EraseRange(%s) - Key length too long.\n", sPrefix.c_str());
+        pcursor->close();
         return false;
     };
 
     // - key starts with strlen || str
-    uint8_t data[256];
-    data[0] = (uint8_t)nLenPrefix;
-    memcpy(&data[1], sPrefix.data(), nLenPrefix);
-
-    Dbt key, record;
-    memset(&key, 0, sizeof(key));
-    key.set_data(data);
-    key.set_size(nLenPrefix+1);
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << sPrefix;
+
     unsigned int fFlags = DB_SET_RANGE;
     int ret;
-    while ((ret = pcursor->get(&key, &record, fFlags)) == 0)
+    while (true)
     {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        if (fFlags == DB_SET_RANGE)
+            ssKey = ssPrefix;
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        if (ReadAtCursor(pcursor, ssKey, ssValue, fFlags) != 0)
+            break;
         fFlags = DB_NEXT;
 
-        if (key.get_size() < nLenPrefix+1
-            || memcmp(key.get_data(), data, nLenPrefix+1) != 0)
+        if (ssKey.size() < ssPrefix.size()
+            || memcmp(&ssKey[0], &ssPrefix[0], ssPrefix.size()) != 0)
             break;
 
         if ((ret = pcursor->del(0)) != 0)
@@ -164,7 +201,7 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
 {
     bool fAllAccounts = (strAccount == "*");
 
-    Dbc* pcursor = GetCursor();
+    CDBCursor* pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListAccountCreditDebit() : cannot create DB cursor");
     unsigned int fFlags = DB_SET_RANGE;
@@ -578,7 +615,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
         };
 
         // Get cursor
-        Dbc* pcursor = GetCursor();
+        CDBCursor* pcursor = GetCursor();
         if (!pcursor)
         {
             LogPrintf("Error getting wallet database cursor\n");
@@ -598,6 +635,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (ret != 0)
             {
                 LogPrintf("Error reading next record from wallet database\n");
+                pcursor->close();
                 return DB_CORRUPT;
             };
 
@@ -670,6 +708,10 @@ void ThreadFlushWalletDB(const std::string& strFile)
     if (!GetBoolArg("-flushwallet", true))
         return;
 
+    // -- LevelDB appends to its own log, there is nothing to checkpoint and CDB syncs every write or txn
+    if (bitdb.IsLevelDB(strFile))
+        return;
+
     unsigned int nLastSeen = nWalletDBUpdated;
     unsigned int nLastFlushed = nWalletDBUpdated;
     int64_t nLastWalletUpdate = GetTime();
@@ -721,10 +763,69 @@ void ThreadFlushWalletDB(const std::string& strFile)
     };
 }
 
+static bool BackupWalletLevelDB(const CWallet& wallet, const string& strDest)
+{
+    // -- copy a snapshot of the store into a new LevelDB directory,
+    //    the live files can't be copied safely while the store is open
+    fs::path pathDest(strDest);
+    if (fs::is_directory(pathDest) && !fs::exists(pathDest / "CURRENT"))
+        pathDest /= bitdb.GetLevelDBPath(wallet.strWalletFile).filename();
+
+    if (fs::exists(pathDest))
+    {
+        LogPrintf("error backing up wallet to %s - already exists\n", pathDest.string().c_str());
+        return false;
+    };
+
+    leveldb::DB* pldbSrc;
+    {
+        LOCK(bitdb.cs_db);
+        if (!(pldbSrc = bitdb.OpenLevelDB(wallet.strWalletFile, false)))
+            return false;
+    }
+
+    leveldb::Options options;
+    options.create_if_missing = true;
+    options.error_if_exists = true;
+    leveldb::DB* pldbDest = NULL;
+    leveldb::Status s = leveldb::DB::Open(options, pathDest.string(), &pldbDest);
+    if (!s.ok())
+    {
+        LogPrintf("error backing up wallet to %s - %s\n", pathDest.string().c_str(), s.ToString().c_str());
+        return false;
+    };
+
+    leveldb::Iterator* it = pldbSrc->NewIterator(leveldb::ReadOptions());
+    leveldb::WriteBatch batch;
+    for (it->SeekToFirst(); it->Valid(); it->Next())
+        batch.Put(it->key(), it->value());
+    bool fSuccess = it->status().ok();
+    delete it;
+
+    leveldb::WriteOptions writeOptions;
+    writeOptions.sync = true;
+    if (fSuccess)
+        fSuccess = pldbDest->Write(writeOptions, &batch).ok();
+    delete pldbDest;
+
+    if (!fSuccess)
+    {
+        LogPrintf("error backing up wallet to %s\n", pathDest.string().c_str());
+        return false;
+    };
+
+    LogPrintf("copied %s to %s\n", wallet.strWalletFile.c_str(), pathDest.string().c_str());
+    return true;
+}
+
 bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+
+    if (bitdb.IsLevelDB(wallet.strWalletFile))
+        return BackupWalletLevelDB(wallet, strDest);
+
     for (;;)
     {
         boost::this_thread::interruption_point();
@@ -185,23 +185,26 @@ private:
     CWalletDB(const CWalletDB&);
     void operator=(const CWalletDB&);
 public:
-    Dbc* GetAtCursor()
+    CDBCursor* GetAtCursor()
     {
         return GetCursor();
     }
 
-    Dbc* GetTxnCursor()
+    CDBCursor* GetTxnCursor()
     {
+        if (pldb)
+            return GetCursor();
+
         if (!pdb)
             return NULL;
 
         DbTxn* ptxnid = activeTxn; // call TxnBegin first
 
-        Dbc* pcursor = NULL;
-        int ret = pdb->cursor(ptxnid, &pcursor, 0);
+        Dbc* pdbc = NULL;
+        int ret = pdb->cursor(ptxnid, &pdbc, 0);
         if (ret != 0)
             return NULL;
-        return pcursor;
+        return new CDBCursor(pdbc);
     }
 
     DbTxn* GetAtActiveTxn()
@@ -210,7 +213,7 @@ public:
     }
 
     template< typename T>
-    bool Replace(Dbc *pcursor, const T& value)
+    bool Replace(CDBCursor *pcursor, const T& value)
     {
         if (!pcursor)
             return false;
@@ -222,17 +225,16 @@ public:
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(10000);
         ssValue << value;
-        Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
-        int ret = pcursor->put(NULL, &datValue, DB_CURRENT);
+        int ret = pcursor->put(ssValue);
 
         if (ret != 0)
         {
             LogPrintf("CursorPut ret %d - %s\n", ret, DbEnv::strerror(ret));
         }
         // Clear memory in case it was a private key
-        memset(datValue.get_data(), 0, datValue.get_size());
+        memset(&ssValue[0], 0, ssValue.size());
 
         return (ret == 0);
     }
@@ -244,12 +246,13 @@ public:
 
     bool EraseRange(const std::string& sPrefix, uint32_t &nAffected);
 
-    bool WriteTx(uint256 hash, const CWalletTx& wtx)
+    bool ReadTx(uint256 hash, CWalletTx& wtx)
     {
-        nWalletDBUpdated++;
-        return Write(std::make_pair(std::string("tx"), hash), wtx);
+        return Read(std::make_pair(std::string("tx"), hash), wtx);
     }
 
+    bool WriteTx(uint256 hash, const CWalletTx& wtx);
+
     bool EraseTx(uint256 hash)
     {
         nWalletDBUpdated++;